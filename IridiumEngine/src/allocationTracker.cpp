@@ -0,0 +1,195 @@
+#include "allocationTracker.hpp"
+
+#include "log.hpp"
+
+const char* Iridium::AllocationTracker::tagName(tag t) {
+	switch(t) {
+		case tag::untagged: return "untagged";
+		case tag::renderer: return "renderer";
+		case tag::assets: return "assets";
+		case tag::log: return "log";
+		case tag::input: return "input";
+		case tag::memory: return "memory";
+		case tag::COUNT: break;
+	}
+	return "unknown";
+}
+
+const char* Iridium::AllocationTracker::sourceName(source s) {
+	switch(s) {
+		case source::heap: return "heap";
+		case source::slab: return "slab";
+		case source::arena: return "arena";
+		case source::COUNT: break;
+	}
+	return "unknown";
+}
+
+#if IRIDIUM_TRACK_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace IrA = Iridium::AllocationTracker;
+
+namespace {
+	struct alignas(64) tag_counters {
+		std::atomic<uint64_t> allocations{0};
+		std::atomic<uint64_t> bytes{0};
+	};
+
+	struct alignas(64) source_counters {
+		std::atomic<uint64_t> liveBytes{0};
+		std::atomic<uint64_t> peakBytes{0};
+	};
+
+	tag_counters g_tags[size_t(IrA::tag::COUNT)];
+	source_counters g_sources[size_t(IrA::source::COUNT)];
+	IrA::tag_stats g_previousTags[size_t(IrA::tag::COUNT)];
+	IrA::frame_report g_lastFrame{};
+
+	thread_local IrA::tag t_tag = IrA::tag::untagged;
+}
+
+IrA::tag IrA::setTag(tag t) {
+	tag previous = t_tag;
+	t_tag = t;
+	return previous;
+}
+
+IrA::tag IrA::getTag() {
+	return t_tag;
+}
+
+void IrA::recordAllocation(source s, size_t size) {
+	tag_counters& tagCounters = g_tags[size_t(t_tag)];
+	tagCounters.allocations.fetch_add(1, std::memory_order_relaxed);
+	tagCounters.bytes.fetch_add(size, std::memory_order_relaxed);
+
+	source_counters& sourceCounters = g_sources[size_t(s)];
+	uint64_t live = sourceCounters.liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+	uint64_t peak = sourceCounters.peakBytes.load(std::memory_order_relaxed);
+	while(live > peak && !sourceCounters.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+}
+
+void IrA::recordFree(source s, size_t size) {
+	g_sources[size_t(s)].liveBytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+void IrA::endFrame() {
+	g_lastFrame.frame++;
+	for(size_t index = 0; index < size_t(tag::COUNT); index++) {
+		tag_stats current{
+			.allocations = g_tags[index].allocations.load(std::memory_order_relaxed),
+			.bytes = g_tags[index].bytes.load(std::memory_order_relaxed)
+		};
+		g_lastFrame.tags[index] = {
+			.allocations = current.allocations - g_previousTags[index].allocations,
+			.bytes = current.bytes - g_previousTags[index].bytes
+		};
+		g_previousTags[index] = current;
+	}
+	for(size_t index = 0; index < size_t(source::COUNT); index++) {
+		uint64_t live = g_sources[index].liveBytes.load(std::memory_order_relaxed);
+		g_lastFrame.sources[index] = {
+			.liveBytes = live,
+			.peakBytes = g_sources[index].peakBytes.exchange(live, std::memory_order_relaxed)
+		};
+	}
+}
+
+const IrA::frame_report& IrA::lastFrame() {
+	return g_lastFrame;
+}
+
+void IrA::logFrame(const frame_report& report) {
+	IRIDIUM_ALLOCATION_TAG(log);
+	ENGINE_LOG_INFO("Allocations in frame {}:", report.frame);
+	for(size_t index = 0; index < size_t(tag::COUNT); index++) {
+		const tag_stats& stats = report.tags[index];
+		if(stats.allocations == 0)
+			continue;
+		ENGINE_LOG_INFO_NP("{:<9} {:>6} allocations, {:>10} bytes", tagName(tag(index)), stats.allocations, stats.bytes);
+	}
+	for(size_t index = 0; index < size_t(source::COUNT); index++) {
+		const source_stats& stats = report.sources[index];
+		ENGINE_LOG_INFO_NP("{:<9} {:>10} bytes live, {:>10} bytes peak", sourceName(source(index)), stats.liveBytes, stats.peakBytes);
+	}
+}
+
+// Global operator new/delete.
+// Every block gets a 16 byte header in front of it that remembers the size and how far
+// the real allocation starts, so delete can account for it without a lookup.
+
+namespace {
+	struct alignas(16) allocation_header {
+		uint64_t size;
+		uint32_t offset;
+		uint32_t padding;
+	};
+	static_assert(sizeof(allocation_header) == 16);
+
+	void* trackedAllocate(size_t size, size_t alignment) {
+		size_t offset = alignment > sizeof(allocation_header) ? alignment : sizeof(allocation_header);
+		size_t total = (size + offset + alignment - 1) & ~(alignment - 1);
+#ifdef _MSC_VER
+		std::byte* raw = static_cast<std::byte*>(_aligned_malloc(total, alignment));
+#else
+		std::byte* raw = static_cast<std::byte*>(std::aligned_alloc(alignment, total));
+#endif
+		if(raw == nullptr)
+			return nullptr;
+
+		std::byte* user = raw + offset;
+		allocation_header* header = reinterpret_cast<allocation_header*>(user) - 1;
+		header->size = size;
+		header->offset = offset;
+		IrA::recordAllocation(IrA::source::heap, size);
+		return user;
+	}
+
+	void trackedFree(void* ptr) {
+		if(ptr == nullptr)
+			return;
+		allocation_header* header = static_cast<allocation_header*>(ptr) - 1;
+		IrA::recordFree(IrA::source::heap, header->size);
+		std::byte* raw = static_cast<std::byte*>(ptr) - header->offset;
+#ifdef _MSC_VER
+		_aligned_free(raw);
+#else
+		std::free(raw);
+#endif
+	}
+
+	void* trackedAllocateOrThrow(size_t size, size_t alignment) {
+		void* ptr = trackedAllocate(size, alignment);
+		if(ptr == nullptr)
+			throw std::bad_alloc();
+		return ptr;
+	}
+}
+
+void* operator new(size_t size) { return trackedAllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size) { return trackedAllocateOrThrow(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t alignment) { return trackedAllocateOrThrow(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return trackedAllocateOrThrow(size, size_t(alignment)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return trackedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return trackedAllocate(size, __STDCPP_DEFAULT_NEW_ALIGNMENT__); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return trackedAllocate(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return trackedAllocate(size, size_t(alignment)); }
+
+void operator delete(void* ptr) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { trackedFree(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { trackedFree(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { trackedFree(ptr); }
+
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Opt-in with -DIRIDIUM_TRACK_ALLOCATIONS=ON, compiles to nothing otherwise.
+#ifndef IRIDIUM_TRACK_ALLOCATIONS
+#define IRIDIUM_TRACK_ALLOCATIONS 0
+#endif
+
+#if IRIDIUM_TRACK_ALLOCATIONS
+#define IRIDIUM_ALLOCATION_TAG_CONCAT_IMPL(x, y) x##y
+#define IRIDIUM_ALLOCATION_TAG_CONCAT(x, y) IRIDIUM_ALLOCATION_TAG_CONCAT_IMPL(x, y)
+#define IRIDIUM_ALLOCATION_TAG(TAG) Iridium::AllocationTracker::scoped_tag IRIDIUM_ALLOCATION_TAG_CONCAT(__allocationTag, __COUNTER__)(Iridium::AllocationTracker::tag::TAG)
+#else
+#define IRIDIUM_ALLOCATION_TAG(TAG)
+#endif
+
+namespace Iridium {
+	namespace AllocationTracker {
+		// which subsystem an allocation is attributed to, set per thread with IRIDIUM_ALLOCATION_TAG
+		enum class tag : uint8_t {
+			untagged,
+			renderer,
+			assets,
+			log,
+			input,
+			memory,
+			COUNT
+		};
+
+		// where the bytes came from
+		enum class source : uint8_t {
+			heap,  // global operator new
+			slab,  // MemoryExperimental::slab_allocator
+			arena, // MemoryExperimental::linear_arena
+			COUNT
+		};
+
+		struct tag_stats {
+			uint64_t allocations;
+			uint64_t bytes;
+		};
+
+		struct source_stats {
+			uint64_t liveBytes;
+			uint64_t peakBytes; // highest liveBytes seen during the frame
+		};
+
+		struct frame_report {
+			uint64_t frame;
+			tag_stats tags[size_t(tag::COUNT)];
+			source_stats sources[size_t(source::COUNT)];
+		};
+
+		const char* tagName(tag t);
+		const char* sourceName(source s);
+
+#if IRIDIUM_TRACK_ALLOCATIONS
+		tag setTag(tag t);
+		tag getTag();
+
+		void recordAllocation(source s, size_t size);
+		void recordFree(source s, size_t size);
+
+		// closes the current frame, the report holds what happened since the previous call
+		void endFrame();
+		const frame_report& lastFrame();
+		void logFrame(const frame_report& report);
+
+		struct scoped_tag {
+			tag previous;
+
+			scoped_tag(tag t) : previous(setTag(t)) {}
+			~scoped_tag() { setTag(previous); }
+		};
+#else
+		inline tag setTag(tag) { return tag::untagged; }
+		inline tag getTag() { return tag::untagged; }
+
+		inline void recordAllocation(source, size_t) {}
+		inline void recordFree(source, size_t) {}
+
+		inline void endFrame() {}
+		inline void logFrame(const frame_report&) {}
+#endif
+	}
+}
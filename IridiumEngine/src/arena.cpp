@@ -0,0 +1,63 @@
+#include "arena.hpp"
+
+#include <new>
+
+#include "allocationTracker.hpp"
+#include "memory.hpp"
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace IrM = Iridium::MemoryExperimental;
+
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+static constexpr size_t COMMIT_GRANULARITY = 64 * 1024;
+
+static inline size_t alignUp(size_t value, size_t alignment) {
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+IrM::linear_arena::linear_arena(size_t capacity, flags arenaFlags) {
+	bool hugePages = arenaFlags & HUGE_PAGES;
+	m_commitGranularity = hugePages ? HUGE_PAGE_SIZE : alignUp(COMMIT_GRANULARITY, virtual_memory::pageSize());
+	m_capacity = alignUp(capacity, m_commitGranularity);
+
+	// over-reserve so the usable range can start on a huge page boundary
+	m_reservationSize = m_capacity + (hugePages ? HUGE_PAGE_SIZE : 0);
+	m_reservation = static_cast<std::byte*>(virtual_memory::reserve(m_reservationSize));
+	m_base = reinterpret_cast<std::byte*>(alignUp(reinterpret_cast<uintptr_t>(m_reservation), hugePages ? HUGE_PAGE_SIZE : 1));
+
+#ifdef __linux__
+	if(hugePages)
+		madvise(m_base, m_capacity, MADV_HUGEPAGE); // only a hint, fine if THP is disabled
+#endif
+}
+
+IrM::linear_arena::~linear_arena() {
+	virtual_memory::release(m_reservation, m_reservationSize);
+}
+
+void IrM::linear_arena::reset() {
+	AllocationTracker::recordFree(AllocationTracker::source::arena, m_offset);
+	m_offset = 0;
+}
+
+void* IrM::linear_arena::do_allocate(size_t bytes, size_t alignment) {
+	size_t start = alignUp(reinterpret_cast<uintptr_t>(m_base) + m_offset, alignment) - reinterpret_cast<uintptr_t>(m_base);
+	size_t end = start + bytes;
+	if(end > m_capacity)
+		throw std::bad_alloc();
+
+	if(end > m_committed) {
+		size_t newCommitted = alignUp(end, m_commitGranularity);
+		virtual_memory::commit(m_base + m_committed, newCommitted - m_committed);
+		m_committed = newCommitted;
+	}
+
+	AllocationTracker::recordAllocation(AllocationTracker::source::arena, end - m_offset);
+	m_offset = end;
+	if(m_offset > m_peak)
+		m_peak = m_offset;
+	return m_base + start;
+}
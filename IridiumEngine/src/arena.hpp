@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+
+namespace Iridium {
+	namespace MemoryExperimental {
+		// Bump allocator over one reserved address range, everything is freed at once with reset().
+		// Pages are committed on first use and kept across resets, so a warmed up arena never
+		// touches the OS. Not thread safe.
+		class linear_arena final : public std::pmr::memory_resource {
+		public:
+			enum flags : uint32_t {
+				NONE       = 0,
+				HUGE_PAGES = (1 << 0), // madvise(MADV_HUGEPAGE) on Linux, ignored elsewhere
+			};
+
+			enum : size_t {
+				DEFAULT_CAPACITY = 64 * 1024 * 1024
+			};
+
+			linear_arena(size_t capacity = DEFAULT_CAPACITY, flags arenaFlags = NONE);
+			~linear_arena();
+
+			linear_arena(const linear_arena&) = delete;
+			linear_arena& operator=(const linear_arena&) = delete;
+
+			template<typename T>
+			T* allocateArray(size_t count) {
+				return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+			}
+
+			void reset();
+
+			size_t used() const { return m_offset; }
+			size_t committed() const { return m_committed; }
+			size_t peak() const { return m_peak; }
+		private:
+			std::byte* m_reservation = nullptr;
+			size_t m_reservationSize = 0;
+
+			std::byte* m_base = nullptr;
+			size_t m_capacity = 0;
+			size_t m_offset = 0;
+			size_t m_committed = 0;
+			size_t m_peak = 0;
+			size_t m_commitGranularity = 0;
+
+			void* do_allocate(size_t bytes, size_t alignment) override;
+			void do_deallocate(void*, size_t, size_t) override {}
+			bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+				return this == &other;
+			}
+		};
+	}
+}
@@ -12,7 +12,9 @@
 #include <ranges>
 #include <filesystem>
 
+#include "../allocationTracker.hpp"
 #include "../log.hpp"
+#include "../profiler.hpp"
 
 static inline EShLanguage shaderTypeToEShLanguage(Iridium::shader_type type) {
 	switch(type) {
@@ -55,6 +57,8 @@ Iridium::shader_compiler::~shader_compiler() {
 }
 
 std::vector<uint32_t> Iridium::shader_compiler::compileShaderFromFile(const std::vector<const char*> filePaths, shader_type type) {
+	IRIDIUM_ALLOCATION_TAG(assets);
+	IRIDIUM_PROFILE_SCOPE("compileShaderFromFile");
 	std::vector<std::string> sources(filePaths.size());
 	std::vector<const char*> rawSources(filePaths.size());
 	std::vector<int> sourceSizes(filePaths.size());
@@ -79,14 +83,17 @@ std::vector<uint32_t> Iridium::shader_compiler::compileShaderFromFile(const std:
 	shader.setEnvInput(glslang::EShSourceGlsl, EsType, client, 450);
 	shader.setEnvClient(client, glslang::EShTargetVulkan_1_3);
 	shader.setEnvTarget(glslang::EShTargetSpv, glslang::EShTargetSpv_1_0);
-	if(!shader.parse(GetDefaultResources(), 450, false, EShMsgDefault)) {
-		throw std::runtime_error(std::string("shader parsing failed: ") + shader.getInfoLog());
-	}
-
 	glslang::TProgram program;
-	program.addShader(&shader);
-	if(!program.link(EShMsgDefault)) {
-		throw std::runtime_error(std::string("shader program linking failed: ") + program.getInfoLog());
+	{
+		IRIDIUM_PROFILE_SCOPE("glslang parse and link");
+		if(!shader.parse(GetDefaultResources(), 450, false, EShMsgDefault)) {
+			throw std::runtime_error(std::string("shader parsing failed: ") + shader.getInfoLog());
+		}
+
+		program.addShader(&shader);
+		if(!program.link(EShMsgDefault)) {
+			throw std::runtime_error(std::string("shader program linking failed: ") + program.getInfoLog());
+		}
 	}
 
 	std::vector<uint32_t> spirv{};
@@ -98,7 +105,10 @@ std::vector<uint32_t> Iridium::shader_compiler::compileShaderFromFile(const std:
 		.optimizeSize = true,
 	};
 	spv::SpvBuildLogger logger{};
-	glslang::GlslangToSpv(*intermediate, spirv, &logger, &options);
+	{
+		IRIDIUM_PROFILE_SCOPE("GlslangToSpv");
+		glslang::GlslangToSpv(*intermediate, spirv, &logger, &options);
+	}
 	std::string shaderLogs = logger.getAllMessages();
 	if(!shaderLogs.empty())
 		ENGINE_LOG_INFO("{}", shaderLogs);
@@ -109,7 +119,10 @@ std::vector<uint32_t> Iridium::shader_compiler::compileShaderFromFile(const std:
 	spvtools::Optimizer optimizer(SPV_ENV_VULKAN_1_3);
 	optimizer.SetMessageConsumer(messageConsumer);
 	optimizer.RegisterPerformancePasses();
-	optimizer.Run(spirv.data(), spirv.size(), &optimizedSpirv);
+	{
+		IRIDIUM_PROFILE_SCOPE("spirv-opt");
+		optimizer.Run(spirv.data(), spirv.size(), &optimizedSpirv);
+	}
 
 	ENGINE_LOG_INFO("Generated optimized SPIR-V ({})", optimizedSpirv.size());
 
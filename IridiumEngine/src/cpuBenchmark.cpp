@@ -0,0 +1,278 @@
+#include "cpuBenchmark.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "jobSystem.hpp"
+#include "log.hpp"
+#include "memory.hpp"
+#include "thread.hpp"
+#include "utils.hpp"
+
+namespace IrM = Iridium::MemoryExperimental;
+
+namespace {
+	using clock = std::chrono::steady_clock;
+
+	struct payload {
+		uint64_t a;
+		uint64_t b;
+	};
+
+	// the last few results stay alive, so nothing can be optimized away and releases are real
+	constexpr uint32_t KEPT = 16;
+
+	double nanoseconds(clock::duration duration, uint32_t amount) {
+		return amount ? std::chrono::duration<double, std::nano>(duration).count() / amount : 0.0;
+	}
+
+	// Runs func(threadIndex) on count threads released at the same time, returns the slowest one's time.
+	template<typename Callable>
+	clock::duration runConcurrently(uint32_t count, Callable func) {
+		std::atomic<bool> go{false};
+		std::vector<clock::duration> durations(count);
+		std::vector<Iridium::thread_handle> threads;
+		for(uint32_t index = 0; index < count; index++) {
+			threads.push_back(Iridium::getThreadManager()->spawnThread(std::format("Benchmark {}", index), Iridium::thread_role::benchmark, [&, index]() -> void {
+				while(!go.load(std::memory_order_acquire))
+					std::this_thread::yield();
+				auto start = clock::now();
+				func(index);
+				durations[index] = clock::now() - start;
+			}));
+		}
+		go.store(true, std::memory_order_release);
+		for(Iridium::thread_handle thread : threads)
+			Iridium::getThreadManager()->join(thread);
+		return *std::max_element(durations.begin(), durations.end());
+	}
+
+	template<typename Pointer, typename Make>
+	void measureRefcount(uint32_t iterations, uint32_t threads, Make make, double& create, double& copy, double& contendedCopy) {
+		std::vector<Pointer> kept(KEPT);
+		auto start = clock::now();
+		for(uint32_t index = 0; index < iterations; index++)
+			kept[index % KEPT] = make(index);
+		create = nanoseconds(clock::now() - start, iterations);
+
+		// a fresh copy moved in every time, assigning the pointer a slot already holds is free for std::shared_ptr
+		Pointer shared = make(0);
+		start = clock::now();
+		for(uint32_t index = 0; index < iterations; index++)
+			kept[index % KEPT] = Pointer(shared);
+		copy = nanoseconds(clock::now() - start, iterations);
+		kept.assign(KEPT, Pointer());
+
+		clock::duration slowest = runConcurrently(threads, [&](uint32_t) -> void {
+			std::vector<Pointer> local(KEPT);
+			for(uint32_t index = 0; index < iterations; index++)
+				local[index % KEPT] = Pointer(shared);
+		});
+		contendedCopy = nanoseconds(slowest, iterations);
+	}
+
+	Iridium::refcount_benchmark benchmarkRefcount(uint32_t iterations) {
+		Iridium::refcount_benchmark result{};
+		result.threads = std::max<uint32_t>(Iridium::getThreadManager()->topology().cores.size(), 2);
+
+		measureRefcount<IrM::shared_ptr<payload>>(iterations, result.threads, [](uint32_t index) -> IrM::shared_ptr<payload> {
+			return IrM::make_shared<payload>(index, index);
+		}, result.createNanoseconds, result.copyNanoseconds, result.contendedCopyNanoseconds);
+		measureRefcount<std::shared_ptr<payload>>(iterations, result.threads, [](uint32_t index) -> std::shared_ptr<payload> {
+			return std::make_shared<payload>(index, index);
+		}, result.stdCreateNanoseconds, result.stdCopyNanoseconds, result.stdContendedCopyNanoseconds);
+
+		ENGINE_LOG_INFO("Reference counting: make_shared {:.1f} ns, copy {:.1f} ns, copy on {} threads {:.1f} ns, std::shared_ptr {:.1f}, {:.1f} and {:.1f} ns.",
+			result.createNanoseconds, result.copyNanoseconds, result.threads, result.contendedCopyNanoseconds,
+			result.stdCreateNanoseconds, result.stdCopyNanoseconds, result.stdContendedCopyNanoseconds);
+		return result;
+	}
+
+	// Frees the oldest of WINDOW live blocks and allocates a new one in its place, sizes come from
+	// a fixed table so both allocators see the same sequence.
+	template<typename Allocate, typename Free>
+	double measureAllocator(uint32_t iterations, const std::vector<uint32_t>& sizes, Allocate allocate, Free free) {
+		constexpr uint32_t WINDOW = 256;
+		std::vector<void*> live(WINDOW, nullptr);
+		std::vector<uint32_t> liveSizes(WINDOW, 0);
+		auto start = clock::now();
+		for(uint32_t index = 0; index < iterations; index++) {
+			uint32_t slot = index % WINDOW;
+			if(live[slot])
+				free(live[slot], liveSizes[slot]);
+			liveSizes[slot] = sizes[index % sizes.size()];
+			live[slot] = allocate(liveSizes[slot]);
+			static_cast<std::byte*>(live[slot])[0] = std::byte(index);
+		}
+		auto duration = clock::now() - start;
+		for(uint32_t slot = 0; slot < WINDOW; slot++) {
+			if(live[slot])
+				free(live[slot], liveSizes[slot]);
+		}
+		return nanoseconds(duration, iterations);
+	}
+
+	// Allocates the objects with noise of other sizes from operator new in between, like a program that
+	// does more than create these, then returns the fastest of a few linear walks over them.
+	template<typename Pointer, typename Make>
+	double measureWalk(uint32_t count, Make make) {
+		constexpr uint32_t WALKS = 8;
+		std::vector<Pointer> objects;
+		std::vector<std::pair<void*, uint32_t>> noise;
+		objects.reserve(count);
+		noise.reserve(count * 2);
+		uint64_t state = 7;
+		for(uint32_t index = 0; index < count; index++) {
+			objects.push_back(make(index));
+			state = state * 6364136223846793005ull + 1442695040888963407ull;
+			for(uint32_t extra = 0; extra < uint32_t(state >> 62) + 1; extra++) {
+				uint32_t size = 16 + uint32_t(state >> (32 + extra * 8)) % 496;
+				noise.emplace_back(::operator new(size), size);
+			}
+		}
+
+		clock::duration fastest = clock::duration::max();
+		uint64_t sum = 0;
+		for(uint32_t walk = 0; walk < WALKS; walk++) {
+			auto start = clock::now();
+			for(const Pointer& object : objects)
+				sum += object->a + object->b;
+			fastest = std::min(fastest, clock::now() - start);
+		}
+		for(auto [ptr, size] : noise)
+			::operator delete(ptr, size);
+		volatile uint64_t sink = sum; // keeps the walks from being optimized out
+		(void)sink;
+		return nanoseconds(fastest, count);
+	}
+
+	Iridium::slab_benchmark benchmarkSlab(uint32_t iterations) {
+		Iridium::slab_benchmark result{};
+		result.threads = std::max<uint32_t>(Iridium::getThreadManager()->topology().cores.size(), 2);
+
+		// half of them in the smallest class, a quarter in the next and so on, like the objects
+		// make_shared and the job system put in there
+		std::vector<uint32_t> sizes(4096);
+		uint64_t state = 1;
+		for(uint32_t& size : sizes) {
+			state = state * 6364136223846793005ull + 1442695040888963407ull;
+			uint32_t sizeClass = std::countr_zero((state >> 32) | (1ull << (IrM::slab_allocator::CLASS_COUNT - 1)));
+			size = uint32_t(IrM::slab_allocator::classSize(sizeClass)) - uint32_t(state >> 24) % 8;
+		}
+
+		auto slabAllocate = [](uint32_t size) -> void* { return IrM::slab_allocator::allocate(size); };
+		auto slabFree = [](void* ptr, uint32_t) -> void { IrM::slab_allocator::deallocate(ptr); };
+		auto heapAllocate = [](uint32_t size) -> void* { return ::operator new(size); };
+		auto heapFree = [](void* ptr, uint32_t size) -> void { ::operator delete(ptr, size); };
+
+		result.slabNanoseconds = measureAllocator(iterations, sizes, slabAllocate, slabFree);
+		result.heapNanoseconds = measureAllocator(iterations, sizes, heapAllocate, heapFree);
+		result.slabContendedNanoseconds = nanoseconds(runConcurrently(result.threads, [&](uint32_t) -> void {
+			measureAllocator(iterations, sizes, slabAllocate, slabFree);
+		}), iterations);
+		result.heapContendedNanoseconds = nanoseconds(runConcurrently(result.threads, [&](uint32_t) -> void {
+			measureAllocator(iterations, sizes, heapAllocate, heapFree);
+		}), iterations);
+
+		// the narrow reference table holds 65535 objects at most
+		result.walkObjects = std::min<uint32_t>(iterations, 32768);
+		result.slabWalkNanoseconds = measureWalk<IrM::shared_ptr<payload>>(result.walkObjects, [](uint32_t index) -> IrM::shared_ptr<payload> {
+			return IrM::make_shared<payload>(index, index);
+		});
+		result.heapWalkNanoseconds = measureWalk<std::unique_ptr<payload>>(result.walkObjects, [](uint32_t index) -> std::unique_ptr<payload> {
+			return std::unique_ptr<payload>(new payload{index, index});
+		});
+
+		ENGINE_LOG_INFO("Slab allocator: {:.1f} ns, {:.1f} ns on {} threads, operator new {:.1f} and {:.1f} ns.",
+			result.slabNanoseconds, result.slabContendedNanoseconds, result.threads, result.heapNanoseconds, result.heapContendedNanoseconds);
+		ENGINE_LOG_INFO("Walking {} objects: {:.2f} ns each from make_shared, {:.2f} ns from new.",
+			result.walkObjects, result.slabWalkNanoseconds, result.heapWalkNanoseconds);
+		return result;
+	}
+
+	Iridium::job_scaling_benchmark benchmarkJobScaling(uint32_t iterations) {
+		constexpr uint32_t RUNS = 5;
+		constexpr uint32_t ROUNDS = 1000; // per item, around a microsecond
+		Iridium::job_scaling_benchmark result{};
+		result.items = std::max<uint32_t>(iterations / 100, 1);
+		uint32_t maxWorkers = std::max<uint32_t>(Iridium::getThreadManager()->topology().cores.size(), 1);
+
+		// not pinned, the engine's own workers already hold a dedicated core each
+		for(uint32_t workers = 1; workers <= maxWorkers; workers++) {
+			Iridium::job_system jobs(workers, "Benchmark worker", Iridium::thread_role::benchmark);
+			std::atomic<uint64_t> sink{0};
+			clock::duration fastest = clock::duration::max();
+			for(uint32_t run = 0; run < RUNS; run++) {
+				auto start = clock::now();
+				jobs.parallelFor(0, result.items, [&sink](size_t begin, size_t end) -> void {
+					uint64_t value = begin;
+					for(size_t item = begin; item < end; item++) {
+						for(uint32_t round = 0; round < ROUNDS; round++)
+							value = value * 6364136223846793005ull + item;
+					}
+					sink.fetch_add(value, std::memory_order_relaxed);
+				});
+				fastest = std::min(fastest, clock::now() - start);
+			}
+			result.milliseconds.push_back(std::chrono::duration<double, std::milli>(fastest).count());
+		}
+
+		std::string times;
+		for(double milliseconds : result.milliseconds)
+			std::format_to(std::back_inserter(times), "{}{:.2f}", times.empty() ? "" : ", ", milliseconds);
+		ENGINE_LOG_INFO("Job system: {} items in {} ms with 1 to {} workers.", result.items, times, maxWorkers);
+		return result;
+	}
+
+	Iridium::log_benchmark benchmarkLog(uint32_t iterations) {
+		namespace IrL = Iridium::Logger;
+		Iridium::log_benchmark result{};
+		result.burst = 1000; // well inside the default ring
+		auto message = [](uint32_t index) -> void {
+			IrL::Impl::submit(IrL::INFO, IrL::DISCARD, "Benchmark message {} at {:.3f} from {}", index, float(index) * 0.5f, "cpuBenchmark");
+		};
+
+		clock::duration bursts{};
+		uint32_t burstMessages = 0;
+		while(burstMessages < iterations) {
+			IrL::flush();
+			auto start = clock::now();
+			for(uint32_t index = 0; index < result.burst; index++)
+				message(index);
+			bursts += clock::now() - start;
+			burstMessages += result.burst;
+		}
+		IrL::flush();
+		result.burstNanoseconds = nanoseconds(bursts, burstMessages);
+
+		auto start = clock::now();
+		for(uint32_t index = 0; index < iterations; index++)
+			message(index);
+		result.sustainedNanoseconds = nanoseconds(clock::now() - start, iterations);
+		IrL::flush();
+
+		ENGINE_LOG_INFO("Logging: {:.1f} ns per message in bursts of {}, {:.1f} ns sustained.", result.burstNanoseconds, result.burst, result.sustainedNanoseconds);
+		return result;
+	}
+}
+
+Iridium::cpu_benchmark Iridium::runCpuBenchmarks(uint32_t iterations) {
+	cpu_benchmark result{};
+	result.iterations = iterations;
+	if(iterations == 0)
+		return result;
+
+	result.refcount = benchmarkRefcount(iterations);
+	result.slab = benchmarkSlab(iterations);
+	result.jobs = benchmarkJobScaling(iterations);
+	result.log = benchmarkLog(iterations);
+	return result;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Iridium {
+	// make_shared/copy costs of the reference table pointers next to std::shared_ptr, in nanoseconds
+	// per operation. A copy is one increment and one release, contended copies hit one shared object
+	// from every thread at once.
+	struct refcount_benchmark {
+		uint32_t threads;
+		double createNanoseconds;
+		double copyNanoseconds;
+		double contendedCopyNanoseconds;
+		double stdCreateNanoseconds;
+		double stdCopyNanoseconds;
+		double stdContendedCopyNanoseconds;
+	};
+
+	// Nanoseconds per free plus allocate of 16 B to 4 KiB blocks with a window of blocks kept alive,
+	// slab_allocator next to the general purpose operator new. Contended runs every thread at once.
+	// The walks read objects from make_shared and from new, allocated with other allocations in
+	// between, in the order they were made and are in nanoseconds per object.
+	struct slab_benchmark {
+		uint32_t threads;
+		double slabNanoseconds;
+		double slabContendedNanoseconds;
+		double heapNanoseconds;
+		double heapContendedNanoseconds;
+		uint32_t walkObjects;
+		double slabWalkNanoseconds;
+		double heapWalkNanoseconds;
+	};
+
+	// One parallelFor over items of a fixed amount of arithmetic on pools of 1 to one worker per
+	// physical core, the fastest of a few runs each.
+	struct job_scaling_benchmark {
+		uint32_t items;
+		std::vector<double> milliseconds; // [workers - 1]
+	};
+
+	// Nanoseconds a logging thread spends per message with an int, a float and a string argument.
+	// Bursts fit in the ring and are flushed in between, sustained keeps going and includes waiting
+	// for the backend. The messages are drained but never written.
+	struct log_benchmark {
+		uint32_t burst;
+		double burstNanoseconds;
+		double sustainedNanoseconds;
+	};
+
+	// Microbenchmarks of the engine's CPU side building blocks against what the standard library
+	// would give, written into the --benchmark report next to the frame numbers.
+	struct cpu_benchmark {
+		uint32_t iterations; // per measurement and thread
+		refcount_benchmark refcount;
+		slab_benchmark slab;
+		job_scaling_benchmark jobs;
+		log_benchmark log;
+	};
+
+	// needs the thread manager, 0 iterations skips everything
+	cpu_benchmark runCpuBenchmarks(uint32_t iterations);
+}
@@ -1,12 +1,21 @@
 #include "entryPoint.hpp"
+#include <chrono>
 #include <exception>
 #include <iterator>
+#include <limits>
+#include <optional>
 #include <ranges>
+#include <string>
 #include <vulkan/vulkan_core.h>
 
 #include "appinfo.hpp"
+#include "frameStats.hpp"
 #include "inputHandler.hpp"
+#include "jobSystem.hpp"
 #include "log.hpp"
+#include "memory.hpp"
+#include "metrics.hpp"
+#include "profiler.hpp"
 #include "renderer/renderer.hpp"
 #include "assets/shaderCompiler.hpp"
 #include "renderer/window.hpp"
@@ -21,9 +30,25 @@ namespace Ir = Iridium;
 
 extern Ir::application& createApp();
 
+// set by --benchmark, the app then runs headless
+static std::optional<Ir::Renderer::benchmark_config> g_benchmark;
+
 Ir::application::application(Iridium::appinfo& info) {
 	setApplicationPointer(this, I_KNOW_WHAT_I_AM_DOING);
 
+	threadManager = ::new thread_manager();
+	threadManager->registerCurrentThread("Main", thread_role::main);
+	jobSystem = ::new job_system();
+
+	if(g_benchmark) {
+		// no window, so nothing that needs a display either
+		windowManager = nullptr;
+		inputHandler = nullptr;
+		shaderCompiler = ::new shader_compiler();
+		renderer = ::new Renderer::renderer(info, &*g_benchmark);
+		renderer->runBenchmark();
+		return;
+	}
 	windowManager = ::new window_manager();
 	windowManager->createWindow(800, 600, info.name);
 	inputHandler = ::new input_handler();
@@ -33,24 +58,100 @@ Ir::application::application(Iridium::appinfo& info) {
 	renderer->testLoop();
 }
 
+void Ir::application::teardown() {
+	::delete jobSystem;
+	jobSystem = nullptr;
+	// whatever is still running gets joined newest first
+	::delete threadManager;
+	threadManager = nullptr;
+}
+
 extern void entryPoint();
 
 int main(int argc, char** argv) {
+	auto launchTime = std::chrono::steady_clock::now();
 #ifdef _MSC_VER
 	SetConsoleOutputCP(65001);
 #endif
 
 	Ir::setThreadName("Main");
 	auto span = std::span(argv, std::next(argv, argc));
+
+	Ir::Logger::config loggerConfig{};
+	std::string profilePath = "Iridium.trace.json";
+	Ir::FrameStats::config statsConfig{};
+	Ir::Metrics::config metricsConfig{};
+	for(auto [index, option] : std::views::enumerate(span)) {
+		if(std::string_view(option) == "--log-file" && index + 1 < argc)
+			loggerConfig.filePath = span[index + 1];
+		if(std::string_view(option) == "--profile-output" && index + 1 < argc)
+			profilePath = span[index + 1];
+		if(std::string_view(option) == "--frame-stats" && index + 1 < argc)
+			statsConfig.csvPath = span[index + 1];
+		if(std::string_view(option) == "--frame-budget" && index + 1 < argc)
+			statsConfig.budgetMilliseconds = std::stod(span[index + 1]);
+		if(std::string_view(option) == "--no-stats-title")
+			statsConfig.titleReadout = false;
+		if(std::string_view(option) == "--pipeline-stats")
+			statsConfig.pipelineStatistics = true;
+		if(std::string_view(option) == "--benchmark")
+			g_benchmark.emplace().launchTime = launchTime;
+		if(std::string_view(option) == "--metrics-port" && index + 1 < argc)
+			metricsConfig.port = uint16_t(std::stoul(span[index + 1]));
+		if(std::string_view(option) == "--metrics-socket" && index + 1 < argc)
+			metricsConfig.socketPath = span[index + 1];
+		if(std::string_view(option) == "--metrics-interval" && index + 1 < argc)
+			metricsConfig.sampleSeconds = std::stod(span[index + 1]);
+	}
+	if(g_benchmark) {
+		for(auto [index, option] : std::views::enumerate(span)) {
+			if(index + 1 >= argc)
+				break;
+			if(std::string_view(option) == "--benchmark-frames")
+				g_benchmark->frames = std::stoul(span[index + 1]);
+			if(std::string_view(option) == "--benchmark-warmup")
+				g_benchmark->warmupFrames = std::stoul(span[index + 1]);
+			if(std::string_view(option) == "--benchmark-instances")
+				g_benchmark->instances = std::stoul(span[index + 1]);
+			if(std::string_view(option) == "--benchmark-allocations")
+				g_benchmark->allocations = std::stoul(span[index + 1]);
+			if(std::string_view(option) == "--benchmark-cpu-iterations")
+				g_benchmark->cpuIterations = std::stoul(span[index + 1]);
+			if(std::string_view(option) == "--benchmark-seed")
+				g_benchmark->seed = std::stoull(span[index + 1]);
+			if(std::string_view(option) == "--benchmark-output")
+				g_benchmark->outputPath = span[index + 1];
+		}
+		// one window over the whole run, it's closed by the benchmark itself
+		statsConfig.reportSeconds = std::numeric_limits<double>::infinity();
+		statsConfig.titleReadout = false;
+	}
+	Ir::Logger::init(loggerConfig);
+	Ir::FrameStats::init(statsConfig);
+	Ir::Metrics::init(metricsConfig);
+
+	Ir::MemoryExperimental::slab_allocator::init();
+	Ir::MemoryExperimental::reftable_type::init();
+	Ir::MemoryExperimental::segmented_reftable_type::init();
 	ENGINE_LOG_INFO("Argumets are:");
 	for(auto [index, option] : std::views::enumerate(span)) {
 		ENGINE_LOG_INFO_NP("#{} -> {}", index, option);
 	}
 
 	try {
-		[[maybe_unused]] Iridium::application& app = createApp();
+		Iridium::application& app = createApp();
+		app.teardown();
 	} catch (std::exception& e) {
 		ENGINE_LOG_FATAL("Oh Fiddlesticks! What now? \n{}", e.what());
 	}
+	Ir::MemoryExperimental::segmented_reftable_type::cleanup();
+	Ir::MemoryExperimental::reftable_type::cleanup();
+	Ir::MemoryExperimental::slab_allocator::cleanup();
+	// every other thread is joined by now
+	Ir::Metrics::shutdown();
+	Ir::FrameStats::shutdown();
+	Ir::Profiler::exportChromeTrace(profilePath);
+	Ir::Profiler::shutdown();
+	Ir::Logger::shutdown();
 	return 0;
 }
\ No newline at end of file
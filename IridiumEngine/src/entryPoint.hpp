@@ -19,8 +19,13 @@ namespace Iridium {
 		class input_handler* inputHandler;
 		class shader_compiler* shaderCompiler;
 		class window_manager* windowManager;
+		class thread_manager* threadManager;
+		class job_system* jobSystem;
 
 		application(Iridium::appinfo& info);
+
+		// stops everything that outlives the main loop, called by main once createApp returns
+		void teardown();
 	};
 }
 int main(int, char**);
\ No newline at end of file
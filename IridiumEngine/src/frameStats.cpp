@@ -0,0 +1,294 @@
+#include "frameStats.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <format>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+#include "log.hpp"
+#include "metrics.hpp"
+
+namespace IrF = Iridium::FrameStats;
+
+namespace {
+	IrF::config g_config;
+	std::chrono::steady_clock::time_point g_start;
+	std::chrono::steady_clock::time_point g_windowStart;
+
+	// render thread only
+	IrF::histogram g_histograms[size_t(IrF::metric::COUNT)];
+	uint64_t g_counters[size_t(IrF::counter::COUNT)] = {};
+	double g_levels[size_t(IrF::level::COUNT)] = {};
+	uint64_t g_frames = 0; // endFrame calls in the current window
+	uint64_t g_hitches = 0;
+	uint64_t g_totalHitches = 0;
+	uint64_t g_windows = 0;
+
+	std::mutex g_reportMutex;
+	IrF::report g_lastReport{};
+	FILE* g_csv = nullptr;
+
+	// the same numbers for the metrics exporter, registered by init
+	Iridium::Metrics::histogram* g_exportedMetrics[size_t(IrF::metric::COUNT)] = {};
+	Iridium::Metrics::counter* g_exportedCounters[size_t(IrF::counter::COUNT)] = {};
+	Iridium::Metrics::counter* g_exportedFrames = nullptr;
+	Iridium::Metrics::counter* g_exportedHitches = nullptr;
+}
+
+const char* IrF::metricName(metric m) {
+	switch(m) {
+		case metric::frame: return "frame";
+		case metric::cpu: return "cpu";
+		case metric::gpu: return "gpu";
+		case metric::acquireWait: return "acquire";
+		case metric::presentWait: return "present";
+		case metric::COUNT: break;
+	}
+	return "unknown";
+}
+
+const char* IrF::counterName(counter c) {
+	switch(c) {
+		case counter::draws: return "draws";
+		case counter::pipelineBinds: return "pipeline_binds";
+		case counter::descriptorBinds: return "descriptor_binds";
+		case counter::frameUploadBytes: return "frame_upload_bytes";
+		case counter::inputVertices: return "ia_vertices";
+		case counter::inputPrimitives: return "ia_primitives";
+		case counter::vertexInvocations: return "vs_invocations";
+		case counter::clippingPrimitives: return "clipping_primitives";
+		case counter::fragmentInvocations: return "fs_invocations";
+		case counter::COUNT: break;
+	}
+	return "unknown";
+}
+
+const char* IrF::levelName(level l) {
+	switch(l) {
+		case level::deviceMemoryBytes: return "device_memory_bytes";
+		case level::hostMemoryBytes: return "host_memory_bytes";
+		case level::COUNT: break;
+	}
+	return "unknown";
+}
+
+// histogram
+
+size_t IrF::histogram::bucketOf(uint64_t microseconds) {
+	if(microseconds < SUB_BUCKETS)
+		return microseconds;
+	size_t exponent = std::bit_width(microseconds) - 1;
+	size_t bucket = (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + (microseconds >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+	return std::min<size_t>(bucket, BUCKET_COUNT - 1);
+}
+
+uint64_t IrF::histogram::bucketStart(size_t bucket) {
+	if(bucket < SUB_BUCKETS)
+		return bucket;
+	size_t exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+	return uint64_t(SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BUCKET_BITS);
+}
+
+void IrF::histogram::record(int64_t nanoseconds) {
+	nanoseconds = std::max<int64_t>(nanoseconds, 0);
+	m_buckets[bucketOf(uint64_t(nanoseconds) / 1000)]++;
+	m_count++;
+	m_sum += nanoseconds;
+	m_max = std::max(m_max, nanoseconds);
+}
+
+void IrF::histogram::reset() {
+	std::fill(std::begin(m_buckets), std::end(m_buckets), 0);
+	m_count = 0;
+	m_sum = 0;
+	m_max = 0;
+}
+
+double IrF::histogram::mean() const {
+	return m_count ? double(m_sum) / double(m_count) / 1e6 : 0.0;
+}
+
+double IrF::histogram::percentile(double fraction) const {
+	if(m_count == 0)
+		return 0.0;
+	uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(fraction * double(m_count))));
+	uint64_t seen = 0;
+	for(size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+		seen += m_buckets[bucket];
+		if(seen < rank)
+			continue;
+		// middle of the bucket, but never past the largest value actually seen
+		double middle = (double(bucketStart(bucket)) + double(bucket + 1 < BUCKET_COUNT ? bucketStart(bucket + 1) : bucketStart(bucket))) / 2.0;
+		return std::min(middle / 1e3, max());
+	}
+	return max();
+}
+
+// collection
+
+void IrF::init(const config& statsConfig) {
+	g_config = statsConfig;
+	g_start = std::chrono::steady_clock::now();
+	g_windowStart = g_start;
+
+	const std::vector<double> bounds = {1.0, 2.0, 4.0, 6.0, 8.0, 10.0, 12.0, 14.0, 16.7, 20.0, 25.0, 33.3, 50.0, 100.0, 250.0};
+	for(size_t index = 0; index < size_t(metric::COUNT); index++) {
+		g_exportedMetrics[index] = &Metrics::addHistogram("iridium_frame_milliseconds", "Frame time split by what it was spent on.",
+			bounds, std::format("metric=\"{}\"", metricName(metric(index))));
+	}
+	for(size_t index = 0; index < size_t(counter::COUNT); index++)
+		g_exportedCounters[index] = &Metrics::addCounter(std::format("iridium_{}_total", counterName(counter(index))), "Per frame counter, summed over all frames.");
+	g_exportedFrames = &Metrics::addCounter("iridium_frames_total", "Frames drawn.");
+	g_exportedHitches = &Metrics::addCounter("iridium_hitches_total", "Frames over the frame budget.");
+
+	if(!g_config.csvPath.empty()) {
+		g_csv = std::fopen(g_config.csvPath.c_str(), "w");
+		if(g_csv == nullptr) {
+			ENGINE_LOG_ERROR("Failed to open frame stats file {}.", g_config.csvPath);
+			return;
+		}
+		std::fputs("seconds,hitches", g_csv);
+		for(size_t index = 0; index < size_t(metric::COUNT); index++) {
+			const char* name = metricName(metric(index));
+			std::fprintf(g_csv, ",%s_count,%s_mean_ms,%s_p50_ms,%s_p95_ms,%s_p99_ms,%s_max_ms", name, name, name, name, name, name);
+		}
+		for(size_t index = 0; index < size_t(counter::COUNT); index++)
+			std::fprintf(g_csv, ",%s_per_frame", counterName(counter(index)));
+		for(size_t index = 0; index < size_t(level::COUNT); index++)
+			std::fprintf(g_csv, ",%s_max", levelName(level(index)));
+		std::fputc('\n', g_csv);
+	}
+}
+
+void IrF::shutdown() {
+	if(g_csv) {
+		std::fclose(g_csv);
+		g_csv = nullptr;
+	}
+}
+
+const IrF::config& IrF::getConfig() {
+	return g_config;
+}
+
+void IrF::record(metric m, int64_t nanoseconds) {
+	g_histograms[size_t(m)].record(nanoseconds);
+	if(g_exportedMetrics[size_t(m)])
+		g_exportedMetrics[size_t(m)]->observe(double(nanoseconds) / 1e6);
+	if(m == metric::frame && double(nanoseconds) > g_config.budgetMilliseconds * 1e6) {
+		g_hitches++;
+		g_totalHitches++;
+		if(g_exportedHitches)
+			g_exportedHitches->add();
+	}
+}
+
+void IrF::count(counter c, uint64_t amount) {
+	g_counters[size_t(c)] += amount;
+	if(g_exportedCounters[size_t(c)])
+		g_exportedCounters[size_t(c)]->add(amount);
+}
+
+void IrF::sample(level l, double value) {
+	g_levels[size_t(l)] = std::max(g_levels[size_t(l)], value);
+}
+
+void IrF::endFrame() {
+	g_frames++;
+	if(g_exportedFrames)
+		g_exportedFrames->add();
+	auto now = std::chrono::steady_clock::now();
+	if(std::chrono::duration<double>(now - g_windowStart).count() < g_config.reportSeconds)
+		return;
+	flush();
+}
+
+void IrF::reset() {
+	for(histogram& values : g_histograms)
+		values.reset();
+	g_totalHitches -= g_hitches;
+	g_hitches = 0;
+	std::fill(std::begin(g_counters), std::end(g_counters), 0);
+	std::fill(std::begin(g_levels), std::end(g_levels), 0.0);
+	g_frames = 0;
+	g_windowStart = std::chrono::steady_clock::now();
+}
+
+IrF::report IrF::flush() {
+	auto now = std::chrono::steady_clock::now();
+	g_windowStart = now;
+
+	report frameReport{
+		.window = g_windows++,
+		.seconds = std::chrono::duration<double>(now - g_start).count(),
+		.hitches = g_hitches,
+		.totalHitches = g_totalHitches,
+		.metrics = {},
+		.counters = {},
+		.levels = {}
+	};
+	for(size_t index = 0; index < size_t(metric::COUNT); index++) {
+		histogram& values = g_histograms[index];
+		frameReport.metrics[index] = {
+			.count = values.count(),
+			.mean = values.mean(),
+			.p50 = values.percentile(0.50),
+			.p95 = values.percentile(0.95),
+			.p99 = values.percentile(0.99),
+			.max = values.max()
+		};
+		values.reset();
+	}
+	g_hitches = 0;
+	for(size_t index = 0; index < size_t(counter::COUNT); index++) {
+		frameReport.counters[index] = g_frames ? double(g_counters[index]) / double(g_frames) : 0.0;
+		g_counters[index] = 0;
+	}
+	for(size_t index = 0; index < size_t(level::COUNT); index++) {
+		frameReport.levels[index] = g_levels[index];
+		g_levels[index] = 0.0;
+	}
+	g_frames = 0;
+
+	{
+		std::scoped_lock<std::mutex> lock(g_reportMutex);
+		g_lastReport = frameReport;
+	}
+
+	// a line per window, stdio buffers it so the render thread doesn't wait on the disk
+	if(g_csv) {
+		std::string line = std::format("{:.3f},{}", frameReport.seconds, frameReport.hitches);
+		for(const summary& values : frameReport.metrics)
+			std::format_to(std::back_inserter(line), ",{},{:.3f},{:.3f},{:.3f},{:.3f},{:.3f}", values.count, values.mean, values.p50, values.p95, values.p99, values.max);
+		for(double value : frameReport.counters)
+			std::format_to(std::back_inserter(line), ",{:.1f}", value);
+		for(double value : frameReport.levels)
+			std::format_to(std::back_inserter(line), ",{:.0f}", value);
+		line += '\n';
+		std::fwrite(line.data(), 1, line.size(), g_csv);
+	}
+	return frameReport;
+}
+
+IrF::report IrF::lastReport() {
+	std::scoped_lock<std::mutex> lock(g_reportMutex);
+	return g_lastReport;
+}
+
+std::string IrF::readout(const report& frameReport) {
+	const summary& frame = frameReport.metrics[size_t(metric::frame)];
+	const summary& gpu = frameReport.metrics[size_t(metric::gpu)];
+	std::string text = std::format("frame p50 {:.2f} p99 {:.2f} max {:.2f} ms", frame.p50, frame.p99, frame.max);
+	if(gpu.count)
+		std::format_to(std::back_inserter(text), " | gpu p50 {:.2f} p99 {:.2f} ms", gpu.p50, gpu.p99);
+	std::format_to(std::back_inserter(text), " | {:.0f} draws", frameReport.counters[size_t(counter::draws)]);
+	if(g_config.pipelineStatistics)
+		std::format_to(std::back_inserter(text), " {:.1f}M fs", frameReport.counters[size_t(counter::fragmentInvocations)] / 1e6);
+	std::format_to(std::back_inserter(text), " | {} hitches", frameReport.hitches);
+	return text;
+}
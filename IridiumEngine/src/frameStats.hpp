@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace Iridium {
+	namespace FrameStats {
+		enum class metric : uint8_t {
+			frame,       // start to start of consecutive frames, what hitches are counted against
+			cpu,         // render thread work, without the waits below
+			gpu,         // timestamps around the frame's command buffer, arrives a few frames late
+			acquireWait, // in-flight fences plus vkAcquireNextImageKHR
+			presentWait, // vkQueuePresentKHR
+			COUNT
+		};
+
+		const char* metricName(metric m);
+
+		// things counted per frame rather than timed
+		enum class counter : uint8_t {
+			draws,
+			pipelineBinds,
+			descriptorBinds,
+			frameUploadBytes, // written into the frame_upload_arena
+			// pipeline statistics queries, only with config::pipelineStatistics and a few frames late like gpu
+			inputVertices,
+			inputPrimitives,
+			vertexInvocations,
+			clippingPrimitives,
+			fragmentInvocations,
+			COUNT
+		};
+
+		const char* counterName(counter c);
+
+		// things sampled once a frame, a report keeps the highest sample of its window
+		enum class level : uint8_t {
+			deviceMemoryBytes, // usage of the device local heaps
+			hostMemoryBytes,   // usage of the other heaps
+			COUNT
+		};
+
+		const char* levelName(level l);
+
+		struct config {
+			double budgetMilliseconds = 1000.0 / 60.0; // frames over this count as hitches
+			double reportSeconds = 1.0;                // length of a report window
+			std::string csvPath;                       // no CSV when empty
+			bool titleReadout = true;                  // readout() in the window title
+			bool pipelineStatistics = false;           // query pipeline statistics around every GPU pass
+		};
+
+		// Log-linear buckets over microseconds, 32 per power of two. Every value up to about
+		// 16 seconds lands within 3% of its bucket's lower bound, the rest in the last bucket.
+		class histogram {
+		public:
+			enum {
+				SUB_BUCKET_BITS = 5,
+				SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+				BUCKET_COUNT = 640
+			};
+
+			void record(int64_t nanoseconds);
+			void reset();
+
+			uint64_t count() const { return m_count; }
+			double mean() const;                 // milliseconds
+			double percentile(double fraction) const; // milliseconds
+			double max() const { return double(m_max) / 1e6; }
+		private:
+			uint32_t m_buckets[BUCKET_COUNT] = {};
+			uint64_t m_count = 0;
+			int64_t m_sum = 0;
+			int64_t m_max = 0;
+
+			static size_t bucketOf(uint64_t microseconds);
+			static uint64_t bucketStart(size_t bucket);
+		};
+
+		struct summary {
+			uint64_t count;
+			double mean, p50, p95, p99, max; // milliseconds
+		};
+
+		struct report {
+			uint64_t window;       // how many windows were closed before this one
+			double seconds;        // since init, at the end of the window
+			uint64_t hitches;      // in this window
+			uint64_t totalHitches; // since init
+			summary metrics[size_t(metric::COUNT)];
+			double counters[size_t(counter::COUNT)]; // per frame averages
+			double levels[size_t(level::COUNT)];     // window maximums
+		};
+
+		void init(const config& statsConfig = {});
+		void shutdown();
+		const config& getConfig();
+
+		// render thread only
+		void record(metric m, int64_t nanoseconds);
+		void count(counter c, uint64_t amount);
+		void sample(level l, double value);
+		// closes the window once reportSeconds have passed, writing it to the CSV
+		void endFrame();
+		// drops what the current window has seen so far
+		void reset();
+		// closes the current window right away and returns it,
+		// from the render thread or from anywhere once it's joined
+		report flush();
+
+		// any thread, the last closed window
+		report lastReport();
+		// something like "frame p50 4.12 p99 6.80 max 9.01 ms | gpu p50 2.10 p99 2.90 ms | 1024 draws | 2 hitches"
+		std::string readout(const report& frameReport);
+	}
+}
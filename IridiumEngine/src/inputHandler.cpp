@@ -1,4 +1,5 @@
 #include "inputHandler.hpp"
+#include "allocationTracker.hpp"
 #include "log.hpp"
 
 #include <GLFW//glfw3.h>
@@ -137,6 +138,7 @@ static Iridium::keyboard_key glfwKeyToIrKey(int key) {
 }
 
 Iridium::input_handler::input_handler() {
+	IRIDIUM_ALLOCATION_TAG(input);
 	window_manager* windowManager = getWindowManager();
 	GLFWwindow* window = (GLFWwindow*)windowManager->getWindowHandle();
 
@@ -149,6 +151,7 @@ Iridium::input_handler::input_handler() {
 	memset(m_keyStateArray, 0, KEY_MAX_VALUE * sizeof(bool));
 
 	glfwSetKeyCallback(window, [](GLFWwindow*, int key, [[maybe_unused]] int scancode, int action, [[maybe_unused]] int mods) -> void {
+		IRIDIUM_ALLOCATION_TAG(input);
 		if(action == GLFW_PRESS) {
 			std::scoped_lock<std::mutex> lock(getInputHandler()->m_keyStateMutex);
 			getInputHandler()->m_keyStateArray[glfwKeyToIrKey(key)] = true;
@@ -188,6 +191,7 @@ Iridium::input_handler::input_handler() {
 
 	
 	glfwSetCharCallback(window, [](GLFWwindow*, unsigned int codepoint) -> void {
+		IRIDIUM_ALLOCATION_TAG(input);
 		input_handler* inputHandler = getInputHandler();
 
 		{
@@ -0,0 +1,218 @@
+#include "jobSystem.hpp"
+
+#include <exception>
+#include <format>
+#include <utility>
+
+#include "entryPoint.hpp"
+#include "log.hpp"
+#include "thread.hpp"
+#include "utils.hpp"
+
+// which pool the calling thread works for, pools are told apart by id so a new pool at the
+// address of a destroyed one isn't mistaken for it
+namespace {
+	struct worker_slot {
+		uint64_t pool;
+		int32_t index;
+	};
+}
+
+static std::atomic<uint64_t> s_nextPoolId{1};
+static thread_local worker_slot t_worker{0, -1};
+
+// job_deque
+// bottom/top accesses that need a store-load order are seq_cst instead of standalone fences
+
+bool Iridium::job_deque::push(job* newJob) {
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	int64_t top = m_top.load(std::memory_order_acquire);
+	if(bottom - top >= CAPACITY)
+		return false;
+
+	m_jobs[bottom & MASK].store(newJob, std::memory_order_relaxed);
+	m_bottom.store(bottom + 1, std::memory_order_release);
+	return true;
+}
+
+Iridium::job* Iridium::job_deque::pop() {
+	int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	m_bottom.store(bottom, std::memory_order_seq_cst);
+	int64_t top = m_top.load(std::memory_order_seq_cst);
+
+	if(top > bottom) { // empty
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	job* poppedJob = m_jobs[bottom & MASK].load(std::memory_order_relaxed);
+	if(top == bottom) { // last job, race the thieves for it
+		if(!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			poppedJob = nullptr;
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+	return poppedJob;
+}
+
+Iridium::job* Iridium::job_deque::steal() {
+	int64_t top = m_top.load(std::memory_order_seq_cst);
+	int64_t bottom = m_bottom.load(std::memory_order_seq_cst);
+	if(top >= bottom)
+		return nullptr;
+
+	job* stolenJob = m_jobs[top & MASK].load(std::memory_order_relaxed);
+	if(!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+	return stolenJob;
+}
+
+// job_system
+
+Iridium::job_system::job_system(uint32_t workerCount, std::string name, thread_role role)
+	:m_id(s_nextPoolId.fetch_add(1, std::memory_order_relaxed)) {
+	if(workerCount == 0)
+		workerCount = getThreadManager()->topology().cores.size();
+	m_workerCount = workerCount;
+
+	for(uint32_t index = 0; index < m_workerCount; index++)
+		m_deques.push_back(::new job_deque());
+
+	// the creating thread is worker 0 and helps out while it waits, until this pool is destroyed
+	// it is outside the pool it worked for before
+	m_creatorPreviousPool = t_worker.pool;
+	m_creatorPreviousIndex = t_worker.index;
+	t_worker = worker_slot{m_id, 0};
+	for(uint32_t index = 1; index < m_workerCount; index++) {
+		m_workers.push_back(getThreadManager()->spawnThread(std::format("{} {}", name, index), role, [this, index]() -> void {
+			workerLoop(index);
+		}));
+	}
+	m_queueSampler = Metrics::addSampler("iridium_job_queue_depth", "Jobs waiting in the queue that threads outside the pool submit to.", std::format("queue=\"shared\",pool=\"{}\"", name), [this]() -> double {
+		return m_sharedCount.load(std::memory_order_relaxed);
+	});
+	ENGINE_LOG_INFO("Job system started with {} workers.", m_workerCount);
+}
+
+Iridium::job_system::~job_system() {
+	Metrics::removeSampler(m_queueSampler);
+	m_running.store(false, std::memory_order_release);
+	m_signal.fetch_add(1, std::memory_order_release);
+	m_signal.notify_all();
+	for(thread_handle worker : m_workers)
+		getThreadManager()->join(worker);
+
+	for(auto deque : m_deques)
+		::delete deque;
+	if(t_worker.pool == m_id)
+		t_worker = worker_slot{m_creatorPreviousPool, m_creatorPreviousIndex};
+}
+
+int32_t Iridium::job_system::currentWorker() const {
+	return t_worker.pool == m_id ? t_worker.index : -1;
+}
+
+void Iridium::job_system::workerLoop(uint32_t workerIndex) {
+	t_worker = worker_slot{m_id, int32_t(workerIndex)};
+
+	while(true) {
+		uint32_t signal = m_signal.load(std::memory_order_acquire);
+		job* nextJob = findJob(workerIndex);
+		if(nextJob) {
+			execute(nextJob);
+			continue;
+		}
+		if(!m_running.load(std::memory_order_acquire))
+			break;
+		// anything submitted after the signal was read bumps it, so this can't miss a wakeup
+		m_signal.wait(signal, std::memory_order_acquire);
+	}
+}
+
+void Iridium::job_system::notify() {
+	m_signal.fetch_add(1, std::memory_order_release);
+	m_signal.notify_one();
+}
+
+void Iridium::job_system::submit(job* newJob) {
+	if(newJob->counter)
+		newJob->counter->value.fetch_add(1, std::memory_order_relaxed);
+
+	int32_t workerIndex = currentWorker();
+	if(workerIndex >= 0 && m_deques[workerIndex]->push(newJob)) {
+		notify();
+		return;
+	}
+	if(workerIndex >= 0) { // own deque is full, run it right here
+		execute(newJob);
+		return;
+	}
+
+	{
+		std::scoped_lock<std::mutex> lock(m_sharedMutex);
+		m_sharedQueue.push_back(newJob);
+	}
+	m_sharedCount.fetch_add(1, std::memory_order_release);
+	notify();
+}
+
+Iridium::job* Iridium::job_system::findJob(int32_t workerIndex) {
+	if(workerIndex >= 0) {
+		if(job* ownJob = m_deques[workerIndex]->pop())
+			return ownJob;
+	}
+
+	if(m_sharedCount.load(std::memory_order_acquire) > 0) {
+		std::scoped_lock<std::mutex> lock(m_sharedMutex);
+		if(!m_sharedQueue.empty()) {
+			job* sharedJob = m_sharedQueue.front();
+			m_sharedQueue.pop_front();
+			m_sharedCount.fetch_sub(1, std::memory_order_relaxed);
+			return sharedJob;
+		}
+	}
+
+	// start at our neighbour so thieves don't all pile onto worker 0
+	uint32_t start = workerIndex >= 0 ? workerIndex + 1 : 0;
+	for(uint32_t offset = 0; offset < m_workerCount; offset++) {
+		uint32_t victim = (start + offset) % m_workerCount;
+		if(int32_t(victim) == workerIndex)
+			continue;
+		if(job* stolenJob = m_deques[victim]->steal())
+			return stolenJob;
+	}
+	return nullptr;
+}
+
+void Iridium::job_system::execute(job* currentJob) {
+	job_counter* counter = currentJob->counter;
+	try {
+		currentJob->invoke(currentJob);
+	} catch(...) {
+		// the counter still has to reach zero or its waiter spins forever
+		if(counter == nullptr) {
+			ENGINE_LOG_FATAL("A job without a counter threw, nothing can wait for its exception.");
+			std::terminate();
+		}
+		if(!counter->failed.exchange(true, std::memory_order_relaxed))
+			counter->exception = std::current_exception();
+	}
+	MemoryExperimental::slab_allocator::deallocate(currentJob);
+	if(counter)
+		counter->value.fetch_sub(1, std::memory_order_release);
+}
+
+void Iridium::job_system::wait(job_counter& counter) {
+	while(!counter.done()) {
+		job* nextJob = findJob(currentWorker());
+		if(nextJob)
+			execute(nextJob);
+		else
+			std::this_thread::yield();
+	}
+	if(counter.failed.exchange(false, std::memory_order_relaxed))
+		std::rethrow_exception(std::exchange(counter.exception, nullptr));
+}
+
+Iridium::job_system* Iridium::getJobSystem() {
+	return getApplicationPointer()->jobSystem;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "metrics.hpp"
+#include "slabAllocator.hpp"
+#include "thread.hpp"
+
+namespace Iridium {
+	// Counts unfinished jobs, every job submitted with a counter increments it and
+	// decrements it once it has run. Wait on it with job_system::wait to join.
+	// The first exception one of its jobs throws is kept and rethrown by wait.
+	struct job_counter {
+		std::atomic<uint32_t> value{0};
+		std::atomic<bool> failed{false};
+		std::exception_ptr exception;
+
+		bool done() const {
+			return value.load(std::memory_order_acquire) == 0;
+		}
+	};
+
+	struct job {
+		void (*invoke)(job* self);
+		job_counter* counter;
+		alignas(16) std::byte storage[48];
+	};
+
+	// Chase-Lev work stealing deque with a fixed capacity.
+	// The owning thread pushes and pops at the bottom, everyone else steals from the top.
+	class job_deque {
+	public:
+		enum : int64_t {
+			CAPACITY = 4096,
+			MASK = CAPACITY - 1
+		};
+
+		bool push(job* newJob);
+		job* pop();
+		job* steal();
+	private:
+		alignas(64) std::atomic<int64_t> m_top{0};
+		alignas(64) std::atomic<int64_t> m_bottom{0};
+		alignas(64) std::atomic<job*> m_jobs[CAPACITY] = {};
+	};
+
+	// Fixed pool of worker threads, one per core (the thread that created the pool is worker 0).
+	// Jobs are pushed to the submitting worker's own deque and idle workers steal from the others.
+	// Threads that are not part of the pool submit through a shared queue.
+	class job_system {
+	public:
+		// 0 workers means one per physical core, name prefixes the worker threads and labels the pool's metrics
+		job_system(uint32_t workerCount = 0, std::string name = "Worker", thread_role role = thread_role::worker);
+		~job_system();
+
+		job_system(const job_system&) = delete;
+		job_system& operator=(const job_system&) = delete;
+
+		template<typename Callable>
+		void run(Callable&& func, job_counter* counter = nullptr) {
+			submit(makeJob(std::forward<Callable>(func), counter));
+		}
+
+		// runs other jobs until the counter reaches zero, then rethrows what one of them threw
+		void wait(job_counter& counter);
+
+		// Splits [begin, end) into chunks of grain items and calls func(chunkBegin, chunkEnd) for each one
+		// in parallel. With grain 0 the range is split into roughly four chunks per worker.
+		template<typename Callable>
+		void parallelFor(size_t begin, size_t end, Callable&& func, size_t grain = 0) {
+			if(begin >= end)
+				return;
+
+			size_t count = end - begin;
+			size_t chunk = grain != 0 ? grain : (count + m_workerCount * 4 - 1) / (m_workerCount * 4);
+			chunk = std::max<size_t>(chunk, 1);
+
+			job_counter counter;
+			for(size_t chunkBegin = begin; chunkBegin < end; chunkBegin += chunk) {
+				size_t chunkEnd = std::min(chunkBegin + chunk, end);
+				run([&func, chunkBegin, chunkEnd]() -> void {
+					func(chunkBegin, chunkEnd);
+				}, &counter);
+			}
+			wait(counter);
+		}
+
+		uint32_t workerCount() const {
+			return m_workerCount;
+		}
+
+		// index of the calling worker in this pool, -1 for threads outside it (workers of other pools too)
+		int32_t currentWorker() const;
+	private:
+		uint64_t m_id;
+		uint64_t m_creatorPreviousPool; // what the creating thread was a worker of before
+		int32_t m_creatorPreviousIndex;
+		uint32_t m_workerCount;
+		std::vector<job_deque*> m_deques;
+		std::vector<thread_handle> m_workers;
+
+		std::mutex m_sharedMutex;
+		std::deque<job*> m_sharedQueue;
+		std::atomic<uint32_t> m_sharedCount{0};
+
+		alignas(64) std::atomic<uint32_t> m_signal{0};
+		std::atomic<bool> m_running{true};
+
+		Metrics::sampler_id m_queueSampler;
+
+		template<typename Callable>
+		static job* makeJob(Callable&& func, job_counter* counter) {
+			using callable_t = std::decay_t<Callable>;
+
+			job* newJob = static_cast<job*>(MemoryExperimental::slab_allocator::allocate(sizeof(job)));
+			newJob->counter = counter;
+			if constexpr(sizeof(callable_t) <= sizeof(job::storage) && alignof(callable_t) <= alignof(job)) {
+				::new (newJob->storage) callable_t(std::forward<Callable>(func));
+				newJob->invoke = [](job* self) -> void {
+					// destroyed even when it throws
+					struct destroy_on_exit {
+						callable_t* callable;
+						~destroy_on_exit() { callable->~callable_t(); }
+					} guard{std::launder(reinterpret_cast<callable_t*>(self->storage))};
+					(*guard.callable)();
+				};
+			} else {
+				callable_t* callable = ::new callable_t(std::forward<Callable>(func));
+				::new (newJob->storage) callable_t*(callable);
+				newJob->invoke = [](job* self) -> void {
+					std::unique_ptr<callable_t> callable(*std::launder(reinterpret_cast<callable_t**>(self->storage)));
+					(*callable)();
+				};
+			}
+			return newJob;
+		}
+
+		void submit(job* newJob);
+		void execute(job* currentJob);
+		job* findJob(int32_t workerIndex);
+		void workerLoop(uint32_t workerIndex);
+		void notify();
+	};
+
+	job_system* getJobSystem();
+}
@@ -0,0 +1,18 @@
+#include "json.hpp"
+
+#include <format>
+#include <iterator>
+
+void Iridium::appendJsonString(std::string& out, std::string_view string) {
+	out += '"';
+	for(char character : string) {
+		if(character == '"' || character == '\\') {
+			out += '\\';
+			out += character;
+		} else if(static_cast<unsigned char>(character) < 0x20)
+			std::format_to(std::back_inserter(out), "\\u{:04x}", static_cast<unsigned char>(character));
+		else
+			out += character;
+	}
+	out += '"';
+}
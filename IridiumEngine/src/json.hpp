@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace Iridium {
+	// Quoted JSON string, quotes and backslashes escaped and control characters as \u00XX.
+	// For the reports and traces the engine writes by hand.
+	void appendJsonString(std::string& out, std::string_view string);
+}
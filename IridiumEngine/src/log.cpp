@@ -1,99 +1,509 @@
 #include "log.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
 #include <ctime>
+#include <exception>
 #include <format>
+#include <iterator>
+#include <map>
+#include <mutex>
 #include <string_view>
+#include <thread>
+#include <vector>
 
+#include "metrics.hpp"
 #include "thread.hpp"
 
-#define CONSOLE_TEXT_BLACK "\033[30m"
-#define CONSOLE_TEXT_RED "\033[31m"
-#define CONSOLE_TEXT_GREEN "\033[32m"
-#define CONSOLE_TEXT_YELLOW "\033[33m"
-#define CONSOLE_TEXT_BLUE "\033[34m"
-#define CONSOLE_TEXT_MAGENTA "\033[35m"
-#define CONSOLE_TEXT_CYAN "\033[36m"
-#define CONSOLE_TEXT_LIGHTGRAY "\033[37m"
-#define CONSOLE_TEXT_DARKGRAY "\033[90m"
-#define CONSOLE_TEXT_LIGHTRED "\033[91m"
-#define CONSOLE_TEXT_LIGHTGREEN "\033[92m"
-#define CONSOLE_TEXT_LIGHTYELLOW "\033[93m"
-#define CONSOLE_TEXT_LIGHTBLUE "\033[94m"
-#define CONSOLE_TEXT_LIGHTMAGENTA "\033[95m"
-#define CONSOLE_TEXT_LIGHTCYAN "\033[96m"
-#define CONSOLE_TEXT_WHITE "\033[97m"
-
-#define CONSOLE_TEXT_BOLD "\033[1m"
-#define CONSOLE_TEXT_NOBOLD "\033[22m"
-#define CONSOLE_TEXT_UNDERLINE "\033[4m"
-#define CONSOLE_TEXT_NOUNDERLINE "\033[24m"
-#define CONSOLE_TEXT_NEGATIVE "\033[7m"
-#define CONSOLE_TEXT_POSITIVE "\033[27m"
-
-#define CONSOLE_BACK_BLACK "\033[40m"
-#define CONSOLE_BACK_RED "\033[41m"
-#define CONSOLE_BACK_GREEN "\033[42m"
-#define CONSOLE_BACK_YELLOW "\033[43m"
-#define CONSOLE_BACK_BLUE "\033[44m"
-#define CONSOLE_BACK_MAGENTA "\033[45m"
-#define CONSOLE_BACK_CYAN "\033[46m"
-#define CONSOLE_BACK_LIGHTGRAY "\033[47m"
-#define CONSOLE_BACK_DARKGRAY "\033[100m"
-#define CONSOLE_BACK_LIGHTRED "\033[101m"
-#define CONSOLE_BACK_LIGHTGREEN "\033[102m"
-#define CONSOLE_BACK_LIGHTYELLOW "\033[103m"
-#define CONSOLE_BACK_LIGHTBLUE "\033[104m"
-#define CONSOLE_BACK_LIGHTMAGENTA "\033[105m"
-#define CONSOLE_BACK_LIGHTCYAN "\033[106m"
-#define CONSOLE_BACK_WHITE "\033[107m"
-
-#define CONSOLE_DEFAULT "\033[0m"
-
-std::string Iridium::Logger::getTimestamp() {
-	std::time_t time = std::time(nullptr);
-	std::tm* tm = std::localtime(&time);
-	return std::format("{:0>2}:{:0>2}:{:0>2}", tm->tm_hour, tm->tm_min, tm->tm_sec);
-}
-
-std::string Iridium::Logger::getPrefix(severity level) {
-	std::string_view levelStr{};
-	switch(level) {
-		case INFO:
-			levelStr = "[Info]";
-			break;
-		case WARN:
-			levelStr = CONSOLE_TEXT_YELLOW "[Warn]";
-			break;
-		case ERROR:
-			levelStr = CONSOLE_TEXT_LIGHTRED "[Error]";
-			break;
-		case FATAL:
-			levelStr = CONSOLE_TEXT_WHITE CONSOLE_BACK_RED "[Fatal]";
-			break;
+namespace IrL = Iridium::Logger;
+namespace IrB = Iridium::Logger::Binary;
+
+namespace {
+	// single producer (the owning thread), single consumer (the backend) byte ring
+	struct log_ring {
+		std::byte* data;
+		size_t capacity;
+		std::string threadName; // only for the dropped message report
+		uint16_t id;            // thread id in binary logs, 0 is for synchronous writes
+
+		alignas(64) std::atomic<uint64_t> head{0};
+		uint64_t cachedTail = 0;  // producer only
+		uint64_t pendingHead = 0; // producer only, where the record being written starts
+		alignas(64) std::atomic<uint64_t> tail{0};
+		std::atomic<uint64_t> dropped{0};
+		std::atomic<bool> closed{false};
+
+		log_ring(size_t size, std::string_view name, uint16_t ringId)
+			:data(::new std::byte[size]), capacity(size), threadName(name), id(ringId) {}
+		~log_ring() {
+			::delete[] data;
+		}
+	};
+
+	struct ring_owner {
+		log_ring* ring = nullptr;
+		~ring_owner();
+	};
+
+	struct pending_record {
+		int64_t timestamp;
+		const IrL::Impl::record_header* header;
+		const log_ring* ring;
+	};
+
+	// what has been announced in the binary file so far
+	struct binary_registry {
+		std::map<std::pair<const char*, const IrB::arg_type*>, uint32_t> formats;
+		std::map<uint16_t, std::string> threads;
+	};
+
+	IrL::config g_config;
+	std::atomic<bool> g_running{false};
+
+	std::mutex g_ringsMutex;
+	std::vector<log_ring*> g_rings;
+	uint16_t g_nextRingId = 1;
+
+	std::mutex g_sinkMutex;
+	FILE* g_file = nullptr;
+	binary_registry g_binary; // under g_sinkMutex, like the file it describes
+
+	std::mutex g_wakeMutex;
+	std::condition_variable g_wake;
+	std::atomic<uint64_t> g_flushRequested{0};
+	std::atomic<uint64_t> g_flushCompleted{0};
+	std::terminate_handler g_previousTerminate = nullptr;
+
+	// crashes that would otherwise take whatever is still in the rings with them
+	constexpr int FATAL_SIGNALS[] = {
+		SIGSEGV, SIGABRT, SIGILL, SIGFPE,
+#ifdef SIGBUS
+		SIGBUS
+#endif
+	};
+	using signal_handler = void(*)(int);
+	signal_handler g_previousSignals[std::size(FATAL_SIGNALS)] = {};
+	Iridium::Metrics::counter* g_droppedMetric = nullptr; // every policy, not just overflow_policy::count
+
+	thread_local ring_owner t_ring;
+	thread_local bool t_threadExited = false;
+	thread_local bool t_isBackend = false;
+
+	std::jthread g_backend; // last, so it's stopped before anything above is destroyed
+}
+
+ring_owner::~ring_owner() {
+	t_threadExited = true;
+	if(ring)
+		ring->closed.store(true, std::memory_order_release);
+}
+
+// binary sink, everything here needs g_sinkMutex
+
+template<typename T>
+static void appendBytes(std::string& out, const T& value) {
+	out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+static uint32_t binaryFormat(std::string& out, std::string_view format, std::span<const IrB::arg_type> types) {
+	auto [iterator, inserted] = g_binary.formats.try_emplace({format.data(), types.data()}, uint32_t(g_binary.formats.size()));
+	if(inserted) {
+		appendBytes(out, IrB::entry_kind::format);
+		appendBytes(out, iterator->second);
+		appendBytes(out, uint8_t(types.size()));
+		out.append(reinterpret_cast<const char*>(types.data()), types.size());
+		appendBytes(out, uint32_t(format.size()));
+		out.append(format);
 	}
-	std::string_view threadName = Iridium::getThreadName();
-	std::string prefix = std::format("{}[{}][{}]", levelStr, threadName, getTimestamp());
-	return prefix;
+	return iterator->second;
 }
 
-//TODO: This is bad, redo later :)
-std::string Iridium::Logger::getPrefix(severity level, empty_prefix) {
-	std::string_view levelStr{};
-	switch(level) {
-		case INFO:
-			levelStr = "      ";
-			break;
-		case WARN:
-			levelStr = CONSOLE_TEXT_YELLOW "      ";
-			break;
-		case ERROR:
-			levelStr = CONSOLE_TEXT_LIGHTRED "       ";
+static void binaryThread(std::string& out, uint16_t id, std::string_view name) {
+	auto [iterator, inserted] = g_binary.threads.try_emplace(id, name);
+	if(!inserted && iterator->second == name)
+		return;
+	iterator->second = name;
+	appendBytes(out, IrB::entry_kind::thread);
+	appendBytes(out, id);
+	appendBytes(out, uint16_t(name.size()));
+	out.append(name);
+}
+
+static void binaryMessage(std::string& out, IrL::severity level, uint8_t flags, uint16_t thread, uint32_t format, int64_t timestamp, const std::byte* args, size_t size) {
+	appendBytes(out, IrB::entry_kind::message);
+	appendBytes(out, level);
+	appendBytes(out, flags);
+	appendBytes(out, thread);
+	appendBytes(out, format);
+	appendBytes(out, timestamp);
+	appendBytes(out, uint32_t(size));
+	out.append(reinterpret_cast<const char*>(args), size);
+}
+
+// messages that are already formatted, "{}" with a single string
+static void binaryText(std::string& out, IrL::severity level, uint8_t flags, std::string_view threadName, int64_t timestamp, std::string_view message) {
+	static constexpr std::string_view format = "{}";
+	static constexpr IrB::arg_type types[] = {IrB::arg_type::string};
+	binaryThread(out, 0, threadName);
+	uint32_t formatId = binaryFormat(out, format, types);
+
+	std::string args;
+	appendBytes(args, uint32_t(message.size()));
+	args.append(message);
+	binaryMessage(out, level, flags, 0, formatId, timestamp, reinterpret_cast<const std::byte*>(args.data()), args.size());
+}
+
+// without a file there's nothing else to read them from
+static bool showOnConsole(IrL::severity level) {
+	return !IRIDIUM_BINARY_LOG || g_file == nullptr || !(level & IrL::INFO);
+}
+
+static void writeSinks(std::string_view console, std::string_view file) {
+	std::scoped_lock<std::mutex> lock(g_sinkMutex);
+	if(g_config.console && !console.empty()) {
+		std::fwrite(console.data(), 1, console.size(), stdout);
+		std::fflush(stdout);
+	}
+	if(g_file && !file.empty()) {
+		std::fwrite(file.data(), 1, file.size(), g_file);
+		std::fflush(g_file);
+	}
+}
+
+// formats and writes everything the rings hold right now, backend thread (or shutdown) only
+static void drain() {
+	static std::vector<log_ring*> rings;
+	static std::vector<uint64_t> heads;
+	static std::vector<bool> closed;
+	static std::vector<pending_record> batch;
+	static std::string console, file, message;
+	static IrL::timestamp_cache timestamps;
+
+	{
+		std::scoped_lock<std::mutex> lock(g_ringsMutex);
+		rings = g_rings;
+	}
+
+	heads.clear();
+	closed.clear();
+	batch.clear();
+	for(log_ring* ring : rings) {
+		// read closed first, a ring closed before we look at its head is empty once we're done
+		closed.push_back(ring->closed.load(std::memory_order_acquire));
+		uint64_t head = ring->head.load(std::memory_order_acquire);
+		heads.push_back(head);
+
+		uint64_t position = ring->tail.load(std::memory_order_relaxed);
+		while(position < head) {
+			auto* header = reinterpret_cast<const IrL::Impl::record_header*>(ring->data + (position & (ring->capacity - 1)));
+			if(!(header->flags & (IrL::PADDING | IrL::DISCARD)))
+				batch.push_back({header->timestamp, header, ring});
+			position += header->size;
+		}
+	}
+
+	// threads interleave by time, not by ring
+	std::stable_sort(batch.begin(), batch.end(), [](const pending_record& left, const pending_record& right) -> bool {
+		return left.timestamp < right.timestamp;
+	});
+
+	console.clear();
+	file.clear();
+	// the registry and the file have to agree on what was announced, so binary mode holds the lock throughout
+	std::unique_lock<std::mutex> binaryLock(g_sinkMutex, std::defer_lock);
+	if constexpr(IRIDIUM_BINARY_LOG)
+		binaryLock.lock();
+
+	for(const pending_record& record : batch) {
+		const auto* header = record.header;
+		const std::byte* name = reinterpret_cast<const std::byte*>(header) + sizeof(IrL::Impl::record_header);
+		const std::byte* args = name + header->nameLength;
+		std::string_view threadName(reinterpret_cast<const char*>(name), header->nameLength);
+
+#if IRIDIUM_BINARY_LOG
+		if(g_file) {
+			// arguments go into the file exactly as they sit in the ring, nothing is formatted
+			size_t argBytes = 0;
+			for(IrB::arg_type type : header->argTypes)
+				argBytes += IrB::argSize(type, args + argBytes);
+			binaryThread(file, record.ring->id, threadName);
+			uint32_t formatId = binaryFormat(file, header->format, header->argTypes);
+			binaryMessage(file, header->level, header->flags, record.ring->id, formatId, record.timestamp, args, argBytes);
+		}
+#endif
+		bool toConsole = g_config.console && showOnConsole(header->level);
+		bool toTextFile = !IRIDIUM_BINARY_LOG && g_file;
+		if(!toConsole && !toTextFile)
+			continue;
+
+		message.clear();
+		try {
+			header->decode(message, header->format, args);
+		} catch(std::exception& e) {
+			message = std::format("<format error: {}>", e.what());
+		}
+
+		std::string_view timestamp = IrL::formatTimestamp(record.timestamp, timestamps);
+		if(toConsole)
+			IrL::appendLine(console, header->level, header->flags, threadName, timestamp, message, true);
+		if(toTextFile)
+			IrL::appendLine(file, header->level, header->flags, threadName, timestamp, message, false);
+	}
+
+	for(log_ring* ring : rings) {
+		uint64_t dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+		if(dropped == 0)
+			continue;
+		std::string warning = std::format("{} messages from thread {} were dropped", dropped, ring->threadName);
+		int64_t now = IrL::Impl::now();
+		std::string_view timestamp = IrL::formatTimestamp(now, timestamps);
+		IrL::appendLine(console, IrL::WARN, 0, "Logger", timestamp, warning, true);
+		if constexpr(IRIDIUM_BINARY_LOG) {
+			if(g_file)
+				binaryText(file, IrL::WARN, 0, "Logger", now, warning);
+		} else
+			IrL::appendLine(file, IrL::WARN, 0, "Logger", timestamp, warning, false);
+	}
+	if(binaryLock.owns_lock())
+		binaryLock.unlock();
+	writeSinks(console, file);
+
+	bool anyClosed = false;
+	for(size_t index = 0; index < rings.size(); index++) {
+		rings[index]->tail.store(heads[index], std::memory_order_release);
+		anyClosed = anyClosed || closed[index];
+	}
+	if(anyClosed) {
+		std::scoped_lock<std::mutex> lock(g_ringsMutex);
+		for(size_t index = 0; index < rings.size(); index++) {
+			if(!closed[index])
+				continue;
+			std::erase(g_rings, rings[index]);
+			::delete rings[index];
+		}
+	}
+}
+
+static void backendLoop(std::stop_token stop) {
+	t_isBackend = true;
+	Iridium::setThreadName("Logger");
+
+	while(true) {
+		uint64_t flushTicket = g_flushRequested.load(std::memory_order_acquire);
+		bool stopping = stop.stop_requested();
+		drain();
+		g_flushCompleted.store(flushTicket, std::memory_order_release);
+		g_flushCompleted.notify_all();
+		if(stopping)
 			break;
-		case FATAL:
-			levelStr = CONSOLE_TEXT_WHITE CONSOLE_BACK_RED "       ";
+
+		std::unique_lock<std::mutex> lock(g_wakeMutex);
+		g_wake.wait_for(lock, std::chrono::milliseconds(1), [&]() -> bool {
+			return stop.stop_requested() || g_flushRequested.load(std::memory_order_relaxed) != flushTicket;
+		});
+	}
+}
+
+static void wakeBackend() {
+	std::scoped_lock<std::mutex> lock(g_wakeMutex);
+	g_wake.notify_one();
+}
+
+// Async-signal-safe, so no locks, allocations or notifies in here. The backend wakes up every millisecond
+// on its own and sees the flush ticket, this only waits for it, for a second at most in case the crash
+// left the sink mutex locked. A crash on the backend itself loses what it hadn't written yet.
+static void onFatalSignal(int signal) {
+	if(g_running.load(std::memory_order_acquire) && !t_isBackend) {
+		uint64_t ticket = g_flushRequested.fetch_add(1, std::memory_order_acq_rel) + 1;
+		for(uint32_t waited = 0; waited < 1000 && g_flushCompleted.load(std::memory_order_acquire) < ticket; waited++) {
+#ifdef _WIN32
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#else
+			timespec millisecond{.tv_sec = 0, .tv_nsec = 1000000};
+			nanosleep(&millisecond, nullptr);
+#endif
+		}
+	}
+
+	// whatever handled it before us, the default action when that was nobody
+	for(size_t index = 0; index < std::size(FATAL_SIGNALS); index++) {
+		if(FATAL_SIGNALS[index] != signal)
+			continue;
+		signal_handler previous = g_previousSignals[index];
+		std::signal(signal, previous == SIG_ERR ? SIG_DFL : previous);
+	}
+	std::raise(signal);
+}
+
+void IrL::init(const config& loggerConfig) {
+	if(g_running.load(std::memory_order_acquire))
+		return;
+
+	g_config = loggerConfig;
+	g_droppedMetric = &Iridium::Metrics::addCounter("iridium_log_dropped_total", "Log messages lost to full rings.");
+	if(!std::has_single_bit(g_config.ringSize))
+		g_config.ringSize = std::bit_ceil(g_config.ringSize);
+
+	if(IRIDIUM_BINARY_LOG && g_config.filePath.empty())
+		g_config.filePath = "Iridium.irlog";
+
+	if(!g_config.filePath.empty()) {
+		g_file = std::fopen(g_config.filePath.c_str(), IRIDIUM_BINARY_LOG ? "wb" : "w");
+		if(g_file == nullptr)
+			ENGINE_LOG_ERROR("Failed to open log file {}.", g_config.filePath);
+		else if constexpr(IRIDIUM_BINARY_LOG) {
+			std::fwrite(IrB::MAGIC, 1, sizeof(IrB::MAGIC), g_file);
+			std::fwrite(&IrB::VERSION, sizeof(IrB::VERSION), 1, g_file);
+		}
+	}
+
+	g_previousTerminate = std::set_terminate([]() -> void {
+		flush();
+		if(g_previousTerminate)
+			g_previousTerminate();
+		std::abort();
+	});
+	for(size_t index = 0; index < std::size(FATAL_SIGNALS); index++)
+		g_previousSignals[index] = std::signal(FATAL_SIGNALS[index], onFatalSignal);
+
+	g_backend = std::jthread(backendLoop);
+	g_running.store(true, std::memory_order_release);
+}
+
+void IrL::shutdown() {
+	if(!g_running.exchange(false, std::memory_order_acq_rel))
+		return;
+
+	g_backend.request_stop();
+	wakeBackend();
+	g_backend.join();
+	// anything that got in between the last drain and g_running going false
+	drain();
+	g_flushCompleted.store(UINT64_MAX, std::memory_order_release);
+	g_flushCompleted.notify_all();
+
+	std::set_terminate(g_previousTerminate);
+	for(size_t index = 0; index < std::size(FATAL_SIGNALS); index++) {
+		signal_handler previous = g_previousSignals[index];
+		std::signal(FATAL_SIGNALS[index], previous == SIG_ERR ? SIG_DFL : previous);
+	}
+	std::scoped_lock<std::mutex> lock(g_sinkMutex);
+	if(g_file) {
+		std::fclose(g_file);
+		g_file = nullptr;
+	}
+	g_binary = {};
+}
+
+void IrL::flush() {
+	if(!g_running.load(std::memory_order_acquire) || t_isBackend) {
+		std::scoped_lock<std::mutex> lock(g_sinkMutex);
+		std::fflush(stdout);
+		if(g_file)
+			std::fflush(g_file);
+		return;
+	}
+
+	uint64_t ticket = g_flushRequested.fetch_add(1, std::memory_order_acq_rel) + 1;
+	wakeBackend();
+	uint64_t completed = g_flushCompleted.load(std::memory_order_acquire);
+	while(completed < ticket) {
+		g_flushCompleted.wait(completed, std::memory_order_acquire);
+		completed = g_flushCompleted.load(std::memory_order_acquire);
+	}
+}
+
+// hot path
+
+std::string_view IrL::Impl::currentThreadName() {
+	return Iridium::getThreadName();
+}
+
+int64_t IrL::Impl::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::byte* IrL::Impl::beginRecord(size_t size, severity level, bool& dropped) {
+	if(!g_running.load(std::memory_order_acquire) || t_threadExited || t_isBackend)
+		return nullptr;
+
+	log_ring* ring = t_ring.ring;
+	if(ring == nullptr) {
+		std::scoped_lock<std::mutex> lock(g_ringsMutex);
+		ring = ::new log_ring(g_config.ringSize, currentThreadName(), g_nextRingId);
+		g_nextRingId = g_nextRingId == UINT16_MAX ? 1 : g_nextRingId + 1;
+		g_rings.push_back(ring);
+		t_ring.ring = ring;
+	}
+	if(size > ring->capacity / 4)
+		return nullptr; // huge messages go straight out
+
+	uint64_t head = ring->head.load(std::memory_order_relaxed);
+	size_t offset = head & (ring->capacity - 1);
+	size_t contiguous = ring->capacity - offset;
+	size_t needed = size + (contiguous < size ? contiguous : 0); // records never wrap
+
+	while(head + needed - ring->cachedTail > ring->capacity) {
+		ring->cachedTail = ring->tail.load(std::memory_order_acquire);
+		if(head + needed - ring->cachedTail <= ring->capacity)
 			break;
+
+		overflow_policy policy = (level & FATAL) ? overflow_policy::block : g_config.overflow;
+		if(policy != overflow_policy::block) {
+			if(policy == overflow_policy::count)
+				ring->dropped.fetch_add(1, std::memory_order_relaxed);
+			if(g_droppedMetric)
+				g_droppedMetric->add();
+			dropped = true;
+			return nullptr;
+		}
+		if(!g_running.load(std::memory_order_acquire))
+			return nullptr;
+		wakeBackend();
+		std::this_thread::yield();
 	}
-	std::string threadName(Iridium::getThreadName().length(), ' ');
-	std::string prefix = std::format("{} {}  {} ", levelStr, threadName, std::string(getTimestamp().length(), ' '));
-	return prefix;
-}
\ No newline at end of file
+
+	if(contiguous < size) {
+		record_header padding{};
+		padding.size = uint32_t(contiguous);
+		padding.flags = PADDING;
+		std::memcpy(ring->data + offset, &padding, std::min(contiguous, sizeof(padding)));
+		head += contiguous;
+	}
+	ring->pendingHead = head;
+	return ring->data + (head & (ring->capacity - 1));
+}
+
+void IrL::Impl::endRecord([[maybe_unused]] std::byte* record, size_t size) {
+	log_ring* ring = t_ring.ring;
+	ring->head.store(ring->pendingHead + size, std::memory_order_release);
+}
+
+void IrL::Impl::writeSynchronous(severity level, uint8_t flags, std::string_view message) {
+	if(flags & DISCARD)
+		return;
+	IrL::timestamp_cache timestamp;
+	std::string console, file;
+	int64_t nanoseconds = now();
+	std::string_view time = IrL::formatTimestamp(nanoseconds, timestamp);
+	if(g_config.console && showOnConsole(level))
+		IrL::appendLine(console, level, flags, currentThreadName(), time, message, true);
+
+	if constexpr(IRIDIUM_BINARY_LOG) {
+		std::unique_lock<std::mutex> lock(g_sinkMutex);
+		if(g_file) {
+			binaryText(file, level, flags, currentThreadName(), nanoseconds, message);
+			std::fwrite(file.data(), 1, file.size(), g_file);
+			std::fflush(g_file);
+		}
+		lock.unlock();
+		writeSinks(console, {});
+		return;
+	}
+	if(g_file)
+		IrL::appendLine(file, level, flags, currentThreadName(), time, message, false);
+	writeSinks(console, file);
+}
@@ -1,11 +1,29 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <format>
-#include <print>
+#include <iterator>
+#include <span>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 #include <utility>
 
+#include "allocationTracker.hpp"
+#include "logFormat.hpp"
+
+// Opt-in with -DIRIDIUM_BINARY_LOG=ON. The file sink then gets compact binary records that
+// IridiumLogDecode turns back into text, and the console only shows warnings and up.
+#ifndef IRIDIUM_BINARY_LOG
+#define IRIDIUM_BINARY_LOG 0
+#endif
+
 #define ENGINE_DEBUG
 
 #ifdef ENGINE_DEBUG
@@ -34,31 +52,177 @@
 
 namespace Iridium {
 	namespace Logger {
-		enum severity : uint8_t {
-			INFO = (1 << 0),
-			WARN = (1 << 1),
-			ERROR= (1 << 2),
-			FATAL= (1 << 3)
+		// what a thread does when its ring buffer is full
+		enum class overflow_policy : uint8_t {
+			block, // wait for the backend to catch up
+			drop,  // lose the message
+			count  // lose the message but report how many were lost
 		};
 
-		enum empty_prefix{};
+		struct config {
+			overflow_policy overflow = overflow_policy::block;
+			bool console = true;
+			std::string filePath; // no file sink when empty, "Iridium.irlog" in binary mode
+			size_t ringSize = 256 * 1024; // per thread, power of two
+		};
+
+		// Starts the background thread. Until then, and after shutdown, messages are written
+		// synchronously on the thread that logs them.
+		void init(const config& loggerConfig = {});
+		void shutdown();
+		// blocks until everything logged before the call is written out, FATAL messages do this on their own
+		void flush();
+
+		namespace Impl {
+			using decode_function = void(*)(std::string& out, std::string_view format, const std::byte* args);
+
+			// Every message in a ring starts with this, followed by the thread name and the encoded
+			// arguments. Records are padded to 8 bytes.
+			struct record_header {
+				uint32_t size;
+				severity level;
+				uint8_t flags;
+				uint16_t nameLength;
+				int64_t timestamp; // system_clock nanoseconds
+				std::string_view format;
+				decode_function decode;
+#if IRIDIUM_BINARY_LOG
+				std::span<const Binary::arg_type> argTypes; // the backend registers format and types once per call site
+#endif
+			};
+
+			// Strings are copied with their length, plain values as raw bytes. Anything else gets the
+			// whole message formatted on the calling thread, views and spans could dangle by the time
+			// the backend formats them. void pointers only ever print their address.
+			template<typename T>
+			constexpr bool is_string_arg_v = std::is_convertible_v<const T&, std::string_view>;
+
+			template<typename T>
+			constexpr bool is_raw_arg_v = !is_string_arg_v<T>
+				&& (std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_same_v<T, const void*> || std::is_same_v<T, void*>);
+
+			// what the record can carry without formatting on the logging thread
+			template<typename T>
+			constexpr bool is_deferred_arg_v = IRIDIUM_BINARY_LOG ? Binary::is_encodable_v<T> : (is_string_arg_v<T> || is_raw_arg_v<T>);
+
+			template<typename... Args>
+			constexpr std::array<Binary::arg_type, sizeof...(Args)> argTypes{Binary::argTypeOf<Args>()...};
 
-		std::string getTimestamp();
-		std::string getPrefix(severity level);
-		std::string getPrefix(severity level, empty_prefix);
+			template<typename T>
+			using decoded_arg_t = std::conditional_t<is_string_arg_v<T>, std::string_view, T>;
+
+			template<typename T>
+			size_t encodedSize(const T& arg) {
+				if constexpr(is_string_arg_v<T>)
+					return sizeof(uint32_t) + std::string_view(arg).size();
+				else
+					return sizeof(T);
+			}
+
+			template<typename T>
+			std::byte* encodeArg(std::byte* cursor, const T& arg) {
+				if constexpr(is_string_arg_v<T>) {
+					std::string_view string(arg);
+					uint32_t length = string.size();
+					std::memcpy(cursor, &length, sizeof(length));
+					std::memcpy(cursor + sizeof(length), string.data(), length);
+					return cursor + sizeof(length) + length;
+				} else {
+					std::memcpy(cursor, &arg, sizeof(T));
+					return cursor + sizeof(T);
+				}
+			}
+
+			template<typename T>
+			decoded_arg_t<T> decodeArg(const std::byte*& cursor) {
+				if constexpr(is_string_arg_v<T>) {
+					uint32_t length;
+					std::memcpy(&length, cursor, sizeof(length));
+					std::string_view string(reinterpret_cast<const char*>(cursor + sizeof(length)), length);
+					cursor += sizeof(length) + length;
+					return string;
+				} else {
+					T value;
+					std::memcpy(&value, cursor, sizeof(T));
+					cursor += sizeof(T);
+					return value;
+				}
+			}
+
+			template<typename... Stored>
+			void decodeRecord(std::string& out, std::string_view format, [[maybe_unused]] const std::byte* args) {
+				// braced init evaluates left to right, so the cursor walks the arguments in order
+				std::tuple<decoded_arg_t<Stored>...> values{decodeArg<Stored>(args)...};
+				std::apply([&](auto&... values) -> void {
+					std::vformat_to(std::back_inserter(out), format, std::make_format_args(values...));
+				}, values);
+			}
+
+			// nullptr when the message has to be written synchronously or was dropped
+			std::byte* beginRecord(size_t size, severity level, bool& dropped);
+			void endRecord(std::byte* record, size_t size);
+			void writeSynchronous(severity level, uint8_t flags, std::string_view message);
+
+			std::string_view currentThreadName();
+			int64_t now();
+
+			template<typename... Args>
+			void enqueue(severity level, uint8_t flags, std::string_view format, const Args&... args) {
+				std::string_view name = currentThreadName();
+				size_t size = sizeof(record_header) + name.size() + (size_t(0) + ... + encodedSize(args));
+				size = (size + 7) & ~size_t(7);
+
+				bool dropped = false;
+				std::byte* record = beginRecord(size, level, dropped);
+				if(record == nullptr) {
+					if(!dropped)
+						writeSynchronous(level, flags, std::vformat(format, std::make_format_args(args...)));
+					return;
+				}
+
+				record_header header{
+					.size = uint32_t(size),
+					.level = level,
+					.flags = flags,
+					.nameLength = uint16_t(name.size()),
+					.timestamp = now(),
+					.format = format,
+					.decode = &decodeRecord<Args...>,
+#if IRIDIUM_BINARY_LOG
+					.argTypes = argTypes<Args...>
+#endif
+				};
+				std::memcpy(record, &header, sizeof(header));
+				std::byte* cursor = record + sizeof(header);
+				std::memcpy(cursor, name.data(), name.size());
+				cursor += name.size();
+				((cursor = encodeArg(cursor, args)), ...);
+				endRecord(record, size);
+			}
+
+			template<typename... Args>
+			void submit(severity level, uint8_t flags, std::format_string<Args...> fmt, Args&&... args) {
+				if constexpr((... && is_deferred_arg_v<std::decay_t<Args>>)) {
+					enqueue<std::decay_t<Args>...>(level, flags, fmt.get(), args...);
+				} else {
+					std::string message = std::format(fmt, std::forward<Args>(args)...);
+					enqueue<std::string_view>(level, flags, "{}", std::string_view(message));
+				}
+				if(level & FATAL)
+					flush();
+			}
+		}
 
 		template<typename... Args>
 		void log(severity level, std::format_string<Args...> fmt, Args&&... args) {
-			std::string prefix = getPrefix(level);
-			std::string message = std::format(fmt, std::forward<Args>(args)...);
-			std::println("{}: {}" "\033[0m", prefix, message);
+			IRIDIUM_ALLOCATION_TAG(log);
+			Impl::submit(level, 0, fmt, std::forward<Args>(args)...);
 		}
 
 		template<typename... Args>
 		void logNP(severity level, std::format_string<Args...> fmt, Args&&... args) {
-			std::string prefix = getPrefix(level, empty_prefix());
-			std::string message = std::format(fmt, std::forward<Args>(args)...);
-			std::println("{}| {}" "\033[0m", prefix, message);
+			IRIDIUM_ALLOCATION_TAG(log);
+			Impl::submit(level, NO_PREFIX, fmt, std::forward<Args>(args)...);
 		}
 	}
 }
\ No newline at end of file
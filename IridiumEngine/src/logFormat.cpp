@@ -0,0 +1,224 @@
+#include "logFormat.hpp"
+
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <format>
+#include <iterator>
+#include <vector>
+
+#define CONSOLE_TEXT_BLACK "\033[30m"
+#define CONSOLE_TEXT_RED "\033[31m"
+#define CONSOLE_TEXT_GREEN "\033[32m"
+#define CONSOLE_TEXT_YELLOW "\033[33m"
+#define CONSOLE_TEXT_BLUE "\033[34m"
+#define CONSOLE_TEXT_MAGENTA "\033[35m"
+#define CONSOLE_TEXT_CYAN "\033[36m"
+#define CONSOLE_TEXT_LIGHTGRAY "\033[37m"
+#define CONSOLE_TEXT_DARKGRAY "\033[90m"
+#define CONSOLE_TEXT_LIGHTRED "\033[91m"
+#define CONSOLE_TEXT_LIGHTGREEN "\033[92m"
+#define CONSOLE_TEXT_LIGHTYELLOW "\033[93m"
+#define CONSOLE_TEXT_LIGHTBLUE "\033[94m"
+#define CONSOLE_TEXT_LIGHTMAGENTA "\033[95m"
+#define CONSOLE_TEXT_LIGHTCYAN "\033[96m"
+#define CONSOLE_TEXT_WHITE "\033[97m"
+
+#define CONSOLE_TEXT_BOLD "\033[1m"
+#define CONSOLE_TEXT_NOBOLD "\033[22m"
+#define CONSOLE_TEXT_UNDERLINE "\033[4m"
+#define CONSOLE_TEXT_NOUNDERLINE "\033[24m"
+#define CONSOLE_TEXT_NEGATIVE "\033[7m"
+#define CONSOLE_TEXT_POSITIVE "\033[27m"
+
+#define CONSOLE_BACK_BLACK "\033[40m"
+#define CONSOLE_BACK_RED "\033[41m"
+#define CONSOLE_BACK_GREEN "\033[42m"
+#define CONSOLE_BACK_YELLOW "\033[43m"
+#define CONSOLE_BACK_BLUE "\033[44m"
+#define CONSOLE_BACK_MAGENTA "\033[45m"
+#define CONSOLE_BACK_CYAN "\033[46m"
+#define CONSOLE_BACK_LIGHTGRAY "\033[47m"
+#define CONSOLE_BACK_DARKGRAY "\033[100m"
+#define CONSOLE_BACK_LIGHTRED "\033[101m"
+#define CONSOLE_BACK_LIGHTGREEN "\033[102m"
+#define CONSOLE_BACK_LIGHTYELLOW "\033[103m"
+#define CONSOLE_BACK_LIGHTBLUE "\033[104m"
+#define CONSOLE_BACK_LIGHTMAGENTA "\033[105m"
+#define CONSOLE_BACK_LIGHTCYAN "\033[106m"
+#define CONSOLE_BACK_WHITE "\033[107m"
+
+#define CONSOLE_DEFAULT "\033[0m"
+
+namespace IrL = Iridium::Logger;
+namespace IrB = Iridium::Logger::Binary;
+
+std::string_view IrL::formatTimestamp(int64_t nanoseconds, timestamp_cache& cache) {
+	int64_t second = nanoseconds / 1'000'000'000;
+	if(second != cache.second) {
+		std::time_t time = second;
+		std::tm tm;
+#ifdef _WIN32
+		localtime_s(&tm, &time);
+#else
+		localtime_r(&time, &tm);
+#endif
+		std::format_to_n(cache.text, sizeof(cache.text) - 1, "{:0>2}:{:0>2}:{:0>2}", tm.tm_hour, tm.tm_min, tm.tm_sec);
+		cache.second = second;
+	}
+	return cache.text;
+}
+
+void IrL::appendLine(std::string& out, severity level, uint8_t flags, std::string_view threadName, std::string_view timestamp, std::string_view message, bool colors) {
+	std::string_view color{};
+	std::string_view levelStr{};
+	switch(level) {
+		case INFO:
+			levelStr = "[Info]";
+			break;
+		case WARN:
+			color = CONSOLE_TEXT_YELLOW;
+			levelStr = "[Warn]";
+			break;
+		case ERROR:
+			color = CONSOLE_TEXT_LIGHTRED;
+			levelStr = "[Error]";
+			break;
+		case FATAL:
+			color = CONSOLE_TEXT_WHITE CONSOLE_BACK_RED;
+			levelStr = "[Fatal]";
+			break;
+	}
+	if(colors)
+		out += color;
+
+	if(flags & NO_PREFIX) {
+		// lines up with the message of a prefixed line
+		out.append(levelStr.size() + 1 + threadName.size() + 2 + timestamp.size() + 1, ' ');
+		out += "| ";
+	} else {
+		std::format_to(std::back_inserter(out), "{}[{}][{}]: ", levelStr, threadName, timestamp);
+	}
+	out += message;
+	if(colors)
+		out += CONSOLE_DEFAULT;
+	out += '\n';
+}
+
+// binary
+
+size_t IrB::argSize(arg_type type, const std::byte* arg) {
+	switch(type) {
+		case arg_type::boolean:
+		case arg_type::character:
+		case arg_type::int8:
+		case arg_type::uint8:
+			return 1;
+		case arg_type::int16:
+		case arg_type::uint16:
+			return 2;
+		case arg_type::int32:
+		case arg_type::uint32:
+		case arg_type::float32:
+			return 4;
+		case arg_type::int64:
+		case arg_type::uint64:
+		case arg_type::float64:
+			return 8;
+		case arg_type::pointer:
+			return sizeof(const void*);
+		case arg_type::string: {
+			uint32_t length;
+			std::memcpy(&length, arg, sizeof(length));
+			return sizeof(length) + length;
+		}
+	}
+	throw std::format_error("Unknown argument type.");
+}
+
+template<typename T>
+static void formatValue(std::string& out, std::string_view spec, const std::byte* arg) {
+	T value;
+	std::memcpy(&value, arg, sizeof(T));
+	std::vformat_to(std::back_inserter(out), spec, std::make_format_args(value));
+}
+
+static void formatArg(std::string& out, std::string_view spec, IrB::arg_type type, const std::byte* arg) {
+	using enum IrB::arg_type;
+	switch(type) {
+		case boolean:   formatValue<bool>(out, spec, arg); break;
+		case character: formatValue<char>(out, spec, arg); break;
+		case int8:      formatValue<int8_t>(out, spec, arg); break;
+		case int16:     formatValue<int16_t>(out, spec, arg); break;
+		case int32:     formatValue<int32_t>(out, spec, arg); break;
+		case int64:     formatValue<int64_t>(out, spec, arg); break;
+		case uint8:     formatValue<uint8_t>(out, spec, arg); break;
+		case uint16:    formatValue<uint16_t>(out, spec, arg); break;
+		case uint32:    formatValue<uint32_t>(out, spec, arg); break;
+		case uint64:    formatValue<uint64_t>(out, spec, arg); break;
+		case float32:   formatValue<float>(out, spec, arg); break;
+		case float64:   formatValue<double>(out, spec, arg); break;
+		case pointer:   formatValue<const void*>(out, spec, arg); break;
+		case string: {
+			uint32_t length;
+			std::memcpy(&length, arg, sizeof(length));
+			std::string_view value(reinterpret_cast<const char*>(arg + sizeof(length)), length);
+			std::vformat_to(std::back_inserter(out), spec, std::make_format_args(value));
+			break;
+		}
+	}
+}
+
+void IrB::formatMessage(std::string& out, std::string_view format, std::span<const arg_type> types, const std::byte* args) {
+	std::vector<const std::byte*> argPointers(types.size());
+	for(size_t index = 0; index < types.size(); index++) {
+		argPointers[index] = args;
+		args += argSize(types[index], args);
+	}
+
+	// every replacement field is formatted on its own as "{:spec}" with a single argument
+	std::string spec;
+	size_t nextIndex = 0;
+	size_t position = 0;
+	while(position < format.size()) {
+		char character = format[position];
+		if(character == '}') {
+			out += '}';
+			position += (position + 1 < format.size() && format[position + 1] == '}') ? 2 : 1;
+			continue;
+		}
+		if(character != '{') {
+			out += character;
+			position++;
+			continue;
+		}
+		if(position + 1 < format.size() && format[position + 1] == '{') {
+			out += '{';
+			position += 2;
+			continue;
+		}
+
+		size_t close = format.find('}', position);
+		if(close == std::string_view::npos)
+			throw std::format_error("Unterminated replacement field.");
+		std::string_view field = format.substr(position + 1, close - position - 1);
+		size_t colon = field.find(':');
+		std::string_view indexText = field.substr(0, colon);
+
+		size_t index = nextIndex++;
+		if(!indexText.empty()) {
+			auto [end, error] = std::from_chars(indexText.data(), indexText.data() + indexText.size(), index);
+			if(error != std::errc())
+				throw std::format_error("Bad argument index.");
+		}
+		if(index >= types.size())
+			throw std::format_error("Argument index out of range.");
+
+		spec = "{";
+		if(colon != std::string_view::npos)
+			spec += field.substr(colon);
+		spec += '}';
+		formatArg(out, spec, types[index], argPointers[index]);
+		position = close + 1;
+	}
+}
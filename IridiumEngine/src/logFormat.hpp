@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Shared by the logger and IridiumLogDecode, so nothing in here may depend on the rest of the engine.
+
+namespace Iridium {
+	namespace Logger {
+		enum severity : uint8_t {
+			INFO = (1 << 0),
+			WARN = (1 << 1),
+			ERROR= (1 << 2),
+			FATAL= (1 << 3)
+		};
+
+		enum record_flags : uint8_t {
+			NO_PREFIX = (1 << 0),
+			PADDING   = (1 << 1), // filler up to the end of a ring, skip it
+			DISCARD   = (1 << 2)  // goes through the ring like any message but is never written, for benchmarks
+		};
+
+		// second resolution is all the prefix shows, so localtime only runs when the second changes
+		struct timestamp_cache {
+			int64_t second = -1;
+			char text[9] = {};
+		};
+
+		std::string_view formatTimestamp(int64_t nanoseconds, timestamp_cache& cache);
+
+		// one finished line in the usual "[Level][Thread][hh:mm:ss]: message" layout
+		void appendLine(std::string& out, severity level, uint8_t flags, std::string_view threadName, std::string_view timestamp, std::string_view message, bool colors);
+
+		// Binary log files start with MAGIC and VERSION (u32) followed by entries that each begin with
+		// an entry_kind byte. Formats and threads are announced before the first message using them,
+		// a thread id is announced again when that thread gets renamed.
+		//   format:  u32 id, u8 argCount, argCount x arg_type, u32 length, format string
+		//   thread:  u16 id, u16 length, name
+		//   message: u8 level, u8 flags, u16 thread, u32 format, i64 timestamp, u32 size, arguments
+		// Everything is in the byte order of the machine that wrote it, strings aren't null terminated.
+		namespace Binary {
+			constexpr char MAGIC[8] = {'I', 'R', 'L', 'O', 'G', 'B', 'I', 'N'};
+			constexpr uint32_t VERSION = 1;
+
+			enum class entry_kind : uint8_t {
+				format = 1,
+				thread = 2,
+				message = 3
+			};
+
+			// strings are a u32 length followed by the characters, everything else is stored as is
+			enum class arg_type : uint8_t {
+				boolean,
+				character,
+				int8,
+				int16,
+				int32,
+				int64,
+				uint8,
+				uint16,
+				uint32,
+				uint64,
+				float32,
+				float64,
+				pointer,
+				string
+			};
+
+			template<typename T>
+			constexpr bool is_string_v = std::is_convertible_v<const T&, std::string_view>;
+
+			template<typename T>
+			constexpr bool is_encodable_v = is_string_v<T> || std::is_same_v<T, bool> || std::is_same_v<T, char>
+				|| (std::is_integral_v<T> && sizeof(T) <= 8) || std::is_same_v<T, float> || std::is_same_v<T, double>
+				|| std::is_same_v<T, const void*> || std::is_same_v<T, void*>;
+
+			template<typename T>
+			consteval arg_type argTypeOf() {
+				static_assert(is_encodable_v<T>);
+				if constexpr(is_string_v<T>)
+					return arg_type::string;
+				else if constexpr(std::is_same_v<T, bool>)
+					return arg_type::boolean;
+				else if constexpr(std::is_same_v<T, char>)
+					return arg_type::character;
+				else if constexpr(std::is_same_v<T, float>)
+					return arg_type::float32;
+				else if constexpr(std::is_same_v<T, double>)
+					return arg_type::float64;
+				else if constexpr(std::is_integral_v<T>) {
+					constexpr arg_type signedTypes[] = {arg_type::int8, arg_type::int16, arg_type::int32, arg_type::int32, arg_type::int64};
+					constexpr arg_type unsignedTypes[] = {arg_type::uint8, arg_type::uint16, arg_type::uint32, arg_type::uint32, arg_type::uint64};
+					constexpr size_t index = sizeof(T) == 8 ? 4 : sizeof(T) / 2;
+					return std::is_signed_v<T> ? signedTypes[index] : unsignedTypes[index];
+				} else
+					return arg_type::pointer;
+			}
+
+			// bytes one encoded argument takes up
+			size_t argSize(arg_type type, const std::byte* arg);
+
+			// Formats the arguments field by field. Dynamic width and precision ("{:{}}") aren't supported.
+			// Throws std::format_error on malformed input.
+			void formatMessage(std::string& out, std::string_view format, std::span<const arg_type> types, const std::byte* args);
+		}
+	}
+}
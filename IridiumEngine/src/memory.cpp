@@ -1 +1,296 @@
-#include "memory.hpp"
\ No newline at end of file
+#include "memory.hpp"
+
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+
+#include "allocationTracker.hpp"
+#include "log.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace IrM = Iridium::MemoryExperimental;
+
+static constexpr uint64_t FREE_ID_MASK = 0x00000000ffffffff;
+
+static inline uint64_t makeFreeHead(uint64_t previous, uint32_t id) {
+	uint64_t tag = (previous >> 32) + 1;
+	return (tag << 32) | id;
+}
+
+// ids that still hold references when the table is torn down are leaks
+template<typename NodeT>
+static void reportLeakedIds(const char* tableName, const NodeT* table, uint32_t count) {
+	if constexpr(!IRIDIUM_TRACK_ALLOCATIONS)
+		return;
+
+	uint32_t leaked = 0;
+	for(uint32_t index = 0; index < count; index++) {
+		uint32_t strong = table[index].strong.load(std::memory_order_relaxed);
+		uint32_t weak = table[index].weak.load(std::memory_order_relaxed);
+		if(strong == 0 && weak == 0)
+			continue;
+		if(leaked < 16)
+			ENGINE_LOG_WARN("{}: id {} leaked (strong {}, weak {})", tableName, index, strong, weak);
+		leaked++;
+	}
+	if(leaked)
+		ENGINE_LOG_WARN("{}: {} leaked ids at cleanup", tableName, leaked);
+}
+
+// virtual memory
+
+size_t IrM::virtual_memory::pageSize() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+void* IrM::virtual_memory::reserve(size_t size) {
+#ifdef _WIN32
+	void* address = VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+	if(address == nullptr)
+		throw std::runtime_error("Failed to reserve address space.");
+#else
+	void* address = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if(address == MAP_FAILED)
+		throw std::runtime_error("Failed to reserve address space.");
+#endif
+	return address;
+}
+
+void IrM::virtual_memory::commit(void* address, size_t size) {
+#ifdef _WIN32
+	if(VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) == nullptr)
+		throw std::runtime_error("Failed to commit memory.");
+#else
+	if(mprotect(address, size, PROT_READ | PROT_WRITE) != 0)
+		throw std::runtime_error("Failed to commit memory.");
+#endif
+}
+
+void IrM::virtual_memory::release(void* address, [[maybe_unused]] size_t size) {
+	if(address == nullptr)
+		return;
+#ifdef _WIN32
+	VirtualFree(address, 0, MEM_RELEASE);
+#else
+	munmap(address, size);
+#endif
+}
+
+// reftable_type
+
+void IrM::reftable_type::init() {
+	if(refTable != nullptr)
+		return;
+
+	refTable = ::new node[MAX_ID];
+	for(uint32_t id = 0; id < MAX_ID; id++) {
+		refTable[id].strong.store(0, std::memory_order_relaxed);
+		refTable[id].weak.store(0, std::memory_order_relaxed);
+		refTable[id].next.store(id + 1, std::memory_order_relaxed); // the last one links to NULL_ID
+	}
+	freeHead.store(0, std::memory_order_release);
+}
+
+void IrM::reftable_type::cleanup() {
+	if(refTable == nullptr)
+		return;
+
+	reportLeakedIds("reftable_type", refTable, MAX_ID);
+	::delete[] refTable;
+	refTable = nullptr;
+	freeHead.store(NULL_ID, std::memory_order_release);
+}
+
+IrM::id_t IrM::reftable_type::claimId() {
+	uint64_t head = freeHead.load(std::memory_order_acquire);
+	for(;;) {
+		uint32_t id = head & FREE_ID_MASK;
+		if(id == NULL_ID)
+			throw std::runtime_error("Reference table is out of free ids.");
+
+		// the node may be claimed by another thread in the meantime, the tag makes the CAS fail then
+		uint32_t next = refTable[id].next.load(std::memory_order_relaxed);
+		if(freeHead.compare_exchange_weak(head, makeFreeHead(head, next), std::memory_order_acquire, std::memory_order_acquire))
+			return id;
+	}
+}
+
+void IrM::reftable_type::releaseId(id_t id) {
+	uint64_t head = freeHead.load(std::memory_order_relaxed);
+	uint64_t newHead;
+	do {
+		refTable[id].next.store(head & FREE_ID_MASK, std::memory_order_relaxed);
+		newHead = makeFreeHead(head, id);
+	} while(!freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+uint32_t IrM::reftable_type::increment(id_t id) {
+	return refTable[id].strong.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+bool IrM::reftable_type::incrementIfNonZero(id_t id) {
+	std::atomic<uint32_t>& strong = refTable[id].strong;
+	uint32_t count = strong.load(std::memory_order_relaxed);
+	while(count != 0) {
+		if(strong.compare_exchange_weak(count, count + 1, std::memory_order_acquire, std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+uint32_t IrM::reftable_type::decrement(id_t id) {
+	uint32_t remaining = refTable[id].strong.fetch_sub(1, std::memory_order_acq_rel) - 1;
+	return remaining;
+}
+
+uint32_t IrM::reftable_type::check(id_t id) {
+	return refTable[id].strong.load(std::memory_order_relaxed);
+}
+
+uint32_t IrM::reftable_type::incrementWeak(id_t id) {
+	return refTable[id].weak.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+uint32_t IrM::reftable_type::decrementWeak(id_t id) {
+	uint32_t remaining = refTable[id].weak.fetch_sub(1, std::memory_order_acq_rel) - 1;
+	return remaining;
+}
+
+uint32_t IrM::reftable_type::checkWeak(id_t id) {
+	return refTable[id].weak.load(std::memory_order_acquire);
+}
+
+// segmented_reftable_type
+
+static constexpr uint32_t SEGMENT_BYTES = 64 * 1024;
+
+void IrM::segmented_reftable_type::init() {
+	if(refTable != nullptr)
+		return;
+
+	refTable = static_cast<node*>(virtual_memory::reserve(size_t(MAX_INDEX) * sizeof(node)));
+	committedNodes = 0;
+	freeHead.store(NULL_INDEX, std::memory_order_release);
+	grow();
+}
+
+void IrM::segmented_reftable_type::cleanup() {
+	if(refTable == nullptr)
+		return;
+
+	reportLeakedIds("segmented_reftable_type", refTable, committedNodes);
+	virtual_memory::release(refTable, size_t(MAX_INDEX) * sizeof(node));
+	refTable = nullptr;
+	committedNodes = 0;
+	freeHead.store(NULL_INDEX, std::memory_order_release);
+}
+
+void IrM::segmented_reftable_type::grow() {
+	std::scoped_lock<std::mutex> lock(growMutex);
+	// someone else may have grown the table while we waited
+	if((freeHead.load(std::memory_order_acquire) & FREE_ID_MASK) != NULL_INDEX)
+		return;
+
+	if(committedNodes >= MAX_INDEX)
+		throw std::runtime_error("Segmented reference table is out of free ids.");
+
+	uint32_t first = committedNodes;
+	uint32_t count = std::min<uint32_t>(SEGMENT_BYTES / sizeof(node), MAX_INDEX - first);
+	uint32_t last = first + count - 1;
+	virtual_memory::commit(refTable + first, size_t(count) * sizeof(node));
+	for(uint32_t index = first; index <= last; index++) {
+		::new (&refTable[index]) node{};
+		refTable[index].next.store(index + 1, std::memory_order_relaxed);
+	}
+	committedNodes += count;
+
+	// splice the whole segment onto the free list in one go
+	uint64_t head = freeHead.load(std::memory_order_relaxed);
+	uint64_t newHead;
+	do {
+		refTable[last].next.store(head & FREE_ID_MASK, std::memory_order_relaxed);
+		newHead = makeFreeHead(head, first);
+	} while(!freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+IrM::segmented_reftable_type::id_type IrM::segmented_reftable_type::claimId() {
+	uint64_t head = freeHead.load(std::memory_order_acquire);
+	for(;;) {
+		uint32_t index = head & FREE_ID_MASK;
+		if(index == NULL_INDEX) {
+			grow();
+			head = freeHead.load(std::memory_order_acquire);
+			continue;
+		}
+
+		uint32_t next = refTable[index].next.load(std::memory_order_relaxed);
+		if(freeHead.compare_exchange_weak(head, makeFreeHead(head, next), std::memory_order_acquire, std::memory_order_acquire)) {
+			uint64_t generation = refTable[index].generation.load(std::memory_order_relaxed);
+			return (generation << 32) | index;
+		}
+	}
+}
+
+void IrM::segmented_reftable_type::releaseId(id_type id) {
+	uint32_t index = getIndex(id);
+	refTable[index].generation.fetch_add(1, std::memory_order_relaxed);
+
+	uint64_t head = freeHead.load(std::memory_order_relaxed);
+	uint64_t newHead;
+	do {
+		refTable[index].next.store(head & FREE_ID_MASK, std::memory_order_relaxed);
+		newHead = makeFreeHead(head, index);
+	} while(!freeHead.compare_exchange_weak(head, newHead, std::memory_order_release, std::memory_order_relaxed));
+}
+
+bool IrM::segmented_reftable_type::isCurrent(id_type id) {
+	return refTable[getIndex(id)].generation.load(std::memory_order_acquire) == getGeneration(id);
+}
+
+uint32_t IrM::segmented_reftable_type::increment(id_type id) {
+	return refTable[getIndex(id)].strong.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+bool IrM::segmented_reftable_type::incrementIfNonZero(id_type id) {
+	std::atomic<uint32_t>& strong = refTable[getIndex(id)].strong;
+	uint32_t count = strong.load(std::memory_order_relaxed);
+	while(count != 0) {
+		if(strong.compare_exchange_weak(count, count + 1, std::memory_order_acquire, std::memory_order_relaxed))
+			return true;
+	}
+	return false;
+}
+
+uint32_t IrM::segmented_reftable_type::decrement(id_type id) {
+	uint32_t remaining = refTable[getIndex(id)].strong.fetch_sub(1, std::memory_order_acq_rel) - 1;
+	return remaining;
+}
+
+uint32_t IrM::segmented_reftable_type::check(id_type id) {
+	return refTable[getIndex(id)].strong.load(std::memory_order_relaxed);
+}
+
+uint32_t IrM::segmented_reftable_type::incrementWeak(id_type id) {
+	return refTable[getIndex(id)].weak.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+uint32_t IrM::segmented_reftable_type::decrementWeak(id_type id) {
+	uint32_t remaining = refTable[getIndex(id)].weak.fetch_sub(1, std::memory_order_acq_rel) - 1;
+	return remaining;
+}
+
+uint32_t IrM::segmented_reftable_type::checkWeak(id_type id) {
+	return refTable[getIndex(id)].weak.load(std::memory_order_acquire);
+}
@@ -1,31 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <concepts>
 #include <limits>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#include "slabAllocator.hpp"
 
 namespace Iridium {
 	namespace MemoryExperimental {
 		using id_t = uint16_t;
 
+		// A table hands out ids and owns the reference counts behind them.
+		// It also decides how an id is stored next to the object pointer (handle_type),
+		// so compact and wide handles can share the same shared_ptr_impl.
 		template<typename T>
-		concept reference_count_table_c = requires {
+		concept reference_count_table_c = requires(typename T::id_type id, typename T::handle_type handle, void* ptr) {
 			T::init();
 			T::cleanup();
-			T::claimId();
-			T::releaseId(id_t());
-
-			T::increment(id_t());
-			T::decrement(id_t());
-			T::check(id_t());
-			
-			T::incrementWeak(id_t());
-			T::decrementWeak(id_t());
-			T::checkWeak(id_t());
+			{ T::claimId() } -> std::same_as<typename T::id_type>;
+			T::releaseId(id);
+
+			T::increment(id);
+			{ T::incrementIfNonZero(id) } -> std::same_as<bool>;
+			T::decrement(id);
+			T::check(id);
+
+			T::incrementWeak(id);
+			T::decrementWeak(id);
+			T::checkWeak(id);
+
+			{ T::makeHandle(id, ptr) } -> std::same_as<typename T::handle_type>;
+			{ T::getId(handle) } -> std::same_as<typename T::id_type>;
+			{ T::getPtr(handle) } -> std::same_as<void*>;
 		};
 
 		namespace utils {
+			// The weak count holds one extra reference on behalf of all strong references,
+			// the id is released when the weak count drops to zero.
 			template<reference_count_table_c T>
-			inline id_t claimAndIncrement() {
-				id_t id = T::claimId();
+			inline typename T::id_type claimAndIncrement() {
+				typename T::id_type id = T::claimId();
 				T::increment(id);
+				T::incrementWeak(id);
 				return id;
 			}
 
@@ -35,23 +56,48 @@ namespace Iridium {
 				combined |= uintptr_t(id) << 48;
 				return combined;
 			}
+
+			// objects can come from make_shared (slab) or from plain new
+			template<typename T>
+			inline void destroyObject(T* ptr) {
+				if(slab_allocator::owns(ptr)) {
+					ptr->~T();
+					slab_allocator::deallocate(ptr);
+				} else {
+					::delete ptr;
+				}
+			}
 	}
 
+		// Address space reservation, used by tables and allocators that must grow without moving.
+		namespace virtual_memory {
+			size_t pageSize();
+			[[nodiscard]] void* reserve(size_t size);
+			void commit(void* address, size_t size);
+			void release(void* address, size_t size);
+		}
+
+		// Thread safe reference count table.
+		// Increments are relaxed, decrements are acquire/release so the one that reaches zero
+		// synchronizes with every previous release and the owner can safely destroy the object.
+		// Free ids are kept in a lock-free stack, the head is tagged with a counter to avoid ABA.
 		struct reftable_type {
+			using id_type = id_t;
+			using handle_type = uintptr_t; // [id:16][ptr:48]
+
 			enum {
-				MAX_ID = std::numeric_limits<id_t>::max()
+				MAX_ID = std::numeric_limits<id_t>::max(),
+				NULL_ID = MAX_ID // end of the free list, never handed out
 			};
 
-			union node {
-				node* next = nullptr;
-				struct {
-					uint32_t strong;
-					uint32_t weak;
-				} references;
+			struct node {
+				std::atomic<uint32_t> strong;
+				std::atomic<uint32_t> weak;
+				std::atomic<uint32_t> next;
 			};
-		
-			inline static node* refTable = nullptr;		
-			inline static node* nextFree = nullptr;
+
+			inline static node* refTable = nullptr;
+			inline static std::atomic<uint64_t> freeHead{NULL_ID}; // [tag:32][id:32]
 
 			reftable_type() = delete;
 			reftable_type(reftable_type&&) = delete;
@@ -63,67 +109,168 @@ namespace Iridium {
 			static void releaseId(id_t id);
 
 			static uint32_t increment(id_t id);
+			static bool incrementIfNonZero(id_t id);
 			static uint32_t decrement(id_t id);
 			static uint32_t check(id_t id);
 			static uint32_t incrementWeak(id_t id);
 			static uint32_t decrementWeak(id_t id);
 			static uint32_t checkWeak(id_t id);
+
+			static handle_type makeHandle(id_type id, void* ptr) {
+				return utils::combinePtrId(id, ptr);
+			}
+
+			static id_type getId(handle_type handle) {
+				return (handle & 0xffff000000000000) >> 48;
+			}
+
+			static void* getPtr(handle_type handle) {
+				return reinterpret_cast<void*>(handle & 0x0000ffffffffffff);
+			}
+		};
+
+		// Growable reference count table for when 65535 live objects are not enough.
+		// Nodes live in one reserved address range that is committed page by page, so growing
+		// never moves a node and a lookup is still a single indexed load.
+		// Ids are [generation:32][index:32], the generation is bumped on every release so a
+		// recycled index never compares equal to a stale id.
+		// The id does not fit next to a 48 bit pointer, handles are a {pointer, id} pair
+		// (16 bytes instead of 8), see wide_shared_ptr.
+		struct segmented_reftable_type {
+			using id_type = uint64_t;
+
+			struct handle_type {
+				void* ptr;
+				id_type id;
+			};
+
+			enum : uint32_t {
+				MAX_INDEX = 1 << 24,
+				NULL_INDEX = 0xffffffff
+			};
+
+			struct node {
+				std::atomic<uint32_t> strong;
+				std::atomic<uint32_t> weak;
+				std::atomic<uint32_t> generation;
+				std::atomic<uint32_t> next;
+			};
+
+			inline static node* refTable = nullptr;
+			inline static std::atomic<uint64_t> freeHead{NULL_INDEX}; // [tag:32][index:32]
+			inline static uint32_t committedNodes = 0;
+			inline static std::mutex growMutex;
+
+			segmented_reftable_type() = delete;
+			segmented_reftable_type(segmented_reftable_type&&) = delete;
+
+			static void init();
+			static void cleanup();
+
+			[[nodiscard]] static id_type claimId();
+			static void releaseId(id_type id);
+
+			static uint32_t increment(id_type id);
+			static bool incrementIfNonZero(id_type id);
+			static uint32_t decrement(id_type id);
+			static uint32_t check(id_type id);
+			static uint32_t incrementWeak(id_type id);
+			static uint32_t decrementWeak(id_type id);
+			static uint32_t checkWeak(id_type id);
+
+			// false once the id was released, even if its index is in use again
+			static bool isCurrent(id_type id);
+
+			static uint32_t getIndex(id_type id) {
+				return id & 0xffffffff;
+			}
+
+			static uint32_t getGeneration(id_type id) {
+				return id >> 32;
+			}
+
+			static handle_type makeHandle(id_type id, void* ptr) {
+				return handle_type{.ptr = ptr, .id = id};
+			}
+
+			static id_type getId(handle_type handle) {
+				return handle.id;
+			}
+
+			static void* getPtr(handle_type handle) {
+				return handle.ptr;
+			}
+		private:
+			static void grow();
 		};
 
 		template<typename T, reference_count_table_c RefcountT>
 		class shared_ptr_impl {
 			template <typename f_T, reference_count_table_c f_refcount_t> friend class weak_ptr_impl;
 		private:
-			enum : uintptr_t {
-				ID_MASK  = 0xffff000000000000,
-				PTR_MASK = 0x0000ffffffffffff
-			};
+			using id_type = typename RefcountT::id_type;
+			using handle_type = typename RefcountT::handle_type;
 
-			uintptr_t m_ptr;
+			handle_type m_ptr;
 
-			inline id_t getId() {
-				return (m_ptr & ID_MASK) >> 48;
+			inline id_type getId() const {
+				return RefcountT::getId(m_ptr);
 			}
 
-			inline T* getPtr() {
-				return reinterpret_cast<T*>(m_ptr & PTR_MASK);
+			inline T* getPtr() const {
+				return static_cast<T*>(RefcountT::getPtr(m_ptr));
 			}
 
 			void onDecrement() {
-				id_t id = getId();
+				id_type id = getId();
 				uint32_t strongRefs = RefcountT::decrement(id);
 				if(strongRefs != 0)
 					return;
 
-				uint32_t weakRefs = RefcountT::checkWeak(id);
-				if(weakRefs == 0)			
-					RefcountT::releaseId(id);
+				utils::destroyObject(getPtr());
 
-				::delete getPtr();
+				// drop the weak reference held by the strong ones, weak pointers may still keep the id
+				if(RefcountT::decrementWeak(id) == 0)
+					RefcountT::releaseId(id);
 			}
+
+			enum adopt_tag { ADOPT };
+
+			// takes over a strong reference that was already counted (weak_ptr_impl::lock)
+			shared_ptr_impl(handle_type handle, adopt_tag)
+				:m_ptr(handle) {}
 		public:
 			shared_ptr_impl()
-			:m_ptr(0) {};
+			:m_ptr{} {};
 
-			shared_ptr_impl(shared_ptr_impl &other)
+			shared_ptr_impl(const shared_ptr_impl& other)
 			: m_ptr(other.m_ptr) {
-				RefcountT::increment(getId());
+				if(getPtr())
+					RefcountT::increment(getId());
         	}
 
         	shared_ptr_impl(shared_ptr_impl&& other)
 				:m_ptr(other.m_ptr) {
-			other.m_ptr = 0;
+			other.m_ptr = {};
 			}
 
 			shared_ptr_impl(std::nullptr_t)
-				:m_ptr(0) {}
+				:m_ptr{} {}
 
-			shared_ptr_impl(T* ptr) {
+			shared_ptr_impl(T* ptr)
+				:m_ptr{} {
 				if(ptr == nullptr)
 					return;
 
-				uintptr_t id = utils::claimAndIncrement<RefcountT>();
-				m_ptr = utils::combinePtrId(id, ptr);
+				// the pointer is ours from here on, even when the table is out of ids
+				id_type id;
+				try {
+					id = utils::claimAndIncrement<RefcountT>();
+				} catch(...) {
+					utils::destroyObject(ptr);
+					throw;
+				}
+				m_ptr = RefcountT::makeHandle(id, ptr);
 			}
 
 			~shared_ptr_impl() {
@@ -137,55 +284,177 @@ namespace Iridium {
 				return getPtr();
 			}
 
-			T* get() {
+			T& operator*() const {
+				return *getPtr();
+			}
+
+			T* operator->() const {
 				return getPtr();
 			}
 
-			T& operator*() const {
-				return *getPtr();
+			shared_ptr_impl& operator=(const shared_ptr_impl& other) {
+				// take the new reference first, so self assignment can't drop the last one
+				if(other.getPtr())
+					RefcountT::increment(other.getId());
+				if(getPtr())
+					onDecrement();
+
+				m_ptr = other.m_ptr;
+				return *this;
 			}
 
-			T& operator*() {
-				return *getPtr();
+			shared_ptr_impl& operator=(shared_ptr_impl&& other) {
+				if(this == &other)
+					return *this;
+				if(getPtr())
+					onDecrement();
+
+				m_ptr = other.m_ptr;
+				other.m_ptr = {};
+				return *this;
 			}
 
-			T* operator->() const {
+			operator bool() const {
 				return getPtr();
 			}
+		};
 
-			T* operator->() {
-				return getPtr();
+		// Non-owning observer of a shared_ptr_impl, same size as the shared pointer and no allocations.
+		// The id stays claimed while any weak pointer exists, so it can't be recycled under us.
+		template<typename T, reference_count_table_c RefcountT>
+		class weak_ptr_impl {
+		private:
+			using id_type = typename RefcountT::id_type;
+			using handle_type = typename RefcountT::handle_type;
+
+			handle_type m_ptr;
+
+			inline id_type getId() const {
+				return RefcountT::getId(m_ptr);
 			}
 
-			shared_ptr_impl& operator=(const shared_ptr_impl& other) {
+			inline T* getPtr() const {
+				return static_cast<T*>(RefcountT::getPtr(m_ptr));
+			}
+
+			void onDecrement() {
+				id_type id = getId();
+				if(RefcountT::decrementWeak(id) == 0)
+					RefcountT::releaseId(id);
+			}
+		public:
+			weak_ptr_impl()
+				:m_ptr{} {}
+
+			weak_ptr_impl(std::nullptr_t)
+				:m_ptr{} {}
+
+			weak_ptr_impl(const shared_ptr_impl<T, RefcountT>& shared)
+				:m_ptr(shared.m_ptr) {
+				if(getPtr())
+					RefcountT::incrementWeak(getId());
+			}
+
+			weak_ptr_impl(const weak_ptr_impl& other)
+				:m_ptr(other.m_ptr) {
+				if(getPtr())
+					RefcountT::incrementWeak(getId());
+			}
+
+			weak_ptr_impl(weak_ptr_impl&& other)
+				:m_ptr(other.m_ptr) {
+				other.m_ptr = {};
+			}
+
+			~weak_ptr_impl() {
+				if(!getPtr())
+					return;
+
+				onDecrement();
+			}
+
+			weak_ptr_impl& operator=(const weak_ptr_impl& other) {
+				if(other.getPtr())
+					RefcountT::incrementWeak(other.getId());
 				if(getPtr())
 					onDecrement();
-				
-				m_ptr = other.m_ptr;
-				RefcountT::increment(getId());
 
+				m_ptr = other.m_ptr;
 				return *this;
 			}
 
-			shared_ptr_impl& operator=(shared_ptr_impl& other) {
+			weak_ptr_impl& operator=(weak_ptr_impl&& other) {
+				if(this == &other)
+					return *this;
 				if(getPtr())
 					onDecrement();
 
 				m_ptr = other.m_ptr;
-				other.m_ptr = 0;
+				other.m_ptr = {};
 				return *this;
 			}
 
-			operator bool() const {
-				return getPtr();
+			weak_ptr_impl& operator=(const shared_ptr_impl<T, RefcountT>& shared) {
+				return *this = weak_ptr_impl(shared);
 			}
 
-			operator bool() {
-				return getPtr();
+			void reset() {
+				if(getPtr())
+					onDecrement();
+				m_ptr = {};
+			}
+
+			bool expired() const {
+				return !getPtr() || RefcountT::check(getId()) == 0;
+			}
+
+			// Returns an empty shared pointer once the object is gone.
+			shared_ptr_impl<T, RefcountT> lock() const {
+				if(!getPtr() || !RefcountT::incrementIfNonZero(getId()))
+					return nullptr;
+
+				return shared_ptr_impl<T, RefcountT>(m_ptr, shared_ptr_impl<T, RefcountT>::ADOPT);
 			}
 		};
 
+		// Constructs the object inside a slab of its size class, the reference counts live in the table,
+		// so this is the only allocation. Types too big for a slab fall back to new.
+		template<typename T, reference_count_table_c RefcountT, typename... Args>
+		shared_ptr_impl<T, RefcountT> make_shared_impl(Args&&... args) {
+			if constexpr(slab_allocator::fits(sizeof(T), alignof(T))) {
+				void* memory = slab_allocator::allocate(sizeof(T));
+				T* object = nullptr;
+				try {
+					object = ::new (memory) T(std::forward<Args>(args)...);
+				} catch(...) {
+					slab_allocator::deallocate(memory);
+					throw;
+				}
+				return shared_ptr_impl<T, RefcountT>(object);
+			} else {
+				return shared_ptr_impl<T, RefcountT>(::new T(std::forward<Args>(args)...));
+			}
+		}
+
 		template<typename Type>
 		using shared_ptr = shared_ptr_impl<Type, reftable_type>;
+		template<typename Type>
+		using weak_ptr = weak_ptr_impl<Type, reftable_type>;
+
+		// 16 byte handle without the 65535 object limit.
+		template<typename Type>
+		using wide_shared_ptr = shared_ptr_impl<Type, segmented_reftable_type>;
+		template<typename Type>
+		using wide_weak_ptr = weak_ptr_impl<Type, segmented_reftable_type>;
+
+		template<typename Type, typename... Args>
+		shared_ptr<Type> make_shared(Args&&... args) {
+			return make_shared_impl<Type, reftable_type>(std::forward<Args>(args)...);
+		}
+
+		template<typename Type, typename... Args>
+		wide_shared_ptr<Type> make_wide_shared(Args&&... args) {
+			return make_shared_impl<Type, segmented_reftable_type>(std::forward<Args>(args)...);
+		}
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,411 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <format>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#include "log.hpp"
+#include "thread.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace IrM = Iridium::Metrics;
+
+namespace {
+#ifdef _WIN32
+	using socket_type = SOCKET;
+	constexpr socket_type NO_SOCKET = INVALID_SOCKET;
+	void closeSocket(socket_type socket) { closesocket(socket); }
+	int pollSockets(pollfd* fds, size_t count, int milliseconds) { return WSAPoll(fds, ULONG(count), milliseconds); }
+#else
+	using socket_type = int;
+	constexpr socket_type NO_SOCKET = -1;
+	void closeSocket(socket_type socket) { close(socket); }
+	int pollSockets(pollfd* fds, size_t count, int milliseconds) { return poll(fds, nfds_t(count), milliseconds); }
+#endif
+
+#ifdef MSG_NOSIGNAL
+	constexpr int SEND_FLAGS = MSG_NOSIGNAL; // a scraper hanging up early shouldn't kill us with SIGPIPE
+#else
+	constexpr int SEND_FLAGS = 0;
+#endif
+
+	struct series {
+		std::string labels;
+		std::unique_ptr<IrM::counter> counterValue;
+		std::unique_ptr<IrM::gauge> gaugeValue;
+		std::unique_ptr<IrM::histogram> histogramValue;
+		std::function<double()> sample; // for sampled gauges
+		IrM::sampler_id sampler = 0;
+	};
+
+	struct family {
+		std::string name;
+		std::string help;
+		IrM::metric_type type;
+		std::vector<std::unique_ptr<series>> entries;
+	};
+
+	struct registry {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<family>> families; // in registration order
+		IrM::sampler_id nextSampler = 1;
+	};
+
+	registry& getRegistry() {
+		static registry instance;
+		return instance;
+	}
+
+	IrM::config g_config;
+	std::jthread g_exporter;
+
+	const char* typeName(IrM::metric_type type) {
+		switch(type) {
+			case IrM::metric_type::counter: return "counter";
+			case IrM::metric_type::gauge: return "gauge";
+			case IrM::metric_type::histogram: return "histogram";
+		}
+		return "untyped";
+	}
+
+	bool isValidName(std::string_view name) {
+		auto valid = [](char c, bool first) -> bool {
+			return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == ':' || (!first && c >= '0' && c <= '9');
+		};
+		if(name.empty() || !valid(name[0], true))
+			return false;
+		return std::ranges::all_of(name.substr(1), [&](char c) { return valid(c, false); });
+	}
+
+	// needs the registry lock
+	series& findSeries(std::string_view name, std::string_view help, IrM::metric_type type, std::string_view labels) {
+		if(!isValidName(name))
+			throw std::runtime_error(std::format("Invalid metric name {}.", name));
+
+		registry& metrics = getRegistry();
+		auto found = std::ranges::find_if(metrics.families, [&](const auto& entry) { return entry->name == name; });
+		if(found == metrics.families.end()) {
+			metrics.families.push_back(std::make_unique<family>(std::string(name), std::string(help), type));
+			found = std::prev(metrics.families.end());
+		}
+		family& metricFamily = **found;
+		if(metricFamily.type != type)
+			throw std::runtime_error(std::format("Metric {} is already registered as a {}.", name, typeName(metricFamily.type)));
+
+		for(auto& entry : metricFamily.entries) {
+			if(entry->labels == labels)
+				return *entry;
+		}
+		metricFamily.entries.push_back(std::make_unique<series>());
+		metricFamily.entries.back()->labels = labels;
+		return *metricFamily.entries.back();
+	}
+
+	void appendValue(std::string& out, double value) {
+		if(std::isnan(value))
+			out += "NaN";
+		else if(std::isinf(value))
+			out += value > 0 ? "+Inf" : "-Inf";
+		else
+			std::format_to(std::back_inserter(out), "{}", value);
+	}
+
+	void appendSample(std::string& out, std::string_view name, std::string_view suffix, std::string_view labels, std::string_view extraLabel, double value) {
+		out += name;
+		out += suffix;
+		if(!labels.empty() || !extraLabel.empty()) {
+			out += '{';
+			out += labels;
+			if(!labels.empty() && !extraLabel.empty())
+				out += ',';
+			out += extraLabel;
+			out += '}';
+		}
+		out += ' ';
+		appendValue(out, value);
+		out += '\n';
+	}
+}
+
+// histogram
+
+IrM::histogram::histogram(std::vector<double> bounds)
+	:m_bounds(std::move(bounds)), m_buckets(std::make_unique<std::atomic<uint64_t>[]>(m_bounds.size() + 1)) {
+	std::ranges::sort(m_bounds);
+}
+
+void IrM::histogram::observe(double value) {
+	size_t bucket = std::ranges::lower_bound(m_bounds, value) - m_bounds.begin();
+	m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(value, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// registry
+
+IrM::counter& IrM::addCounter(std::string_view name, std::string_view help, std::string_view labels) {
+	std::scoped_lock<std::mutex> lock(getRegistry().mutex);
+	series& entry = findSeries(name, help, metric_type::counter, labels);
+	if(!entry.counterValue)
+		entry.counterValue = std::make_unique<counter>();
+	return *entry.counterValue;
+}
+
+IrM::gauge& IrM::addGauge(std::string_view name, std::string_view help, std::string_view labels) {
+	std::scoped_lock<std::mutex> lock(getRegistry().mutex);
+	series& entry = findSeries(name, help, metric_type::gauge, labels);
+	if(entry.sample)
+		throw std::runtime_error(std::format("Metric {}{{{}}} is already a sampled gauge.", name, labels));
+	if(!entry.gaugeValue)
+		entry.gaugeValue = std::make_unique<gauge>();
+	return *entry.gaugeValue;
+}
+
+IrM::histogram& IrM::addHistogram(std::string_view name, std::string_view help, std::vector<double> bounds, std::string_view labels) {
+	std::scoped_lock<std::mutex> lock(getRegistry().mutex);
+	series& entry = findSeries(name, help, metric_type::histogram, labels);
+	if(!entry.histogramValue)
+		entry.histogramValue = std::make_unique<histogram>(std::move(bounds));
+	return *entry.histogramValue;
+}
+
+IrM::sampler_id IrM::addSampler(std::string_view name, std::string_view help, std::string_view labels, std::function<double()> sample) {
+	registry& metrics = getRegistry();
+	std::scoped_lock<std::mutex> lock(metrics.mutex);
+	series& entry = findSeries(name, help, metric_type::gauge, labels);
+	if(entry.gaugeValue || entry.sample)
+		throw std::runtime_error(std::format("Metric {}{{{}}} is already registered.", name, labels));
+	entry.sample = std::move(sample);
+	entry.sampler = metrics.nextSampler++;
+	return entry.sampler;
+}
+
+void IrM::removeSampler(sampler_id id) {
+	registry& metrics = getRegistry();
+	std::scoped_lock<std::mutex> lock(metrics.mutex);
+	for(auto& metricFamily : metrics.families)
+		std::erase_if(metricFamily->entries, [id](const auto& entry) { return entry->sample && entry->sampler == id; });
+	std::erase_if(metrics.families, [](const auto& metricFamily) { return metricFamily->entries.empty(); });
+}
+
+std::string IrM::exposition() {
+	registry& metrics = getRegistry();
+	std::scoped_lock<std::mutex> lock(metrics.mutex);
+
+	std::string out;
+	for(const auto& metricFamily : metrics.families) {
+		std::format_to(std::back_inserter(out), "# HELP {} {}\n# TYPE {} {}\n", metricFamily->name, metricFamily->help, metricFamily->name, typeName(metricFamily->type));
+		for(const auto& entry : metricFamily->entries) {
+			if(entry->counterValue)
+				appendSample(out, metricFamily->name, "", entry->labels, "", double(entry->counterValue->value()));
+			else if(entry->gaugeValue)
+				appendSample(out, metricFamily->name, "", entry->labels, "", entry->gaugeValue->value());
+			else if(entry->sample)
+				appendSample(out, metricFamily->name, "", entry->labels, "", entry->sample());
+			else if(entry->histogramValue) {
+				// count first, so no bucket can end up above it while observations keep coming in
+				const histogram& values = *entry->histogramValue;
+				uint64_t count = values.count();
+				uint64_t cumulative = 0;
+				for(size_t bucket = 0; bucket < values.bounds().size(); bucket++) {
+					cumulative += values.bucket(bucket);
+					std::string le = "le=\"";
+					appendValue(le, values.bounds()[bucket]);
+					le += '"';
+					appendSample(out, metricFamily->name, "_bucket", entry->labels, le, double(std::min(cumulative, count)));
+				}
+				appendSample(out, metricFamily->name, "_bucket", entry->labels, "le=\"+Inf\"", double(count));
+				appendSample(out, metricFamily->name, "_sum", entry->labels, "", values.sum());
+				appendSample(out, metricFamily->name, "_count", entry->labels, "", double(count));
+			}
+		}
+	}
+	return out;
+}
+
+// exporter
+
+static socket_type listenTcp(uint16_t port) {
+	socket_type listener = socket(AF_INET, SOCK_STREAM, 0);
+	if(listener == NO_SOCKET)
+		return NO_SOCKET;
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // never reachable from outside the machine
+	if(bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+		closeSocket(listener);
+		return NO_SOCKET;
+	}
+	return listener;
+}
+
+static socket_type listenUnix([[maybe_unused]] const std::string& path) {
+#ifdef _WIN32
+	return NO_SOCKET;
+#else
+	sockaddr_un address{};
+	if(path.size() >= sizeof(address.sun_path))
+		return NO_SOCKET;
+	socket_type listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener == NO_SOCKET)
+		return NO_SOCKET;
+
+	address.sun_family = AF_UNIX;
+	std::copy(path.begin(), path.end(), address.sun_path);
+	struct stat existing{};
+	if(stat(path.c_str(), &existing) == 0 && S_ISSOCK(existing.st_mode))
+		unlink(path.c_str()); // left behind by a run that didn't shut down
+	if(bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 8) != 0) {
+		closeSocket(listener);
+		return NO_SOCKET;
+	}
+	return listener;
+#endif
+}
+
+static void sendAll(socket_type client, std::string_view data) {
+	while(!data.empty()) {
+		auto sent = send(client, data.data(), int(std::min<size_t>(data.size(), 1 << 20)), SEND_FLAGS);
+		if(sent <= 0)
+			return;
+		data.remove_prefix(size_t(sent));
+	}
+}
+
+// one request per connection, a scraper doesn't need keep-alive
+static void serve(socket_type client, const std::string& snapshot) {
+#ifdef _WIN32
+	DWORD timeout = 250;
+#else
+	timeval timeout{0, 250000};
+#endif
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&timeout), sizeof(timeout));
+
+	std::string request;
+	char buffer[1024];
+	while(request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+		auto received = recv(client, buffer, sizeof(buffer), 0);
+		if(received <= 0)
+			break;
+		request.append(buffer, size_t(received));
+	}
+
+	std::string_view line = std::string_view(request).substr(0, request.find("\r\n"));
+	bool found = line.starts_with("GET /metrics ") || line.starts_with("GET / ");
+	std::string_view body = found ? std::string_view(snapshot) : std::string_view("not found\n");
+	std::string header = std::format("HTTP/1.1 {}\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+		found ? "200 OK" : "404 Not Found", body.size());
+	sendAll(client, header);
+	sendAll(client, body);
+	closeSocket(client);
+}
+
+static void exporterLoop(std::stop_token stop, std::vector<socket_type> listeners) {
+	Iridium::setThreadName("Metrics");
+
+	std::vector<pollfd> fds;
+	for(socket_type listener : listeners)
+		fds.push_back({.fd = listener, .events = POLLIN, .revents = 0});
+
+	std::string snapshot;
+	auto nextSample = std::chrono::steady_clock::now();
+	while(!stop.stop_requested()) {
+		auto now = std::chrono::steady_clock::now();
+		if(now >= nextSample) {
+			snapshot = IrM::exposition();
+			nextSample = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(g_config.sampleSeconds));
+		}
+
+		// short timeout, so the stop request is seen without a wake up
+		if(pollSockets(fds.data(), fds.size(), 100) <= 0)
+			continue;
+		for(pollfd& fd : fds) {
+			if(!(fd.revents & POLLIN))
+				continue;
+			socket_type client = accept(fd.fd, nullptr, nullptr);
+			if(client != NO_SOCKET)
+				serve(client, snapshot);
+		}
+	}
+
+	for(socket_type listener : listeners)
+		closeSocket(listener);
+#ifndef _WIN32
+	if(!g_config.socketPath.empty())
+		unlink(g_config.socketPath.c_str());
+#endif
+}
+
+void IrM::init(const config& metricsConfig) {
+	g_config = metricsConfig;
+	g_config.sampleSeconds = std::max(g_config.sampleSeconds, 0.01);
+	if(g_config.port == 0 && g_config.socketPath.empty())
+		return;
+
+#ifdef _WIN32
+	WSADATA data;
+	if(WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+		ENGINE_LOG_ERROR("Failed to start Winsock, metrics won't be exported.");
+		return;
+	}
+#endif
+
+	std::vector<socket_type> listeners;
+	if(g_config.port != 0) {
+		socket_type listener = listenTcp(g_config.port);
+		if(listener == NO_SOCKET)
+			ENGINE_LOG_ERROR("Failed to listen for metrics scrapes on 127.0.0.1:{}.", g_config.port);
+		else {
+			listeners.push_back(listener);
+			ENGINE_LOG_INFO("Serving metrics on http://127.0.0.1:{}/metrics", g_config.port);
+		}
+	}
+	if(!g_config.socketPath.empty()) {
+		socket_type listener = listenUnix(g_config.socketPath);
+		if(listener == NO_SOCKET)
+			ENGINE_LOG_ERROR("Failed to listen for metrics scrapes on Unix socket {}.", g_config.socketPath);
+		else {
+			listeners.push_back(listener);
+			ENGINE_LOG_INFO("Serving metrics on Unix socket {}", g_config.socketPath);
+		}
+	}
+	if(listeners.empty()) {
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return;
+	}
+	g_exporter = std::jthread(exporterLoop, std::move(listeners));
+}
+
+void IrM::shutdown() {
+	if(!g_exporter.joinable())
+		return;
+	g_exporter.request_stop();
+	g_exporter.join();
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
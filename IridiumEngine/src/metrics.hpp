@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace Iridium {
+	namespace Metrics {
+		// Live telemetry in the Prometheus text format. Registering takes a lock and is meant for startup,
+		// updating a registered metric is a relaxed atomic and safe from any thread, drawFrame included.
+		// Names follow Prometheus rules, labels are written as they'd appear between the braces: heap="0".
+
+		enum class metric_type : uint8_t {
+			counter,
+			gauge,
+			histogram
+		};
+
+		class counter {
+		public:
+			void add(uint64_t amount = 1) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+			uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+		private:
+			std::atomic<uint64_t> m_value{0};
+		};
+
+		class gauge {
+		public:
+			void set(double value) { m_value.store(value, std::memory_order_relaxed); }
+			void add(double amount) { m_value.fetch_add(amount, std::memory_order_relaxed); }
+			double value() const { return m_value.load(std::memory_order_relaxed); }
+		private:
+			std::atomic<double> m_value{0.0};
+		};
+
+		// cumulative buckets like Prometheus wants them, bounds are the upper edges in ascending order
+		class histogram {
+		public:
+			histogram(std::vector<double> bounds);
+
+			void observe(double value);
+
+			const std::vector<double>& bounds() const { return m_bounds; }
+			uint64_t bucket(size_t index) const { return m_buckets[index].load(std::memory_order_relaxed); } // not cumulative
+			uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+			double sum() const { return m_sum.load(std::memory_order_relaxed); }
+		private:
+			std::vector<double> m_bounds;
+			std::unique_ptr<std::atomic<uint64_t>[]> m_buckets; // one more than bounds, for +Inf
+			std::atomic<uint64_t> m_count{0};
+			std::atomic<double> m_sum{0.0};
+		};
+
+		// Registering the same name and labels again gives back the same metric, a different type throws.
+		// The references stay valid until the process exits.
+		counter& addCounter(std::string_view name, std::string_view help, std::string_view labels = {});
+		gauge& addGauge(std::string_view name, std::string_view help, std::string_view labels = {});
+		histogram& addHistogram(std::string_view name, std::string_view help, std::vector<double> bounds, std::string_view labels = {});
+
+		// A gauge read on the exporter thread when it samples, for values that already live somewhere else.
+		// The function has to be thread safe, removeSampler waits for a running sample to finish.
+		using sampler_id = uint32_t;
+		sampler_id addSampler(std::string_view name, std::string_view help, std::string_view labels, std::function<double()> sample);
+		void removeSampler(sampler_id id);
+
+		// everything registered, in the text exposition format
+		std::string exposition();
+
+		struct config {
+			uint16_t port = 0;      // HTTP on 127.0.0.1, none when 0
+			std::string socketPath; // HTTP on a Unix socket, none when empty
+			double sampleSeconds = 1.0;
+		};
+
+		// Starts the exporter thread when an endpoint is configured. It renders the exposition every
+		// sampleSeconds and answers scrapes with the last one, nobody else ever waits on it.
+		void init(const config& metricsConfig);
+		void shutdown();
+	}
+}
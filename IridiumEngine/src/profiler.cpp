@@ -0,0 +1,336 @@
+#include "profiler.hpp"
+
+#if IRIDIUM_PROFILE
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <iterator>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "json.hpp"
+#include "log.hpp"
+#include "thread.hpp"
+
+#if IRIDIUM_PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace IrP = Iridium::Profiler;
+
+namespace {
+	constexpr size_t EVENTS_PER_THREAD = 64 * 1024; // power of two
+	constexpr const char* FRAME_MARKER = "Frame";
+
+	// Relaxed atomics so the exporter can read while the owner overwrites, torn events are
+	// thrown away afterwards by looking at head again.
+	struct zone_event {
+		std::atomic<const char*> name;
+		std::atomic<int64_t> start;
+		std::atomic<int64_t> end;
+		std::atomic<uint64_t> frame;
+#if IRIDIUM_PERF_COUNTERS
+		std::atomic<uint64_t> counters[size_t(IrP::perf_counter::COUNT)];
+		std::atomic<uint8_t> counterMask; // 0 for zones without counters
+#endif
+	};
+
+	// what a zone has on top of its times, none of it without perf counters
+	struct zone_counters {
+#if IRIDIUM_PERF_COUNTERS
+		uint64_t deltas[size_t(IrP::perf_counter::COUNT)];
+		uint8_t mask;
+#endif
+	};
+
+	// rings outlive their threads so the trace still has them after a join
+	std::mutex g_tracksMutex;
+	std::vector<IrP::track*> g_tracks;
+	std::atomic<uint64_t> g_frame{0};
+	const int64_t g_epoch = IrP::now();
+
+	// the calling thread's track, shutdown reaches it through track::owner to clear it
+	struct track_owner {
+		IrP::track* target = nullptr;
+		~track_owner();
+	};
+
+	thread_local track_owner t_track;
+
+#if IRIDIUM_PERF_COUNTERS
+	constexpr size_t PERF_COUNTERS = size_t(IrP::perf_counter::COUNT);
+
+	// one group per thread, the members are scheduled onto the PMU together
+	struct perf_group {
+		int fds[PERF_COUNTERS] = {-1, -1, -1, -1};
+		int leader = -1;
+		uint8_t mask = 0;
+		bool opened = false;
+
+		~perf_group() {
+			for(int fd : fds) {
+				if(fd != -1)
+					close(fd);
+			}
+		}
+	};
+
+	thread_local perf_group t_perf;
+	std::atomic<bool> g_perfWarned{false};
+
+	int openPerfEvent(uint64_t config, int group) {
+		perf_event_attr attr{};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.disabled = group == -1; // the leader starts the whole group once it's complete
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return int(syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC));
+	}
+
+	void openPerfGroup(perf_group& group) {
+		group.opened = true;
+		const uint64_t configs[PERF_COUNTERS] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES
+		};
+		// whatever the PMU or the VM doesn't have is left out, the rest still works
+		for(size_t counter = 0; counter < PERF_COUNTERS; counter++) {
+			group.fds[counter] = openPerfEvent(configs[counter], group.leader);
+			if(group.fds[counter] == -1)
+				continue;
+			if(group.leader == -1)
+				group.leader = group.fds[counter];
+			group.mask |= uint8_t(1 << counter);
+		}
+
+		if(group.leader == -1) {
+			if(!g_perfWarned.exchange(true, std::memory_order_relaxed))
+				ENGINE_LOG_WARN("Hardware performance counters aren't available (check /proc/sys/kernel/perf_event_paranoid), zones are recorded without them.");
+			return;
+		}
+		ioctl(group.leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(group.leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+#endif
+}
+
+struct Iridium::Profiler::track {
+	std::string name;
+	uint32_t id;
+	track_owner* owner = nullptr; // under g_tracksMutex, null for createTrack tracks and once the thread exited
+	std::atomic<uint64_t> head{0};
+	zone_event events[EVENTS_PER_THREAD];
+
+	track(std::string_view trackName, uint32_t trackId) :name(trackName), id(trackId) {}
+};
+
+int64_t IrP::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// needs g_tracksMutex
+static IrP::track* addTrack(std::string_view name) {
+	IrP::track* newTrack = ::new IrP::track(name, uint32_t(g_tracks.size() + 1));
+	g_tracks.push_back(newTrack);
+	return newTrack;
+}
+
+track_owner::~track_owner() {
+	std::scoped_lock<std::mutex> lock(g_tracksMutex);
+	if(target)
+		target->owner = nullptr;
+}
+
+IrP::track* IrP::createTrack(std::string_view name) {
+	std::scoped_lock<std::mutex> lock(g_tracksMutex);
+	return addTrack(name);
+}
+
+// the only writer of the rings, counters is null for zones without them
+static void writeZone(IrP::track* target, const char* name, int64_t start, int64_t end, uint64_t frame, [[maybe_unused]] const zone_counters* counters) {
+	uint64_t head = target->head.load(std::memory_order_relaxed);
+	zone_event& event = target->events[head & (EVENTS_PER_THREAD - 1)];
+	event.name.store(name, std::memory_order_relaxed);
+	event.start.store(start, std::memory_order_relaxed);
+	event.end.store(end, std::memory_order_relaxed);
+	event.frame.store(frame, std::memory_order_relaxed);
+#if IRIDIUM_PERF_COUNTERS
+	if(counters) {
+		for(size_t counter = 0; counter < PERF_COUNTERS; counter++)
+			event.counters[counter].store(counters->deltas[counter], std::memory_order_relaxed);
+	}
+	event.counterMask.store(counters ? counters->mask : 0, std::memory_order_relaxed);
+#endif
+	target->head.store(head + 1, std::memory_order_release);
+}
+
+void IrP::recordZone(track* target, const char* name, int64_t start, int64_t end, uint64_t frame) {
+	writeZone(target, name, start, end, frame, nullptr);
+}
+
+static IrP::track* currentTrack() {
+	if(t_track.target == nullptr) {
+		std::scoped_lock<std::mutex> lock(g_tracksMutex);
+		t_track.target = addTrack(Iridium::getThreadName());
+		t_track.target->owner = &t_track;
+	}
+	return t_track.target;
+}
+
+void IrP::recordZone(const char* name, int64_t start, int64_t end) {
+	recordZone(currentTrack(), name, start, end, g_frame.load(std::memory_order_relaxed));
+}
+
+void IrP::frameMark() {
+	int64_t time = now();
+	uint64_t frame = g_frame.fetch_add(1, std::memory_order_relaxed) + 1;
+	recordZone(currentTrack(), FRAME_MARKER, time, time, frame);
+}
+
+#if IRIDIUM_PERF_COUNTERS
+const char* IrP::perfCounterName(perf_counter counter) {
+	switch(counter) {
+		case perf_counter::cycles: return "cycles";
+		case perf_counter::instructions: return "instructions";
+		case perf_counter::cacheMisses: return "llc_misses";
+		case perf_counter::branchMisses: return "branch_misses";
+		case perf_counter::COUNT: break;
+	}
+	return "unknown";
+}
+
+IrP::perf_sample IrP::readPerfCounters() {
+	perf_sample sample{};
+	if(!t_perf.opened)
+		openPerfGroup(t_perf);
+	if(t_perf.leader == -1)
+		return sample;
+
+	// PERF_FORMAT_GROUP layout: nr, time_enabled, time_running, then a value per member in open order
+	uint64_t buffer[3 + PERF_COUNTERS];
+	if(read(t_perf.leader, buffer, sizeof(buffer)) < ssize_t(3 * sizeof(uint64_t)))
+		return sample;
+	uint64_t enabled = buffer[1];
+	uint64_t running = buffer[2];
+	double scale = running != 0 && running < enabled ? double(enabled) / double(running) : 1.0;
+
+	size_t member = 0;
+	for(size_t counter = 0; counter < PERF_COUNTERS && member < buffer[0]; counter++) {
+		if(!(t_perf.mask & (1 << counter)))
+			continue;
+		sample.values[counter] = uint64_t(double(buffer[3 + member++]) * scale);
+	}
+	sample.mask = t_perf.mask;
+	return sample;
+}
+
+void IrP::recordZone(const char* name, int64_t start, int64_t end, const perf_sample& begin, const perf_sample& finish) {
+	zone_counters counters{};
+	for(size_t counter = 0; counter < PERF_COUNTERS; counter++) {
+		// scaled values can step back a little while multiplexed
+		counters.deltas[counter] = finish.values[counter] > begin.values[counter] ? finish.values[counter] - begin.values[counter] : 0;
+	}
+	counters.mask = begin.mask & finish.mask;
+	writeZone(currentTrack(), name, start, end, g_frame.load(std::memory_order_relaxed), &counters);
+}
+#endif
+
+uint64_t IrP::currentFrame() {
+	return g_frame.load(std::memory_order_relaxed);
+}
+
+void IrP::exportChromeTrace(const std::string& path) {
+	std::vector<track*> tracks;
+	{
+		std::scoped_lock<std::mutex> lock(g_tracksMutex);
+		tracks = g_tracks;
+	}
+
+	std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+	size_t zoneCount = 0;
+	for(track* target : tracks) {
+		out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+		std::format_to(std::back_inserter(out), "{},\"args\":{{\"name\":", target->id);
+		appendJsonString(out, target->name);
+		out += "}},\n";
+
+		uint64_t head = target->head.load(std::memory_order_acquire);
+		uint64_t first = head > EVENTS_PER_THREAD ? head - EVENTS_PER_THREAD : 0;
+		for(uint64_t index = first; index < head; index++) {
+			const zone_event& event = target->events[index & (EVENTS_PER_THREAD - 1)];
+			const char* name = event.name.load(std::memory_order_relaxed);
+			int64_t start = event.start.load(std::memory_order_relaxed);
+			int64_t end = event.end.load(std::memory_order_relaxed);
+			uint64_t frame = event.frame.load(std::memory_order_relaxed);
+#if IRIDIUM_PERF_COUNTERS
+			uint64_t counters[PERF_COUNTERS];
+			for(size_t counter = 0; counter < PERF_COUNTERS; counter++)
+				counters[counter] = event.counters[counter].load(std::memory_order_relaxed);
+			uint8_t counterMask = event.counterMask.load(std::memory_order_relaxed);
+#endif
+			// the owner may have lapped us while we were reading
+			if(index + EVENTS_PER_THREAD <= target->head.load(std::memory_order_acquire))
+				continue;
+
+			double timestamp = double(start - g_epoch) / 1000.0;
+			if(name == FRAME_MARKER) {
+				std::format_to(std::back_inserter(out), "{{\"name\":\"Frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"args\":{{\"frame\":{}}}}},\n",
+					target->id, timestamp, frame);
+				continue;
+			}
+			out += "{\"name\":";
+			appendJsonString(out, name);
+			std::format_to(std::back_inserter(out), ",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"frame\":{}",
+				target->id, timestamp, double(end - start) / 1000.0, frame);
+#if IRIDIUM_PERF_COUNTERS
+			for(size_t counter = 0; counter < PERF_COUNTERS; counter++) {
+				if(counterMask & (1 << counter))
+					std::format_to(std::back_inserter(out), ",\"{}\":{}", perfCounterName(perf_counter(counter)), counters[counter]);
+			}
+			constexpr uint8_t IPC_MASK = (1 << size_t(perf_counter::cycles)) | (1 << size_t(perf_counter::instructions));
+			if((counterMask & IPC_MASK) == IPC_MASK && counters[size_t(perf_counter::cycles)] != 0)
+				std::format_to(std::back_inserter(out), ",\"ipc\":{:.3f}", double(counters[size_t(perf_counter::instructions)]) / double(counters[size_t(perf_counter::cycles)]));
+#endif
+			out += "}},\n";
+			zoneCount++;
+		}
+	}
+	// the format doesn't allow a trailing comma
+	if(out.ends_with(",\n"))
+		out.erase(out.size() - 2, 1);
+	out += "]}\n";
+
+	FILE* file = std::fopen(path.c_str(), "w");
+	if(file == nullptr) {
+		ENGINE_LOG_ERROR("Failed to open profiler trace {}.", path);
+		return;
+	}
+	std::fwrite(out.data(), 1, out.size(), file);
+	std::fclose(file);
+	ENGINE_LOG_INFO("Wrote {} profiler zones from {} tracks to {}.", zoneCount, tracks.size(), path);
+}
+
+// Threads may outlive this but must not be recording during it. Each one's track pointer is cleared,
+// so a zone recorded afterwards starts a new track instead of writing into a deleted one.
+void IrP::shutdown() {
+	std::scoped_lock<std::mutex> lock(g_tracksMutex);
+	for(track* target : g_tracks) {
+		if(target->owner)
+			target->owner->target = nullptr;
+		::delete target;
+	}
+	g_tracks.clear();
+}
+
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Opt-in with -DIRIDIUM_PROFILE=ON, compiles to nothing otherwise.
+#ifndef IRIDIUM_PROFILE
+#define IRIDIUM_PROFILE 0
+#endif
+
+// Opt-in with -DIRIDIUM_PERF_COUNTERS=ON on top of IRIDIUM_PROFILE, Linux only. Every zone then carries
+// the hardware counter deltas of its thread, at the price of two read syscalls per zone.
+#if !defined(IRIDIUM_PERF_COUNTERS) || !IRIDIUM_PROFILE || !defined(__linux__)
+#undef IRIDIUM_PERF_COUNTERS
+#define IRIDIUM_PERF_COUNTERS 0
+#endif
+
+#if IRIDIUM_PROFILE
+#define IRIDIUM_PROFILE_CONCAT_IMPL(x, y) x##y
+#define IRIDIUM_PROFILE_CONCAT(x, y) IRIDIUM_PROFILE_CONCAT_IMPL(x, y)
+// name has to outlive the profiler, a string literal
+#define IRIDIUM_PROFILE_SCOPE(NAME) Iridium::Profiler::scoped_zone IRIDIUM_PROFILE_CONCAT(__profileZone, __COUNTER__)(NAME)
+#define IRIDIUM_PROFILE_FRAME() Iridium::Profiler::frameMark()
+#else
+#define IRIDIUM_PROFILE_SCOPE(NAME)
+#define IRIDIUM_PROFILE_FRAME()
+#endif
+
+namespace Iridium {
+	namespace Profiler {
+#if IRIDIUM_PROFILE
+		int64_t now();
+
+		// Every thread records into its own ring of its last 64K zones, older ones
+		// are overwritten. Nothing is locked or allocated after the first zone of a thread.
+		void recordZone(const char* name, int64_t start, int64_t end);
+#if IRIDIUM_PERF_COUNTERS
+		enum class perf_counter : uint8_t {
+			cycles,
+			instructions,
+			cacheMisses,  // last level cache
+			branchMisses,
+			COUNT
+		};
+
+		const char* perfCounterName(perf_counter counter);
+
+		struct perf_sample {
+			uint64_t values[size_t(perf_counter::COUNT)];
+			uint8_t mask; // bit per perf_counter that could be opened, 0 when perf events aren't permitted
+		};
+
+		// Reads the calling thread's counter group, opening it the first time. Multiplexed counters
+		// are scaled up to the whole time they were enabled.
+		perf_sample readPerfCounters();
+		void recordZone(const char* name, int64_t start, int64_t end, const perf_sample& begin, const perf_sample& finish);
+#endif
+		void frameMark();
+		// the number of the frame the last frameMark started, every zone is tagged with it
+		uint64_t currentFrame();
+
+		// A timeline that isn't a CPU thread, like the GPU. Only one thread may record into a track
+		// at a time, it lives until shutdown.
+		struct track;
+		track* createTrack(std::string_view name);
+		void recordZone(track* target, const char* name, int64_t start, int64_t end, uint64_t frame);
+
+		// Chrome trace event JSON, opens in chrome://tracing and ui.perfetto.dev
+		void exportChromeTrace(const std::string& path);
+		void shutdown();
+
+#if IRIDIUM_PERF_COUNTERS
+		struct scoped_zone {
+			const char* name;
+			perf_sample counters;
+			int64_t start;
+
+			// counters on the inside of the timestamps, so the zone's time includes their cost
+			scoped_zone(const char* zoneName) : name(zoneName), start(now()) { counters = readPerfCounters(); }
+			~scoped_zone() {
+				perf_sample finish = readPerfCounters();
+				recordZone(name, start, now(), counters, finish);
+			}
+		};
+#else
+		struct scoped_zone {
+			const char* name;
+			int64_t start;
+
+			scoped_zone(const char* zoneName) : name(zoneName), start(now()) {}
+			~scoped_zone() { recordZone(name, start, now()); }
+		};
+#endif
+#else
+		inline void frameMark() {}
+		inline void exportChromeTrace(const std::string&) {}
+		inline void shutdown() {}
+#endif
+	}
+}
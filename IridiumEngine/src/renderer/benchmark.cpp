@@ -0,0 +1,379 @@
+#include "benchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <format>
+#include <iterator>
+#include <numbers>
+
+#include "glm/ext/matrix_transform.hpp"
+
+#include "vulkan.hpp"
+#include "../json.hpp"
+#include "../log.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace IrR = Iridium::Renderer;
+
+namespace {
+	// splitmix64, same sequence everywhere
+	struct scene_random {
+		uint64_t state;
+
+		uint64_t next() {
+			uint64_t value = (state += 0x9E3779B97F4A7C15ull);
+			value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+			value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+			return value ^ (value >> 31);
+		}
+
+		float unit() { return float(next() >> 40) * 0x1.0p-24f; }
+		float range(float low, float high) { return low + (high - low) * unit(); }
+
+		glm::vec3 direction() {
+			glm::vec3 axis(range(-1.0f, 1.0f), range(-1.0f, 1.0f), range(-1.0f, 1.0f));
+			float length = glm::length(axis);
+			return length > 1e-3f ? axis / length : glm::vec3(0.0f, 0.0f, 1.0f);
+		}
+	};
+
+	const glm::vec3 palette[] = {
+		{0.90f, 0.30f, 0.25f},
+		{0.95f, 0.65f, 0.20f},
+		{0.90f, 0.90f, 0.35f},
+		{0.35f, 0.80f, 0.40f},
+		{0.25f, 0.70f, 0.85f},
+		{0.30f, 0.40f, 0.90f},
+		{0.65f, 0.35f, 0.85f},
+		{0.85f, 0.85f, 0.85f},
+	};
+
+	using shape_builder = void (*)(IrR::benchmark_scene& scene, glm::vec3 color);
+
+	void addCube(IrR::benchmark_scene& scene, glm::vec3 color) {
+		const glm::vec3 normals[] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+		uint32_t base = 0;
+		for(const glm::vec3& normal : normals) {
+			// two axes spanning the face
+			glm::vec3 u = normal.x != 0.0f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+			glm::vec3 v = glm::cross(normal, u);
+			float shade = 0.6f + 0.4f * std::abs(normal.z);
+			for(int corner = 0; corner < 4; corner++) {
+				float s = (corner == 1 || corner == 2) ? 1.0f : 0.0f;
+				float t = corner >= 2 ? 1.0f : 0.0f;
+				scene.vertices.push_back({
+					.position = (normal + u * (s * 2.0f - 1.0f) + v * (t * 2.0f - 1.0f)) * 0.5f,
+					.color = color * shade,
+					.uv = {s, t}
+				});
+			}
+			for(uint32_t index : {0u, 1u, 2u, 2u, 3u, 0u})
+				scene.indices.push_back(base + index);
+			base += 4;
+		}
+	}
+
+	void addSphere(IrR::benchmark_scene& scene, glm::vec3 color) {
+		constexpr uint32_t RINGS = 12;
+		constexpr uint32_t SEGMENTS = 16;
+		for(uint32_t ring = 0; ring <= RINGS; ring++) {
+			float theta = std::numbers::pi_v<float> * float(ring) / float(RINGS);
+			for(uint32_t segment = 0; segment <= SEGMENTS; segment++) {
+				float phi = 2.0f * std::numbers::pi_v<float> * float(segment) / float(SEGMENTS);
+				glm::vec3 normal(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi), std::cos(theta));
+				scene.vertices.push_back({
+					.position = normal * 0.5f,
+					.color = color * (0.6f + 0.4f * normal.z * normal.z),
+					.uv = {float(segment) / float(SEGMENTS), float(ring) / float(RINGS)}
+				});
+			}
+		}
+		for(uint32_t ring = 0; ring < RINGS; ring++) {
+			for(uint32_t segment = 0; segment < SEGMENTS; segment++) {
+				uint32_t a = ring * (SEGMENTS + 1) + segment;
+				uint32_t b = a + SEGMENTS + 1;
+				for(uint32_t index : {a, b, a + 1, a + 1, b, b + 1})
+					scene.indices.push_back(index);
+			}
+		}
+	}
+
+	void addGrid(IrR::benchmark_scene& scene, glm::vec3 color) {
+		constexpr uint32_t CELLS = 8;
+		for(uint32_t y = 0; y <= CELLS; y++) {
+			for(uint32_t x = 0; x <= CELLS; x++) {
+				float s = float(x) / float(CELLS);
+				float t = float(y) / float(CELLS);
+				scene.vertices.push_back({
+					.position = {s - 0.5f, t - 0.5f, 0.05f * std::sin(s * 6.0f) * std::cos(t * 6.0f)},
+					.color = color * (((x + y) & 1) ? 1.0f : 0.75f),
+					.uv = {s, t}
+				});
+			}
+		}
+		for(uint32_t y = 0; y < CELLS; y++) {
+			for(uint32_t x = 0; x < CELLS; x++) {
+				uint32_t a = y * (CELLS + 1) + x;
+				uint32_t b = a + CELLS + 1;
+				for(uint32_t index : {a, a + 1, b + 1, b + 1, b, a})
+					scene.indices.push_back(index);
+			}
+		}
+	}
+
+	void writeSummary(std::string& out, const char* name, const Iridium::FrameStats::summary& values, bool last) {
+		std::format_to(std::back_inserter(out),
+			"\t\t\"{}\": {{\"count\": {}, \"mean\": {:.4f}, \"p50\": {:.4f}, \"p95\": {:.4f}, \"p99\": {:.4f}, \"max\": {:.4f}}}{}\n",
+			name, values.count, values.mean, values.p50, values.p95, values.p99, values.max, last ? "" : ",");
+	}
+}
+
+IrR::benchmark_scene IrR::buildBenchmarkScene(const benchmark_config& config) {
+	benchmark_scene scene;
+	scene_random random{config.seed};
+
+	// every shape in every color, the color standing in for a material
+	const shape_builder shapes[] = {addCube, addSphere, addGrid};
+	for(shape_builder shape : shapes) {
+		for(const glm::vec3& color : palette) {
+			benchmark_mesh mesh{
+				.indexCount = 0,
+				.firstIndex = uint32_t(scene.indices.size()),
+				.vertexOffset = int32_t(scene.vertices.size())
+			};
+			shape(scene, color);
+			mesh.indexCount = uint32_t(scene.indices.size()) - mesh.firstIndex;
+			scene.meshes.push_back(mesh);
+		}
+	}
+
+	// a box in front of the camera path, everything within the far plane
+	scene.instances.reserve(config.instances);
+	for(uint32_t index = 0; index < config.instances; index++) {
+		glm::vec3 position(random.range(0.5f, 9.0f), random.range(-4.0f, 4.0f), random.range(-2.5f, 2.5f));
+		float scale = random.range(0.05f, 0.2f);
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), position);
+		transform = glm::rotate(transform, random.range(0.0f, 2.0f * std::numbers::pi_v<float>), random.direction());
+		transform = glm::scale(transform, glm::vec3(scale));
+		scene.instances.push_back({
+			.transform = transform,
+			.spinAxis = random.direction(),
+			.spinSpeed = random.range(-2.0f, 2.0f),
+			.mesh = uint32_t(random.next() % scene.meshes.size())
+		});
+	}
+
+	ENGINE_LOG_INFO("Benchmark scene: {} instances of {} meshes, {} vertices, {} indices.",
+		scene.instances.size(), scene.meshes.size(), scene.vertices.size(), scene.indices.size());
+	return scene;
+}
+
+glm::vec3 IrR::benchmarkCameraAt(double time) {
+	float t = float(time);
+	return {-1.5f + 0.75f * std::sin(0.25f * t), 1.5f * std::sin(0.5f * t), 0.5f + 0.5f * std::sin(0.35f * t)};
+}
+
+uint64_t IrR::peakResidentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters{};
+	if(GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	rusage usage{};
+	if(getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return uint64_t(usage.ru_maxrss) * 1024; // kilobytes on Linux
+#endif
+}
+
+IrR::allocator_benchmark IrR::runAllocatorBenchmark(VkDevice device, device_allocator& allocator, memory_budget& budget, uint32_t count, uint64_t seed) {
+	using clock = std::chrono::steady_clock;
+	constexpr uint32_t DRIVER_BUFFERS = 1000;
+	scene_random random{seed};
+
+	auto createBuffers = [&](uint32_t amount) -> std::vector<VkBuffer> {
+		std::vector<VkBuffer> buffers(amount);
+		for(VkBuffer& buffer : buffers) {
+			VkBufferCreateInfo createInfo{};
+			createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			createInfo.size = VkDeviceSize(256) << (random.next() % 8);
+			createInfo.size += random.next() % createInfo.size; // below 64 KiB
+			createInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			if(vkCreateBuffer(device, &createInfo, nullptr, &buffer) != VK_SUCCESS)
+				throw renderer_error("Failed to create a benchmark buffer.");
+		}
+		return buffers;
+	};
+	auto shuffle = [&](std::vector<uint32_t>& order) -> void {
+		for(uint32_t index = uint32_t(order.size()); index > 1; index--)
+			std::swap(order[index - 1], order[random.next() % index]);
+	};
+	auto microseconds = [](clock::duration duration, uint32_t amount) -> double {
+		return amount ? std::chrono::duration<double, std::micro>(duration).count() / amount : 0.0;
+	};
+
+	allocator_benchmark result{};
+	std::vector<VkBuffer> buffers = createBuffers(count);
+
+	// no more than half of what the device-local heap has left, small GPUs and software drivers would fail or swap
+	if(count != 0) {
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, buffers[0], &requirements);
+		uint32_t heap = budget.memoryProperties().memoryTypes[allocator.findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)].heapIndex;
+		heap_stats stats = budget.heaps()[heap];
+		VkDeviceSize limit = stats.budget > stats.usage ? (stats.budget - stats.usage) / 2 : 0;
+		VkDeviceSize live = 0;
+		uint32_t fitting = 0;
+		for(; fitting < count; fitting++) {
+			vkGetBufferMemoryRequirements(device, buffers[fitting], &requirements);
+			if(live + requirements.size > limit)
+				break;
+			live += requirements.size;
+		}
+		if(fitting < count) {
+			ENGINE_LOG_WARN("Allocator benchmark limited to {} of {} buffers, heap {} has {:.1f} MiB of its budget left.", fitting, count, heap, double(limit * 2) / (1024.0 * 1024.0));
+			for(uint32_t index = fitting; index < count; index++)
+				vkDestroyBuffer(device, buffers[index], nullptr);
+			buffers.resize(fitting);
+			count = fitting;
+		}
+	}
+	result.buffers = count;
+	std::vector<device_allocation> allocations(count);
+	std::vector<uint32_t> order(count);
+	for(uint32_t index = 0; index < count; index++)
+		order[index] = index;
+	shuffle(order);
+
+	auto start = clock::now();
+	for(uint32_t index = 0; index < count; index++)
+		allocations[index] = allocator.allocateBuffer(buffers[index], VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	result.allocateMicroseconds = microseconds(clock::now() - start, count);
+	result.peakBlocks = allocator.getStats().blocks;
+
+	start = clock::now();
+	for(uint32_t index : order)
+		allocator.free(allocations[index]);
+	result.freeMicroseconds = microseconds(clock::now() - start, count);
+	for(VkBuffer buffer : buffers)
+		vkDestroyBuffer(device, buffer, nullptr);
+
+	// a buffer can only ever be bound once, so the baseline gets its own
+	result.driverBuffers = std::min(count, DRIVER_BUFFERS);
+	buffers = createBuffers(result.driverBuffers);
+	std::vector<VkDeviceMemory> memories(result.driverBuffers);
+	start = clock::now();
+	for(uint32_t index = 0; index < result.driverBuffers; index++) {
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(device, buffers[index], &requirements);
+		VkMemoryAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		allocInfo.allocationSize = requirements.size;
+		allocInfo.memoryTypeIndex = allocator.findMemoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		if(budget.allocate(allocInfo, memories[index]) != VK_SUCCESS)
+			throw renderer_error("Failed to allocate benchmark buffer memory.");
+		vkBindBufferMemory(device, buffers[index], memories[index], 0);
+	}
+	result.driverAllocateMicroseconds = microseconds(clock::now() - start, result.driverBuffers);
+
+	order.resize(result.driverBuffers);
+	for(uint32_t index = 0; index < result.driverBuffers; index++)
+		order[index] = index;
+	shuffle(order);
+	start = clock::now();
+	for(uint32_t index : order)
+		budget.free(memories[index]);
+	result.driverFreeMicroseconds = microseconds(clock::now() - start, result.driverBuffers);
+	for(VkBuffer buffer : buffers)
+		vkDestroyBuffer(device, buffer, nullptr);
+
+	ENGINE_LOG_INFO("Allocator: {:.3f} us to allocate and {:.3f} us to free per buffer over {} buffers in {} blocks, {:.3f} and {:.3f} us with vkAllocateMemory.",
+		result.allocateMicroseconds, result.freeMicroseconds, result.buffers, result.peakBlocks, result.driverAllocateMicroseconds, result.driverFreeMicroseconds);
+	return result;
+}
+
+void IrR::writeBenchmarkReport(const benchmark_config& config, const benchmark_result& result) {
+	using FrameStats::metric;
+	const FrameStats::report& stats = result.stats;
+
+	std::string out = "{\n";
+	out += "\t\"device\": ";
+	appendJsonString(out, result.device);
+	out += ",\n";
+	std::format_to(std::back_inserter(out),
+		"\t\"config\": {{\"frames\": {}, \"warmupFrames\": {}, \"instances\": {}, \"width\": {}, \"height\": {}, \"seed\": {}, \"timestep\": {}}},\n",
+		config.frames, config.warmupFrames, config.instances, config.width, config.height, config.seed, config.timestep);
+	std::format_to(std::back_inserter(out), "\t\"framesDrawn\": {},\n", result.framesDrawn);
+	std::format_to(std::back_inserter(out), "\t\"startupSeconds\": {:.4f},\n", result.startupSeconds);
+	std::format_to(std::back_inserter(out), "\t\"runSeconds\": {:.4f},\n", result.runSeconds);
+	std::format_to(std::back_inserter(out), "\t\"framesPerSecond\": {:.2f},\n", result.runSeconds > 0.0 ? result.framesDrawn / result.runSeconds : 0.0);
+	std::format_to(std::back_inserter(out), "\t\"budgetMilliseconds\": {:.4f},\n", FrameStats::getConfig().budgetMilliseconds);
+	std::format_to(std::back_inserter(out), "\t\"hitches\": {},\n", stats.hitches);
+	out += "\t\"milliseconds\": {\n";
+	for(size_t index = 0; index < size_t(metric::COUNT); index++)
+		writeSummary(out, FrameStats::metricName(metric(index)), stats.metrics[index], index + 1 == size_t(metric::COUNT));
+	out += "\t},\n";
+	out += "\t\"perFrame\": {\n";
+	for(size_t index = 0; index < size_t(FrameStats::counter::COUNT); index++) {
+		std::format_to(std::back_inserter(out), "\t\t\"{}\": {:.1f}{}\n", FrameStats::counterName(FrameStats::counter(index)),
+			stats.counters[index], index + 1 == size_t(FrameStats::counter::COUNT) ? "" : ",");
+	}
+	out += "\t},\n";
+	out += "\t\"peak\": {\n";
+	for(size_t index = 0; index < size_t(FrameStats::level::COUNT); index++) {
+		std::format_to(std::back_inserter(out), "\t\t\"{}\": {:.0f}{}\n", FrameStats::levelName(FrameStats::level(index)),
+			stats.levels[index], index + 1 == size_t(FrameStats::level::COUNT) ? "" : ",");
+	}
+	out += "\t},\n";
+	out += "\t\"heaps\": [\n";
+	for(size_t index = 0; index < result.heaps.size(); index++) {
+		const heap_stats& heap = result.heaps[index];
+		std::format_to(std::back_inserter(out),
+			"\t\t{{\"size\": {}, \"budget\": {}, \"usage\": {}, \"engineBytes\": {}, \"allocations\": {}, \"deviceLocal\": {}}}{}\n",
+			heap.size, heap.budget, heap.usage, heap.engineBytes, heap.allocations, heap.deviceLocal, index + 1 == result.heaps.size() ? "" : ",");
+	}
+	out += "\t],\n";
+	const allocator_benchmark& allocator = result.allocator;
+	std::format_to(std::back_inserter(out),
+		"\t\"allocator\": {{\"buffers\": {}, \"allocateMicroseconds\": {:.4f}, \"freeMicroseconds\": {:.4f}, \"peakBlocks\": {}, \"driverBuffers\": {}, \"driverAllocateMicroseconds\": {:.4f}, \"driverFreeMicroseconds\": {:.4f}}},\n",
+		allocator.buffers, allocator.allocateMicroseconds, allocator.freeMicroseconds, allocator.peakBlocks, allocator.driverBuffers, allocator.driverAllocateMicroseconds, allocator.driverFreeMicroseconds);
+	const refcount_benchmark& refcount = result.cpu.refcount;
+	std::format_to(std::back_inserter(out), "\t\"cpu\": {{\"iterations\": {},\n", result.cpu.iterations);
+	std::format_to(std::back_inserter(out),
+		"\t\t\"refcount\": {{\"threads\": {}, \"createNanoseconds\": {:.2f}, \"copyNanoseconds\": {:.2f}, \"contendedCopyNanoseconds\": {:.2f}, \"stdCreateNanoseconds\": {:.2f}, \"stdCopyNanoseconds\": {:.2f}, \"stdContendedCopyNanoseconds\": {:.2f}}},\n",
+		refcount.threads, refcount.createNanoseconds, refcount.copyNanoseconds, refcount.contendedCopyNanoseconds, refcount.stdCreateNanoseconds, refcount.stdCopyNanoseconds, refcount.stdContendedCopyNanoseconds);
+	const slab_benchmark& slab = result.cpu.slab;
+	std::format_to(std::back_inserter(out),
+		"\t\t\"slab\": {{\"threads\": {}, \"slabNanoseconds\": {:.2f}, \"slabContendedNanoseconds\": {:.2f}, \"heapNanoseconds\": {:.2f}, \"heapContendedNanoseconds\": {:.2f}, "
+		"\"walkObjects\": {}, \"slabWalkNanoseconds\": {:.3f}, \"heapWalkNanoseconds\": {:.3f}}},\n",
+		slab.threads, slab.slabNanoseconds, slab.slabContendedNanoseconds, slab.heapNanoseconds, slab.heapContendedNanoseconds,
+		slab.walkObjects, slab.slabWalkNanoseconds, slab.heapWalkNanoseconds);
+	std::format_to(std::back_inserter(out), "\t\t\"jobs\": {{\"items\": {}, \"milliseconds\": [", result.cpu.jobs.items);
+	for(size_t index = 0; index < result.cpu.jobs.milliseconds.size(); index++)
+		std::format_to(std::back_inserter(out), "{}{:.4f}", index ? ", " : "", result.cpu.jobs.milliseconds[index]);
+	out += "]},\n";
+	std::format_to(std::back_inserter(out), "\t\t\"log\": {{\"burst\": {}, \"burstNanoseconds\": {:.2f}, \"sustainedNanoseconds\": {:.2f}}}\n",
+		result.cpu.log.burst, result.cpu.log.burstNanoseconds, result.cpu.log.sustainedNanoseconds);
+	out += "\t},\n";
+	std::format_to(std::back_inserter(out), "\t\"peakResidentBytes\": {}\n", peakResidentBytes());
+	out += "}\n";
+
+	FILE* file = std::fopen(config.outputPath.c_str(), "w");
+	if(file == nullptr) {
+		ENGINE_LOG_ERROR("Failed to open benchmark report {}.", config.outputPath);
+		return;
+	}
+	std::fwrite(out.data(), 1, out.size(), file);
+	std::fclose(file);
+	ENGINE_LOG_INFO("Benchmark report written to {}.", config.outputPath);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "deviceAllocator.hpp"
+#include "memoryBudget.hpp"
+#include "vertex.hpp"
+#include "../cpuBenchmark.hpp"
+#include "../frameStats.hpp"
+
+namespace Iridium {
+	namespace Renderer {
+		struct benchmark_config {
+			uint32_t frames = 1000;
+			uint32_t warmupFrames = 100; // drawn but left out of the report
+			uint32_t instances = 10000;
+			uint32_t allocations = 100000; // buffers for the allocator benchmark after the frames, 0 skips it
+			uint32_t cpuIterations = 1000000; // per CPU benchmark and thread, 0 skips them
+			uint32_t width = 1280;
+			uint32_t height = 720;
+			uint64_t seed = 1;
+			double timestep = 1.0 / 60.0; // simulated seconds per frame, whatever the real frame took
+			std::string outputPath = "Iridium.benchmark.json";
+			std::chrono::steady_clock::time_point launchTime; // startup is measured from here
+		};
+
+		struct benchmark_mesh {
+			uint32_t indexCount;
+			uint32_t firstIndex;
+			int32_t vertexOffset;
+		};
+
+		struct benchmark_instance {
+			glm::mat4 transform;
+			glm::vec3 spinAxis;
+			float spinSpeed; // radians per simulated second
+			uint32_t mesh;
+		};
+
+		// Procedurally generated stress scene. The same config gives the same scene on every machine,
+		// nothing in here goes through std distributions or the C library's rand().
+		struct benchmark_scene {
+			std::vector<vertex> vertices;
+			std::vector<uint32_t> indices;
+			std::vector<benchmark_mesh> meshes; // every shape in every palette color
+			std::vector<benchmark_instance> instances;
+		};
+
+		benchmark_scene buildBenchmarkScene(const benchmark_config& config);
+		// fixed camera path, the view always looks down +x
+		glm::vec3 benchmarkCameraAt(double time);
+
+		struct allocator_benchmark {
+			uint32_t buffers;
+			double allocateMicroseconds; // per buffer, allocation plus bind
+			double freeMicroseconds;
+			uint32_t peakBlocks;
+			// the same with a vkAllocateMemory per buffer, on fewer buffers to stay clear of maxMemoryAllocationCount
+			uint32_t driverBuffers;
+			double driverAllocateMicroseconds;
+			double driverFreeMicroseconds;
+		};
+
+		// Allocates and frees buffers of 256 B to 64 KiB in a shuffled order, the device has to be idle.
+		// Stops short of count buffers once they would take more than half of the device-local heap's headroom.
+		allocator_benchmark runAllocatorBenchmark(VkDevice device, device_allocator& allocator, memory_budget& budget, uint32_t count, uint64_t seed);
+
+		struct benchmark_result {
+			std::string device;
+			double startupSeconds;
+			double runSeconds; // measured frames only
+			uint32_t framesDrawn;
+			FrameStats::report stats;
+			std::vector<heap_stats> heaps; // at the end of the run
+			allocator_benchmark allocator;
+			cpu_benchmark cpu;
+		};
+
+		// peak resident set of the process, 0 where it can't be queried
+		uint64_t peakResidentBytes();
+		void writeBenchmarkReport(const benchmark_config& config, const benchmark_result& result);
+	}
+}
@@ -0,0 +1,306 @@
+#include "defragmenter.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "vulkan.hpp"
+#include "../log.hpp"
+#include "../profiler.hpp"
+
+namespace IrR = Iridium::Renderer;
+
+IrR::fragmentation_stats IrR::measureFragmentation(device_allocator& allocator) {
+	fragmentation_stats stats{};
+	for(const device_allocator::block_info& info : allocator.getBlocks()) {
+		stats.blocks++;
+		stats.blockBytes += info.size;
+		stats.freeBytes += info.size - info.usedBytes;
+		stats.largestFree = std::max(stats.largestFree, info.largestFree);
+	}
+	stats.fragmentation = stats.freeBytes ? 1.0 - double(stats.largestFree) / double(stats.freeBytes) : 0.0;
+	return stats;
+}
+
+void IrR::defragmenter::create(VkDevice device, device_allocator& allocator, deletion_queue& deletionQueue, staging_uploader& uploader, const defrag_config& config) {
+	m_device = device;
+	m_allocator = &allocator;
+	m_deletionQueue = &deletionQueue;
+	m_uploader = &uploader;
+	m_config = config;
+
+	m_movedBytes = &Metrics::addCounter("iridium_defrag_moved_bytes_total", "Bytes copied to empty sparse device memory blocks.");
+	m_blocksFreed = &Metrics::addCounter("iridium_defrag_blocks_total", "Device memory blocks emptied by defragmentation.");
+	m_samplers.push_back(Metrics::addSampler("iridium_gpu_fragmentation", "1 - largest free range / free bytes over all device memory blocks.", {}, [this]() -> double {
+		return measureFragmentation(*m_allocator).fragmentation;
+	}));
+	m_samplers.push_back(Metrics::addSampler("iridium_gpu_largest_free_bytes", "Biggest sub-allocation that fits without a new block.", {}, [this]() -> double {
+		return double(measureFragmentation(*m_allocator).largestFree);
+	}));
+}
+
+void IrR::defragmenter::destroy() {
+	for(Metrics::sampler_id sampler : m_samplers)
+		Metrics::removeSampler(sampler);
+	m_samplers.clear();
+
+	if(m_evacuating)
+		m_allocator->setEvacuating(m_sourceType, m_sourceBlock, false);
+	m_evacuating = false;
+	m_entries.clear();
+}
+
+IrR::defragmenter::move_id IrR::defragmenter::addBuffer(VkBuffer& buffer, device_allocation& allocation, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, upload_handle upload) {
+	auto slot = std::ranges::find_if(m_entries, [](const entry& other) { return !other.live; });
+	if(slot == m_entries.end())
+		slot = m_entries.insert(m_entries.end(), entry{});
+	*slot = {
+		.buffer = &buffer,
+		.allocation = &allocation,
+		.bufferSize = size,
+		.bufferUsage = usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		.properties = properties,
+		.rebind = {},
+		.upload = upload,
+		.live = true
+	};
+	return move_id(slot - m_entries.begin());
+}
+
+IrR::defragmenter::move_id IrR::defragmenter::addImage(VkImage& image, device_allocation& allocation, const VkImageCreateInfo& createInfo, VkImageLayout layout, VkImageAspectFlags aspect, VkMemoryPropertyFlags properties, rebind_function rebind, upload_handle upload) {
+	constexpr VkImageUsageFlags transfer = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	if((createInfo.usage & transfer) != transfer || createInfo.sharingMode != VK_SHARING_MODE_EXCLUSIVE)
+		throw renderer_error("Movable images need transfer usage and exclusive sharing.");
+
+	auto slot = std::ranges::find_if(m_entries, [](const entry& other) { return !other.live; });
+	if(slot == m_entries.end())
+		slot = m_entries.insert(m_entries.end(), entry{});
+	*slot = {
+		.image = &image,
+		.allocation = &allocation,
+		.imageInfo = createInfo,
+		.layout = layout,
+		.aspect = aspect,
+		.properties = properties,
+		.rebind = std::move(rebind),
+		.upload = upload,
+		.live = true
+	};
+	slot->imageInfo.pNext = nullptr;
+	slot->imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	return move_id(slot - m_entries.begin());
+}
+
+void IrR::defragmenter::remove(move_id id) {
+	m_entries[id] = {};
+}
+
+void IrR::defragmenter::pickSource() {
+	std::vector<device_allocator::block_info> blocks = m_allocator->getBlocks();
+	const device_allocator::block_info* source = nullptr;
+	for(const device_allocator::block_info& candidate : blocks) {
+		if(candidate.evacuating || candidate.allocations == 0 || double(candidate.usedBytes) >= double(candidate.size) * m_config.sparseBlock)
+			continue;
+		if(source && candidate.usedBytes >= source->usedBytes)
+			continue;
+
+		// a single allocation we can't move pins the whole block, one that's still being uploaded to as well
+		uint32_t movable = 0;
+		VkDeviceSize biggest = 0;
+		for(entry& movableEntry : m_entries) {
+			if(movableEntry.live && movableEntry.allocation->memoryType == candidate.memoryType && movableEntry.allocation->block == candidate.block) {
+				if(movableEntry.upload.value != 0) {
+					if(!m_uploader->isComplete(movableEntry.upload))
+						continue;
+					movableEntry.upload = {};
+				}
+				movable++;
+				biggest = std::max(biggest, movableEntry.allocation->size);
+			}
+		}
+		if(movable != candidate.allocations)
+			continue;
+
+		VkDeviceSize room = 0, largestFree = 0;
+		for(const device_allocator::block_info& other : blocks) {
+			if(other.memoryType != candidate.memoryType || other.block == candidate.block || other.evacuating)
+				continue;
+			room += other.size - other.usedBytes;
+			largestFree = std::max(largestFree, other.largestFree);
+		}
+		if(room >= candidate.usedBytes && largestFree >= biggest)
+			source = &candidate;
+	}
+	if(!source)
+		return;
+
+	m_before = measureFragmentation(*m_allocator);
+	m_sourceType = source->memoryType;
+	m_sourceBlock = source->block;
+	m_evacuating = true;
+	m_allocator->setEvacuating(m_sourceType, m_sourceBlock, true);
+	ENGINE_LOG_INFO("Defragmenting block {} of memory type {}: {} KiB live in {} allocations, fragmentation {:.3f} over {} blocks.",
+		m_sourceBlock, m_sourceType, source->usedBytes >> 10, source->allocations, m_before.fragmentation, m_before.blocks);
+}
+
+bool IrR::defragmenter::moveEntry(move_id id, move& result) {
+	const entry& movableEntry = m_entries[id];
+	result = {.id = id, .buffer = VK_NULL_HANDLE, .image = VK_NULL_HANDLE, .allocation = {}};
+	try {
+		if(movableEntry.buffer) {
+			VkBufferCreateInfo createInfo{};
+			createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			createInfo.size = movableEntry.bufferSize;
+			createInfo.usage = movableEntry.bufferUsage;
+			createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			if(vkCreateBuffer(m_device, &createInfo, nullptr, &result.buffer) != VK_SUCCESS)
+				return false;
+			result.allocation = m_allocator->allocateBuffer(result.buffer, movableEntry.properties);
+		} else {
+			if(vkCreateImage(m_device, &movableEntry.imageInfo, nullptr, &result.image) != VK_SUCCESS)
+				return false;
+			result.allocation = m_allocator->allocateImage(result.image, movableEntry.properties);
+		}
+	} catch(const renderer_error& error) {
+		ENGINE_LOG_WARN("Defragmentation couldn't place an allocation: {}", error.what());
+		if(result.buffer != VK_NULL_HANDLE)
+			vkDestroyBuffer(m_device, result.buffer, nullptr);
+		if(result.image != VK_NULL_HANDLE)
+			vkDestroyImage(m_device, result.image, nullptr);
+		return false;
+	}
+	return true;
+}
+
+void IrR::defragmenter::recordCopies(VkCommandBuffer commandBuffer, const std::vector<move>& moves) {
+	std::vector<VkImageMemoryBarrier> toTransfer;
+	std::vector<VkImageMemoryBarrier> toLayout;
+	for(const move& pending : moves) {
+		const entry& movableEntry = m_entries[pending.id];
+		if(!movableEntry.image)
+			continue;
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange = {movableEntry.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+
+		barrier.image = *movableEntry.image;
+		barrier.oldLayout = movableEntry.layout;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		toTransfer.push_back(barrier);
+
+		barrier.image = pending.image;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toTransfer.push_back(barrier);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = movableEntry.layout;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+		toLayout.push_back(barrier);
+	}
+
+	// earlier frames on the queue may still be writing the old resources
+	VkMemoryBarrier before{};
+	before.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	before.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+	before.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+		1, &before, 0, nullptr, uint32_t(toTransfer.size()), toTransfer.data());
+
+	for(const move& pending : moves) {
+		const entry& movableEntry = m_entries[pending.id];
+		if(movableEntry.buffer) {
+			VkBufferCopy region{0, 0, movableEntry.bufferSize};
+			vkCmdCopyBuffer(commandBuffer, *movableEntry.buffer, pending.buffer, 1, &region);
+			continue;
+		}
+		const VkImageCreateInfo& info = movableEntry.imageInfo;
+		std::vector<VkImageCopy> regions(info.mipLevels);
+		for(uint32_t level = 0; level < info.mipLevels; level++) {
+			regions[level].srcSubresource = {movableEntry.aspect, level, 0, info.arrayLayers};
+			regions[level].dstSubresource = regions[level].srcSubresource;
+			regions[level].extent = {
+				std::max(info.extent.width >> level, 1u),
+				std::max(info.extent.height >> level, 1u),
+				std::max(info.extent.depth >> level, 1u)
+			};
+		}
+		vkCmdCopyImage(commandBuffer, *movableEntry.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			pending.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t(regions.size()), regions.data());
+	}
+
+	VkMemoryBarrier after{};
+	after.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	after.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	after.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+		1, &after, 0, nullptr, uint32_t(toLayout.size()), toLayout.data());
+}
+
+void IrR::defragmenter::record(VkCommandBuffer commandBuffer) {
+	IRIDIUM_PROFILE_SCOPE("defragment");
+	if(!m_evacuating && ++m_frames % m_config.checkInterval == 0)
+		pickSource();
+	if(!m_evacuating)
+		return;
+
+	auto inSource = [&](const entry& movableEntry) {
+		return movableEntry.live && movableEntry.allocation->memoryType == m_sourceType && movableEntry.allocation->block == m_sourceBlock;
+	};
+
+	std::vector<move> moves;
+	VkDeviceSize bytes = 0;
+	for(move_id id = 0; id < uint32_t(m_entries.size()); id++) {
+		if(!inSource(m_entries[id]))
+			continue;
+		VkDeviceSize size = m_entries[id].allocation->size;
+		if(bytes != 0 && bytes + size > m_config.bytesPerFrame)
+			break;
+		move pending;
+		if(!moveEntry(id, pending)) {
+			// what already moved stays moved, the block just isn't emptied this time
+			m_allocator->setEvacuating(m_sourceType, m_sourceBlock, false);
+			m_evacuating = false;
+			break;
+		}
+		moves.push_back(pending);
+		bytes += size;
+	}
+	if(moves.empty())
+		return;
+
+	recordCopies(commandBuffer, moves);
+	for(const move& pending : moves) {
+		entry& movableEntry = m_entries[pending.id];
+		device_allocation oldAllocation = *movableEntry.allocation;
+		*movableEntry.allocation = pending.allocation;
+		if(movableEntry.buffer) {
+			m_deletionQueue->destroyBuffer(std::exchange(*movableEntry.buffer, pending.buffer), oldAllocation);
+			continue;
+		}
+		VkImage oldImage = std::exchange(*movableEntry.image, pending.image);
+		// the queue runs in order, views the rebind hands over go before their image
+		if(movableEntry.rebind)
+			movableEntry.rebind();
+		m_deletionQueue->destroyImage(oldImage, oldAllocation);
+	}
+	m_movedBytes->add(bytes);
+
+	// the block itself goes once the last old allocation in it is freed
+	if(m_evacuating && std::ranges::none_of(m_entries, inSource)) {
+		m_evacuating = false;
+		m_blocksFreed->add();
+		// queued behind the last old allocations, the block is gone by the time it runs
+		m_deletionQueue->defer([allocator = m_allocator, before = m_before]() {
+			fragmentation_stats after = measureFragmentation(*allocator);
+			ENGINE_LOG_INFO("Defragmentation emptied a block: fragmentation {:.3f} -> {:.3f}, {} -> {} blocks, largest free range {} -> {} KiB.",
+				before.fragmentation, after.fragmentation, before.blocks, after.blocks, before.largestFree >> 10, after.largestFree >> 10);
+		});
+	}
+}
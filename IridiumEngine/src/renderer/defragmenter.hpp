@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "deletionQueue.hpp"
+#include "deviceAllocator.hpp"
+#include "stagingUploader.hpp"
+#include "../metrics.hpp"
+
+namespace Iridium {
+	namespace Renderer {
+		struct fragmentation_stats {
+			uint32_t blocks;
+			VkDeviceSize blockBytes;
+			VkDeviceSize freeBytes;
+			VkDeviceSize largestFree;
+			double fragmentation; // 1 - largestFree / freeBytes, 0 while the free space is one range
+		};
+
+		fragmentation_stats measureFragmentation(device_allocator& allocator);
+
+		struct defrag_config {
+			VkDeviceSize bytesPerFrame = VkDeviceSize(4) << 20; // one bigger allocation still moves, on its own
+			float sparseBlock = 0.5f; // blocks used less than this are emptied
+			uint32_t checkInterval = 60; // frames between looking for a sparse block
+		};
+
+		// Empties sparse device_allocator blocks by moving what lives in them into the other blocks,
+		// a few copies per frame recorded ahead of the frame's own work. Only blocks where every
+		// allocation was registered here get picked, anything else pins its block. So does a
+		// registered allocation whose upload hasn't completed, the upload still targets the old handle.
+		//
+		// The owner's handle and device_allocation are rewritten in place while the copy is recorded,
+		// so everything recorded after it already uses the new one. The old resource goes through the
+		// deletion_queue, the frames before it may still be reading it.
+		// Render thread only once the render thread runs.
+		class defragmenter {
+		public:
+			using move_id = uint32_t;
+			// called after an image moved, views and framebuffers of the old one go to the deletion_queue
+			using rebind_function = std::function<void()>;
+
+			void create(VkDevice device, device_allocator& allocator, deletion_queue& deletionQueue, staging_uploader& uploader, const defrag_config& config = {});
+			// the device has to be idle
+			void destroy();
+
+			// both references have to stay valid until remove, the buffer needs transfer source usage,
+			// upload is the last staging_uploader upload into it, it stays put until that completed
+			move_id addBuffer(VkBuffer& buffer, device_allocation& allocation, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, upload_handle upload = {});
+			// needs transfer source and destination usage, the image is expected in layout whenever a frame starts
+			move_id addImage(VkImage& image, device_allocation& allocation, const VkImageCreateInfo& createInfo, VkImageLayout layout, VkImageAspectFlags aspect, VkMemoryPropertyFlags properties, rebind_function rebind, upload_handle upload = {});
+			void remove(move_id id);
+
+			// records this frame's copies, before anything that uses the moved resources
+			void record(VkCommandBuffer commandBuffer);
+		private:
+			struct entry {
+				VkBuffer* buffer = nullptr;
+				VkImage* image = nullptr;
+				device_allocation* allocation = nullptr;
+				VkDeviceSize bufferSize = 0;
+				VkBufferUsageFlags bufferUsage = 0;
+				VkImageCreateInfo imageInfo{};
+				VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+				VkImageAspectFlags aspect = 0;
+				VkMemoryPropertyFlags properties = 0;
+				rebind_function rebind;
+				upload_handle upload;
+				bool live = false;
+			};
+
+			// the copy of a single entry, new resource already bound
+			struct move {
+				move_id id;
+				VkBuffer buffer;
+				VkImage image;
+				device_allocation allocation;
+			};
+
+			VkDevice m_device = VK_NULL_HANDLE;
+			device_allocator* m_allocator = nullptr;
+			deletion_queue* m_deletionQueue = nullptr;
+			staging_uploader* m_uploader = nullptr;
+			defrag_config m_config;
+			std::vector<entry> m_entries;
+			uint64_t m_frames = 0;
+
+			bool m_evacuating = false;
+			uint32_t m_sourceType = 0;
+			uint32_t m_sourceBlock = 0;
+			fragmentation_stats m_before{};
+
+			Metrics::counter* m_movedBytes = nullptr;
+			Metrics::counter* m_blocksFreed = nullptr;
+			std::vector<Metrics::sampler_id> m_samplers;
+
+			void pickSource();
+			bool moveEntry(move_id id, move& result);
+			void recordCopies(VkCommandBuffer commandBuffer, const std::vector<move>& moves);
+		};
+	}
+}
@@ -0,0 +1,116 @@
+#include "deletionQueue.hpp"
+
+namespace IrR = Iridium::Renderer;
+
+void IrR::deletion_queue::create(VkDevice device, device_allocator& allocator) {
+	m_device = device;
+	m_allocator = &allocator;
+	m_frame = 0;
+	m_sampler = Metrics::addSampler("iridium_deletion_queue_pending", "Vulkan objects waiting for the GPU to finish the frames that used them.", {}, [this]() -> double {
+		return double(pending());
+	});
+}
+
+void IrR::deletion_queue::destroy() {
+	Metrics::removeSampler(m_sampler);
+	while(pending() != 0)
+		retire(UINT64_MAX);
+}
+
+void IrR::deletion_queue::beginFrame(uint64_t frame) {
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	m_frame = frame;
+}
+
+void IrR::deletion_queue::retire(uint64_t completedFrame) {
+	// released outside the lock, a destroy function is free to queue more
+	std::deque<entry> done;
+	{
+		std::scoped_lock<std::mutex> lock(m_mutex);
+		while(!m_entries.empty() && m_entries.front().frame <= completedFrame) {
+			done.push_back(std::move(m_entries.front()));
+			m_entries.pop_front();
+		}
+	}
+	for(entry& old : done)
+		release(old);
+}
+
+void IrR::deletion_queue::release(entry& old) {
+	switch(old.type) {
+		case object_type::buffer:
+			vkDestroyBuffer(m_device, (VkBuffer)old.handle, nullptr);
+			m_allocator->free(old.allocation);
+			break;
+		case object_type::image:
+			vkDestroyImage(m_device, (VkImage)old.handle, nullptr);
+			m_allocator->free(old.allocation);
+			break;
+		case object_type::imageView:
+			vkDestroyImageView(m_device, (VkImageView)old.handle, nullptr);
+			break;
+		case object_type::framebuffer:
+			vkDestroyFramebuffer(m_device, (VkFramebuffer)old.handle, nullptr);
+			break;
+		case object_type::pipeline:
+			vkDestroyPipeline(m_device, (VkPipeline)old.handle, nullptr);
+			break;
+		case object_type::swapchain:
+			vkDestroySwapchainKHR(m_device, (VkSwapchainKHR)old.handle, nullptr);
+			break;
+		case object_type::memory:
+			m_allocator->free(old.allocation);
+			break;
+		case object_type::function:
+			old.destroy();
+			break;
+	}
+}
+
+void IrR::deletion_queue::push(object_type type, uint64_t handle, const device_allocation& allocation, std::function<void()> destroy) {
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	m_entries.push_back({
+		.frame = m_frame,
+		.type = type,
+		.handle = handle,
+		.allocation = allocation,
+		.destroy = std::move(destroy)
+	});
+}
+
+void IrR::deletion_queue::destroyBuffer(VkBuffer buffer, const device_allocation& allocation) {
+	push(object_type::buffer, (uint64_t)buffer, allocation);
+}
+
+void IrR::deletion_queue::destroyImage(VkImage image, const device_allocation& allocation) {
+	push(object_type::image, (uint64_t)image, allocation);
+}
+
+void IrR::deletion_queue::destroyImageView(VkImageView view) {
+	push(object_type::imageView, (uint64_t)view);
+}
+
+void IrR::deletion_queue::destroyFramebuffer(VkFramebuffer framebuffer) {
+	push(object_type::framebuffer, (uint64_t)framebuffer);
+}
+
+void IrR::deletion_queue::destroyPipeline(VkPipeline pipeline) {
+	push(object_type::pipeline, (uint64_t)pipeline);
+}
+
+void IrR::deletion_queue::destroySwapchain(VkSwapchainKHR swapchain) {
+	push(object_type::swapchain, (uint64_t)swapchain);
+}
+
+void IrR::deletion_queue::free(const device_allocation& allocation) {
+	push(object_type::memory, 0, allocation);
+}
+
+void IrR::deletion_queue::defer(std::function<void()> destroy) {
+	push(object_type::function, 0, {}, std::move(destroy));
+}
+
+size_t IrR::deletion_queue::pending() {
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	return m_entries.size();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+#include <vulkan/vulkan_core.h>
+
+#include "deviceAllocator.hpp"
+#include "../metrics.hpp"
+
+namespace Iridium {
+	namespace Renderer {
+		// Vulkan objects destroyed once the GPU is past the last frame that could use them, instead of
+		// draining the device. Everything queued is tagged with the frame being recorded and runs, in the
+		// order it was queued, when retire is told that frame completed.
+		//
+		// Queueing is safe from any thread, beginFrame and retire belong to the render thread.
+		class deletion_queue {
+		public:
+			void create(VkDevice device, device_allocator& allocator);
+			// runs everything still queued, the device has to be idle
+			void destroy();
+
+			// frame numbers only go up, what's queued from here on waits for frame
+			void beginFrame(uint64_t frame);
+			// the GPU is done with every frame up to and including completedFrame
+			void retire(uint64_t completedFrame);
+
+			void destroyBuffer(VkBuffer buffer, const device_allocation& allocation);
+			void destroyImage(VkImage image, const device_allocation& allocation);
+			void destroyImageView(VkImageView view);
+			void destroyFramebuffer(VkFramebuffer framebuffer);
+			void destroyPipeline(VkPipeline pipeline);
+			void destroySwapchain(VkSwapchainKHR swapchain);
+			void free(const device_allocation& allocation);
+			void defer(std::function<void()> destroy);
+
+			size_t pending();
+		private:
+			enum class object_type : uint8_t {
+				buffer,
+				image,
+				imageView,
+				framebuffer,
+				pipeline,
+				swapchain,
+				memory,
+				function
+			};
+
+			struct entry {
+				uint64_t frame;
+				object_type type;
+				uint64_t handle; // non-dispatchable handles fit in 64 bits everywhere
+				device_allocation allocation;
+				std::function<void()> destroy;
+			};
+
+			VkDevice m_device = VK_NULL_HANDLE;
+			device_allocator* m_allocator = nullptr;
+
+			std::mutex m_mutex;
+			std::deque<entry> m_entries; // sorted by frame, beginFrame only goes forward
+			uint64_t m_frame = 0;
+			Metrics::sampler_id m_sampler{};
+
+			void push(object_type type, uint64_t handle, const device_allocation& allocation = {}, std::function<void()> destroy = {});
+			void release(entry& old);
+		};
+	}
+}
@@ -0,0 +1,314 @@
+#include "deviceAllocator.hpp"
+
+#include <algorithm>
+
+#include "vulkan.hpp"
+#include "../log.hpp"
+
+namespace IrR = Iridium::Renderer;
+
+namespace {
+	VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+void IrR::device_allocator::create(VkPhysicalDevice physicalDevice, VkDevice device, memory_budget& budget) {
+	m_device = device;
+	m_budget = &budget;
+	m_properties = budget.memoryProperties();
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	m_bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+
+	for(uint32_t type = 0; type < m_properties.memoryTypeCount; type++) {
+		VkDeviceSize heapSize = m_properties.memoryHeaps[m_properties.memoryTypes[type].heapIndex].size;
+		m_pools[type].blockSize = heapSize >= (VkDeviceSize(1) << 30) ? BLOCK_SIZE : alignUp(heapSize / 8, MIN_ALIGNMENT);
+	}
+}
+
+void IrR::device_allocator::destroy() {
+	uint32_t leaked = 0;
+	std::vector<VkDeviceMemory> released;
+	for(memory_pool& pool : m_pools) {
+		std::scoped_lock<std::mutex> lock(pool.mutex);
+		for(auto& memoryBlock : pool.blocks) {
+			if(!memoryBlock)
+				continue;
+			leaked += memoryBlock->tlsf.allocationCount();
+			released.push_back(memoryBlock->memory);
+		}
+		pool.blocks.clear();
+		leaked += pool.dedicated;
+		pool.dedicated = 0;
+	}
+	for(VkDeviceMemory memory : released)
+		m_budget->free(memory);
+	if(leaked != 0)
+		ENGINE_LOG_WARN("{} device memory allocations were never freed.", leaked);
+}
+
+uint32_t IrR::device_allocator::findMemoryType(uint32_t filter, VkMemoryPropertyFlags properties) const {
+	for(uint32_t i = 0; i < m_properties.memoryTypeCount; i++) {
+		if(filter & (1 << i) && (m_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+
+	throw Iridium::Renderer::renderer_error("Failed to find suitable memory type.");
+}
+
+void* IrR::device_allocator::mapIfHostVisible(VkDeviceMemory memory, uint32_t memoryType) {
+	if(!(m_properties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+		return nullptr;
+	void* mapped = nullptr;
+	if(vkMapMemory(m_device, memory, 0, VK_WHOLE_SIZE, 0, &mapped) != VK_SUCCESS)
+		throw Iridium::Renderer::renderer_error("Failed to map device memory.");
+	return mapped;
+}
+
+IrR::device_allocation IrR::device_allocator::allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties) {
+	VkMemoryDedicatedRequirements dedicatedRequirements{};
+	dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+	VkMemoryRequirements2 requirements{};
+	requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	requirements.pNext = &dedicatedRequirements;
+	VkBufferMemoryRequirementsInfo2 requirementsInfo{};
+	requirementsInfo.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_REQUIREMENTS_INFO_2;
+	requirementsInfo.buffer = buffer;
+	vkGetBufferMemoryRequirements2(m_device, &requirementsInfo, &requirements);
+
+	VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+	dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+	dedicatedInfo.buffer = buffer;
+	bool dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+	device_allocation allocation = allocate(requirements.memoryRequirements, properties, dedicated, false, dedicatedInfo);
+
+	if(vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+		free(allocation);
+		throw Iridium::Renderer::renderer_error("Failed to bind buffer memory.");
+	}
+	return allocation;
+}
+
+IrR::device_allocation IrR::device_allocator::allocateImage(VkImage image, VkMemoryPropertyFlags properties) {
+	VkMemoryDedicatedRequirements dedicatedRequirements{};
+	dedicatedRequirements.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS;
+	VkMemoryRequirements2 requirements{};
+	requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+	requirements.pNext = &dedicatedRequirements;
+	VkImageMemoryRequirementsInfo2 requirementsInfo{};
+	requirementsInfo.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2;
+	requirementsInfo.image = image;
+	vkGetImageMemoryRequirements2(m_device, &requirementsInfo, &requirements);
+
+	VkMemoryDedicatedAllocateInfo dedicatedInfo{};
+	dedicatedInfo.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO;
+	dedicatedInfo.image = image;
+	bool dedicated = dedicatedRequirements.prefersDedicatedAllocation || dedicatedRequirements.requiresDedicatedAllocation;
+	// every image we make is optimal tiling
+	device_allocation allocation = allocate(requirements.memoryRequirements, properties, dedicated, true, dedicatedInfo);
+
+	if(vkBindImageMemory(m_device, image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+		free(allocation);
+		throw Iridium::Renderer::renderer_error("Failed to bind image memory.");
+	}
+	return allocation;
+}
+
+IrR::device_allocation IrR::device_allocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool dedicated, bool optimalImage, const VkMemoryDedicatedAllocateInfo& dedicatedInfo) {
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+	memory_pool& pool = m_pools[memoryType];
+
+	VkDeviceSize alignment = std::max(requirements.alignment, MIN_ALIGNMENT);
+	VkDeviceSize size = requirements.size;
+	if(optimalImage) {
+		// keeps linear buffers off the image's pages, so neighbours never alias under bufferImageGranularity
+		alignment = std::max(alignment, m_bufferImageGranularity);
+		size = alignUp(size, m_bufferImageGranularity);
+	}
+	size = alignUp(size, MIN_ALIGNMENT);
+
+	if(dedicated || size > pool.blockSize / 2)
+		return allocateDedicated(requirements.size, memoryType, dedicated ? &dedicatedInfo : nullptr);
+
+	auto place = [&](uint32_t index) -> device_allocation {
+		block& target = *pool.blocks[index];
+		tlsf_allocator::allocation placed = target.tlsf.allocate(size, alignment);
+		if(placed.node == tlsf_allocator::NO_NODE)
+			return {};
+		return {
+			.memory = target.memory,
+			.offset = placed.offset,
+			.size = size,
+			.mapped = target.mapped ? static_cast<std::byte*>(target.mapped) + placed.offset : nullptr,
+			.memoryType = memoryType,
+			.block = index,
+			.node = placed.node
+		};
+	};
+	auto placeInBlocks = [&]() -> device_allocation {
+		for(uint32_t index = 0; index < uint32_t(pool.blocks.size()); index++) {
+			if(!pool.blocks[index] || pool.blocks[index]->evacuating)
+				continue;
+			device_allocation allocation = place(index);
+			if(allocation.memory != VK_NULL_HANDLE)
+				return allocation;
+		}
+		return {};
+	};
+
+	std::unique_lock<std::mutex> lock(pool.mutex);
+	device_allocation allocation = placeInBlocks();
+	if(allocation.memory != VK_NULL_HANDLE)
+		return allocation;
+	lock.unlock();
+
+	std::unique_ptr<block> created = createBlock(memoryType);
+	if(!created) {
+		// the heap can't take another whole block, but maybe it can take just this
+		return allocateDedicated(requirements.size, memoryType, nullptr);
+	}
+
+	lock.lock();
+	// another thread, or a pressure callback, may have made room in the meantime
+	allocation = placeInBlocks();
+	if(allocation.memory == VK_NULL_HANDLE)
+		return place(insertBlock(pool, std::move(created)));
+	lock.unlock();
+	m_budget->free(created->memory);
+	return allocation;
+}
+
+IrR::device_allocation IrR::device_allocator::allocateDedicated(VkDeviceSize size, uint32_t memoryType, const VkMemoryDedicatedAllocateInfo* dedicatedInfo) {
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+	allocInfo.pNext = dedicatedInfo;
+
+	device_allocation allocation{};
+	if(m_budget->allocate(allocInfo, allocation.memory) != VK_SUCCESS)
+		throw Iridium::Renderer::renderer_error("Failed to allocate device memory.");
+	allocation.size = size;
+	allocation.memoryType = memoryType;
+	allocation.block = DEDICATED;
+	try {
+		allocation.mapped = mapIfHostVisible(allocation.memory, memoryType);
+	} catch(...) {
+		m_budget->free(allocation.memory);
+		throw;
+	}
+
+	std::scoped_lock<std::mutex> lock(m_pools[memoryType].mutex);
+	m_pools[memoryType].dedicated++;
+	return allocation;
+}
+
+std::unique_ptr<IrR::device_allocator::block> IrR::device_allocator::createBlock(uint32_t memoryType) {
+	VkDeviceSize blockSize = m_pools[memoryType].blockSize; // never changes after create
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = blockSize;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	VkDeviceMemory memory;
+	if(m_budget->allocate(allocInfo, memory) != VK_SUCCESS)
+		return nullptr;
+	try {
+		return std::make_unique<block>(memory, mapIfHostVisible(memory, memoryType), tlsf_allocator(blockSize));
+	} catch(...) {
+		m_budget->free(memory);
+		throw;
+	}
+}
+
+uint32_t IrR::device_allocator::insertBlock(memory_pool& pool, std::unique_ptr<block> created) {
+	auto slot = std::find(pool.blocks.begin(), pool.blocks.end(), nullptr);
+	if(slot == pool.blocks.end())
+		slot = pool.blocks.insert(pool.blocks.end(), nullptr);
+	*slot = std::move(created);
+	return uint32_t(slot - pool.blocks.begin());
+}
+
+void IrR::device_allocator::free(device_allocation& allocation) {
+	if(allocation.memory == VK_NULL_HANDLE)
+		return;
+	memory_pool& pool = m_pools[allocation.memoryType];
+
+	if(allocation.block == DEDICATED) {
+		m_budget->free(allocation.memory); // implicitly unmapped
+		std::scoped_lock<std::mutex> lock(pool.mutex);
+		pool.dedicated--;
+	} else {
+		VkDeviceMemory released = VK_NULL_HANDLE;
+		{
+			std::scoped_lock<std::mutex> lock(pool.mutex);
+			block& target = *pool.blocks[allocation.block];
+			target.tlsf.free(allocation.node);
+			// one empty block is kept around, so a buffer bouncing in and out doesn't hit the driver every time
+			if(target.tlsf.empty()) {
+				bool otherEmpty = std::ranges::any_of(pool.blocks, [&](const auto& other) {
+					return other && other.get() != &target && other->tlsf.empty();
+				});
+				if(otherEmpty || target.evacuating) {
+					released = target.memory;
+					pool.blocks[allocation.block].reset();
+				}
+			}
+		}
+		// after unlocking, the pressure callbacks may free into this pool
+		m_budget->free(released);
+	}
+	allocation = {};
+}
+
+IrR::device_allocator::stats IrR::device_allocator::getStats() {
+	stats total{};
+	for(memory_pool& pool : m_pools) {
+		std::scoped_lock<std::mutex> lock(pool.mutex);
+		for(const auto& memoryBlock : pool.blocks) {
+			if(!memoryBlock)
+				continue;
+			total.blocks++;
+			total.allocations += memoryBlock->tlsf.allocationCount();
+			total.blockBytes += memoryBlock->tlsf.size();
+			total.usedBytes += memoryBlock->tlsf.usedBytes();
+			if(!memoryBlock->evacuating)
+				total.largestFree = std::max(total.largestFree, memoryBlock->tlsf.largestFree());
+		}
+		total.dedicated += pool.dedicated;
+		total.allocations += pool.dedicated;
+	}
+	return total;
+}
+
+std::vector<IrR::device_allocator::block_info> IrR::device_allocator::getBlocks() {
+	std::vector<block_info> blocks;
+	for(uint32_t type = 0; type < m_properties.memoryTypeCount; type++) {
+		std::scoped_lock<std::mutex> lock(m_pools[type].mutex);
+		for(uint32_t index = 0; index < uint32_t(m_pools[type].blocks.size()); index++) {
+			const auto& memoryBlock = m_pools[type].blocks[index];
+			if(!memoryBlock)
+				continue;
+			blocks.push_back({
+				.memoryType = type,
+				.block = index,
+				.size = memoryBlock->tlsf.size(),
+				.usedBytes = memoryBlock->tlsf.usedBytes(),
+				.largestFree = memoryBlock->tlsf.largestFree(),
+				.allocations = memoryBlock->tlsf.allocationCount(),
+				.evacuating = memoryBlock->evacuating
+			});
+		}
+	}
+	return blocks;
+}
+
+void IrR::device_allocator::setEvacuating(uint32_t memoryType, uint32_t block, bool evacuating) {
+	memory_pool& pool = m_pools[memoryType];
+	std::scoped_lock<std::mutex> lock(pool.mutex);
+	if(block < pool.blocks.size() && pool.blocks[block])
+		pool.blocks[block]->evacuating = evacuating;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "memoryBudget.hpp"
+#include "tlsf.hpp"
+
+namespace Iridium {
+	namespace Renderer {
+		struct device_allocation {
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+			void* mapped = nullptr; // host visible memory stays mapped for its whole life
+			uint32_t memoryType = 0;
+			uint32_t block = 0;     // device_allocator::DEDICATED for its own vkAllocateMemory
+			uint32_t node = 0;
+		};
+
+		// Sub-allocates buffers and images out of big blocks, one set of blocks per memory type,
+		// so a small buffer costs a TLSF lookup instead of a driver allocation and the
+		// maxMemoryAllocationCount limit stays far away. Blocks go through memory_budget,
+		// so its numbers are in blocks rather than buffers. Safe from any thread.
+		class device_allocator {
+		public:
+			enum : uint32_t {
+				DEDICATED = UINT32_MAX
+			};
+
+			static constexpr VkDeviceSize BLOCK_SIZE = VkDeviceSize(64) << 20; // smaller on heaps under 1 GiB
+			static constexpr VkDeviceSize MIN_ALIGNMENT = 256;                 // covers nonCoherentAtomSize on every device we know
+
+			struct stats {
+				uint32_t blocks;
+				uint32_t dedicated;
+				uint32_t allocations; // sub-allocations and dedicated ones
+				VkDeviceSize blockBytes;
+				VkDeviceSize usedBytes;
+				VkDeviceSize largestFree; // the biggest sub-allocation that fits without a new block
+			};
+
+			struct block_info {
+				uint32_t memoryType;
+				uint32_t block;
+				VkDeviceSize size;
+				VkDeviceSize usedBytes;
+				VkDeviceSize largestFree;
+				uint32_t allocations;
+				bool evacuating;
+			};
+
+			void create(VkPhysicalDevice physicalDevice, VkDevice device, memory_budget& budget);
+			void destroy();
+
+			uint32_t findMemoryType(uint32_t filter, VkMemoryPropertyFlags properties) const;
+
+			// allocate and bind, the driver decides if it wants a dedicated allocation
+			device_allocation allocateBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties);
+			device_allocation allocateImage(VkImage image, VkMemoryPropertyFlags properties);
+			void free(device_allocation& allocation);
+
+			stats getStats();
+			std::vector<block_info> getBlocks();
+			// nothing new is placed in an evacuating block, and it's freed as soon as it's empty
+			void setEvacuating(uint32_t memoryType, uint32_t block, bool evacuating);
+		private:
+			struct block {
+				VkDeviceMemory memory;
+				void* mapped;
+				tlsf_allocator tlsf;
+				bool evacuating = false;
+			};
+
+			struct memory_pool {
+				std::mutex mutex;
+				std::vector<std::unique_ptr<block>> blocks; // freed ones stay as nullptr, allocations keep their index
+				VkDeviceSize blockSize = 0;
+				uint32_t dedicated = 0;
+			};
+
+			VkDevice m_device = VK_NULL_HANDLE;
+			memory_budget* m_budget = nullptr;
+			VkPhysicalDeviceMemoryProperties m_properties{};
+			VkDeviceSize m_bufferImageGranularity = 1;
+			memory_pool m_pools[VK_MAX_MEMORY_TYPES];
+
+			device_allocation allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool dedicated, bool optimalImage, const VkMemoryDedicatedAllocateInfo& dedicatedInfo);
+			device_allocation allocateDedicated(VkDeviceSize size, uint32_t memoryType, const VkMemoryDedicatedAllocateInfo* dedicatedInfo);
+			// without the pool's lock, memory_budget may run pressure callbacks that free into the pool;
+			// nullptr when the heap is out of memory
+			std::unique_ptr<block> createBlock(uint32_t memoryType);
+			// needs the pool's lock, returns the block's index
+			uint32_t insertBlock(memory_pool& pool, std::unique_ptr<block> created);
+			void* mapIfHostVisible(VkDeviceMemory memory, uint32_t memoryType);
+		};
+	}
+}
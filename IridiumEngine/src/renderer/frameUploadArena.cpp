@@ -0,0 +1,85 @@
+#include "frameUploadArena.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <format>
+
+#include "vulkan.hpp"
+#include "../log.hpp"
+
+namespace IrR = Iridium::Renderer;
+
+void IrR::frame_upload_arena::create(VkDevice device, VkPhysicalDevice physicalDevice, device_allocator& allocator, uint32_t framesInFlight, VkDeviceSize capacity) {
+	m_device = device;
+	m_allocator = &allocator;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	// 16 keeps vec4s and vertex attributes aligned too
+	m_uniformAlignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+
+	m_slots.assign(framesInFlight, {});
+	for(slot& target : m_slots)
+		createSlot(target, capacity);
+	m_frame = 0;
+	m_offset.store(0, std::memory_order_relaxed);
+}
+
+void IrR::frame_upload_arena::destroy() {
+	for(slot& target : m_slots)
+		destroySlot(target);
+	m_slots.clear();
+}
+
+void IrR::frame_upload_arena::createSlot(slot& target, VkDeviceSize capacity) {
+	VkBufferCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	createInfo.size = capacity;
+	createInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if(vkCreateBuffer(m_device, &createInfo, nullptr, &target.buffer) != VK_SUCCESS)
+		throw renderer_error("Failed to create a frame upload buffer.");
+	target.allocation = m_allocator->allocateBuffer(target.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	target.capacity = capacity;
+}
+
+void IrR::frame_upload_arena::destroySlot(slot& target) {
+	vkDestroyBuffer(m_device, target.buffer, nullptr);
+	m_allocator->free(target.allocation);
+	target = {};
+}
+
+bool IrR::frame_upload_arena::reset(uint32_t frame, VkDeviceSize minimumBytes) {
+	m_peak = std::max(m_peak, m_offset.load(std::memory_order_relaxed));
+	m_frame = frame;
+	m_offset.store(0, std::memory_order_relaxed);
+
+	slot& target = m_slots[frame];
+	if(minimumBytes <= target.capacity)
+		return false;
+	VkDeviceSize capacity = std::bit_ceil(minimumBytes);
+	ENGINE_LOG_INFO("Frame upload buffer {} grows from {} to {} KiB.", frame, target.capacity / 1024, capacity / 1024);
+	destroySlot(target);
+	createSlot(target, capacity);
+	return true;
+}
+
+IrR::frame_allocation IrR::frame_upload_arena::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+	if(alignment == 0)
+		alignment = m_uniformAlignment;
+	const slot& target = m_slots[m_frame];
+
+	VkDeviceSize offset = m_offset.load(std::memory_order_relaxed);
+	VkDeviceSize aligned;
+	do {
+		aligned = (offset + alignment - 1) / alignment * alignment;
+		if(aligned + size > target.capacity)
+			throw renderer_error(std::format("Frame upload buffer is full, {} of {} bytes used and {} more asked for.", offset, target.capacity, size));
+	} while(!m_offset.compare_exchange_weak(offset, aligned + size, std::memory_order_relaxed));
+
+	return {
+		.buffer = target.buffer,
+		.offset = uint32_t(aligned),
+		.mapped = static_cast<std::byte*>(target.allocation.mapped) + aligned
+	};
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "deviceAllocator.hpp"
+
+namespace Iridium {
+	namespace Renderer {
+		struct frame_allocation {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			uint32_t offset = 0; // what goes into vkCmdBindDescriptorSets' dynamic offsets or vkCmdBindVertexBuffers
+			void* mapped = nullptr;
+		};
+
+		// One persistently mapped, host coherent buffer per frame slot, bump allocated for whatever the
+		// frame writes from the CPU: uniforms, per-draw constants, dynamic vertices and indices. A slot is
+		// reset once its in-flight fence is waited on, nothing is ever freed on its own.
+		//
+		// The buffers only change in reset, so descriptor sets pointing at them get written once and every
+		// allocation after is bound through a dynamic offset. allocate is safe from any thread.
+		class frame_upload_arena {
+		public:
+			static constexpr VkDeviceSize DEFAULT_CAPACITY = VkDeviceSize(4) << 20;
+
+			void create(VkDevice device, VkPhysicalDevice physicalDevice, device_allocator& allocator, uint32_t framesInFlight, VkDeviceSize capacity = DEFAULT_CAPACITY);
+			// the device has to be idle
+			void destroy();
+
+			// Starts allocating from frame's slot, its fence has to be retired. The slot grows when it's
+			// smaller than minimumBytes, true means its buffer was replaced and descriptors need rewriting.
+			bool reset(uint32_t frame, VkDeviceSize minimumBytes = 0);
+
+			// alignment 0 is uniformAlignment(), throws when the slot is full
+			frame_allocation allocate(VkDeviceSize size, VkDeviceSize alignment = 0);
+
+			VkBuffer buffer(uint32_t frame) const { return m_slots[frame].buffer; }
+			VkDeviceSize capacity(uint32_t frame) const { return m_slots[frame].capacity; }
+			// minUniformBufferOffsetAlignment, dynamic offsets have to be multiples of it
+			VkDeviceSize uniformAlignment() const { return m_uniformAlignment; }
+			// uniformAlignment rounded up to hold size
+			VkDeviceSize stride(VkDeviceSize size) const { return (size + m_uniformAlignment - 1) / m_uniformAlignment * m_uniformAlignment; }
+			VkDeviceSize used() const { return m_offset.load(std::memory_order_relaxed); }
+			VkDeviceSize peak() const { return m_peak; }
+		private:
+			struct slot {
+				VkBuffer buffer = VK_NULL_HANDLE;
+				device_allocation allocation;
+				VkDeviceSize capacity = 0;
+			};
+
+			VkDevice m_device = VK_NULL_HANDLE;
+			device_allocator* m_allocator = nullptr;
+			VkDeviceSize m_uniformAlignment = 0;
+			std::vector<slot> m_slots;
+			uint32_t m_frame = 0;
+			std::atomic<VkDeviceSize> m_offset{0};
+			VkDeviceSize m_peak = 0;
+
+			void createSlot(slot& target, VkDeviceSize capacity);
+			void destroySlot(slot& target);
+		};
+	}
+}
@@ -0,0 +1,215 @@
+#include "gpuProfiler.hpp"
+
+#include <bit>
+
+#include "vulkan.hpp"
+#include "../frameStats.hpp"
+#include "../log.hpp"
+
+void Iridium::Renderer::gpu_profiler::create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameCount, [[maybe_unused]] VkQueue queue, [[maybe_unused]] VkCommandPool commandPool, bool pipelineStatistics) {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+	uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 0;
+	if(validBits == 0 || properties.limits.timestampPeriod == 0.0f) {
+		ENGINE_LOG_WARN("The graphics queue doesn't support timestamps, GPU timing and pipeline statistics are disabled.");
+		return;
+	}
+
+	m_device = device;
+	m_period = properties.limits.timestampPeriod;
+	m_validMask = validBits == 64 ? UINT64_MAX : (uint64_t(1) << validBits) - 1;
+	m_results.resize(MAX_QUERIES);
+	m_openScopes.reserve(16);
+	if(pipelineStatistics) {
+		m_statisticsFlags = PIPELINE_STATISTICS;
+		m_statisticsResults.resize(MAX_PASSES * std::popcount(PIPELINE_STATISTICS));
+	}
+
+	m_slots.resize(frameCount);
+	for(frame_slot& slot : m_slots) {
+		VkQueryPoolCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		createInfo.queryCount = MAX_QUERIES;
+		if(vkCreateQueryPool(m_device, &createInfo, nullptr, &slot.pool) != VK_SUCCESS)
+			throw Iridium::Renderer::renderer_error("Failed to create timestamp query pool.");
+		slot.scopes.reserve(MAX_QUERIES / 2);
+
+		if(m_statisticsFlags) {
+			createInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			createInfo.queryCount = MAX_PASSES;
+			createInfo.pipelineStatistics = m_statisticsFlags;
+			if(vkCreateQueryPool(m_device, &createInfo, nullptr, &slot.statisticsPool) != VK_SUCCESS)
+				throw Iridium::Renderer::renderer_error("Failed to create pipeline statistics query pool.");
+		}
+	}
+
+#if IRIDIUM_PROFILE
+	calibrate(queue, commandPool);
+	m_track = Profiler::createTrack("GPU");
+#endif
+	ENGINE_LOG_INFO("GPU timing with {} ns timestamp period and {} valid bits.", m_period, validBits);
+}
+
+void Iridium::Renderer::gpu_profiler::destroy() {
+	for(frame_slot& slot : m_slots) {
+		vkDestroyQueryPool(m_device, slot.pool, nullptr);
+		vkDestroyQueryPool(m_device, slot.statisticsPool, nullptr);
+	}
+	m_slots.clear();
+	m_current = nullptr;
+}
+
+#if IRIDIUM_PROFILE
+// Puts GPU ticks on the profiler's clock. The timestamp lands somewhere between submit and idle,
+// so the midpoint is off by at most half a round trip.
+void Iridium::Renderer::gpu_profiler::calibrate(VkQueue queue, VkCommandPool commandPool) {
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	VkCommandBuffer commandBuffer;
+	vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	vkCmdResetQueryPool(commandBuffer, m_slots[0].pool, 0, 1);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_slots[0].pool, 0);
+	vkEndCommandBuffer(commandBuffer);
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	int64_t submitTime = Profiler::now();
+	vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+	vkQueueWaitIdle(queue);
+	int64_t idleTime = Profiler::now();
+	vkFreeCommandBuffers(m_device, commandPool, 1, &commandBuffer);
+
+	uint64_t ticks = 0;
+	vkGetQueryPoolResults(m_device, m_slots[0].pool, 0, 1, sizeof(ticks), &ticks, sizeof(ticks), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	m_cpuOffset = submitTime + (idleTime - submitTime) / 2 - int64_t(double(ticks & m_validMask) * m_period);
+}
+#endif
+
+void Iridium::Renderer::gpu_profiler::collect(frame_slot& slot) {
+	if(!slot.submitted)
+		return;
+
+	if(slot.usedPasses) {
+		// results come in flag bit order, the counters are declared in the same order
+		constexpr uint32_t STATISTICS_COUNT = std::popcount(PIPELINE_STATISTICS);
+		VkResult result = vkGetQueryPoolResults(m_device, slot.statisticsPool, 0, slot.usedPasses, slot.usedPasses * STATISTICS_COUNT * sizeof(uint64_t), m_statisticsResults.data(), STATISTICS_COUNT * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+		if(result == VK_SUCCESS) {
+			uint64_t totals[STATISTICS_COUNT] = {};
+			for(uint32_t pass = 0; pass < slot.usedPasses; pass++) {
+				for(uint32_t statistic = 0; statistic < STATISTICS_COUNT; statistic++)
+					totals[statistic] += m_statisticsResults[pass * STATISTICS_COUNT + statistic];
+			}
+			for(uint32_t statistic = 0; statistic < STATISTICS_COUNT; statistic++)
+				FrameStats::count(FrameStats::counter(uint32_t(FrameStats::counter::inputVertices) + statistic), totals[statistic]);
+		}
+	}
+
+	if(slot.usedQueries == 0)
+		return;
+	// the fence already retired, so anything not available now never will be
+	VkResult result = vkGetQueryPoolResults(m_device, slot.pool, 0, slot.usedQueries, slot.usedQueries * sizeof(uint64_t), m_results.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if(result != VK_SUCCESS)
+		return;
+
+	for(const scope& finished : slot.scopes) {
+		uint64_t begin = m_results[finished.beginQuery] & m_validMask;
+		uint64_t ticks = ((m_results[finished.endQuery] & m_validMask) - begin) & m_validMask;
+		int64_t duration = int64_t(double(ticks) * m_period);
+		if(&finished == &slot.scopes.front())
+			FrameStats::record(FrameStats::metric::gpu, duration);
+#if IRIDIUM_PROFILE
+		int64_t start = m_cpuOffset + int64_t(double(begin) * m_period);
+		Profiler::recordZone(m_track, finished.name, start, start + duration, slot.frame);
+#endif
+	}
+}
+
+void Iridium::Renderer::gpu_profiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t slotIndex) {
+	if(m_slots.empty())
+		return;
+
+	frame_slot& slot = m_slots[slotIndex];
+	collect(slot);
+
+	slot.scopes.clear();
+	slot.usedQueries = 0;
+	slot.usedPasses = 0;
+#if IRIDIUM_PROFILE
+	slot.frame = Profiler::currentFrame();
+#endif
+	slot.submitted = true; // recorded now, the caller submits before this slot comes around again
+	m_openScopes.clear();
+	m_openPass = NO_SCOPE;
+	m_passDepth = 0;
+	m_current = &slot;
+	vkCmdResetQueryPool(commandBuffer, slot.pool, 0, MAX_QUERIES);
+	if(m_statisticsFlags)
+		vkCmdResetQueryPool(commandBuffer, slot.statisticsPool, 0, MAX_PASSES);
+	beginScope(commandBuffer, "frame");
+}
+
+void Iridium::Renderer::gpu_profiler::endFrame(VkCommandBuffer commandBuffer) {
+	endScope(commandBuffer);
+	m_current = nullptr;
+}
+
+void Iridium::Renderer::gpu_profiler::beginScope(VkCommandBuffer commandBuffer, const char* name) {
+	if(m_current == nullptr)
+		return;
+	if(m_current->usedQueries + 2 > MAX_QUERIES) {
+		m_openScopes.push_back(NO_SCOPE); // still has to be matched by its endScope
+		return;
+	}
+
+	// the end query is taken right away, so a scope that was opened can always be closed
+	uint32_t query = m_current->usedQueries;
+	m_current->usedQueries += 2;
+	m_openScopes.push_back(uint32_t(m_current->scopes.size()));
+	m_current->scopes.push_back({name, query, query + 1});
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_current->pool, query);
+}
+
+void Iridium::Renderer::gpu_profiler::endScope(VkCommandBuffer commandBuffer) {
+	if(m_current == nullptr || m_openScopes.empty())
+		return;
+
+	uint32_t open = m_openScopes.back();
+	m_openScopes.pop_back();
+	if(open != NO_SCOPE)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_current->pool, m_current->scopes[open].endQuery);
+}
+
+void Iridium::Renderer::gpu_profiler::beginPass(VkCommandBuffer commandBuffer, const char* name) {
+	beginScope(commandBuffer, name);
+	// a query type can only be active once, so a nested pass counts towards the outer one
+	if(m_passDepth++ != 0 || m_current == nullptr || m_statisticsFlags == 0 || m_current->usedPasses == MAX_PASSES)
+		return;
+	m_openPass = m_current->usedPasses++;
+	vkCmdBeginQuery(commandBuffer, m_current->statisticsPool, m_openPass, 0);
+}
+
+void Iridium::Renderer::gpu_profiler::endPass(VkCommandBuffer commandBuffer) {
+	if(m_passDepth > 0 && --m_passDepth == 0 && m_openPass != NO_SCOPE) {
+		vkCmdEndQuery(commandBuffer, m_current->statisticsPool, m_openPass);
+		m_openPass = NO_SCOPE;
+	}
+	endScope(commandBuffer);
+}
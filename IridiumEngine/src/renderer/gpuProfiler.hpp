@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "../profiler.hpp"
+
+#if IRIDIUM_PROFILE
+#define IRIDIUM_GPU_PROFILE_SCOPE(PROFILER, COMMAND_BUFFER, NAME) Iridium::Renderer::gpu_scope IRIDIUM_PROFILE_CONCAT(__gpuProfileZone, __COUNTER__)(PROFILER, COMMAND_BUFFER, NAME)
+#else
+#define IRIDIUM_GPU_PROFILE_SCOPE(PROFILER, COMMAND_BUFFER, NAME)
+#endif
+
+namespace Iridium {
+	namespace Renderer {
+		// Timestamp queries in a query pool per frame in flight. A slot's results are read back when it
+		// comes around again, after its in-flight fence was waited on, so reading never stalls.
+		// The whole frame is always timed for FrameStats. With IRIDIUM_PROFILE the scopes also end up on
+		// a "GPU" track of the CPU profiler, tagged with the CPU frame they were recorded in.
+		// Passes are scopes that can also carry a pipeline statistics query, summed into FrameStats' counters.
+		// Neither can be opened inside a render pass that executes secondary command buffers.
+		class gpu_profiler {
+		public:
+			enum {
+				MAX_QUERIES = 128, // per frame slot, two per scope
+				MAX_PASSES = 16    // pipeline statistics queries per frame slot
+			};
+
+			static constexpr VkQueryPipelineStatisticFlags PIPELINE_STATISTICS =
+				VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+				VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+			// pipelineStatistics needs the pipelineStatisticsQuery and inheritedQueries features enabled
+			void create(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, uint32_t frameCount, VkQueue queue, VkCommandPool commandPool, bool pipelineStatistics);
+			void destroy();
+
+			// reads what the slot recorded last time, resets it and opens the frame's own scope
+			void beginFrame(VkCommandBuffer commandBuffer, uint32_t slot);
+			// closes the frame's scope, right before the command buffer ends
+			void endFrame(VkCommandBuffer commandBuffer);
+
+			void beginScope(VkCommandBuffer commandBuffer, const char* name);
+			void endScope(VkCommandBuffer commandBuffer);
+
+			// secondaries executed inside a pass need statisticsFlags() in their inheritance info
+			void beginPass(VkCommandBuffer commandBuffer, const char* name);
+			void endPass(VkCommandBuffer commandBuffer);
+			VkQueryPipelineStatisticFlags statisticsFlags() const { return m_statisticsFlags; }
+		private:
+			static constexpr uint32_t NO_SCOPE = UINT32_MAX; // opened while the pool was full
+
+			struct scope {
+				const char* name;
+				uint32_t beginQuery;
+				uint32_t endQuery;
+			};
+
+			struct frame_slot {
+				VkQueryPool pool = VK_NULL_HANDLE;
+				VkQueryPool statisticsPool = VK_NULL_HANDLE;
+				std::vector<scope> scopes; // the first one is the whole frame
+				uint32_t usedQueries = 0;
+				uint32_t usedPasses = 0;
+				uint64_t frame = 0;
+				bool submitted = false;
+			};
+
+			VkDevice m_device = VK_NULL_HANDLE;
+			std::vector<frame_slot> m_slots;
+			frame_slot* m_current = nullptr;
+			std::vector<uint32_t> m_openScopes; // indices into m_current->scopes
+			std::vector<uint64_t> m_results;
+			std::vector<uint64_t> m_statisticsResults;
+			VkQueryPipelineStatisticFlags m_statisticsFlags = 0;
+			uint32_t m_openPass = NO_SCOPE;
+			uint32_t m_passDepth = 0;
+
+			double m_period = 1.0;      // nanoseconds per tick
+			uint64_t m_validMask = 0;
+#if IRIDIUM_PROFILE
+			int64_t m_cpuOffset = 0;    // profiler time of GPU tick 0
+			Profiler::track* m_track = nullptr;
+
+			void calibrate(VkQueue queue, VkCommandPool commandPool);
+#endif
+			void collect(frame_slot& slot);
+		};
+
+		struct gpu_scope {
+			gpu_profiler& profiler;
+			VkCommandBuffer commandBuffer;
+
+			gpu_scope(gpu_profiler& gpuProfiler, VkCommandBuffer buffer, const char* name) : profiler(gpuProfiler), commandBuffer(buffer) {
+				profiler.beginScope(commandBuffer, name);
+			}
+			~gpu_scope() { profiler.endScope(commandBuffer); }
+		};
+
+		struct gpu_pass {
+			gpu_profiler& profiler;
+			VkCommandBuffer commandBuffer;
+
+			gpu_pass(gpu_profiler& gpuProfiler, VkCommandBuffer buffer, const char* name) : profiler(gpuProfiler), commandBuffer(buffer) {
+				profiler.beginPass(commandBuffer, name);
+			}
+			~gpu_pass() { profiler.endPass(commandBuffer); }
+		};
+	}
+}
@@ -0,0 +1,255 @@
+#include "memoryBudget.hpp"
+
+#include <algorithm>
+#include <format>
+#include <string>
+
+#include "../frameStats.hpp"
+#include "../log.hpp"
+
+namespace {
+	double toMiB(VkDeviceSize bytes) {
+		return double(bytes) / (1024.0 * 1024.0);
+	}
+}
+
+const char* Iridium::Renderer::memoryPressureName(memory_pressure pressure) {
+	switch(pressure) {
+		case memory_pressure::none: return "none";
+		case memory_pressure::elevated: return "elevated";
+		case memory_pressure::critical: return "critical";
+	}
+	return "unknown";
+}
+
+void Iridium::Renderer::memory_budget::create(VkPhysicalDevice physicalDevice, VkDevice device, bool budgetExtension) {
+	m_physicalDevice = physicalDevice;
+	m_device = device;
+	m_budgetExtension = budgetExtension;
+	vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &m_properties);
+
+	{
+		std::lock_guard lock(m_mutex);
+		m_heaps.assign(m_properties.memoryHeapCount, {});
+		m_engineBytesAtUpdate.assign(m_properties.memoryHeapCount, 0);
+		m_peakUsage.assign(m_properties.memoryHeapCount, 0);
+		for(uint32_t heap = 0; heap < m_properties.memoryHeapCount; heap++) {
+			m_heaps[heap].size = m_properties.memoryHeaps[heap].size;
+			m_heaps[heap].budget = m_properties.memoryHeaps[heap].size / 100 * FALLBACK_BUDGET_PERCENT;
+			m_heaps[heap].deviceLocal = m_properties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+		}
+	}
+
+	for(uint32_t heap = 0; heap < m_properties.memoryHeapCount; heap++) {
+		std::string labels = std::format("heap=\"{}\"", heap);
+		m_gauges.push_back({
+			.usage = &Metrics::addGauge("iridium_gpu_heap_usage_bytes", "Device memory heap usage.", labels),
+			.budget = &Metrics::addGauge("iridium_gpu_heap_budget_bytes", "Device memory heap budget.", labels),
+			.allocations = &Metrics::addGauge("iridium_gpu_heap_allocations", "Live device memory allocations made by the engine.", labels)
+		});
+	}
+
+	if(!m_budgetExtension)
+		ENGINE_LOG_WARN("VK_EXT_memory_budget isn't supported, budgets are estimated from the heap sizes and only count the engine's allocations.");
+}
+
+void Iridium::Renderer::memory_budget::destroy() {
+	// the gauges outlive us, nothing is left on the heaps once the device is gone
+	for(const heap_gauges& gauges : m_gauges) {
+		gauges.usage->set(0.0);
+		gauges.allocations->set(0.0);
+	}
+	m_gauges.clear();
+
+	std::lock_guard lock(m_mutex);
+	if(!m_allocations.empty())
+		ENGINE_LOG_WARN("{} device memory allocations still alive at shutdown.", m_allocations.size());
+	m_allocations.clear();
+	m_heaps.clear();
+	m_engineBytesAtUpdate.clear();
+	m_peakUsage.clear();
+}
+
+VkDeviceSize Iridium::Renderer::memory_budget::currentUsage(uint32_t heap) const {
+	const heap_stats& stats = m_heaps[heap];
+	if(!m_budgetExtension)
+		return stats.engineBytes;
+	// the driver's number is a frame old, anything we did since then is on top (or freed already)
+	int64_t delta = int64_t(stats.engineBytes) - int64_t(m_engineBytesAtUpdate[heap]);
+	return VkDeviceSize(std::max<int64_t>(int64_t(stats.usage) + delta, 0));
+}
+
+bool Iridium::Renderer::memory_budget::refreshPressure(uint32_t heap) {
+	heap_stats& stats = m_heaps[heap];
+	if(!m_budgetExtension)
+		stats.usage = stats.engineBytes;
+
+	VkDeviceSize usage = currentUsage(heap);
+	memory_pressure pressure = memory_pressure::none;
+	if(usage >= stats.budget / 100 * CRITICAL_PERCENT)
+		pressure = memory_pressure::critical;
+	else if(usage >= stats.budget / 100 * ELEVATED_PERCENT)
+		pressure = memory_pressure::elevated;
+
+	if(pressure == stats.pressure)
+		return false;
+	stats.pressure = pressure;
+	return true;
+}
+
+VkResult Iridium::Renderer::memory_budget::allocate(const VkMemoryAllocateInfo& allocInfo, VkDeviceMemory& memory) {
+	uint32_t heap = m_properties.memoryTypes[allocInfo.memoryTypeIndex].heapIndex;
+	std::vector<pressure_event> events;
+
+	{
+		// warn before the allocation, whoever listens gets a chance to make room
+		std::lock_guard lock(m_mutex);
+		const heap_stats& stats = m_heaps[heap];
+		if(currentUsage(heap) + allocInfo.allocationSize > stats.budget) {
+			ENGINE_LOG_WARN("Allocating {:.1f} MiB from heap {} goes over its {:.1f} MiB budget.", toMiB(allocInfo.allocationSize), heap, toMiB(stats.budget));
+			events.push_back({heap, memory_pressure::critical, stats});
+		}
+	}
+	notify(events);
+	events.clear();
+
+	VkResult result = vkAllocateMemory(m_device, &allocInfo, nullptr, &memory);
+
+	{
+		std::lock_guard lock(m_mutex);
+		heap_stats& stats = m_heaps[heap];
+		if(result == VK_SUCCESS) {
+			m_allocations[memory] = {allocInfo.allocationSize, heap};
+			stats.engineBytes += allocInfo.allocationSize;
+			stats.allocations++;
+			if(refreshPressure(heap))
+				events.push_back({heap, stats.pressure, stats});
+		}
+		else {
+			ENGINE_LOG_ERROR("Failed to allocate {:.1f} MiB from heap {} ({:.1f} of {:.1f} MiB used).", toMiB(allocInfo.allocationSize), heap, toMiB(currentUsage(heap)), toMiB(stats.budget));
+			stats.pressure = memory_pressure::critical;
+			events.push_back({heap, memory_pressure::critical, stats});
+		}
+	}
+	notify(events);
+	return result;
+}
+
+void Iridium::Renderer::memory_budget::free(VkDeviceMemory memory) {
+	if(memory == VK_NULL_HANDLE)
+		return;
+
+	// the entry goes first, once freed the driver may hand the same handle to another thread's allocate
+	std::vector<pressure_event> events;
+	{
+		std::lock_guard lock(m_mutex);
+		auto found = m_allocations.find(memory);
+		if(found != m_allocations.end()) {
+			heap_stats& stats = m_heaps[found->second.heap];
+			stats.engineBytes -= found->second.size;
+			stats.allocations--;
+			if(refreshPressure(found->second.heap))
+				events.push_back({found->second.heap, stats.pressure, stats});
+			m_allocations.erase(found);
+		}
+	}
+	vkFreeMemory(m_device, memory, nullptr);
+	notify(events);
+}
+
+void Iridium::Renderer::memory_budget::update() {
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties{};
+	budgetProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+	VkPhysicalDeviceMemoryProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2;
+	properties.pNext = &budgetProperties;
+	if(m_budgetExtension)
+		vkGetPhysicalDeviceMemoryProperties2(m_physicalDevice, &properties);
+
+	std::vector<pressure_event> events;
+	std::vector<heap_stats> sampled;
+	{
+		std::lock_guard lock(m_mutex);
+		for(uint32_t heap = 0; heap < uint32_t(m_heaps.size()); heap++) {
+			heap_stats& stats = m_heaps[heap];
+			if(m_budgetExtension) {
+				stats.usage = budgetProperties.heapUsage[heap];
+				stats.budget = std::min(budgetProperties.heapBudget[heap], stats.size);
+				m_engineBytesAtUpdate[heap] = stats.engineBytes;
+			}
+			if(refreshPressure(heap))
+				events.push_back({heap, stats.pressure, stats});
+			m_peakUsage[heap] = std::max(m_peakUsage[heap], stats.usage);
+		}
+		sampled = m_heaps;
+	}
+
+	VkDeviceSize deviceBytes = 0;
+	VkDeviceSize hostBytes = 0;
+	for(uint32_t heap = 0; heap < uint32_t(sampled.size()); heap++) {
+		const heap_stats& stats = sampled[heap];
+		(stats.deviceLocal ? deviceBytes : hostBytes) += stats.usage;
+		m_gauges[heap].usage->set(double(stats.usage));
+		m_gauges[heap].budget->set(double(stats.budget));
+		m_gauges[heap].allocations->set(double(stats.allocations));
+	}
+	FrameStats::sample(FrameStats::level::deviceMemoryBytes, double(deviceBytes));
+	FrameStats::sample(FrameStats::level::hostMemoryBytes, double(hostBytes));
+
+	for(const pressure_event& event : events) {
+		ENGINE_LOG_INFO("Heap {} memory pressure is {} ({:.1f} of {:.1f} MiB used).",
+			event.heap, memoryPressureName(event.pressure), toMiB(event.stats.usage), toMiB(event.stats.budget));
+	}
+	notify(events);
+}
+
+void Iridium::Renderer::memory_budget::notify(const std::vector<pressure_event>& events) {
+	if(events.empty())
+		return;
+
+	// copied, so a callback can remove itself
+	std::vector<std::pair<uint32_t, pressure_callback>> callbacks;
+	{
+		std::lock_guard lock(m_callbackMutex);
+		callbacks = m_callbacks;
+	}
+	for(const pressure_event& event : events) {
+		for(const auto& [id, callback] : callbacks)
+			callback(event.heap, event.pressure, event.stats);
+	}
+}
+
+uint32_t Iridium::Renderer::memory_budget::addPressureCallback(pressure_callback callback) {
+	std::lock_guard lock(m_callbackMutex);
+	uint32_t id = m_nextCallbackId++;
+	m_callbacks.emplace_back(id, std::move(callback));
+	return id;
+}
+
+void Iridium::Renderer::memory_budget::removePressureCallback(uint32_t id) {
+	std::lock_guard lock(m_callbackMutex);
+	std::erase_if(m_callbacks, [id](const auto& entry) { return entry.first == id; });
+}
+
+std::vector<Iridium::Renderer::heap_stats> Iridium::Renderer::memory_budget::heaps() {
+	std::lock_guard lock(m_mutex);
+	std::vector<heap_stats> heaps = m_heaps;
+	for(uint32_t heap = 0; heap < uint32_t(heaps.size()); heap++)
+		heaps[heap].usage = currentUsage(heap);
+	return heaps;
+}
+
+void Iridium::Renderer::memory_budget::logHeaps() {
+	std::vector<heap_stats> stats = heaps();
+	std::vector<VkDeviceSize> peaks;
+	{
+		std::lock_guard lock(m_mutex);
+		peaks.swap(m_peakUsage);
+		m_peakUsage.assign(peaks.size(), 0);
+	}
+	for(uint32_t heap = 0; heap < uint32_t(stats.size()) && heap < uint32_t(peaks.size()); heap++) {
+		ENGINE_LOG_INFO("Heap {}{}: {:.1f} of {:.1f} MiB used, {:.1f} MiB at the peak ({:.1f} MiB in {} engine allocations), pressure {}.",
+			heap, stats[heap].deviceLocal ? " (device local)" : "", toMiB(stats[heap].usage), toMiB(stats[heap].budget),
+			toMiB(std::max(peaks[heap], stats[heap].usage)), toMiB(stats[heap].engineBytes), stats[heap].allocations, memoryPressureName(stats[heap].pressure));
+	}
+}
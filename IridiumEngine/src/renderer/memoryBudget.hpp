@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "../metrics.hpp"
+
+namespace Iridium {
+	namespace Renderer {
+		enum class memory_pressure : uint8_t {
+			none,
+			elevated, // past ELEVATED_PERCENT of the budget, time to trim caches
+			critical  // past CRITICAL_PERCENT, or an allocation failed or won't fit
+		};
+
+		struct heap_stats {
+			VkDeviceSize size = 0;
+			VkDeviceSize budget = 0;      // what the driver says we can use, or a share of size without the extension
+			VkDeviceSize usage = 0;       // whole process with the extension, our own allocations without it
+			VkDeviceSize engineBytes = 0; // allocated through memory_budget
+			uint32_t allocations = 0;
+			bool deviceLocal = false;
+			memory_pressure pressure = memory_pressure::none;
+		};
+
+		// Every vkAllocateMemory/vkFreeMemory of the renderer goes through here. Heap usage and budget come
+		// from VK_EXT_memory_budget when the device has it, refreshed by update() once a frame; in between
+		// the engine's own allocations are added on top, so a burst of allocations is still seen.
+		// update() also samples every heap into FrameStats and the heap gauges, logHeaps() is a summary.
+		// Pressure callbacks run on whichever thread noticed the change, never with the lock held,
+		// so they can free memory right away.
+		class memory_budget {
+		public:
+			enum {
+				ELEVATED_PERCENT = 80,
+				CRITICAL_PERCENT = 95,
+				FALLBACK_BUDGET_PERCENT = 80 // of the heap size, without the extension
+			};
+
+			using pressure_callback = std::function<void(uint32_t heap, memory_pressure pressure, const heap_stats& stats)>;
+
+			void create(VkPhysicalDevice physicalDevice, VkDevice device, bool budgetExtension);
+			void destroy();
+
+			VkResult allocate(const VkMemoryAllocateInfo& allocInfo, VkDeviceMemory& memory);
+			void free(VkDeviceMemory memory);
+
+			// refreshes usage and budget and samples them, render thread once a frame
+			void update();
+
+			uint32_t addPressureCallback(pressure_callback callback);
+			void removePressureCallback(uint32_t id);
+
+			std::vector<heap_stats> heaps();
+			// one line per heap with the peak usage since the last call
+			void logHeaps();
+
+			const VkPhysicalDeviceMemoryProperties& memoryProperties() const { return m_properties; }
+		private:
+			struct allocation {
+				VkDeviceSize size;
+				uint32_t heap;
+			};
+
+			struct heap_gauges {
+				Metrics::gauge* usage;
+				Metrics::gauge* budget;
+				Metrics::gauge* allocations;
+			};
+
+			struct pressure_event {
+				uint32_t heap;
+				memory_pressure pressure;
+				heap_stats stats;
+			};
+
+			VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+			VkDevice m_device = VK_NULL_HANDLE;
+			VkPhysicalDeviceMemoryProperties m_properties{};
+			bool m_budgetExtension = false;
+
+			std::mutex m_mutex;
+			std::vector<heap_stats> m_heaps;
+			std::vector<VkDeviceSize> m_engineBytesAtUpdate; // engineBytes when usage was last queried
+			std::vector<VkDeviceSize> m_peakUsage;           // highest sampled usage since logHeaps
+			std::unordered_map<VkDeviceMemory, allocation> m_allocations;
+
+			std::mutex m_callbackMutex;
+			std::vector<std::pair<uint32_t, pressure_callback>> m_callbacks;
+			uint32_t m_nextCallbackId = 0;
+
+			std::vector<heap_gauges> m_gauges; // set by update()
+
+			// usage including what was allocated since the last update
+			VkDeviceSize currentUsage(uint32_t heap) const;
+			// updates the heap's pressure, returns true when it changed
+			bool refreshPressure(uint32_t heap);
+			void notify(const std::vector<pressure_event>& events);
+		};
+
+		const char* memoryPressureName(memory_pressure pressure);
+	}
+}
@@ -9,29 +9,45 @@
 
 #include "vertex.hpp"
 #include "vulkan.hpp"
+#include "../allocationTracker.hpp"
+#include "../frameStats.hpp"
+#include "../jobSystem.hpp"
 #include "../log.hpp"
+#include "../profiler.hpp"
 #include "../utils.hpp"
 #include "window.hpp"
 #include "../assets/shader.hpp"
 #include "../assets/shaderCompiler.hpp"
 
+#include <algorithm>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <format>
 #include <set>
+#include <tuple>
 #include <ranges>
 
 #include <vulkan/vulkan_core.h>
 
 namespace IrV = Iridium::Vulkan;
 
-Iridium::Renderer::renderer::renderer(appinfo& info)
-	:m_info(info) {
-	ENGINE_LOG_INFO("Initializing engine renderer.");
+Iridium::Renderer::renderer::renderer(appinfo& info, const benchmark_config* benchmark)
+	:m_info(info), m_benchmark(benchmark), m_headless(benchmark != nullptr) {
+	IRIDIUM_ALLOCATION_TAG(renderer);
+	ENGINE_LOG_INFO("Initializing engine renderer{}.", m_headless ? " (headless)" : "");
 
 	m_rendererStart = std::chrono::steady_clock::now();
+	if(m_headless) {
+		m_framebufferExtent = {m_benchmark->width, m_benchmark->height};
+		m_benchmarkScene = buildBenchmarkScene(*m_benchmark);
+		m_vertices = m_benchmarkScene.vertices;
+		m_indices = m_benchmarkScene.indices;
+	} else {
+		auto [width, height] = getWindowManager()->framebufferSize();
+		m_framebufferExtent = {width, height};
+	}
 
 	initVulkan();
 }
@@ -41,7 +57,6 @@ void Iridium::Renderer::renderer::initVulkan() {
 	createInstance();
 	setupDebugMessenger();
 	createSurface();
-	setWindowCallbacks();
 	pickPhysicalDevice();
 	createLogicalDevice();
 	createSwapchain();
@@ -58,20 +73,27 @@ void Iridium::Renderer::renderer::initVulkan() {
 	createDescriptorSets();
 	createCommandBuffers();
 	createSyncObjects();
+	createGpuProfiler();
 }
 
 void Iridium::Renderer::renderer::cleanupVulkan() {
 	destroySyncObjects();
+	m_gpuProfiler.destroy();
 	vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
 	cleanupVertexBuffer();
 	cleanupIndexBuffer();
 	cleanupUniformBuffers();
-	vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+	m_defragmenter.destroy();
+	m_uploader.destroy();
+	destroyCommandPools();
 	cleanupSwapchain();
+	m_deletionQueue.destroy();
 	vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
 	vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
 	vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
 	vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+	m_allocator.destroy();
+	m_memoryBudget.destroy();
 	vkDestroyDevice(m_device, nullptr);
 	if constexpr(USE_VALIDATION_LAYERS)
 		IrV::DestroyDebugUtilsMessengerEXT(m_instance, m_debugMessenger, nullptr);
@@ -94,13 +116,15 @@ void Iridium::Renderer::renderer::createInstance() {
 	appInfo.apiVersion = VK_API_VERSION_1_3;
 
 	std::vector<const char*> layers;
-	layers.push_back("VK_LAYER_KHRONOS_shader_object");
+	// only needed where the driver has no VK_EXT_shader_object of its own
+	if(Vulkan::isLayerAvailable("VK_LAYER_KHRONOS_shader_object"))
+		layers.push_back("VK_LAYER_KHRONOS_shader_object");
 	if constexpr(USE_VALIDATION_LAYERS) {
 		ENGINE_LOG_INFO("Using validation layers");
 		for(const auto layer : Iridium::Vulkan::getValidationLayers())
 			layers.push_back(layer);
 	}
-	auto extensions = IrV::getRequiredExtensions();
+	auto extensions = IrV::getRequiredExtensions(m_headless);
 	for(const auto& ext : extensions) {
 		ENGINE_LOG_WARN("Enabled instance extension: {}", ext);
 	}
@@ -131,20 +155,14 @@ void Iridium::Renderer::renderer::setupDebugMessenger() {
 }
 
 void Iridium::Renderer::renderer::createSurface() {
+	if(m_headless)
+		return;
 	GLFWwindow* window = (GLFWwindow*)getWindowManager()->getWindowHandle();
 	if(glfwCreateWindowSurface(m_instance, window, nullptr, &m_surface) != VK_SUCCESS) {
 		throw Iridium::Renderer::renderer_error("failed to create window surface");
 	}
 }
 
-void Iridium::Renderer::renderer::setWindowCallbacks() {
-	GLFWwindow* window = (GLFWwindow*)getWindowManager()->getWindowHandle();
-	glfwSetFramebufferSizeCallback(window, [](GLFWwindow*, int, int) -> void {
-		renderer* renderer = getApplicationPointer()->renderer;
-		renderer->m_framebufferResized = true;
-	});
-}
-
 void Iridium::Renderer::renderer::pickPhysicalDevice() {
 	uint32_t deviceCount = 0;
 	vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
@@ -193,10 +211,24 @@ void Iridium::Renderer::renderer::createLogicalDevice() {
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	VkPhysicalDeviceFeatures supportedFeatures{};
+	vkGetPhysicalDeviceFeatures(m_physicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures{};
 	deviceFeatures.fillModeNonSolid = VK_TRUE;
+	if(FrameStats::getConfig().pipelineStatistics) {
+		// the draws are all in secondaries, so the query has to be inherited
+		m_pipelineStatistics = supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries;
+		if(!m_pipelineStatistics)
+			ENGINE_LOG_WARN("The device can't inherit pipeline statistics queries, they are disabled.");
+		deviceFeatures.pipelineStatisticsQuery = m_pipelineStatistics;
+		deviceFeatures.inheritedQueries = m_pipelineStatistics;
+	}
 
-	auto& deviceExtensions = Iridium::Vulkan::getDeviceExtensions();
+	std::vector<const char*> deviceExtensions = Iridium::Vulkan::getDeviceExtensions(m_headless);
+	bool memoryBudget = Iridium::Vulkan::isDeviceExtensionAvailable(m_physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	if(memoryBudget)
+		deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
 
 	//TODO(): move this to separate function to make the chain automatically.
 	VkPhysicalDeviceExtendedDynamicState3FeaturesEXT extendedDynamicState3{};
@@ -211,7 +243,12 @@ void Iridium::Renderer::renderer::createLogicalDevice() {
 	VkPhysicalDeviceShaderObjectFeaturesEXT shaderObject{};
 	shaderObject.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_OBJECT_FEATURES_EXT;
 	shaderObject.shaderObject = VK_TRUE;
-	shaderObject.pNext = &swapchainMaintenance1;
+	shaderObject.pNext = m_headless ? (void*)&extendedDynamicState3 : (void*)&swapchainMaintenance1;
+
+	VkPhysicalDeviceVulkan12Features vulkan12{};
+	vulkan12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	vulkan12.timelineSemaphore = VK_TRUE; // staging_uploader's batches
+	vulkan12.pNext = &shaderObject;
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -222,24 +259,31 @@ void Iridium::Renderer::renderer::createLogicalDevice() {
 	createInfo.enabledExtensionCount = deviceExtensions.size();
 	createInfo.enabledLayerCount = 0; //DONT USE, DEPRECATED
 	createInfo.ppEnabledLayerNames = nullptr; //DONT USE, DEPRECATED
-	createInfo.pNext = &shaderObject;
+	createInfo.pNext = &vulkan12;
 
 	if (vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device) != VK_SUCCESS)
 		throw Iridium::Renderer::renderer_error("Failed to create logical device.");
+	m_memoryBudget.create(m_physicalDevice, m_device, memoryBudget);
+	m_allocator.create(m_physicalDevice, m_device, m_memoryBudget);
+	m_deletionQueue.create(m_device, m_allocator);
 
 	vkGetDeviceQueue(m_device, indices.families[graphics], 0, &m_graphicsQueue);
 	vkGetDeviceQueue(m_device, indices.families[present], 0, &m_presentQueue);
 	vkGetDeviceQueue(m_device, indices.families[compute], 0, &m_computeQueue);
 	vkGetDeviceQueue(m_device, indices.families[transfer], 0, &m_transferQueue);
+	m_uploader.create(m_device, m_allocator, m_transferQueue, m_queueMutex, indices.families[transfer], indices.families[graphics]);
+	m_defragmenter.create(m_device, m_allocator, m_deletionQueue, m_uploader);
 }
 
 void Iridium::Renderer::renderer::createSwapchain() {
-	GLFWwindow* window = (GLFWwindow*)getApplicationPointer()->windowManager->getWindowHandle();
-
+	if(m_headless) {
+		createOffscreenImages();
+		return;
+	}
 	Iridium::Vulkan::swapchain_support_details swapchainSupport = Iridium::Vulkan::querySwapchainSupport(m_physicalDevice, m_surface);
 	VkSurfaceFormatKHR surfaceFormat = Iridium::Vulkan::chooseSwapSurfaceFormat(swapchainSupport.formats);
 	VkPresentModeKHR presentMode = Iridium::Vulkan::chooseSwapPresentMode(swapchainSupport.presentModes);
-	VkExtent2D extent = Iridium::Vulkan::chooseSwapExtent(swapchainSupport.capabilities, window);
+	VkExtent2D extent = Iridium::Vulkan::chooseSwapExtent(swapchainSupport.capabilities, m_framebufferExtent);
 	uint32_t imageCount = swapchainSupport.capabilities.minImageCount + 1;
 	if(swapchainSupport.capabilities.maxImageCount > 0 && imageCount > swapchainSupport.capabilities.maxImageCount) {
 		imageCount = swapchainSupport.capabilities.maxImageCount;
@@ -289,17 +333,36 @@ void Iridium::Renderer::renderer::createSwapchain() {
 	m_swapchainExtent = extent;
 }
 
-void Iridium::Renderer::renderer::recreateSwapchain() {
-	auto [width, height] = getWindowManager()->framebufferSize();
-	while(width == 0 || height == 0) {
-		ENGINE_LOG_ERROR("Framebuffer width and height are ({}, {})", width, height);
-		auto [newWidth, newHeight] = getWindowManager()->framebufferSize();
-		width = newWidth;
-		height = newHeight;
-		glfwWaitEvents();
+void Iridium::Renderer::renderer::createOffscreenImages() {
+	m_swapchainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+	m_swapchainExtent = m_framebufferExtent;
+
+	// one per frame in flight, the in-flight fence already keeps a slot's image from being reused early
+	m_swapchainImages.resize(MAX_FRAMES_IN_FLIGHT);
+	m_offscreenMemory.resize(MAX_FRAMES_IN_FLIGHT);
+	for(auto [image, memory] : std::views::zip(m_swapchainImages, m_offscreenMemory)) {
+		VkImageCreateInfo createInfo{};
+		createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		createInfo.imageType = VK_IMAGE_TYPE_2D;
+		createInfo.format = m_swapchainImageFormat;
+		createInfo.extent = {m_swapchainExtent.width, m_swapchainExtent.height, 1};
+		createInfo.mipLevels = 1;
+		createInfo.arrayLayers = 1;
+		createInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		createInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		createInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+		createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		createInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if(vkCreateImage(m_device, &createInfo, nullptr, &image) != VK_SUCCESS)
+			throw Iridium::Renderer::renderer_error("Failed to create offscreen image.");
+
+		memory = m_allocator.allocateImage(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 	}
-	vkDeviceWaitIdle(m_device);
+}
 
+void Iridium::Renderer::renderer::recreateSwapchain() {
+	// minimized windows never get here, the main thread doesn't publish packets for them.
+	// frames in flight keep using the old objects, they go through the deletion queue
 	cleanupSwapchain();
 	
 	createSwapchain();
@@ -309,13 +372,21 @@ void Iridium::Renderer::renderer::recreateSwapchain() {
 
 void Iridium::Renderer::renderer::cleanupSwapchain() {
 	for(auto& framebuffer : m_swapchainFrameBuffers) {
-		vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+		m_deletionQueue.destroyFramebuffer(framebuffer);
 	}
 	for(auto imageView : m_swapchainImageViews) {
-		vkDestroyImageView(m_device, imageView, nullptr);
+		m_deletionQueue.destroyImageView(imageView);
 	}
-	vkDestroySwapchainKHR(m_device, m_swapchain, nullptr);
-	m_swapchain = VK_NULL_HANDLE;
+	if(m_headless) {
+		for(auto [image, memory] : std::views::zip(m_swapchainImages, m_offscreenMemory)) {
+			m_deletionQueue.destroyImage(image, memory);
+		}
+		m_offscreenMemory.clear();
+		return;
+	}
+	// the handle stays, createSwapchain retires it as oldSwapchain. the present fences of the frames
+	// before cover its images, so it's safe to destroy once they retire
+	m_deletionQueue.destroySwapchain(m_swapchain);
 }
 
 void Iridium::Renderer::renderer::createImageViews() {
@@ -350,7 +421,7 @@ void Iridium::Renderer::renderer::createRenderPass() {
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = m_headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0; //references the layout(location = 0) out vec4 outColor !!!
@@ -382,17 +453,20 @@ void Iridium::Renderer::renderer::createRenderPass() {
 }
 
 void Iridium::Renderer::renderer::createDescriptorSetLayout() {
-	VkDescriptorSetLayoutBinding layoutBinding{};
-	layoutBinding.binding = 0;
-	layoutBinding.descriptorCount = 1;
-	layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	layoutBinding.pImmutableSamplers = nullptr;
-	layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	// 0 is the frame's uniform_buffer, 1 the draw's draw_constants, both move with dynamic offsets
+	VkDescriptorSetLayoutBinding layoutBindings[2]{};
+	for(uint32_t binding = 0; binding < 2; binding++) {
+		layoutBindings[binding].binding = binding;
+		layoutBindings[binding].descriptorCount = 1;
+		layoutBindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		layoutBindings[binding].pImmutableSamplers = nullptr;
+		layoutBindings[binding].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	}
 
 	VkDescriptorSetLayoutCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	createInfo.bindingCount = 1;
-	createInfo.pBindings = &layoutBinding;
+	createInfo.bindingCount = 2;
+	createInfo.pBindings = layoutBindings;
 
 	if(vkCreateDescriptorSetLayout(m_device, &createInfo, nullptr, &m_descriptorSetLayout) != VK_SUCCESS) {
 		throw Renderer::renderer_error("Failed to create descriptor set layout.");
@@ -551,17 +625,12 @@ void Iridium::Renderer::renderer::createGraphicsPipeline() {
 	colorBlending.attachmentCount = 1;
 	colorBlending.pAttachments = &colorBlendAttachment;
 
-	VkPushConstantRange range{};
-	range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	range.offset = 0;
-	range.size = sizeof(Iridium::Renderer::push_constants);
-
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayoutInfo.setLayoutCount = 1;
 	pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
-	pipelineLayoutInfo.pushConstantRangeCount = 1;
-	pipelineLayoutInfo.pPushConstantRanges = &range;
+	pipelineLayoutInfo.pushConstantRangeCount = 0;
+	pipelineLayoutInfo.pPushConstantRanges = nullptr;
 	if(vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout) != VK_SUCCESS)
 		throw Iridium::Renderer::renderer_error("Failed to create pipeline layout");
 
@@ -621,78 +690,85 @@ void Iridium::Renderer::renderer::createCommandPool() {
 	if(vkCreateCommandPool(m_device, &createInfo, nullptr, &m_commandPool) != VK_SUCCESS)
 		throw Iridium::Renderer::renderer_error("Failed to create command pool.");
 
+	// per frame pools are only ever reset whole
+	createInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	uint32_t threadCount = getJobSystem()->workerCount() + 1;
+	for(size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		if(vkCreateCommandPool(m_device, &createInfo, nullptr, &m_frameCommandPools[frame]) != VK_SUCCESS)
+			throw Iridium::Renderer::renderer_error("Failed to create frame command pool.");
+
+		m_threadCommandPools[frame].resize(threadCount);
+		for(auto& threadPool : m_threadCommandPools[frame]) {
+			if(vkCreateCommandPool(m_device, &createInfo, nullptr, &threadPool.pool) != VK_SUCCESS)
+				throw Iridium::Renderer::renderer_error("Failed to create thread command pool.");
+		}
+	}
+}
+
+void Iridium::Renderer::renderer::destroyCommandPools() {
+	for(size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		for(auto& threadPool : m_threadCommandPools[frame])
+			vkDestroyCommandPool(m_device, threadPool.pool, nullptr);
+		m_threadCommandPools[frame].clear();
+		vkDestroyCommandPool(m_device, m_frameCommandPools[frame], nullptr);
+	}
+	vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+}
+
+void Iridium::Renderer::renderer::resetFrameCommandPools(uint32_t frame) {
+	vkResetCommandPool(m_device, m_frameCommandPools[frame], 0);
+	for(auto& threadPool : m_threadCommandPools[frame]) {
+		if(threadPool.used == 0)
+			continue;
+		vkResetCommandPool(m_device, threadPool.pool, 0);
+		threadPool.used = 0;
+	}
 }
 
 void Iridium::Renderer::renderer::createVertexBuffer() {
 	size_t bufferSize = sizeof(decltype(m_vertices)::value_type) * m_vertices.size();
-	VkBuffer stagingBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-	
-	void* data;
-	vkMapMemory(m_device, stagingMemory, 0, bufferSize, 0, &data);
-	std::memcpy(data, m_vertices.data(), bufferSize);
-	vkUnmapMemory(m_device, stagingMemory);
-	
-	createBuffer(bufferSize,  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertexBuffer, m_vertexBufferMemory);
-
-	copyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
-	vkFreeMemory(m_device, stagingMemory, nullptr);
-	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+	// transfer source as well, so the defragmenter can move it
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+	createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertexBuffer, m_vertexBufferMemory);
+	// the first frame waits for it on the GPU, it can't move before the copy into it is done
+	upload_handle upload = m_uploader.uploadBuffer(m_vertexBuffer, 0, std::as_bytes(std::span(m_vertices)));
+	m_vertexBufferMove = m_defragmenter.addBuffer(m_vertexBuffer, m_vertexBufferMemory, bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, upload);
 }
 
 void Iridium::Renderer::renderer::createIndexBuffer() {
 	size_t bufferSize = sizeof(decltype(m_indices)::value_type) * m_indices.size();
-	VkBuffer stagingBuffer = VK_NULL_HANDLE;
-	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
-	createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingMemory);
-	
-	void* data;
-	vkMapMemory(m_device, stagingMemory, 0, bufferSize, 0, &data);
-	std::memcpy(data, m_indices.data(), bufferSize);
-	vkUnmapMemory(m_device, stagingMemory);
-	
-	createBuffer(bufferSize,  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indexBuffer, m_indexBufferMemory);
-
-	copyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
-	vkFreeMemory(m_device, stagingMemory, nullptr);
-	vkDestroyBuffer(m_device, stagingBuffer, nullptr);
+	// transfer source as well, so the defragmenter can move it
+	VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+	createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_indexBuffer, m_indexBufferMemory);
+	// the first frame waits for it on the GPU, it can't move before the copy into it is done
+	upload_handle upload = m_uploader.uploadBuffer(m_indexBuffer, 0, std::as_bytes(std::span(m_indices)));
+	m_indexBufferMove = m_defragmenter.addBuffer(m_indexBuffer, m_indexBufferMemory, bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, upload);
 }
 
 void Iridium::Renderer::renderer::createUniformBuffers() {
-	size_t bufferSize = sizeof(uniform_buffer);
-
-	m_uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-	m_uniformBuffersMapping.resize(MAX_FRAMES_IN_FLIGHT);
-	m_uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-
-	for(auto [buffer, mapping, memory] : std::views::zip(m_uniformBuffers, m_uniformBuffersMapping, m_uniformBuffersMemory)) {
-		createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
-		vkMapMemory(m_device, memory, 0, bufferSize, 0, &mapping);
-	}
+	m_frameUploads.create(m_device, m_physicalDevice, m_allocator, MAX_FRAMES_IN_FLIGHT);
 }
 
 void Iridium::Renderer::renderer::cleanupVertexBuffer() {
-	vkFreeMemory(m_device, m_vertexBufferMemory, nullptr);
+	m_defragmenter.remove(m_vertexBufferMove);
+	m_allocator.free(m_vertexBufferMemory);
 	vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
 }
 
 void Iridium::Renderer::renderer::cleanupIndexBuffer() {
-	vkFreeMemory(m_device, m_indexBufferMemory, nullptr);
+	m_defragmenter.remove(m_indexBufferMove);
+	m_allocator.free(m_indexBufferMemory);
 	vkDestroyBuffer(m_device, m_indexBuffer, nullptr);
 }
 
 void Iridium::Renderer::renderer::cleanupUniformBuffers() {
-	for(auto [buffer, memory] : std::views::zip(m_uniformBuffers, m_uniformBuffersMemory)) {
-		vkFreeMemory(m_device, memory, nullptr);
-		vkDestroyBuffer(m_device, buffer, nullptr);
-	}
+	m_frameUploads.destroy();
 }
 
 void Iridium::Renderer::renderer::createDescriptorPool() {
 	VkDescriptorPoolSize poolSize{};
-	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT;
+	poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSize.descriptorCount = MAX_FRAMES_IN_FLIGHT * 2;
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
@@ -716,66 +792,99 @@ void Iridium::Renderer::renderer::createDescriptorSets() {
 	if(vkAllocateDescriptorSets(m_device, &allocInfo, m_descriptorSets.data()) != VK_SUCCESS)
 		throw Iridium::Renderer::renderer_error("Failed to allocate descriptor sets.");
 
-	for(auto [index, descriptorSet] : std::views::enumerate(m_descriptorSets)) {
-		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = m_uniformBuffers[index];
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(uniform_buffer);
+	for(uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++)
+		writeDescriptorSet(frame);
+}
 
-		VkWriteDescriptorSet descriptorWrite{};
-		descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrite.dstSet = descriptorSet;
-		descriptorWrite.dstBinding = 0;
-		descriptorWrite.dstArrayElement = 0;
-		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrite.descriptorCount = 1;
-		descriptorWrite.pBufferInfo = &bufferInfo;
-		descriptorWrite.pImageInfo = nullptr;
-		descriptorWrite.pTexelBufferView = nullptr;
-		vkUpdateDescriptorSets(m_device, 1, &descriptorWrite, 0, nullptr);
+// only again when the frame's upload buffer is replaced, everything else goes through dynamic offsets
+void Iridium::Renderer::renderer::writeDescriptorSet(uint32_t frame) {
+	VkDescriptorBufferInfo bufferInfos[2]{};
+	bufferInfos[0].buffer = m_frameUploads.buffer(frame);
+	bufferInfos[0].offset = 0;
+	bufferInfos[0].range = sizeof(uniform_buffer);
+	bufferInfos[1].buffer = m_frameUploads.buffer(frame);
+	bufferInfos[1].offset = 0;
+	bufferInfos[1].range = sizeof(draw_constants);
+
+	VkWriteDescriptorSet descriptorWrites[2]{};
+	for(uint32_t binding = 0; binding < 2; binding++) {
+		descriptorWrites[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[binding].dstSet = m_descriptorSets[frame];
+		descriptorWrites[binding].dstBinding = binding;
+		descriptorWrites[binding].dstArrayElement = 0;
+		descriptorWrites[binding].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		descriptorWrites[binding].descriptorCount = 1;
+		descriptorWrites[binding].pBufferInfo = &bufferInfos[binding];
+		descriptorWrites[binding].pImageInfo = nullptr;
+		descriptorWrites[binding].pTexelBufferView = nullptr;
 	}
+	vkUpdateDescriptorSets(m_device, 2, descriptorWrites, 0, nullptr);
 }
 
-void Iridium::Renderer::renderer::updateUniformBuffer(uint32_t currentImage) {
+void Iridium::Renderer::renderer::updateUniformBuffer() {
 	uniform_buffer ubo{};
 	ubo.projection = glm::perspective(glm::radians(45.0f), m_swapchainExtent.width / (float)m_swapchainExtent.height, 0.1f, 10.0f);
-	ubo.rendererTime = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::steady_clock::now() - m_rendererStart).count();
-	ubo.viewTransform = glm::lookAt(m_cameraPos, glm::vec3(1.0f, 0.0f, 0.0f) + m_cameraPos, glm::vec3(0.0f, 0.0f, 1.0f));
+	ubo.rendererTime = m_packet->time;
+	ubo.viewTransform = glm::lookAt(m_packet->cameraPos, glm::vec3(1.0f, 0.0f, 0.0f) + m_packet->cameraPos, glm::vec3(0.0f, 0.0f, 1.0f));
 	ubo.projection[1][1] *= -1.0f;
-	memcpy(m_uniformBuffersMapping[currentImage], &ubo, sizeof(uniform_buffer));
+	frame_allocation allocation = m_frameUploads.allocate(sizeof(uniform_buffer));
+	memcpy(allocation.mapped, &ubo, sizeof(uniform_buffer));
+	m_frameUniformOffset = allocation.offset;
 }
 
 void Iridium::Renderer::renderer::createCommandBuffers() {
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = m_commandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
-	if(vkAllocateCommandBuffers(m_device, &allocInfo, m_commandBuffers) != VK_SUCCESS)
-		throw Iridium::Renderer::renderer_error("Failed to allocate command buffers");
+	allocInfo.commandBufferCount = 1;
+	for(size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+		allocInfo.commandPool = m_frameCommandPools[frame];
+		if(vkAllocateCommandBuffers(m_device, &allocInfo, &m_commandBuffers[frame]) != VK_SUCCESS)
+			throw Iridium::Renderer::renderer_error("Failed to allocate command buffers");
+	}
 }
 
-void Iridium::Renderer::renderer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+VkCommandBuffer Iridium::Renderer::renderer::acquireSecondaryCommandBuffer() {
+	// threads outside the job system share the last slot, only the render thread records from there
+	int32_t worker = getJobSystem()->currentWorker();
+	auto& threadPools = m_threadCommandPools[m_currentFrame];
+	thread_command_pool& threadPool = threadPools[worker >= 0 ? size_t(worker) : threadPools.size() - 1];
+
+	if(threadPool.used == threadPool.buffers.size()) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = threadPool.pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		if(vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer) != VK_SUCCESS)
+			throw Iridium::Renderer::renderer_error("Failed to allocate secondary command buffer");
+		threadPool.buffers.push_back(commandBuffer);
+	}
+	return threadPool.buffers[threadPool.used++];
+}
+
+Iridium::Renderer::command_counters Iridium::Renderer::renderer::recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, std::span<const draw_command> draws) {
+	IRIDIUM_PROFILE_SCOPE("recordDraws");
+	command_counters counters{};
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = m_renderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = m_swapchainFrameBuffers[imageIndex];
+	inheritanceInfo.pipelineStatistics = m_gpuProfiler.statisticsFlags();
+
 	VkCommandBufferBeginInfo beginInfo{};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = 0;
-	beginInfo.pInheritanceInfo = nullptr;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
 	if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
-		throw Iridium::Renderer::renderer_error("Failed to begin recording command buffer");
-	
-	VkRenderPassBeginInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = m_renderPass;
-	renderPassInfo.framebuffer = m_swapchainFrameBuffers[imageIndex];
-	renderPassInfo.renderArea.offset = {0, 0};
-	renderPassInfo.renderArea.extent = m_swapchainExtent;
-	
-	VkClearValue clearColor = {{{0.05f, 0.05f, 0.07f, 1.0f}}};
-	renderPassInfo.clearValueCount = 1;
-	renderPassInfo.pClearValues = &clearColor;
-	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		throw Iridium::Renderer::renderer_error("Failed to begin recording secondary command buffer");
 
+	// dynamic state isn't inherited from the primary
 	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
+	counters.pipelineBinds++;
 	VkViewport viewport{};
 	viewport.x = 0.0f;
 	viewport.y = 0.0f;
@@ -790,7 +899,7 @@ void Iridium::Renderer::renderer::recordCommandBuffer(VkCommandBuffer commandBuf
 	scissor.extent = m_swapchainExtent;
 	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-	VkPolygonMode mode = drawWireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
+	VkPolygonMode mode = m_packet->wireframe ? VK_POLYGON_MODE_LINE : VK_POLYGON_MODE_FILL;
 	Vulkan::CmdSetPolygonModeEXT(m_instance, commandBuffer, mode);
 
 	VkBuffer vertexBuffers[] = {m_vertexBuffer};
@@ -798,20 +907,83 @@ void Iridium::Renderer::renderer::recordCommandBuffer(VkCommandBuffer commandBuf
 	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 	vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT32);
 
-	float time = std::chrono::duration<float, std::chrono::seconds::period>(std::chrono::steady_clock::now() - m_rendererStart).count();
-	push_constants constants{
-		.modelTransform = glm::rotate(glm::mat4(1.0f), glm::degrees(1.0f) * time * 0.1f, glm::vec3(0.0f, 0.0f, 1.0f))
-	};
-	vkCmdPushConstants(commandBuffer, m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push_constants), &constants);
+	// one allocation for the whole chunk, every draw rebinds the same set with its own offset
+	VkDeviceSize stride = m_frameUploads.stride(sizeof(draw_constants));
+	frame_allocation constants = m_frameUploads.allocate(stride * draws.size());
+	for(auto [index, draw] : std::views::enumerate(draws)) {
+		auto* target = reinterpret_cast<draw_constants*>(static_cast<std::byte*>(constants.mapped) + index * stride);
+		target->modelTransform = draw.modelTransform;
+		uint32_t offsets[] = {m_frameUniformOffset, constants.offset + uint32_t(index * stride)};
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[m_currentFrame], 2, offsets);
+		vkCmdDrawIndexed(commandBuffer, draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+	}
+	counters.descriptorBinds += uint32_t(draws.size());
+	counters.draws += uint32_t(draws.size());
+
+	if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw Iridium::Renderer::renderer_error("Failed to record secondary command buffer");
+	return counters;
+}
+
+void Iridium::Renderer::renderer::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+	IRIDIUM_PROFILE_SCOPE("recordCommandBuffer");
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = 0;
+	beginInfo.pInheritanceInfo = nullptr;
+	if(vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw Iridium::Renderer::renderer_error("Failed to begin recording command buffer");
+	m_gpuProfiler.beginFrame(commandBuffer, m_currentFrame);
+	m_uploadWait = m_uploader.recordAcquires(commandBuffer);
+	// moved buffers are swapped in here, everything recorded after already uses the new ones
+	m_defragmenter.record(commandBuffer);
+	command_counters counters = recordMainPass(commandBuffer, imageIndex);
+	m_gpuProfiler.endFrame(commandBuffer);
+	if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		throw Iridium::Renderer::renderer_error("Failed to record command buffer");
+
+	FrameStats::count(FrameStats::counter::draws, counters.draws);
+	FrameStats::count(FrameStats::counter::pipelineBinds, counters.pipelineBinds);
+	FrameStats::count(FrameStats::counter::descriptorBinds, counters.descriptorBinds);
+	FrameStats::count(FrameStats::counter::frameUploadBytes, m_frameUploads.used());
+}
 
-	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelineLayout, 0, 1, &m_descriptorSets[m_currentFrame], 0, nullptr);
+Iridium::Renderer::command_counters Iridium::Renderer::renderer::recordMainPass(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+	gpu_pass pass(m_gpuProfiler, commandBuffer, "mainPass");
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = m_renderPass;
+	renderPassInfo.framebuffer = m_swapchainFrameBuffers[imageIndex];
+	renderPassInfo.renderArea.offset = {0, 0};
+	renderPassInfo.renderArea.extent = m_swapchainExtent;
 	
-	//vkCmdDraw(commandBuffer, m_vertices.size(), 1, 0, 0);
-	vkCmdDrawIndexed(commandBuffer, m_indices.size(), 1, 0, 0, 0);
+	VkClearValue clearColor = {{{0.05f, 0.05f, 0.07f, 1.0f}}};
+	renderPassInfo.clearValueCount = 1;
+	renderPassInfo.pClearValues = &clearColor;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	// every chunk of the draw list gets its own secondary, recorded on whichever worker picks it up
+	const std::vector<draw_command>& drawList = m_packet->drawList;
+	size_t chunkCount = (drawList.size() + DRAWS_PER_CHUNK - 1) / DRAWS_PER_CHUNK;
+	std::pmr::vector<VkCommandBuffer> secondaries(chunkCount, getFrameAllocator());
+	std::pmr::vector<command_counters> chunkCounters(chunkCount, getFrameAllocator());
+	getJobSystem()->parallelFor(0, chunkCount, [&](size_t begin, size_t end) -> void {
+		for(size_t chunk = begin; chunk < end; chunk++) {
+			size_t first = chunk * DRAWS_PER_CHUNK;
+			size_t count = std::min<size_t>(DRAWS_PER_CHUNK, drawList.size() - first);
+			secondaries[chunk] = acquireSecondaryCommandBuffer();
+			chunkCounters[chunk] = recordDraws(secondaries[chunk], imageIndex, std::span(drawList).subspan(first, count));
+		}
+	}, 1);
+	if(!secondaries.empty())
+		vkCmdExecuteCommands(commandBuffer, uint32_t(secondaries.size()), secondaries.data());
 	
 	vkCmdEndRenderPass(commandBuffer);
-	if(vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
-		throw Iridium::Renderer::renderer_error("Failed to record command buffer");
+
+	command_counters counters{};
+	for(const command_counters& chunk : chunkCounters)
+		counters += chunk;
+	return counters;
 }
 
 void Iridium::Renderer::renderer::createSyncObjects() {
@@ -837,6 +1009,13 @@ void Iridium::Renderer::renderer::createSyncObjects() {
 	}
 }
 
+void Iridium::Renderer::renderer::createGpuProfiler() {
+	using enum Iridium::Vulkan::queue_family_indices::family_type;
+	Iridium::Vulkan::queue_family_indices indices = Iridium::Vulkan::findQueueFamilies(m_physicalDevice, m_surface);
+	std::scoped_lock<std::mutex> queueLock(m_queueMutex); // calibrating submits to the graphics queue
+	m_gpuProfiler.create(m_device, m_physicalDevice, indices.families[graphics], MAX_FRAMES_IN_FLIGHT, m_graphicsQueue, m_commandPool, m_pipelineStatistics);
+}
+
 void Iridium::Renderer::renderer::destroySyncObjects() {
 	for(size_t iterator = 0; iterator < MAX_FRAMES_IN_FLIGHT; iterator++) {
 		vkDestroySemaphore(m_device, m_imageAvailableSemaphores[iterator], nullptr);
@@ -846,13 +1025,50 @@ void Iridium::Renderer::renderer::destroySyncObjects() {
 	}
 }
 
-void Iridium::Renderer::renderer::drawFrame() {
-	vkWaitForFences(m_device, 1, &m_presentFences[m_currentFrame], VK_TRUE, UINT64_MAX);
-	vkResetFences(m_device, 1, &m_presentFences[m_currentFrame]);
+void Iridium::Renderer::renderer::drawFrame(const frame_packet& packet) {
+	IRIDIUM_ALLOCATION_TAG(renderer);
+	IRIDIUM_PROFILE_FRAME();
+	IRIDIUM_PROFILE_SCOPE("drawFrame");
+	defer(AllocationTracker::endFrame());
+
+	auto frameStart = std::chrono::steady_clock::now();
+	if(m_lastFrameStart != std::chrono::steady_clock::time_point{})
+		FrameStats::record(FrameStats::metric::frame, std::chrono::nanoseconds(frameStart - m_lastFrameStart).count());
+	m_lastFrameStart = frameStart;
+
+	m_packet = &packet;
+	if(packet.framebufferWidth != m_framebufferExtent.width || packet.framebufferHeight != m_framebufferExtent.height) {
+		m_framebufferExtent = {packet.framebufferWidth, packet.framebufferHeight};
+		m_framebufferResized = true;
+	}
 
-	vkWaitForFences(m_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
-	uint32_t imageIndex = 0;
-	VkResult result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex);
+	auto waitStart = std::chrono::steady_clock::now();
+	{
+		IRIDIUM_PROFILE_SCOPE("waitForFrameFences");
+		if(!m_headless) {
+			vkWaitForFences(m_device, 1, &m_presentFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+		}
+		vkWaitForFences(m_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+	}
+	auto fenceWait = std::chrono::steady_clock::now() - waitStart;
+	m_frameArenas[m_currentFrame].reset();
+	// room for the uniforms and every draw's constants, so recording never runs out
+	VkDeviceSize uploadBytes = m_frameUploads.stride(sizeof(uniform_buffer)) + packet.drawList.size() * m_frameUploads.stride(sizeof(draw_constants));
+	if(m_frameUploads.reset(m_currentFrame, uploadBytes))
+		writeDescriptorSet(m_currentFrame);
+	resetFrameCommandPools(m_currentFrame);
+	// frames complete in order, so everything up to the one this slot submitted last is done, presents included
+	m_deletionQueue.retire(m_slotFrames[m_currentFrame]);
+	m_deletionQueue.beginFrame(++m_frameNumber);
+	m_memoryBudget.update();
+	m_uploader.flush();
+
+	waitStart = std::chrono::steady_clock::now();
+	uint32_t imageIndex = m_currentFrame; // headless has an image per frame slot
+	VkResult result = VK_SUCCESS;
+	if(!m_headless)
+		result = vkAcquireNextImageKHR(m_device, m_swapchain, UINT64_MAX, m_imageAvailableSemaphores[m_currentFrame], VK_NULL_HANDLE, &imageIndex);
+	auto acquireWait = std::chrono::steady_clock::now() - waitStart;
 	if(result == VK_ERROR_OUT_OF_DATE_KHR) {
 		recreateSwapchain();
 		return;
@@ -861,136 +1077,295 @@ void Iridium::Renderer::renderer::drawFrame() {
 	}
 	vkResetFences(m_device, 1, &m_inFlightFences[m_currentFrame]);
 	
-	vkResetCommandBuffer(m_commandBuffers[m_currentFrame], 0);
+	updateUniformBuffer(); // before recording, the draws bind its offset
 	recordCommandBuffer(m_commandBuffers[m_currentFrame], imageIndex);
 	
-	VkSemaphore waitSemaphores[] = { m_imageAvailableSemaphores[m_currentFrame] };
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	VkSemaphore waitSemaphores[2];
+	VkPipelineStageFlags waitStages[2];
+	uint64_t waitValues[2] = {}; // only read for the timeline
+	uint32_t waitCount = 0;
+	if(!m_headless) {
+		waitSemaphores[waitCount] = m_imageAvailableSemaphores[m_currentFrame];
+		waitStages[waitCount++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	}
+	if(m_uploadWait != 0) {
+		waitSemaphores[waitCount] = m_uploader.timeline();
+		waitValues[waitCount] = m_uploadWait;
+		waitStages[waitCount++] = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	}
 	VkSemaphore signalSemaphores[] = { m_renderFinishedSemaphores[m_currentFrame] };
 
-	updateUniformBuffer(m_currentFrame);
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = waitCount;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = waitCount;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &m_commandBuffers[m_currentFrame];
-	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.signalSemaphoreCount = m_headless ? 0 : 1;
 	submitInfo.pSignalSemaphores = signalSemaphores;
-	if(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]) != VK_SUCCESS)
-		throw std::runtime_error("failed to submit draw command buffer");
-
-	VkSwapchainKHR swapChains[] = { m_swapchain };
-
-	VkSwapchainPresentFenceInfoEXT fenceInfo{};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
-	fenceInfo.swapchainCount = 1;
-	fenceInfo.pFences = &m_presentFences[m_currentFrame];
-
-	VkPresentInfoKHR presentInfo{};
-	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-	presentInfo.waitSemaphoreCount = 1;
-	presentInfo.pWaitSemaphores = signalSemaphores;
-	presentInfo.swapchainCount = 1;
-	presentInfo.pSwapchains = swapChains;
-	presentInfo.pImageIndices = &imageIndex;
-	presentInfo.pResults = nullptr;
-	presentInfo.pNext = &fenceInfo;
-
-	result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
-	if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebufferResized) {
-		recreateSwapchain();
-		m_framebufferResized = false;
-	} else if(result != VK_SUCCESS) {
-		throw Iridium::Renderer::renderer_error("failed to present swap chain image");
+	{
+		std::scoped_lock<std::mutex> queueLock(m_queueMutex);
+		if(vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame]) != VK_SUCCESS)
+			throw std::runtime_error("failed to submit draw command buffer");
 	}
-
-	m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-}
-
-uint32_t Iridium::Renderer::renderer::findMemoryType(uint32_t filter, VkMemoryPropertyFlags properties) {
-	VkPhysicalDeviceMemoryProperties memoryProperties;
-	vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memoryProperties);
-
-	for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
-		if(filter & (1 << i) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-			return i;
+	m_slotFrames[m_currentFrame] = m_frameNumber;
+
+	// headless has nothing to present to, the image is simply left for the next time its slot comes around
+	std::chrono::steady_clock::duration presentWait{};
+	if(!m_headless) {
+		VkSwapchainKHR swapChains[] = { m_swapchain };
+
+		VkSwapchainPresentFenceInfoEXT fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT;
+		fenceInfo.swapchainCount = 1;
+		fenceInfo.pFences = &m_presentFences[m_currentFrame];
+
+		VkPresentInfoKHR presentInfo{};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = signalSemaphores;
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = swapChains;
+		presentInfo.pImageIndices = &imageIndex;
+		presentInfo.pResults = nullptr;
+		presentInfo.pNext = &fenceInfo;
+
+		// reset only now, a frame that never got here leaves it signaled for the slot's next turn
+		vkResetFences(m_device, 1, &m_presentFences[m_currentFrame]);
+		auto presentStart = std::chrono::steady_clock::now();
+		{
+			IRIDIUM_PROFILE_SCOPE("present");
+			std::scoped_lock<std::mutex> queueLock(m_queueMutex);
+			result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
+		}
+		presentWait = std::chrono::steady_clock::now() - presentStart;
+		if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebufferResized) {
+			recreateSwapchain();
+			m_framebufferResized = false;
+		} else if(result != VK_SUCCESS) {
+			throw Iridium::Renderer::renderer_error("failed to present swap chain image");
 		}
 	}
 
-	throw Iridium::Renderer::renderer_error("Failed to find suitable memory type.");
+	acquireWait += fenceWait;
+	FrameStats::record(FrameStats::metric::acquireWait, std::chrono::nanoseconds(acquireWait).count());
+	FrameStats::record(FrameStats::metric::presentWait, std::chrono::nanoseconds(presentWait).count());
+	FrameStats::record(FrameStats::metric::cpu, std::chrono::nanoseconds(std::chrono::steady_clock::now() - frameStart - acquireWait - presentWait).count());
+	FrameStats::endFrame();
+
+	m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
-void Iridium::Renderer::renderer::createBuffer(size_t size, VkBufferUsageFlags flags, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory &memory) {
-	using enum Iridium::Vulkan::queue_family_indices::family_type;
-	
-	auto queueFamilies = Iridium::Vulkan::findQueueFamilies(m_physicalDevice, m_surface);
-	std::vector<uint32_t> indices;
-	VkSharingMode mode = VK_SHARING_MODE_MAX_ENUM;
-	if(queueFamilies.families[transfer] != queueFamilies.families[graphics]) {
-		indices.push_back(queueFamilies.families[transfer]);
-		indices.push_back(queueFamilies.families[graphics]);
-		mode = VK_SHARING_MODE_CONCURRENT;
-	} else {
-		indices.push_back(queueFamilies.families[graphics]);
-		mode = VK_SHARING_MODE_EXCLUSIVE;
-	}
-	
+void Iridium::Renderer::renderer::createBuffer(size_t size, VkBufferUsageFlags flags, VkMemoryPropertyFlags properties, VkBuffer& buffer, device_allocation& memory) {
+	// exclusive, staging_uploader hands ownership over from the transfer family
 	VkBufferCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	createInfo.usage = flags;
 	createInfo.size = size;
-	createInfo.sharingMode = mode;
-	createInfo.pQueueFamilyIndices = indices.data();
-	createInfo.queueFamilyIndexCount = indices.size();
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
 	if(vkCreateBuffer(m_device, &createInfo, nullptr, &buffer) != VK_SUCCESS) {
 		throw Iridium::Renderer::renderer_error("Failed to create a buffer.");
 	}
 
-	VkMemoryRequirements memoryRequirements;
-	vkGetBufferMemoryRequirements(m_device, buffer, &memoryRequirements);
+	memory = m_allocator.allocateBuffer(buffer, properties);
+}
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memoryRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memoryRequirements.memoryTypeBits, properties);
+void Iridium::Renderer::renderer::submit(const draw_command& command) {
+	m_packets.writeBuffer().drawList.push_back(command);
+}
 
-	if(vkAllocateMemory(m_device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
-		throw Iridium::Renderer::renderer_error("Failed to allocate memory buffer.");
-	}
-	vkBindBufferMemory(m_device, buffer, memory, 0);
+Iridium::Renderer::command_counters& Iridium::Renderer::command_counters::operator+=(const command_counters& other) {
+	draws += other.draws;
+	pipelineBinds += other.pipelineBinds;
+	descriptorBinds += other.descriptorBinds;
+	return *this;
 }
 
-void Iridium::Renderer::renderer::copyBuffer(VkBuffer src, VkBuffer dst, size_t size) {
-	VkCommandBufferAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = m_commandPool;
-	allocInfo.commandBufferCount = 1;
+// render thread
 
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer);
+void Iridium::Renderer::thread_timings::add(std::chrono::steady_clock::duration busy, std::chrono::steady_clock::duration wait) {
+	busyNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(busy).count(), std::memory_order_relaxed);
+	waitNanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count(), std::memory_order_relaxed);
+	frames.fetch_add(1, std::memory_order_relaxed);
+}
 
-	VkCommandBufferBeginInfo beginInfo{};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+void Iridium::Renderer::renderer::startRenderThread() {
+	m_renderThreadRunning.store(true, std::memory_order_release);
+	m_renderThread = getThreadManager()->spawnThread("Render", thread_role::render, [this]() -> void {
+		try {
+			renderThreadLoop();
+		} catch(...) {
+			m_renderThreadError = std::current_exception();
+		}
+		// let the main thread out of publishFrame
+		m_renderThreadRunning.store(false, std::memory_order_release);
+		m_packetsConsumed.store(UINT64_MAX, std::memory_order_release);
+		m_packetsConsumed.notify_all();
+	});
+}
 
-	VkBufferCopy copyRegion{};
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, src, dst, 1, &copyRegion);
+void Iridium::Renderer::renderer::stopRenderThread() {
+	frame_packet& packet = m_packets.writeBuffer();
+	packet.quit = true;
+	m_packets.publish();
+	getThreadManager()->join(m_renderThread);
 
-	vkEndCommandBuffer(commandBuffer);
+	if(m_renderThreadError)
+		std::rethrow_exception(m_renderThreadError);
+}
 
-	VkSubmitInfo submitInfo{};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-	vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(m_graphicsQueue);
-	vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+void Iridium::Renderer::renderer::renderThreadLoop() {
+	using clock = std::chrono::steady_clock;
+
+	[[maybe_unused]] size_t counter = 0;
+	while(true) {
+		auto waitStart = clock::now();
+		{
+			IRIDIUM_PROFILE_SCOPE("waitForPacket");
+			m_packets.waitForPublish();
+		}
+		m_packets.update();
+		m_packetsConsumed.fetch_add(1, std::memory_order_release);
+		m_packetsConsumed.notify_all();
+
+		const frame_packet& packet = m_packets.readBuffer();
+		if(packet.quit)
+			break;
+		bool measured = m_benchmark && packet.frame > m_benchmark->warmupFrames;
+		if(measured && !m_benchmarkMeasuring) {
+			FrameStats::reset(); // warmup is over
+			m_benchmarkMeasuring = true;
+		}
+
+		auto start = clock::now();
+		drawFrame(packet);
+		m_renderTimings.add(clock::now() - start, start - waitStart);
+		if(measured)
+			m_benchmarkFramesDrawn++;
+
+#if IRIDIUM_TRACK_ALLOCATIONS
+		if(++counter == 2000) {
+			AllocationTracker::logFrame(AllocationTracker::lastFrame());
+			counter = 0;
+		}
+#endif
+	}
+	m_packet = nullptr;
+	std::scoped_lock<std::mutex> queueLock(m_queueMutex);
+	vkDeviceWaitIdle(m_device);
+}
+
+void Iridium::Renderer::renderer::publishFrame(std::chrono::steady_clock::time_point frameStart, float time) {
+	IRIDIUM_PROFILE_SCOPE("publishFrame");
+	auto [width, height] = m_headless ? std::tuple(m_benchmark->width, m_benchmark->height) : getWindowManager()->framebufferSize();
+
+	frame_packet& packet = m_packets.writeBuffer();
+	packet.frame = ++m_packetsPublished;
+	packet.cameraPos = m_cameraPos;
+	packet.time = time;
+	packet.framebufferWidth = width;
+	packet.framebufferHeight = height;
+	packet.wireframe = drawWireframe;
+	packet.quit = false;
+	m_packets.publish();
+	// the slot we got back was drawn already
+	m_packets.writeBuffer().drawList.clear();
+
+	// Simulating more than one frame ahead only produces packets that get dropped. The benchmark has to
+	// draw every packet, so it waits until this one is picked up and only overlaps with drawing it.
+	uint64_t target = m_benchmark ? m_packetsPublished : m_packetsPublished - 1;
+	auto waitStart = std::chrono::steady_clock::now();
+	uint64_t consumed = m_packetsConsumed.load(std::memory_order_acquire);
+	while(consumed < target) {
+		m_packetsConsumed.wait(consumed, std::memory_order_acquire);
+		consumed = m_packetsConsumed.load(std::memory_order_acquire);
+	}
+	auto waitEnd = std::chrono::steady_clock::now();
+	m_mainTimings.add(waitStart - frameStart, waitEnd - waitStart);
+}
+
+void Iridium::Renderer::renderer::logThreadTimings() {
+	auto logTimings = [](const char* name, thread_timings& timings, uint64_t (&reported)[3]) -> void {
+		uint64_t totals[3] = {
+			timings.busyNanoseconds.load(std::memory_order_relaxed),
+			timings.waitNanoseconds.load(std::memory_order_relaxed),
+			timings.frames.load(std::memory_order_relaxed)
+		};
+		uint64_t frames = totals[2] - reported[2];
+		if(frames != 0) {
+			ENGINE_LOG_INFO("{} thread: {:.3f} ms busy, {:.3f} ms waiting per frame over {} frames", name,
+				(totals[0] - reported[0]) / 1e6 / frames, (totals[1] - reported[1]) / 1e6 / frames, frames);
+		}
+		std::copy(std::begin(totals), std::end(totals), std::begin(reported));
+	};
+	logTimings("Main", m_mainTimings, m_reportedTimings[0]);
+	logTimings("Render", m_renderTimings, m_reportedTimings[1]);
+	m_memoryBudget.logHeaps();
+}
+
+void Iridium::Renderer::renderer::runBenchmark() {
+	using clock = std::chrono::steady_clock;
+	const benchmark_config& config = *m_benchmark;
+
+	VkPhysicalDeviceProperties properties{};
+	vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+	benchmark_result result{
+		.device = properties.deviceName,
+		.startupSeconds = std::chrono::duration<double>(clock::now() - config.launchTime).count(),
+		.runSeconds = 0.0,
+		.framesDrawn = 0,
+		.stats = {},
+		.heaps = {},
+		.allocator = {},
+		.cpu = {}
+	};
+	ENGINE_LOG_INFO("Benchmarking {} + {} frames of {} instances at {}x{}.", config.warmupFrames, config.frames, config.instances, config.width, config.height);
+
+	// simulated time only ever advances by the timestep, so every run draws the exact same frames
+	clock::time_point measureStart = clock::now();
+	uint32_t totalFrames = config.warmupFrames + config.frames;
+	startRenderThread();
+	for(uint32_t frame = 0; frame < totalFrames && m_renderThreadRunning.load(std::memory_order_acquire); frame++) {
+		auto start = clock::now();
+		if(frame == config.warmupFrames)
+			measureStart = start;
+
+		double time = double(frame) * config.timestep;
+		m_cameraPos = benchmarkCameraAt(time);
+		for(const benchmark_instance& instance : m_benchmarkScene.instances) {
+			const benchmark_mesh& mesh = m_benchmarkScene.meshes[instance.mesh];
+			submit({
+				.modelTransform = glm::rotate(instance.transform, float(time) * instance.spinSpeed, instance.spinAxis),
+				.indexCount = mesh.indexCount,
+				.firstIndex = mesh.firstIndex,
+				.vertexOffset = mesh.vertexOffset
+			});
+		}
+		publishFrame(start, float(time));
+	}
+	stopRenderThread();
+
+	// the render thread is joined, so its stats can be read from here
+	result.framesDrawn = m_benchmarkFramesDrawn;
+	result.runSeconds = std::chrono::duration<double>(clock::now() - measureStart).count();
+	result.stats = FrameStats::flush();
+	result.heaps = m_memoryBudget.heaps();
+	if(config.allocations != 0)
+		result.allocator = runAllocatorBenchmark(m_device, m_allocator, m_memoryBudget, config.allocations, config.seed);
+	result.cpu = runCpuBenchmarks(config.cpuIterations);
+	writeBenchmarkReport(config, result);
+	ENGINE_LOG_INFO("Benchmark done: {}", FrameStats::readout(result.stats));
+}
+
+std::pmr::memory_resource* Iridium::Renderer::renderer::getFrameAllocator() {
+	return &m_frameArenas[m_currentFrame];
 }
 
 Iridium::Renderer::renderer* Iridium::Renderer::getRenderer() {
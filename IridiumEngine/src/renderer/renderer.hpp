@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
 #include <cstdint>
+#include <exception>
+#include <memory_resource>
+#include <mutex>
 #include <ratio>
+#include <span>
 #include <vector>
 
 #include <vulkan/vulkan.h>
@@ -13,20 +18,74 @@
 #include <glm/glm.hpp>
 #include "glm/geometric.hpp"
 #include "glm/fwd.hpp"
+#include "glm/ext/matrix_transform.hpp"
 
 #include "../appinfo.hpp"
+#include "../arena.hpp"
+#include "benchmark.hpp"
+#include "gpuProfiler.hpp"
+#include "defragmenter.hpp"
+#include "deletionQueue.hpp"
+#include "frameUploadArena.hpp"
+#include "deviceAllocator.hpp"
+#include "memoryBudget.hpp"
+#include "stagingUploader.hpp"
 #include "vertex.hpp"
 #include "window.hpp"
+#include "../allocationTracker.hpp"
+#include "../frameStats.hpp"
 #include "../log.hpp"
+#include "../thread.hpp"
+#include "../tripleBuffer.hpp"
 
 #include "../inputHandler.hpp"
 
 namespace Iridium {
 	namespace Renderer {
-		struct push_constants {
+		// per draw, behind a dynamic offset into the frame_upload_arena
+		struct draw_constants {
 			glm::mat4 modelTransform;
 		};
 
+		// one indexed draw of the shared vertex/index buffers
+		struct draw_command {
+			glm::mat4 modelTransform;
+			uint32_t indexCount;
+			uint32_t firstIndex = 0;
+			int32_t vertexOffset = 0;
+		};
+
+		// what one command buffer recorded, summed into FrameStats' counters every frame
+		struct command_counters {
+			uint32_t draws = 0;
+			uint32_t pipelineBinds = 0;
+			uint32_t descriptorBinds = 0;
+
+			command_counters& operator+=(const command_counters& other);
+		};
+
+		// Everything the render thread needs to draw one frame. Built by the main thread and
+		// never touched again after it's published.
+		struct frame_packet {
+			uint64_t frame = 0;
+			glm::vec3 cameraPos{};
+			float time = 0.0f;
+			uint32_t framebufferWidth = 0;
+			uint32_t framebufferHeight = 0;
+			bool wireframe = false;
+			bool quit = false; // last packet, the render thread exits when it sees it
+			std::vector<draw_command> drawList;
+		};
+
+		// running totals, per frame averages are logged every couple thousand frames
+		struct thread_timings {
+			std::atomic<uint64_t> busyNanoseconds{0};
+			std::atomic<uint64_t> waitNanoseconds{0};
+			std::atomic<uint64_t> frames{0};
+
+			void add(std::chrono::steady_clock::duration busy, std::chrono::steady_clock::duration wait);
+		};
+
 		struct uniform_buffer {
 			glm::mat4 viewTransform;
 			glm::mat4 projection;
@@ -35,16 +94,24 @@ namespace Iridium {
 
 		class renderer {
 		public:
-			renderer(appinfo& info);
+			// with a benchmark config the renderer is headless, it draws into offscreen images and never touches GLFW
+			renderer(appinfo& info, const benchmark_config* benchmark = nullptr);
 
 			void inline testLoop() {
 				auto clock = std::chrono::steady_clock();
 				auto lastFrameTime = std::chrono::duration_cast<std::chrono::duration<float, std::milli>>(std::chrono::milliseconds(1));
 				size_t counter = 0;
-				while(!getWindowManager()->windowShouldClose()) {
+				uint64_t shownReport = UINT64_MAX;
+				startRenderThread();
+				while(!getWindowManager()->windowShouldClose() && m_renderThreadRunning.load(std::memory_order_acquire)) {
 					auto start = clock.now();
 					getWindowManager()->pollEvents();
-					drawFrame();
+
+					auto [width, height] = getWindowManager()->framebufferSize();
+					if(width == 0 || height == 0) { // minimized, nothing to draw
+						getWindowManager()->waitEvents();
+						continue;
+					}
 					
 					glm::vec3 moveVector{};
 					if(getInputHandler()->isKeyPressed(KEY_W)) {
@@ -71,17 +138,33 @@ namespace Iridium {
 					moveVector *= lastFrameTime.count() * 0.01f;
 					
 					m_cameraPos += moveVector;
+
+					float time = std::chrono::duration<float, std::chrono::seconds::period>(clock.now() - m_rendererStart).count();
+					submit({
+						.modelTransform = glm::rotate(glm::mat4(1.0f), glm::degrees(1.0f) * time * 0.1f, glm::vec3(0.0f, 0.0f, 1.0f)),
+						.indexCount = uint32_t(m_indices.size())
+					});
+					publishFrame(start, time);
+
+					FrameStats::report frameReport = FrameStats::lastReport();
+					if(frameReport.window != shownReport && frameReport.metrics[size_t(FrameStats::metric::frame)].count) {
+						if(FrameStats::getConfig().titleReadout)
+							getWindowManager()->setWindowName(FrameStats::readout(frameReport).c_str());
+						shownReport = frameReport.window;
+					}
 					if(counter == 2000) {
-						getWindowManager()->setWindowName(std::format("FPS: {}", 1.0f / std::chrono::duration_cast<std::chrono::duration<double>>(lastFrameTime).count()).c_str());
-						//ENGINE_LOG_INFO("FPS: {}", 1.0f / std::chrono::duration_cast<std::chrono::duration<double>>(lastFrameTime).count());
+						logThreadTimings();
 						counter = 0;
 					}
 					lastFrameTime = clock.now() - start;
 					counter++;
 				}
-				//vkDeviceWaitIdle(m_device);
+				stopRenderThread();
 			}
 
+			// draws the benchmark scene for the configured number of frames and writes the report
+			void runBenchmark();
+
 			void inline cleanup() {
 				cleanupVulkan();
 			}
@@ -89,15 +172,30 @@ namespace Iridium {
 			bool drawWireframe = false;
 		private:
 			enum { //constants
-				MAX_FRAMES_IN_FLIGHT = 3
+				MAX_FRAMES_IN_FLIGHT = 3,
+				DRAWS_PER_CHUNK = 256 // draws recorded into one secondary command buffer
+			};
+
+			// Secondary command buffers of one thread for one frame slot. The pool is reset as a whole
+			// once the slot's fence retires, the buffers stay allocated and get reused the next time.
+			struct alignas(64) thread_command_pool {
+				VkCommandPool pool = VK_NULL_HANDLE;
+				std::vector<VkCommandBuffer> buffers;
+				uint32_t used = 0;
 			};
 			
 			const appinfo& m_info;
+			const benchmark_config* m_benchmark = nullptr;
+			bool m_headless = false;
+			benchmark_scene m_benchmarkScene;
+			// render thread only, read by runBenchmark after the join
+			uint32_t m_benchmarkFramesDrawn = 0;
+			bool m_benchmarkMeasuring = false;
 
 			//Vulkan
 			VkInstance m_instance;
 			VkDebugUtilsMessengerEXT m_debugMessenger;
-			VkSurfaceKHR m_surface;
+			VkSurfaceKHR m_surface = VK_NULL_HANDLE;
 			VkPhysicalDevice m_physicalDevice;
 			VkDevice m_device;
 
@@ -111,36 +209,75 @@ namespace Iridium {
 			VkFormat m_swapchainImageFormat;
 			VkExtent2D m_swapchainExtent;
 			std::vector<VkImageView> m_swapchainImageViews;
+			std::vector<device_allocation> m_offscreenMemory; // headless, backs m_swapchainImages
 			VkRenderPass m_renderPass;
 			VkDescriptorSetLayout m_descriptorSetLayout;
 			VkPipelineLayout m_pipelineLayout;
 			VkPipeline m_graphicsPipeline;
 			std::vector<VkFramebuffer> m_swapchainFrameBuffers;
-			VkCommandPool m_commandPool;
+			VkCommandPool m_commandPool; // one time commands on the graphics queue
+			VkCommandPool m_frameCommandPools[MAX_FRAMES_IN_FLIGHT];
 			VkCommandBuffer m_commandBuffers[MAX_FRAMES_IN_FLIGHT];
+			// one per job system worker plus one for threads outside the pool
+			std::vector<thread_command_pool> m_threadCommandPools[MAX_FRAMES_IN_FLIGHT];
+
+			// main thread -> render thread
+			triple_buffer<frame_packet> m_packets;
+			std::atomic<uint64_t> m_packetsConsumed{0};
+			uint64_t m_packetsPublished = 0;
+			const frame_packet* m_packet = nullptr; // the one being drawn, render thread only
+
+			thread_handle m_renderThread;
+			std::atomic<bool> m_renderThreadRunning{false};
+			std::exception_ptr m_renderThreadError;
+
+			gpu_profiler m_gpuProfiler;
+			memory_budget m_memoryBudget;
+			device_allocator m_allocator;
+			deletion_queue m_deletionQueue;
+			uint64_t m_frameNumber = 0; // frames started, render thread only
+			uint64_t m_slotFrames[MAX_FRAMES_IN_FLIGHT] = {}; // the last frame each slot submitted
+			defragmenter m_defragmenter;
+			staging_uploader m_uploader;
+			// every queue we got is the first of its family, so they can all be one VkQueue; held around
+			// every submit, present and device wait, the uploader submits from other threads
+			std::mutex m_queueMutex;
+			uint64_t m_uploadWait = 0; // timeline value the frame being recorded waits for, render thread only
+			bool m_pipelineStatistics = false; // asked for and supported by the device
+
+			thread_timings m_mainTimings;
+			thread_timings m_renderTimings;
+			uint64_t m_reportedTimings[2][3] = {}; // totals at the last report, main then render
 			
 			VkSemaphore m_imageAvailableSemaphores[MAX_FRAMES_IN_FLIGHT];
 			VkSemaphore m_renderFinishedSemaphores[MAX_FRAMES_IN_FLIGHT];
 			VkFence m_inFlightFences[MAX_FRAMES_IN_FLIGHT];
 			VkFence m_presentFences[MAX_FRAMES_IN_FLIGHT];
 
+			// scratch memory that lives until the frame's in-flight fence is waited on again
+			MemoryExperimental::linear_arena m_frameArenas[MAX_FRAMES_IN_FLIGHT];
+
 			VkBuffer m_vertexBuffer;
-			VkDeviceMemory m_vertexBufferMemory;
+			device_allocation m_vertexBufferMemory;
+			defragmenter::move_id m_vertexBufferMove = 0;
 			
 			VkBuffer m_indexBuffer;
-			VkDeviceMemory m_indexBufferMemory;
+			device_allocation m_indexBufferMemory;
+			defragmenter::move_id m_indexBufferMove = 0;
 
-			std::vector<VkBuffer> m_uniformBuffers;
-			std::vector<VkDeviceMemory> m_uniformBuffersMemory;
-			std::vector<void*> m_uniformBuffersMapping;
+			// uniforms and per-draw constants, the descriptor sets point at it with dynamic offsets
+			frame_upload_arena m_frameUploads;
+			uint32_t m_frameUniformOffset = 0; // this frame's uniform_buffer, render thread only
 
 			VkDescriptorPool m_descriptorPool;
 			std::vector<VkDescriptorSet> m_descriptorSets;
 
-			bool m_framebufferResized = false;
+			VkExtent2D m_framebufferExtent{};
+			bool m_framebufferResized = false; // render thread only
 			uint16_t m_currentFrame = 0;
 
 			std::chrono::steady_clock::time_point m_rendererStart;
+			std::chrono::steady_clock::time_point m_lastFrameStart; // render thread only
 
 			std::vector<Iridium::Renderer::vertex> m_vertices {
 				{{-0.5f, -0.5f, 0.0f},{1, 0, 0}, {0, 0}},
@@ -174,13 +311,12 @@ namespace Iridium {
 
 			void createSurface(); //depends on window
 
-			void setWindowCallbacks();
-			
 			void pickPhysicalDevice();
 			
 			void createLogicalDevice();
 			
 			void createSwapchain();
+			void createOffscreenImages(); // stands in for the swapchain when headless
 			void recreateSwapchain();
 			void cleanupSwapchain();
 
@@ -190,12 +326,15 @@ namespace Iridium {
 
 			void createDescriptorSetLayout();
 			void createDescriptorSets();
+			void writeDescriptorSet(uint32_t frame);
 			
 			void createGraphicsPipeline();
 			
 			void createFramebuffers();
 			
 			void createCommandPool();
+			void destroyCommandPools();
+			void resetFrameCommandPools(uint32_t frame);
 
 			void createVertexBuffer();
 			void createIndexBuffer();
@@ -204,24 +343,45 @@ namespace Iridium {
 			void cleanupIndexBuffer();
 			void cleanupUniformBuffers();
 
-			void updateUniformBuffer(uint32_t);
+			void updateUniformBuffer();
+
+			void startRenderThread();
+			void stopRenderThread();
+			void renderThreadLoop();
+			// publishes the packet built this frame and keeps the main thread at most one frame ahead
+			void publishFrame(std::chrono::steady_clock::time_point frameStart, float time);
+			void logThreadTimings();
 
 			void createDescriptorPool();
 
 			void createCommandBuffers();
 			void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+			command_counters recordMainPass(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+			VkCommandBuffer acquireSecondaryCommandBuffer();
+			command_counters recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, std::span<const draw_command> draws);
 			
 			void createSyncObjects();
 			void destroySyncObjects();
 
+			void createGpuProfiler();
+
+			// render thread only
+			void drawFrame(const frame_packet& packet);
 		public:
-			void drawFrame();
+			// queues a draw for the frame being built, main thread only
+			void submit(const draw_command& command);
+
+			// Per-frame scratch allocator, everything allocated from it is freed
+			// once this frame slot comes around again. Render thread only.
+			std::pmr::memory_resource* getFrameAllocator();
+
+			// Vulkan objects handed here are destroyed once the frames that could use them have
+			// retired. Any thread.
+			deletion_queue* getDeletionQueue() { return &m_deletionQueue; }
 		private:
 			//helpers
-			uint32_t findMemoryType(uint32_t filter, VkMemoryPropertyFlags properties);
 
-			void createBuffer(size_t size, VkBufferUsageFlags flags, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory &memory);
-			void copyBuffer(VkBuffer src, VkBuffer dst, size_t size);
+			void createBuffer(size_t size, VkBufferUsageFlags flags, VkMemoryPropertyFlags properties, VkBuffer& buffer, device_allocation& memory);
 		};
 
 		renderer* getRenderer();
@@ -0,0 +1,319 @@
+#include "stagingUploader.hpp"
+
+#include <cstring>
+
+#include "vulkan.hpp"
+#include "../profiler.hpp"
+
+namespace IrR = Iridium::Renderer;
+
+void IrR::staging_uploader::create(VkDevice device, device_allocator& allocator, VkQueue transferQueue, std::mutex& queueMutex, uint32_t transferFamily, uint32_t graphicsFamily) {
+	m_device = device;
+	m_allocator = &allocator;
+	m_queue = transferQueue;
+	m_queueMutex = &queueMutex;
+	m_transferFamily = transferFamily;
+	m_graphicsFamily = graphicsFamily;
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	poolInfo.queueFamilyIndex = transferFamily;
+	if(vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS)
+		throw renderer_error("Failed to create the upload command pool.");
+
+	VkSemaphoreTypeCreateInfo typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+	if(vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_timeline) != VK_SUCCESS)
+		throw renderer_error("Failed to create the upload timeline semaphore.");
+
+	VkBufferCreateInfo ringInfo{};
+	ringInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	ringInfo.size = RING_SIZE;
+	ringInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	ringInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if(vkCreateBuffer(m_device, &ringInfo, nullptr, &m_ring) != VK_SUCCESS)
+		throw renderer_error("Failed to create the staging ring.");
+	m_ringMemory = m_allocator->allocateBuffer(m_ring, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+
+	m_open = {.value = 1};
+}
+
+void IrR::staging_uploader::destroy() {
+	if(m_submittedValue != 0)
+		wait({m_submittedValue});
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	retire();
+	for(temporary_buffer& temporary : m_open.temporaries) {
+		vkDestroyBuffer(m_device, temporary.buffer, nullptr);
+		m_allocator->free(temporary.allocation);
+	}
+	m_open = {};
+	m_bufferAcquires.clear();
+	m_imageAcquires.clear();
+	m_openBufferAcquires.clear();
+	m_openImageAcquires.clear();
+	m_freeCommandBuffers.clear();
+
+	vkDestroyBuffer(m_device, m_ring, nullptr);
+	m_allocator->free(m_ringMemory);
+	vkDestroySemaphore(m_device, m_timeline, nullptr);
+	vkDestroyCommandPool(m_device, m_commandPool, nullptr); // frees the command buffers with it
+}
+
+VkCommandBuffer IrR::staging_uploader::openBatch() {
+	if(m_open.commandBuffer != VK_NULL_HANDLE)
+		return m_open.commandBuffer;
+
+	if(!m_freeCommandBuffers.empty()) {
+		m_open.commandBuffer = m_freeCommandBuffers.back();
+		m_freeCommandBuffers.pop_back();
+	} else {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = m_commandPool;
+		allocInfo.commandBufferCount = 1;
+		if(vkAllocateCommandBuffers(m_device, &allocInfo, &m_open.commandBuffer) != VK_SUCCESS)
+			throw renderer_error("Failed to allocate an upload command buffer.");
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if(vkBeginCommandBuffer(m_open.commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw renderer_error("Failed to begin an upload command buffer.");
+	return m_open.commandBuffer;
+}
+
+bool IrR::staging_uploader::allocateRing(VkDeviceSize size, VkDeviceSize& offset) {
+	size = (size + RING_ALIGNMENT - 1) & ~(RING_ALIGNMENT - 1);
+	if(m_ringHead >= m_ringTail && m_ringUsed < RING_SIZE) {
+		// free space is the end of the ring and the start up to the tail
+		if(m_ringHead + size <= RING_SIZE) {
+			offset = m_ringHead;
+		} else if(size <= m_ringTail) {
+			m_ringUsed += RING_SIZE - m_ringHead;
+			m_open.ringBytes += RING_SIZE - m_ringHead;
+			offset = 0;
+		} else {
+			return false;
+		}
+	} else if(m_ringHead + size <= m_ringTail) {
+		offset = m_ringHead;
+	} else {
+		return false;
+	}
+	m_ringHead = offset + size;
+	m_ringUsed += size;
+	m_open.ringBytes += size;
+	return true;
+}
+
+VkBuffer IrR::staging_uploader::stage(std::span<const std::byte> data, VkDeviceSize& offset) {
+	retire();
+	if(allocateRing(data.size(), offset)) {
+		std::memcpy(static_cast<std::byte*>(m_ringMemory.mapped) + offset, data.data(), data.size());
+		return m_ring;
+	}
+
+	// bigger than what's free right now, waiting for the ring would stall whoever is uploading
+	temporary_buffer temporary{};
+	VkBufferCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	createInfo.size = data.size();
+	createInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	createInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	if(vkCreateBuffer(m_device, &createInfo, nullptr, &temporary.buffer) != VK_SUCCESS)
+		throw renderer_error("Failed to create a staging buffer.");
+	temporary.allocation = m_allocator->allocateBuffer(temporary.buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	std::memcpy(temporary.allocation.mapped, data.data(), data.size());
+	m_open.temporaries.push_back(temporary);
+	offset = 0;
+	return temporary.buffer;
+}
+
+IrR::upload_handle IrR::staging_uploader::uploadBuffer(VkBuffer buffer, VkDeviceSize offset, std::span<const std::byte> data) {
+	if(data.empty())
+		return {};
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	VkDeviceSize source;
+	VkBuffer from = stage(data, source);
+
+	VkBufferCopy region{source, offset, data.size()};
+	vkCmdCopyBuffer(openBatch(), from, buffer, 1, &region);
+
+	if(m_transferFamily != m_graphicsFamily) {
+		VkBufferMemoryBarrier acquire{};
+		acquire.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		acquire.srcAccessMask = 0;
+		acquire.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		acquire.srcQueueFamilyIndex = m_transferFamily;
+		acquire.dstQueueFamilyIndex = m_graphicsFamily;
+		acquire.buffer = buffer;
+		acquire.offset = offset;
+		acquire.size = data.size();
+		m_openBufferAcquires.push_back(acquire);
+	}
+	return {m_open.value};
+}
+
+IrR::upload_handle IrR::staging_uploader::uploadImage(VkImage image, VkImageAspectFlags aspect, VkExtent3D extent, uint32_t mipLevel, uint32_t layers, VkImageLayout finalLayout, std::span<const std::byte> data) {
+	if(data.empty())
+		return {};
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	VkDeviceSize source;
+	VkBuffer from = stage(data, source);
+	VkCommandBuffer commandBuffer = openBatch();
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = {aspect, mipLevel, 1, 0, layers};
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = source;
+	region.imageSubresource = {aspect, mipLevel, 0, layers};
+	region.imageExtent = extent;
+	vkCmdCopyBufferToImage(commandBuffer, from, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = finalLayout;
+	if(m_transferFamily != m_graphicsFamily) {
+		// the layout change happens as part of the ownership transfer
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		barrier.srcQueueFamilyIndex = m_transferFamily;
+		barrier.dstQueueFamilyIndex = m_graphicsFamily;
+		m_openImageAcquires.push_back(barrier);
+	} else {
+		// the timeline semaphore makes the write visible, this only has to change the layout
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	}
+	return {m_open.value};
+}
+
+void IrR::staging_uploader::flush() {
+	IRIDIUM_PROFILE_SCOPE("flushUploads");
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	retire();
+	if(m_open.commandBuffer == VK_NULL_HANDLE)
+		return;
+
+	if(!m_openBufferAcquires.empty() || !m_openImageAcquires.empty()) {
+		// the release half is the same barrier with the access on this side
+		std::vector<VkBufferMemoryBarrier> bufferReleases = m_openBufferAcquires;
+		std::vector<VkImageMemoryBarrier> imageReleases = m_openImageAcquires;
+		for(VkBufferMemoryBarrier& release : bufferReleases) {
+			release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			release.dstAccessMask = 0;
+		}
+		for(VkImageMemoryBarrier& release : imageReleases) {
+			release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			release.dstAccessMask = 0;
+		}
+		vkCmdPipelineBarrier(m_open.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+			uint32_t(bufferReleases.size()), bufferReleases.data(), uint32_t(imageReleases.size()), imageReleases.data());
+	}
+	if(vkEndCommandBuffer(m_open.commandBuffer) != VK_SUCCESS)
+		throw renderer_error("Failed to record uploads.");
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &m_open.value;
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &m_open.commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &m_timeline;
+	{
+		// wait() flushes from whichever thread is waiting, and m_queue may be the graphics queue
+		std::scoped_lock<std::mutex> queueLock(*m_queueMutex);
+		if(vkQueueSubmit(m_queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+			throw renderer_error("Failed to submit uploads.");
+	}
+
+	m_bufferAcquires.insert(m_bufferAcquires.end(), m_openBufferAcquires.begin(), m_openBufferAcquires.end());
+	m_imageAcquires.insert(m_imageAcquires.end(), m_openImageAcquires.begin(), m_openImageAcquires.end());
+	m_openBufferAcquires.clear();
+	m_openImageAcquires.clear();
+
+	m_open.ringEnd = m_ringHead;
+	m_submittedValue = m_open.value;
+	m_inFlight.push_back(std::move(m_open));
+	m_open = {.value = m_submittedValue + 1};
+}
+
+void IrR::staging_uploader::retire() {
+	uint64_t completed = 0;
+	vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+	// batches finish in order, so the ring only ever frees from the tail
+	while(!m_inFlight.empty() && m_inFlight.front().value <= completed) {
+		batch& done = m_inFlight.front();
+		// a batch of temporaries only never took ring space, its ringEnd says nothing about the tail
+		if(done.ringBytes != 0)
+			m_ringTail = done.ringEnd;
+		m_ringUsed -= done.ringBytes;
+		for(temporary_buffer& temporary : done.temporaries) {
+			vkDestroyBuffer(m_device, temporary.buffer, nullptr);
+			m_allocator->free(temporary.allocation);
+		}
+		m_freeCommandBuffers.push_back(done.commandBuffer);
+		m_inFlight.pop_front();
+	}
+}
+
+uint64_t IrR::staging_uploader::recordAcquires(VkCommandBuffer commandBuffer) {
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	if(!m_bufferAcquires.empty() || !m_imageAcquires.empty()) {
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr,
+			uint32_t(m_bufferAcquires.size()), m_bufferAcquires.data(), uint32_t(m_imageAcquires.size()), m_imageAcquires.data());
+		m_bufferAcquires.clear();
+		m_imageAcquires.clear();
+	}
+	if(m_submittedValue == m_acquiredValue)
+		return 0;
+	m_acquiredValue = m_submittedValue;
+	return m_submittedValue;
+}
+
+bool IrR::staging_uploader::isComplete(upload_handle handle) {
+	uint64_t completed = 0;
+	vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+	return completed >= handle.value;
+}
+
+void IrR::staging_uploader::wait(upload_handle handle) {
+	if(handle.value == 0)
+		return;
+	bool submitted;
+	{
+		std::scoped_lock<std::mutex> lock(m_mutex);
+		submitted = handle.value <= m_submittedValue;
+	}
+	if(!submitted)
+		flush();
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_timeline;
+	waitInfo.pValues = &handle.value;
+	vkWaitSemaphores(m_device, &waitInfo, UINT64_MAX);
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <span>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "deviceAllocator.hpp"
+
+namespace Iridium {
+	namespace Renderer {
+		// the timeline value of the batch an upload went out in
+		struct upload_handle {
+			uint64_t value = 0;
+		};
+
+		// Copies data into device local buffers and images on the transfer queue. Uploads are staged in a
+		// persistently mapped ring and batched into one submission per flush, each batch signals the next value
+		// of a timeline semaphore. Nothing here waits on the GPU, an upload that doesn't fit in the ring gets a
+		// staging buffer of its own instead.
+		//
+		// Destinations have to be exclusive. When the transfer family isn't the graphics family the batch
+		// releases them, and recordAcquires acquires them on the graphics queue. A destination is meant to be
+		// written once, rewriting one the graphics queue already owns would need it released back first.
+		//
+		// Uploads, flush and wait are safe from any thread. The transfer queue can be the same VkQueue as the
+		// graphics queue, so submits take the queue mutex the renderer holds around its own submits and presents.
+		// recordAcquires belongs to the thread recording for the graphics queue.
+		class staging_uploader {
+		public:
+			static constexpr VkDeviceSize RING_SIZE = VkDeviceSize(32) << 20;
+			static constexpr VkDeviceSize RING_ALIGNMENT = 16; // covers texel blocks up to 16 bytes
+
+			void create(VkDevice device, device_allocator& allocator, VkQueue transferQueue, std::mutex& queueMutex, uint32_t transferFamily, uint32_t graphicsFamily);
+			// the device has to be idle
+			void destroy();
+
+			upload_handle uploadBuffer(VkBuffer buffer, VkDeviceSize offset, std::span<const std::byte> data);
+			// one mip level of every layer, tightly packed, the image ends up in finalLayout
+			upload_handle uploadImage(VkImage image, VkImageAspectFlags aspect, VkExtent3D extent, uint32_t mipLevel, uint32_t layers, VkImageLayout finalLayout, std::span<const std::byte> data);
+
+			// submits everything uploaded since the last flush, retires finished batches
+			void flush();
+			// Records the acquire half of the ownership transfers flushed so far. Returns the timeline value
+			// the submission of commandBuffer has to wait for, 0 when it doesn't have to wait.
+			uint64_t recordAcquires(VkCommandBuffer commandBuffer);
+			VkSemaphore timeline() const { return m_timeline; }
+
+			bool isComplete(upload_handle handle);
+			// blocks, for loading screens and shutdown, never for a frame; flushes first if the upload is still open
+			void wait(upload_handle handle);
+		private:
+			struct temporary_buffer {
+				VkBuffer buffer;
+				device_allocation allocation;
+			};
+
+			struct batch {
+				VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+				uint64_t value = 0;
+				VkDeviceSize ringEnd = 0;   // the ring's head after this batch
+				VkDeviceSize ringBytes = 0; // including the tail skipped when it wrapped
+				std::vector<temporary_buffer> temporaries;
+			};
+
+			VkDevice m_device = VK_NULL_HANDLE;
+			device_allocator* m_allocator = nullptr;
+			VkQueue m_queue = VK_NULL_HANDLE;
+			std::mutex* m_queueMutex = nullptr; // taken after m_mutex
+			uint32_t m_transferFamily = 0;
+			uint32_t m_graphicsFamily = 0;
+			VkCommandPool m_commandPool = VK_NULL_HANDLE;
+			VkSemaphore m_timeline = VK_NULL_HANDLE;
+
+			std::mutex m_mutex;
+			VkBuffer m_ring = VK_NULL_HANDLE;
+			device_allocation m_ringMemory;
+			VkDeviceSize m_ringHead = 0;
+			VkDeviceSize m_ringTail = 0;
+			VkDeviceSize m_ringUsed = 0;
+
+			batch m_open;              // being recorded, value is what it will signal
+			std::deque<batch> m_inFlight;
+			std::vector<VkCommandBuffer> m_freeCommandBuffers;
+			uint64_t m_submittedValue = 0;
+			uint64_t m_acquiredValue = 0;
+			std::vector<VkBufferMemoryBarrier> m_bufferAcquires; // flushed, not recorded on the graphics queue yet
+			std::vector<VkImageMemoryBarrier> m_imageAcquires;
+			std::vector<VkBufferMemoryBarrier> m_openBufferAcquires; // for the open batch
+			std::vector<VkImageMemoryBarrier> m_openImageAcquires;
+
+			// needs m_mutex
+			VkCommandBuffer openBatch();
+			bool allocateRing(VkDeviceSize size, VkDeviceSize& offset);
+			// copies data into the ring or a temporary buffer, returns what to copy from
+			VkBuffer stage(std::span<const std::byte> data, VkDeviceSize& offset);
+			void retire();
+		};
+	}
+}
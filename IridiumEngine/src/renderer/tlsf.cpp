@@ -0,0 +1,219 @@
+#include "tlsf.hpp"
+
+#include <algorithm>
+#include <bit>
+
+Iridium::Renderer::tlsf_allocator::tlsf_allocator(uint64_t size) {
+	reset(size);
+}
+
+void Iridium::Renderer::tlsf_allocator::reset(uint64_t size) {
+	m_nodes.clear();
+	m_unusedNodes.clear();
+	for(auto& heads : m_heads)
+		std::fill(std::begin(heads), std::end(heads), NO_NODE);
+	m_flBitmap = 0;
+	std::fill(std::begin(m_slBitmaps), std::end(m_slBitmaps), 0);
+	m_size = size;
+	m_usedBytes = 0;
+	m_allocationCount = 0;
+	if(size != 0)
+		insertFree(newNode(0, size));
+}
+
+// first level is the power of two, second level splits it into SL_COUNT linear steps
+void Iridium::Renderer::tlsf_allocator::mapping(uint64_t size, uint32_t& fl, uint32_t& sl) {
+	if(size < SL_COUNT) {
+		fl = 0;
+		sl = uint32_t(size);
+		return;
+	}
+	uint32_t msb = uint32_t(std::bit_width(size)) - 1;
+	fl = msb - SL_BITS + 1;
+	sl = uint32_t(size >> (msb - SL_BITS)) - SL_COUNT;
+}
+
+uint32_t Iridium::Renderer::tlsf_allocator::newNode(uint64_t offset, uint64_t size) {
+	uint32_t index;
+	if(!m_unusedNodes.empty()) {
+		index = m_unusedNodes.back();
+		m_unusedNodes.pop_back();
+	} else {
+		index = uint32_t(m_nodes.size());
+		m_nodes.emplace_back();
+	}
+	m_nodes[index] = {offset, size, NO_NODE, NO_NODE, NO_NODE, NO_NODE, false};
+	return index;
+}
+
+void Iridium::Renderer::tlsf_allocator::releaseNode(uint32_t index) {
+	m_unusedNodes.push_back(index);
+}
+
+void Iridium::Renderer::tlsf_allocator::insertFree(uint32_t index) {
+	uint32_t fl, sl;
+	mapping(m_nodes[index].size, fl, sl);
+	uint32_t head = m_heads[fl][sl];
+	m_nodes[index].prevFree = NO_NODE;
+	m_nodes[index].nextFree = head;
+	if(head != NO_NODE)
+		m_nodes[head].prevFree = index;
+	m_heads[fl][sl] = index;
+	m_slBitmaps[fl] |= 1u << sl;
+	m_flBitmap |= uint64_t(1) << fl;
+}
+
+void Iridium::Renderer::tlsf_allocator::removeFree(uint32_t index) {
+	node& target = m_nodes[index];
+	if(target.prevFree != NO_NODE)
+		m_nodes[target.prevFree].nextFree = target.nextFree;
+	if(target.nextFree != NO_NODE)
+		m_nodes[target.nextFree].prevFree = target.prevFree;
+
+	uint32_t fl, sl;
+	mapping(target.size, fl, sl);
+	if(m_heads[fl][sl] == index) {
+		m_heads[fl][sl] = target.nextFree;
+		if(target.nextFree == NO_NODE) {
+			m_slBitmaps[fl] &= ~(1u << sl);
+			if(m_slBitmaps[fl] == 0)
+				m_flBitmap &= ~(uint64_t(1) << fl);
+		}
+	}
+	target.prevFree = NO_NODE;
+	target.nextFree = NO_NODE;
+}
+
+uint32_t Iridium::Renderer::tlsf_allocator::findFree(uint64_t size) const {
+	if(size > m_size)
+		return NO_NODE;
+	// rounded up to the next list, so the first node of whatever list is found is big enough
+	if(size >= SL_COUNT)
+		size += (uint64_t(1) << (std::bit_width(size) - 1 - SL_BITS)) - 1;
+
+	uint32_t fl, sl;
+	mapping(size, fl, sl);
+	if(fl >= FL_COUNT)
+		return NO_NODE;
+	uint32_t slMap = m_slBitmaps[fl] & (~0u << sl);
+	if(slMap == 0) {
+		uint64_t flMap = fl + 1 < 64 ? m_flBitmap & (~uint64_t(0) << (fl + 1)) : 0;
+		if(flMap == 0)
+			return NO_NODE;
+		fl = uint32_t(std::countr_zero(flMap));
+		slMap = m_slBitmaps[fl];
+	}
+	return m_heads[fl][std::countr_zero(slMap)];
+}
+
+uint32_t Iridium::Renderer::tlsf_allocator::findInList(uint64_t size, uint64_t alignment) const {
+	if(size > m_size)
+		return NO_NODE;
+	uint32_t fl, sl;
+	mapping(size, fl, sl);
+	for(uint32_t index = m_heads[fl][sl]; index != NO_NODE; index = m_nodes[index].nextFree) {
+		uint64_t offset = (m_nodes[index].offset + alignment - 1) & ~(alignment - 1);
+		if(offset + size <= m_nodes[index].offset + m_nodes[index].size)
+			return index;
+	}
+	return NO_NODE;
+}
+
+void Iridium::Renderer::tlsf_allocator::splitFront(uint32_t index, uint64_t size) {
+	uint32_t front = newNode(m_nodes[index].offset, size);
+	node& target = m_nodes[index];
+	m_nodes[front].prevPhysical = target.prevPhysical;
+	m_nodes[front].nextPhysical = index;
+	if(target.prevPhysical != NO_NODE)
+		m_nodes[target.prevPhysical].nextPhysical = front;
+	target.prevPhysical = front;
+	target.offset += size;
+	target.size -= size;
+	insertFree(front);
+}
+
+Iridium::Renderer::tlsf_allocator::allocation Iridium::Renderer::tlsf_allocator::allocate(uint64_t size, uint64_t alignment) {
+	size = std::max<uint64_t>(size, 1);
+	alignment = std::max<uint64_t>(alignment, 1);
+	auto fits = [&](uint32_t index) -> bool {
+		uint64_t offset = (m_nodes[index].offset + alignment - 1) & ~(alignment - 1);
+		return offset + size <= m_nodes[index].offset + m_nodes[index].size;
+	};
+
+	// only pay for the worst case padding when the good fit doesn't happen to be aligned
+	uint32_t index = findFree(size);
+	if(index != NO_NODE && !fits(index))
+		index = findFree(size + alignment - 1);
+	// rounding up skips the nodes that share size's list, largestFree() promises those fit too
+	if(index == NO_NODE)
+		index = findInList(size, alignment);
+	if(index == NO_NODE)
+		return {0, NO_NODE};
+
+	removeFree(index);
+	uint64_t padding = ((m_nodes[index].offset + alignment - 1) & ~(alignment - 1)) - m_nodes[index].offset;
+	if(padding != 0)
+		splitFront(index, padding);
+
+	if(m_nodes[index].size > size) {
+		uint32_t rest = newNode(m_nodes[index].offset + size, m_nodes[index].size - size);
+		node& target = m_nodes[index];
+		m_nodes[rest].prevPhysical = index;
+		m_nodes[rest].nextPhysical = target.nextPhysical;
+		if(target.nextPhysical != NO_NODE)
+			m_nodes[target.nextPhysical].prevPhysical = rest;
+		target.nextPhysical = rest;
+		target.size = size;
+		insertFree(rest);
+	}
+
+	m_nodes[index].used = true;
+	m_usedBytes += size;
+	m_allocationCount++;
+	return {m_nodes[index].offset, index};
+}
+
+void Iridium::Renderer::tlsf_allocator::free(uint32_t index) {
+	node& target = m_nodes[index];
+	target.used = false;
+	m_usedBytes -= target.size;
+	m_allocationCount--;
+
+	uint32_t previous = target.prevPhysical;
+	if(previous != NO_NODE && !m_nodes[previous].used) {
+		removeFree(previous);
+		target.offset = m_nodes[previous].offset;
+		target.size += m_nodes[previous].size;
+		target.prevPhysical = m_nodes[previous].prevPhysical;
+		if(target.prevPhysical != NO_NODE)
+			m_nodes[target.prevPhysical].nextPhysical = index;
+		releaseNode(previous);
+	}
+
+	uint32_t next = target.nextPhysical;
+	if(next != NO_NODE && !m_nodes[next].used) {
+		removeFree(next);
+		target.size += m_nodes[next].size;
+		target.nextPhysical = m_nodes[next].nextPhysical;
+		if(target.nextPhysical != NO_NODE)
+			m_nodes[target.nextPhysical].prevPhysical = index;
+		releaseNode(next);
+	}
+	insertFree(index);
+}
+
+uint64_t Iridium::Renderer::tlsf_allocator::freeBefore(uint32_t index) const {
+	uint32_t previous = m_nodes[index].prevPhysical;
+	return previous != NO_NODE && !m_nodes[previous].used ? m_nodes[previous].size : 0;
+}
+
+uint64_t Iridium::Renderer::tlsf_allocator::largestFree() const {
+	if(m_flBitmap == 0)
+		return 0;
+	uint32_t fl = 63 - uint32_t(std::countl_zero(m_flBitmap));
+	uint32_t sl = 31 - uint32_t(std::countl_zero(m_slBitmaps[fl]));
+	uint64_t largest = 0;
+	for(uint32_t index = m_heads[fl][sl]; index != NO_NODE; index = m_nodes[index].nextFree)
+		largest = std::max(largest, m_nodes[index].size);
+	return largest;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Iridium {
+	namespace Renderer {
+		// Two-level segregated fit over a range of offsets. It never touches the memory it hands out,
+		// so it works for device memory the CPU can't see. Allocating and freeing are O(1), every
+		// free list holds sizes within 1/32 of each other and neighbours are merged on free.
+		class tlsf_allocator {
+		public:
+			enum : uint32_t {
+				SL_BITS = 5,
+				SL_COUNT = 1 << SL_BITS,
+				FL_COUNT = 64 - SL_BITS + 1,
+				NO_NODE = UINT32_MAX
+			};
+
+			struct allocation {
+				uint64_t offset;
+				uint32_t node; // NO_NODE when nothing fit
+			};
+
+			tlsf_allocator(uint64_t size = 0);
+
+			void reset(uint64_t size);
+
+			// alignment has to be a power of two
+			allocation allocate(uint64_t size, uint64_t alignment);
+			void free(uint32_t node);
+
+			uint64_t size() const { return m_size; }
+			uint64_t usedBytes() const { return m_usedBytes; }
+			uint32_t allocationCount() const { return m_allocationCount; }
+			bool empty() const { return m_allocationCount == 0; }
+			uint64_t allocationSize(uint32_t node) const { return m_nodes[node].size; }
+			uint64_t allocationOffset(uint32_t node) const { return m_nodes[node].offset; }
+			// the free range right before the allocation, 0 when its neighbour is in use
+			uint64_t freeBefore(uint32_t node) const;
+			// the biggest allocation that would still fit, walks one free list
+			uint64_t largestFree() const;
+		private:
+			struct node {
+				uint64_t offset;
+				uint64_t size;
+				uint32_t prevPhysical;
+				uint32_t nextPhysical;
+				uint32_t prevFree;
+				uint32_t nextFree;
+				bool used;
+			};
+
+			std::vector<node> m_nodes;
+			std::vector<uint32_t> m_unusedNodes;
+			uint32_t m_heads[FL_COUNT][SL_COUNT];
+			uint64_t m_flBitmap = 0;
+			uint32_t m_slBitmaps[FL_COUNT] = {};
+
+			uint64_t m_size = 0;
+			uint64_t m_usedBytes = 0;
+			uint32_t m_allocationCount = 0;
+
+			static void mapping(uint64_t size, uint32_t& fl, uint32_t& sl);
+			uint32_t newNode(uint64_t offset, uint64_t size);
+			void releaseNode(uint32_t index);
+			void insertFree(uint32_t index);
+			void removeFree(uint32_t index);
+			// a free node that every size up to size fits in, NO_NODE if there is none
+			uint32_t findFree(uint64_t size) const;
+			// walks the list size maps to for a node the allocation fits in, for when findFree found nothing
+			uint32_t findInList(uint64_t size, uint64_t alignment) const;
+			// cuts the front of a free node off into its own free node
+			void splitFront(uint32_t index, uint64_t size);
+		};
+	}
+}
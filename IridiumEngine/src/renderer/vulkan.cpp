@@ -2,11 +2,9 @@
 
 #include <algorithm>
 #include <cstdint>
-#include <ratio>
 #include <stdexcept>
 #include <string>
 #include <vector>
-#include <chrono>
 
 #include <vulkan/vulkan_core.h>
 
@@ -14,6 +12,7 @@
 #include "GLFW/glfw3.h"
 
 #include "../log.hpp"
+#include "../profiler.hpp"
 
 namespace IrV = Iridium::Vulkan;
 namespace IrR = Iridium::Renderer;
@@ -40,6 +39,11 @@ const std::vector<const char*> deviceExtensions = {
 	VK_EXT_SHADER_OBJECT_EXTENSION_NAME
 };
 
+const std::vector<const char*> headlessDeviceExtensions = {
+	"VK_EXT_extended_dynamic_state3",
+	VK_EXT_SHADER_OBJECT_EXTENSION_NAME
+};
+
 //Lazy loaded funcs
 VkResult IrV::CreateDebugUtilsMessengerEXT(
 	VkInstance instance,
@@ -103,10 +107,8 @@ bool IrV::queue_family_indices::isOneIndex() const {
 }
 
 IrV::queue_family_indices IrV::findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface) {
-	static auto clock = std::chrono::steady_clock{};
-	auto start = clock.now();
-
-	bool cached = true;
+	IRIDIUM_PROFILE_SCOPE("findQueueFamilies");
+	[[maybe_unused]] bool cached = true;
 	static IrV::queue_family_indices indices = [&device, &surface, &cached]() -> IrV::queue_family_indices {
 		cached = false;
 		
@@ -129,7 +131,10 @@ IrV::queue_family_indices IrV::findQueueFamilies(VkPhysicalDevice device, VkSurf
 				result.setFamily(queue_family_indices::transfer, iterator);
 			}
 			VkBool32 presentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(device, iterator, surface, &presentSupport);
+			if(surface != VK_NULL_HANDLE)
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, iterator, surface, &presentSupport);
+			else
+				presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
 			if(presentSupport) {
 				result.setFamily(queue_family_indices::present, iterator);
 			}
@@ -138,13 +143,19 @@ IrV::queue_family_indices IrV::findQueueFamilies(VkPhysicalDevice device, VkSurf
 				break;
 			iterator++;
 		}
+		// a transfer only family is a copy engine that runs next to the graphics queue instead of in it
+		for(uint32_t family = 0; family < queueFamilyCount; family++) {
+			VkQueueFlags flags = queueFamilies[family].queueFlags;
+			if((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+				result.setFamily(queue_family_indices::transfer, family);
+				break;
+			}
+		}
 		return result;
 	}();
 
-	auto end = clock.now();
-	[[maybe_unused]] auto time = std::chrono::duration<double, std::milli>(end - start);
 	/*
-	ENGINE_LOG_INFO("findQueueFamilies() took {:.3} (cached? {})", time, cached);
+	ENGINE_LOG_INFO("findQueueFamilies() (cached? {})", cached);
 	if(indices.isComplete()) {
 		ENGINE_LOG_INFO("Found complete queue family with index {}", indices.families[queue_family_indices::graphics]);
 	} else {
@@ -160,21 +171,38 @@ IrV::queue_family_indices IrV::findQueueFamilies(VkPhysicalDevice device, VkSurf
 
 //Extensions
 
-std::vector<const char*> IrV::getRequiredExtensions() {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+std::vector<const char*> IrV::getRequiredExtensions(bool headless) {
+	std::vector<const char*> extensions;
+	if(!headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		for(const auto extension : instanceExtensions) {
+			extensions.push_back(extension);
+		}
+	}
 	if constexpr(USE_VALIDATION_LAYERS) {
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 	}
-	for(const auto extension : instanceExtensions) {
-		extensions.push_back(extension);
-	}
 	return extensions;
 }
 
-const std::vector<const char*>& IrV::getDeviceExtensions() {
-	return deviceExtensions;
+const std::vector<const char*>& IrV::getDeviceExtensions(bool headless) {
+	return headless ? headlessDeviceExtensions : deviceExtensions;
+}
+
+bool IrV::isDeviceExtensionAvailable(VkPhysicalDevice device, const char* name) {
+	uint32_t extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+
+	std::string_view extension(name);
+	for(const auto& presentExtension : extensions) {
+		if(extension == presentExtension.extensionName)
+			return true;
+	}
+	return false;
 }
 
 //Validation layers
@@ -184,25 +212,26 @@ const std::vector<const char*>& IrV::getValidationLayers() {
 }
 
 bool IrV::checkValidationLayers() {
+	for(const auto& reqLayer : validationLayers) {
+		if(!isLayerAvailable(reqLayer))
+			return false;
+	}
+
+	return true;
+}
+
+bool IrV::isLayerAvailable(const char* name) {
 	uint32_t layerCount = 0;
 	vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
 	std::vector<VkLayerProperties> availableLayers(layerCount);
 	vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
 
-	for(const auto& reqLayerRaw : validationLayers) {
-		std::string_view reqLayer(reqLayerRaw);
-		bool present = false;
-		for(const auto& presentLayer : availableLayers) {
-			if(reqLayer == presentLayer.layerName) {
-				present = true;
-				break;
-			}
-		}
-		if(!present)
-			return false;
+	std::string_view layer(name);
+	for(const auto& presentLayer : availableLayers) {
+		if(layer == presentLayer.layerName)
+			return true;
 	}
-
-	return true;
+	return false;
 }
 
 // Swapchain
@@ -244,19 +273,13 @@ VkPresentModeKHR IrV::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>&
 	return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-VkExtent2D IrV::chooseSwapExtent(VkSurfaceCapabilitiesKHR capabilities, GLFWwindow* window) {
+VkExtent2D IrV::chooseSwapExtent(VkSurfaceCapabilitiesKHR capabilities, VkExtent2D framebufferExtent) {
 	if(capabilities.currentExtent.width != UINT32_MAX)
 		return capabilities.currentExtent;
 	else {
-		int width, height;
-		glfwGetFramebufferSize(window, &width, &height);
-		VkExtent2D extent{
-			.width = static_cast<uint32_t>(width),
-			.height =  static_cast<uint32_t>(height)
-		};
-
-		extent.width = std::clamp(extent.width, capabilities.maxImageExtent.width, capabilities.maxImageExtent.width);
-		extent.height = std::clamp(extent.height, capabilities.maxImageExtent.height, capabilities.maxImageExtent.height);
+		VkExtent2D extent = framebufferExtent;
+		extent.width = std::clamp(extent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
+		extent.height = std::clamp(extent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
 		return extent;
 	}
 
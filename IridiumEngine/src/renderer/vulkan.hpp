@@ -54,15 +54,20 @@ namespace Iridium {
 			bool isOneIndex() const;
 		};
 
+		// without a surface (headless) the graphics family presents
 		queue_family_indices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);		
 
 		//Extensions
-		std::vector<const char*> getRequiredExtensions();
-		const std::vector<const char*>& getDeviceExtensions();
+		// headless leaves out everything that needs GLFW or a surface
+		std::vector<const char*> getRequiredExtensions(bool headless = false);
+		const std::vector<const char*>& getDeviceExtensions(bool headless = false);
+		// for the optional ones, the required ones are checked when picking the device
+		bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char* name);
 
 		//Validation layers
 		const std::vector<const char*>& getValidationLayers();
 		bool checkValidationLayers();
+		bool isLayerAvailable(const char* name);
 
 		//Swapchain
 		struct swapchain_support_details {
@@ -74,7 +79,8 @@ namespace Iridium {
 		swapchain_support_details querySwapchainSupport(VkPhysicalDevice device, VkSurfaceKHR surface);
 		VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& formats);
 		VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes);
-		VkExtent2D chooseSwapExtent(VkSurfaceCapabilitiesKHR capabilities, GLFWwindow* window);
+		// framebufferExtent comes from the main thread, GLFW can't be queried from the render thread
+		VkExtent2D chooseSwapExtent(VkSurfaceCapabilitiesKHR capabilities, VkExtent2D framebufferExtent);
 
 		//Device
 		bool isDeviceSuitable([[maybe_unused]] VkPhysicalDevice device);
@@ -22,6 +22,7 @@ void Iridium::window_manager::createWindow(int width, int height, const char* na
 		throw std::runtime_error("Cannot create new window when one already exists!");
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 	m_window = glfwCreateWindow(width, height, name, nullptr, nullptr);
+	updateWindowState();
 
 	//glfwSetWindowRefreshCallback((GLFWwindow*)m_window, [](GLFWwindow*) -> void {});
 }
@@ -34,6 +35,15 @@ void Iridium::window_manager::setWindowName(const char* name) {
 
 void Iridium::window_manager::pollEvents() {
 	glfwPollEvents();
+	updateWindowState();
+}
+
+void Iridium::window_manager::waitEvents() {
+	glfwWaitEvents();
+	updateWindowState();
+}
+
+void Iridium::window_manager::updateWindowState() {
 	GLFWwindow* window = (GLFWwindow*)m_window;
 	m_shouldClose = glfwWindowShouldClose(window);
 
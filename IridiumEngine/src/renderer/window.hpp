@@ -16,11 +16,14 @@ namespace Iridium {
 		void setWindowName(const char* name);
 		
 		void pollEvents(); 
+		void waitEvents(); // like pollEvents but sleeps until something happens
 		std::tuple<uint32_t, uint32_t> framebufferSize();
 		bool windowShouldClose();
 		
 		window_ptr getWindowHandle();
 		private:
+		void updateWindowState();
+
 		bool m_shouldClose = false;
 		uint32_t m_framebufferWidth = 0;
 		uint32_t m_framebufferHeight = 0;
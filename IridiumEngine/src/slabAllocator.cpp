@@ -0,0 +1,182 @@
+#include "slabAllocator.hpp"
+
+#include <bit>
+#include <cassert>
+#include <mutex>
+#include <new>
+
+#include "allocationTracker.hpp"
+#include "memory.hpp"
+
+namespace IrM = Iridium::MemoryExperimental;
+
+namespace {
+	struct free_block {
+		free_block* next;
+	};
+
+	struct size_class_state {
+		std::mutex mutex;
+		free_block* freeList = nullptr;
+		size_t freeCount = 0;
+		size_t bumpOffset = 0; // first never used byte of the class range
+		size_t committed = 0;
+	};
+
+	std::byte* g_region = nullptr;
+	uint64_t g_generation = 0; // bumped by cleanup, thread caches from before hold blocks of the old region
+	size_class_state g_classes[IrM::slab_allocator::CLASS_COUNT];
+
+	std::byte* classBase(uint32_t sizeClass) {
+		return g_region + sizeClass * IrM::slab_allocator::CLASS_RESERVE;
+	}
+
+	// pulls up to BATCH_SIZE blocks from the shared list, carving new slabs when it runs out
+	free_block* refill(uint32_t sizeClass, uint32_t& count) {
+		using sa = IrM::slab_allocator;
+		size_class_state& state = g_classes[sizeClass];
+		size_t blockSize = sa::classSize(sizeClass);
+
+		std::scoped_lock<std::mutex> lock(state.mutex);
+		free_block* head = nullptr;
+		count = 0;
+		while(count < sa::BATCH_SIZE && state.freeList) {
+			free_block* block = state.freeList;
+			state.freeList = block->next;
+			block->next = head;
+			head = block;
+			count++;
+		}
+		state.freeCount -= count;
+
+		while(count < sa::BATCH_SIZE) {
+			if(state.bumpOffset + blockSize > state.committed) {
+				if(state.committed + sa::SLAB_SIZE > sa::CLASS_RESERVE)
+					break;
+				IrM::virtual_memory::commit(classBase(sizeClass) + state.committed, sa::SLAB_SIZE);
+				state.committed += sa::SLAB_SIZE;
+			}
+			free_block* block = reinterpret_cast<free_block*>(classBase(sizeClass) + state.bumpOffset);
+			state.bumpOffset += blockSize;
+			block->next = head;
+			head = block;
+			count++;
+		}
+		return head;
+	}
+
+	void release(uint32_t sizeClass, free_block* head, free_block* tail, uint32_t count) {
+		size_class_state& state = g_classes[sizeClass];
+		std::scoped_lock<std::mutex> lock(state.mutex);
+		tail->next = state.freeList;
+		state.freeList = head;
+		state.freeCount += count;
+	}
+
+	struct thread_cache {
+		free_block* heads[IrM::slab_allocator::CLASS_COUNT] = {};
+		uint32_t counts[IrM::slab_allocator::CLASS_COUNT] = {};
+		uint64_t generation = g_generation;
+
+		// drops the blocks of a region that cleanup has released since this cache last ran
+		void revalidate() {
+			if(generation == g_generation)
+				return;
+			for(uint32_t sizeClass = 0; sizeClass < IrM::slab_allocator::CLASS_COUNT; sizeClass++) {
+				heads[sizeClass] = nullptr;
+				counts[sizeClass] = 0;
+			}
+			generation = g_generation;
+		}
+
+		// hand back everything but BATCH_SIZE blocks
+		void trim(uint32_t sizeClass, uint32_t keep) {
+			if(counts[sizeClass] <= keep)
+				return;
+			uint32_t toRelease = counts[sizeClass] - keep;
+			free_block* head = heads[sizeClass];
+			free_block* tail = head;
+			for(uint32_t i = 1; i < toRelease; i++)
+				tail = tail->next;
+			heads[sizeClass] = tail->next;
+			counts[sizeClass] = keep;
+			release(sizeClass, head, tail, toRelease);
+		}
+
+		~thread_cache() {
+			if(g_region == nullptr || generation != g_generation) // allocator already cleaned up, the memory is gone
+				return;
+			for(uint32_t sizeClass = 0; sizeClass < IrM::slab_allocator::CLASS_COUNT; sizeClass++)
+				trim(sizeClass, 0);
+		}
+	};
+
+	thread_local thread_cache t_cache;
+}
+
+void IrM::slab_allocator::init() {
+	if(g_region != nullptr)
+		return;
+	g_region = static_cast<std::byte*>(virtual_memory::reserve(CLASS_COUNT * CLASS_RESERVE));
+}
+
+void IrM::slab_allocator::cleanup() {
+	virtual_memory::release(g_region, CLASS_COUNT * CLASS_RESERVE);
+	g_region = nullptr;
+	g_generation++;
+	for(auto& state : g_classes) {
+		state.freeList = nullptr;
+		state.freeCount = 0;
+		state.bumpOffset = 0;
+		state.committed = 0;
+	}
+}
+
+uint32_t IrM::slab_allocator::sizeClass(size_t size) {
+	if(size <= MIN_SIZE)
+		return 0;
+	return std::bit_width(size - 1) - std::bit_width(size_t(MIN_SIZE) - 1);
+}
+
+bool IrM::slab_allocator::owns(const void* ptr) {
+	// before init nothing is ours, memory.hpp asks this for every pointer it destroys
+	if(g_region == nullptr)
+		return false;
+	const std::byte* address = static_cast<const std::byte*>(ptr);
+	return address >= g_region && address < g_region + CLASS_COUNT * CLASS_RESERVE;
+}
+
+void* IrM::slab_allocator::allocate(size_t size) {
+	assert(g_region != nullptr && "slab_allocator::allocate before init");
+	uint32_t sizeClass = slab_allocator::sizeClass(size);
+	thread_cache& cache = t_cache;
+	cache.revalidate();
+	if(cache.heads[sizeClass] == nullptr) {
+		cache.heads[sizeClass] = refill(sizeClass, cache.counts[sizeClass]);
+		if(cache.heads[sizeClass] == nullptr)
+			throw std::bad_alloc();
+	}
+
+	free_block* block = cache.heads[sizeClass];
+	cache.heads[sizeClass] = block->next;
+	cache.counts[sizeClass]--;
+	AllocationTracker::recordAllocation(AllocationTracker::source::slab, classSize(sizeClass));
+	return block;
+}
+
+void IrM::slab_allocator::deallocate(void* ptr) {
+	size_t offset = static_cast<std::byte*>(ptr) - g_region;
+	uint32_t sizeClass = offset / CLASS_RESERVE;
+	size_t blockSize = classSize(sizeClass);
+	// round down to the block start, ptr can point at a base class inside the block
+	free_block* block = reinterpret_cast<free_block*>(g_region + (offset & ~(blockSize - 1)));
+	AllocationTracker::recordFree(AllocationTracker::source::slab, blockSize);
+
+	thread_cache& cache = t_cache;
+	cache.revalidate();
+	block->next = cache.heads[sizeClass];
+	cache.heads[sizeClass] = block;
+	cache.counts[sizeClass]++;
+	if(cache.counts[sizeClass] > 2 * BATCH_SIZE)
+		cache.trim(sizeClass, BATCH_SIZE);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Iridium {
+	namespace MemoryExperimental {
+		// Power of two size class allocator.
+		// Every size class owns its own reserved address range that is carved into 64KiB slabs,
+		// so objects of the same size stay packed together and the size class of any pointer
+		// is known from its address alone.
+		// Threads allocate and free through a small per-thread cache and only touch the shared
+		// per-class lists in batches.
+		class slab_allocator {
+		public:
+			enum : size_t {
+				MIN_SIZE = 16,
+				MAX_SIZE = 4096,
+				CLASS_COUNT = 9, // 16, 32, ... 4096
+				CLASS_RESERVE = size_t(1) << 30,
+				SLAB_SIZE = 64 * 1024,
+				BATCH_SIZE = 32
+			};
+
+			slab_allocator() = delete;
+
+			static void init();
+			static void cleanup();
+
+			// size must not exceed MAX_SIZE, blocks are aligned to min(rounded size, 4096)
+			[[nodiscard]] static void* allocate(size_t size);
+			// accepts any pointer into a block, not just its start
+			static void deallocate(void* ptr);
+
+			static bool owns(const void* ptr);
+			static uint32_t sizeClass(size_t size);
+
+			static constexpr size_t classSize(uint32_t sizeClass) {
+				return MIN_SIZE << sizeClass;
+			}
+
+			static constexpr bool fits(size_t size, size_t alignment) {
+				return size <= MAX_SIZE && alignment <= MAX_SIZE;
+			}
+		};
+	}
+}
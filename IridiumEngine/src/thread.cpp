@@ -1,5 +1,27 @@
 #include "thread.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <ranges>
+
+#include "entryPoint.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
 static thread_local std::string g_threadName{"none"};
 
 std::string_view Iridium::getThreadName() noexcept {
@@ -8,5 +30,355 @@ std::string_view Iridium::getThreadName() noexcept {
 
 void Iridium::setThreadName(const std::string& threadName) {
 	g_threadName = threadName;
+#ifdef __linux__
+	// shows up in top, gdb and perf, the kernel limit is 15 characters
+	pthread_setname_np(pthread_self(), threadName.substr(0, 15).c_str());
+#endif
+}
+
+// topology
+
+#ifdef __linux__
+static std::optional<std::string> readLine(const std::string& path) {
+	std::ifstream file(path);
+	std::string line;
+	if(!file || !std::getline(file, line))
+		return std::nullopt;
+	return line;
+}
+
+static std::optional<uint32_t> readNumber(const std::string& path) {
+	auto line = readLine(path);
+	if(!line)
+		return std::nullopt;
+	try {
+		return uint32_t(std::stoul(*line));
+	} catch(...) {
+		return std::nullopt;
+	}
+}
+
+// "0-3,8,10-11"
+static std::vector<uint32_t> parseCpuList(const std::string& list) {
+	std::vector<uint32_t> cpus;
+	size_t position = 0;
+	while(position < list.size()) {
+		size_t end = list.find(',', position);
+		if(end == std::string::npos)
+			end = list.size();
+		std::string range = list.substr(position, end - position);
+		position = end + 1;
+		if(range.empty())
+			continue;
+
+		size_t dash = range.find('-');
+		try {
+			uint32_t first = std::stoul(range.substr(0, dash));
+			uint32_t last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+			for(uint32_t cpu = first; cpu <= last; cpu++)
+				cpus.push_back(cpu);
+		} catch(...) {}
+	}
+	return cpus;
+}
+#endif
+
+Iridium::cpu_topology Iridium::cpu_topology::detect() {
+	cpu_topology topology;
+	std::vector<uint32_t> coreIds;
+	std::vector<uint32_t> capacities;
+
+#ifdef __linux__
+	if(auto online = readLine("/sys/devices/system/cpu/online")) {
+		for(uint32_t cpu : parseCpuList(*online)) {
+			std::string base = std::format("/sys/devices/system/cpu/cpu{}/", cpu);
+			topology.cpus.push_back({
+				.id = cpu,
+				.core = 0,
+				.package = readNumber(base + "topology/physical_package_id").value_or(0),
+				.numaNode = 0,
+				.efficiency = false
+			});
+			coreIds.push_back(readNumber(base + "topology/core_id").value_or(cpu));
+			capacities.push_back(readNumber(base + "cpu_capacity").value_or(0)); // only on big.LITTLE
+		}
+	}
+
+	std::error_code error;
+	for(const auto& entry : std::filesystem::directory_iterator("/sys/devices/system/node", error)) {
+		std::string name = entry.path().filename().string();
+		if(!name.starts_with("node") || name.size() == 4 || !std::isdigit(name[4]))
+			continue;
+		uint32_t node = std::stoul(name.substr(4));
+		topology.numaNodes = std::max(topology.numaNodes, node + 1);
+		for(uint32_t cpu : parseCpuList(readLine(entry.path().string() + "/cpulist").value_or(""))) {
+			for(auto& logical : topology.cpus) {
+				if(logical.id == cpu)
+					logical.numaNode = node;
+			}
+		}
+	}
+
+	// Intel hybrid parts expose the E cores as their own PMU, ARM ones through cpu_capacity
+	if(auto atomCpus = readLine("/sys/devices/cpu_atom/cpus")) {
+		for(uint32_t cpu : parseCpuList(*atomCpus)) {
+			for(auto& logical : topology.cpus) {
+				if(logical.id == cpu)
+					logical.efficiency = true;
+			}
+		}
+	} else if(!capacities.empty()) {
+		uint32_t maxCapacity = *std::max_element(capacities.begin(), capacities.end());
+		for(size_t index = 0; index < topology.cpus.size(); index++)
+			topology.cpus[index].efficiency = capacities[index] != 0 && capacities[index] < maxCapacity;
+	}
+#endif
+
+	if(topology.cpus.empty()) {
+		uint32_t count = std::max(1u, std::thread::hardware_concurrency());
+		for(uint32_t cpu = 0; cpu < count; cpu++) {
+			topology.cpus.push_back({.id = cpu, .core = 0, .package = 0, .numaNode = 0, .efficiency = false});
+			coreIds.push_back(cpu);
+		}
+	}
+
+	// Only what the process may run on. On Linux the affinity mask already has the cgroup cpuset applied,
+	// so containers and taskset get as many workers as they have cpus.
+	std::vector<bool> allowed(topology.cpus.size(), true);
+#ifdef _WIN32
+	DWORD_PTR processMask = 0;
+	DWORD_PTR systemMask = 0;
+	if(GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask)) {
+		for(size_t index = 0; index < topology.cpus.size(); index++)
+			allowed[index] = topology.cpus[index].id >= sizeof(DWORD_PTR) * 8 || (processMask >> topology.cpus[index].id) & 1;
+	}
+#elif defined(__linux__)
+	cpu_set_t affinity;
+	CPU_ZERO(&affinity);
+	if(sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+		for(size_t index = 0; index < topology.cpus.size(); index++)
+			allowed[index] = topology.cpus[index].id >= CPU_SETSIZE || CPU_ISSET(topology.cpus[index].id, &affinity);
+	}
+#endif
+	if(std::find(allowed.begin(), allowed.end(), true) != allowed.end()) {
+		size_t kept = 0;
+		for(size_t index = 0; index < topology.cpus.size(); index++) {
+			if(!allowed[index])
+				continue;
+			topology.cpus[kept] = topology.cpus[index];
+			coreIds[kept] = coreIds[index];
+			kept++;
+		}
+		topology.cpus.resize(kept);
+		coreIds.resize(kept);
+	}
+
+	// SMT siblings share package and core id
+	std::map<std::pair<uint32_t, uint32_t>, uint32_t> coreLookup;
+	for(size_t index = 0; index < topology.cpus.size(); index++) {
+		logical_cpu& logical = topology.cpus[index];
+		auto [iterator, inserted] = coreLookup.try_emplace({logical.package, coreIds[index]}, uint32_t(topology.cores.size()));
+		if(inserted)
+			topology.cores.push_back({.cpus = {}, .numaNode = logical.numaNode, .efficiency = logical.efficiency});
+		topology.cores[iterator->second].cpus.push_back(logical.id);
+	}
+	std::stable_sort(topology.cores.begin(), topology.cores.end(), [](const physical_core& left, const physical_core& right) -> bool {
+		return !left.efficiency && right.efficiency;
+	});
+
+	for(auto [coreIndex, core] : std::views::enumerate(topology.cores)) {
+		topology.smt = topology.smt || core.cpus.size() > 1;
+		topology.hybrid = topology.hybrid || core.efficiency;
+		for(uint32_t cpu : core.cpus) {
+			for(auto& logical : topology.cpus) {
+				if(logical.id == cpu)
+					logical.core = uint32_t(coreIndex);
+			}
+		}
+	}
+	return topology;
+}
+
+// per thread settings
+
+static void applyAffinity(const std::vector<uint32_t>& cpus) {
+	if(cpus.empty())
+		return;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(uint32_t cpu : cpus)
+		CPU_SET(cpu, &set);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		ENGINE_LOG_WARN("Failed to set the affinity of thread {}.", Iridium::getThreadName());
+#elif defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for(uint32_t cpu : cpus) {
+		if(cpu < sizeof(DWORD_PTR) * 8)
+			mask |= DWORD_PTR(1) << cpu;
+	}
+	if(mask && SetThreadAffinityMask(GetCurrentThread(), mask) == 0)
+		ENGINE_LOG_WARN("Failed to set the affinity of thread {}.", Iridium::getThreadName());
+#endif
+}
+
+static void applyPriority(Iridium::thread_priority priority) {
+	using enum Iridium::thread_priority;
+	if(priority == normal)
+		return;
+#ifdef __linux__
+	// per thread nice value, raising it needs CAP_SYS_NICE so that may just fail
+	setpriority(PRIO_PROCESS, gettid(), priority == high ? -5 : 5);
+#elif defined(_WIN32)
+	SetThreadPriority(GetCurrentThread(), priority == high ? THREAD_PRIORITY_ABOVE_NORMAL : THREAD_PRIORITY_BELOW_NORMAL);
+#endif
 }
 
+// thread_manager
+
+Iridium::thread_manager::thread_manager() {
+	m_topology = cpu_topology::detect();
+	m_coreThreads.assign(m_topology.cores.size(), 0);
+
+	m_policies[size_t(thread_role::main)] = {thread_affinity::performanceCores, thread_priority::normal};
+	m_policies[size_t(thread_role::render)] = {thread_affinity::dedicatedCore, thread_priority::high};
+	m_policies[size_t(thread_role::worker)] = {thread_affinity::dedicatedCore, thread_priority::normal};
+	m_policies[size_t(thread_role::io)] = {thread_affinity::efficiencyCores, thread_priority::low};
+	m_policies[size_t(thread_role::benchmark)] = {thread_affinity::any, thread_priority::normal};
+
+	size_t efficiencyCores = std::ranges::count_if(m_topology.cores, [](const physical_core& core) -> bool {
+		return core.efficiency;
+	});
+	ENGINE_LOG_INFO("CPU topology: {} logical cpus, {} cores ({} efficiency), {} NUMA nodes, SMT {}.",
+		m_topology.cpus.size(), m_topology.cores.size(), efficiencyCores, m_topology.numaNodes, m_topology.smt ? "on" : "off");
+}
+
+Iridium::thread_manager::~thread_manager() {
+	joinAll();
+}
+
+void Iridium::thread_manager::setPolicy(thread_role role, thread_policy policy) {
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	m_policies[size_t(role)] = policy;
+}
+
+Iridium::thread_handle Iridium::thread_manager::addThread(std::string name, thread_role role) {
+	uint32_t index;
+	if(!m_freeSlots.empty()) {
+		index = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	} else {
+		index = uint32_t(m_threads.size());
+		m_threads.emplace_back();
+	}
+	thread_entry& entry = m_threads[index];
+	entry.name = std::move(name);
+	entry.role = role;
+	entry.cpus.clear();
+	entry.core = -1;
+	entry.order = m_nextOrder++;
+
+	auto collectCpus = [&](bool efficiency) -> void {
+		for(const auto& core : m_topology.cores) {
+			if(core.efficiency == efficiency)
+				entry.cpus.insert(entry.cpus.end(), core.cpus.begin(), core.cpus.end());
+		}
+	};
+
+	switch(m_policies[size_t(role)].affinity) {
+	case thread_affinity::any:
+		break;
+	case thread_affinity::performanceCores:
+		if(m_topology.hybrid)
+			collectCpus(false);
+		break;
+	case thread_affinity::efficiencyCores:
+		if(m_topology.hybrid)
+			collectCpus(true);
+		break;
+	case thread_affinity::dedicatedCore: {
+		// the core with the fewest pinned threads, performance cores come first so they win ties
+		auto least = std::ranges::min_element(m_coreThreads);
+		(*least)++;
+		entry.core = int32_t(least - m_coreThreads.begin());
+		entry.cpus = m_topology.cores[entry.core].cpus;
+		break;
+	}
+	}
+	return {index, entry.generation};
+}
+
+bool Iridium::thread_manager::isCurrent(thread_handle handle) const {
+	return handle.index < m_threads.size() && m_threads[handle.index].generation == handle.generation;
+}
+
+void Iridium::thread_manager::enterThread(thread_handle handle) {
+	std::string name;
+	std::vector<uint32_t> cpus;
+	thread_priority priority;
+	{
+		std::scoped_lock<std::mutex> lock(m_mutex);
+		thread_entry& entry = m_threads[handle.index];
+		name = entry.name;
+		cpus = entry.cpus;
+		priority = m_policies[size_t(entry.role)].priority;
+	}
+	setThreadName(name);
+	applyAffinity(cpus);
+	applyPriority(priority);
+}
+
+void Iridium::thread_manager::registerCurrentThread(std::string name, thread_role role) {
+	thread_handle handle;
+	{
+		std::scoped_lock<std::mutex> lock(m_mutex);
+		handle = addThread(std::move(name), role);
+	}
+	enterThread(handle);
+}
+
+void Iridium::thread_manager::join(thread_handle handle) {
+	std::jthread thread;
+	{
+		std::scoped_lock<std::mutex> lock(m_mutex);
+		if(!isCurrent(handle)) {
+			ENGINE_LOG_WARN("Ignoring the handle of a thread that was joined already.");
+			return;
+		}
+		thread = std::move(m_threads[handle.index].thread);
+	}
+	// joined outside the lock, the thread may still want to spawn or register something
+	if(!thread.joinable())
+		return;
+	thread.join();
+
+	// only whoever took the thread out gives the slot back, the thread has read its entry by now
+	std::scoped_lock<std::mutex> lock(m_mutex);
+	thread_entry& entry = m_threads[handle.index];
+	if(entry.core >= 0)
+		m_coreThreads[entry.core]--;
+	entry.core = -1;
+	entry.cpus.clear();
+	entry.generation++;
+	m_freeSlots.push_back(handle.index);
+}
+
+void Iridium::thread_manager::joinAll() {
+	std::vector<std::pair<uint64_t, thread_handle>> running;
+	{
+		std::scoped_lock<std::mutex> lock(m_mutex);
+		for(uint32_t index = 0; index < m_threads.size(); index++) {
+			if(m_threads[index].thread.joinable())
+				running.push_back({m_threads[index].order, {index, m_threads[index].generation}});
+		}
+	}
+	std::ranges::sort(running, std::greater{}, [](const auto& thread) -> uint64_t {
+		return thread.first;
+	});
+	for(const auto& [order, handle] : running)
+		join(handle);
+}
+
+Iridium::thread_manager* Iridium::getThreadManager() {
+	return getApplicationPointer()->threadManager;
+}
@@ -1,23 +1,130 @@
 #pragma once
+#include <cstdint>
+#include <deque>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 namespace Iridium {
 	std::string_view getThreadName() noexcept;
 	void setThreadName(const std::string& threadName);
 
+	struct logical_cpu {
+		uint32_t id;
+		uint32_t core;    // index into cpu_topology::cores
+		uint32_t package;
+		uint32_t numaNode;
+		bool efficiency;  // E core on hybrid parts
+	};
+
+	struct physical_core {
+		std::vector<uint32_t> cpus; // SMT siblings
+		uint32_t numaNode;
+		bool efficiency;
+	};
+
+	// Read from /sys on Linux, elsewhere every logical cpu is its own performance core on node 0.
+	struct cpu_topology {
+		std::vector<logical_cpu> cpus;
+		std::vector<physical_core> cores; // performance cores first
+		uint32_t numaNodes = 1;
+		bool smt = false;
+		bool hybrid = false;
+
+		static cpu_topology detect();
+	};
+
+	enum class thread_role : uint8_t {
+		main,
+		render,
+		worker,
+		io,
+		benchmark, // measures what the engine's threads would get, so anywhere at normal priority
+		COUNT
+	};
+
+	enum class thread_affinity : uint8_t {
+		any,
+		performanceCores,
+		efficiencyCores, // falls back to any without E cores
+		dedicatedCore    // next free physical core, all of its SMT siblings
+	};
+
+	enum class thread_priority : uint8_t {
+		low,
+		normal,
+		high // needs CAP_SYS_NICE on Linux, silently stays normal without it
+	};
+
+	struct thread_policy {
+		thread_affinity affinity;
+		thread_priority priority;
+	};
+
+	// A slot in the registry and the generation it had when the thread was spawned. Joined threads
+	// give their slot back, the next thread in it gets a new generation so old handles stay dead.
+	struct thread_handle {
+		uint32_t index;
+		uint32_t generation;
+	};
+
+	// Registry of every named engine thread. Threads spawned here get their role's affinity
+	// and priority applied before they run and are joined in reverse order by joinAll.
 	class thread_manager {
 	public:
-		thread_manager() = default;
-
-		template<typename Callable, typename... Args>
-		void spawnThread([[maybe_unused]] const char* name, Callable func, Args... args) {
-			std::jthread thread([](const char* name, auto func, auto... args) -> void {
-				setThreadName(name);
-				func(args...);
-			}, name, func, args...);
-			thread.detach();
-		};
+		thread_manager();
+		~thread_manager();
+
+		thread_manager(const thread_manager&) = delete;
+		thread_manager& operator=(const thread_manager&) = delete;
+
+		template<typename Callable>
+		thread_handle spawnThread(std::string name, thread_role role, Callable&& func) {
+			std::scoped_lock<std::mutex> lock(m_mutex);
+			thread_handle handle = addThread(std::move(name), role);
+			// the new thread blocks in enterThread until we let go of the lock
+			m_threads[handle.index].thread = std::jthread([this, handle, func = std::forward<Callable>(func)]() mutable -> void {
+				enterThread(handle);
+				func();
+			});
+			return handle;
+		}
+
+		// for threads the engine didn't start, like main
+		void registerCurrentThread(std::string name, thread_role role);
+
+		// handles of threads that were joined already are ignored
+		void join(thread_handle handle);
+		void joinAll();
+
+		void setPolicy(thread_role role, thread_policy policy);
+		const cpu_topology& topology() const { return m_topology; }
 	private:
+		struct thread_entry {
+			std::string name;
+			thread_role role;
+			std::jthread thread;
+			std::vector<uint32_t> cpus; // empty means anywhere
+			int32_t core = -1;          // index of the dedicated core, -1 for none
+			uint32_t generation = 0;
+			uint64_t order = 0;         // when it was added, joinAll goes newest first
+		};
+
+		cpu_topology m_topology;
+		thread_policy m_policies[size_t(thread_role::COUNT)];
+
+		std::mutex m_mutex;
+		std::deque<thread_entry> m_threads;
+		std::vector<uint32_t> m_freeSlots;
+		std::vector<uint32_t> m_coreThreads; // live threads pinned to each core
+		uint64_t m_nextOrder = 0;
+
+		thread_handle addThread(std::string name, thread_role role);
+		void enterThread(thread_handle handle);
+		bool isCurrent(thread_handle handle) const;
 	};
-}
\ No newline at end of file
+
+	thread_manager* getThreadManager();
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Iridium {
+	// Lock-free handoff between exactly one writer and one reader.
+	// The writer fills writeBuffer() and publishes it, the reader picks up the newest published
+	// slot with update(). Neither side ever waits on the other, a slot that is published twice
+	// before the reader gets to it is simply replaced.
+	template<typename T>
+	class triple_buffer {
+	public:
+		// writer side
+		T& writeBuffer() {
+			return m_slots[m_back];
+		}
+
+		void publish() {
+			// acquire so the slot we get back is no longer being read
+			uint8_t previous = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel);
+			m_back = previous & INDEX_MASK;
+			m_middle.notify_one();
+		}
+
+		// reader side
+		const T& readBuffer() const {
+			return m_slots[m_front];
+		}
+
+		// swaps in the newest published slot, false if nothing was published since the last call
+		bool update() {
+			if(!(m_middle.load(std::memory_order_relaxed) & FRESH))
+				return false;
+			uint8_t previous = m_middle.exchange(m_front, std::memory_order_acq_rel);
+			m_front = previous & INDEX_MASK;
+			return true;
+		}
+
+		void waitForPublish() {
+			uint8_t current = m_middle.load(std::memory_order_acquire);
+			while(!(current & FRESH)) {
+				m_middle.wait(current, std::memory_order_acquire);
+				current = m_middle.load(std::memory_order_acquire);
+			}
+		}
+	private:
+		enum : uint8_t {
+			INDEX_MASK = 0x3,
+			FRESH = 0x4
+		};
+
+		T m_slots[3];
+		alignas(64) std::atomic<uint8_t> m_middle{1};
+		alignas(64) uint8_t m_back = 0;  // writer only
+		alignas(64) uint8_t m_front = 2; // reader only
+	};
+}
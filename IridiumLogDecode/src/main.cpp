@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "logFormat.hpp"
+
+// Turns a log written with IRIDIUM_BINARY_LOG back into the usual text lines.
+// IridiumLogDecode <file.irlog> [--color]
+
+namespace IrL = Iridium::Logger;
+namespace IrB = Iridium::Logger::Binary;
+
+namespace {
+	struct format_entry {
+		std::vector<IrB::arg_type> types;
+		std::string format;
+	};
+
+	class reader {
+	public:
+		reader(const std::vector<std::byte>& data) :m_data(data) {}
+
+		bool done() const { return m_position == m_data.size(); }
+
+		template<typename T>
+		T read() {
+			T value;
+			std::memcpy(&value, take(sizeof(T)), sizeof(T));
+			return value;
+		}
+
+		const std::byte* take(size_t size) {
+			if(m_data.size() - m_position < size)
+				throw std::runtime_error(std::format("Log ends in the middle of an entry at byte {}.", m_position));
+			const std::byte* bytes = m_data.data() + m_position;
+			m_position += size;
+			return bytes;
+		}
+
+		std::string_view takeString(size_t size) {
+			return {reinterpret_cast<const char*>(take(size)), size};
+		}
+	private:
+		const std::vector<std::byte>& m_data;
+		size_t m_position = 0;
+	};
+}
+
+static std::vector<std::byte> readFile(const char* path) {
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if(!file)
+		throw std::runtime_error(std::format("Failed to open {}.", path));
+	std::vector<std::byte> data(size_t(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(data.data()), data.size());
+	return data;
+}
+
+static void decode(const std::vector<std::byte>& data, bool colors) {
+	reader in(data);
+	if(std::memcmp(in.take(sizeof(IrB::MAGIC)), IrB::MAGIC, sizeof(IrB::MAGIC)) != 0)
+		throw std::runtime_error("Not a binary Iridium log.");
+	uint32_t version = in.read<uint32_t>();
+	if(version != IrB::VERSION)
+		throw std::runtime_error(std::format("Unsupported log version {}, expected {}.", version, IrB::VERSION));
+
+	std::unordered_map<uint32_t, format_entry> formats;
+	std::unordered_map<uint16_t, std::string> threads;
+	IrL::timestamp_cache timestamps;
+	std::string line, message;
+
+	while(!in.done()) {
+		switch(in.read<IrB::entry_kind>()) {
+		case IrB::entry_kind::format: {
+			uint32_t id = in.read<uint32_t>();
+			format_entry& entry = formats[id];
+			uint8_t argCount = in.read<uint8_t>();
+			const std::byte* types = in.take(argCount);
+			entry.types.assign(reinterpret_cast<const IrB::arg_type*>(types), reinterpret_cast<const IrB::arg_type*>(types) + argCount);
+			entry.format = in.takeString(in.read<uint32_t>());
+			break;
+		}
+		case IrB::entry_kind::thread: {
+			uint16_t id = in.read<uint16_t>();
+			threads[id] = in.takeString(in.read<uint16_t>());
+			break;
+		}
+		case IrB::entry_kind::message: {
+			auto level = in.read<IrL::severity>();
+			uint8_t flags = in.read<uint8_t>();
+			uint16_t thread = in.read<uint16_t>();
+			uint32_t formatId = in.read<uint32_t>();
+			int64_t timestamp = in.read<int64_t>();
+			const std::byte* args = in.take(in.read<uint32_t>());
+
+			auto format = formats.find(formatId);
+			if(format == formats.end())
+				throw std::runtime_error(std::format("Message uses format {} before it was announced.", formatId));
+
+			message.clear();
+			try {
+				IrB::formatMessage(message, format->second.format, format->second.types, args);
+			} catch(std::exception& e) {
+				message = std::format("<format error: {}>", e.what());
+			}
+
+			line.clear();
+			IrL::appendLine(line, level, flags, threads[thread], IrL::formatTimestamp(timestamp, timestamps), message, colors);
+			std::fwrite(line.data(), 1, line.size(), stdout);
+			break;
+		}
+		default:
+			throw std::runtime_error("Unknown entry, the log is corrupt.");
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* path = nullptr;
+	bool colors = false;
+	for(int index = 1; index < argc; index++) {
+		if(std::string_view(argv[index]) == "--color")
+			colors = true;
+		else
+			path = argv[index];
+	}
+	if(path == nullptr) {
+		std::fputs("Usage: IridiumLogDecode <file.irlog> [--color]\n", stderr);
+		return 1;
+	}
+
+	try {
+		decode(readFile(path), colors);
+	} catch(std::exception& e) {
+		std::fflush(stdout);
+		std::fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
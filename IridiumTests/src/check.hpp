@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+// assert that stays on in release builds, a failed check fails the test through the exit code
+#define CHECK(condition) do { \
+	if(!(condition)) { \
+		std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+		std::exit(1); \
+	} \
+} while(false)
+
+namespace IridiumTests {
+	// splitmix64, the same sequence on every machine
+	struct test_random {
+		uint64_t state;
+
+		uint64_t next() {
+			uint64_t value = (state += 0x9E3779B97F4A7C15ull);
+			value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+			value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+			return value ^ (value >> 31);
+		}
+	};
+}
@@ -0,0 +1,173 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "check.hpp"
+#include "metrics.hpp"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace IrMe = Iridium::Metrics;
+
+// Registers a counter, a gauge and a sampler, starts the exporter on a loopback port and scrapes it
+// like Prometheus would. The exporter renders a snapshot every sampleSeconds, so values that were
+// just changed are polled for until they show up.
+
+namespace {
+#ifdef _WIN32
+	using socket_type = SOCKET;
+	constexpr socket_type NO_SOCKET = INVALID_SOCKET;
+	void closeSocket(socket_type socket) { closesocket(socket); }
+#else
+	using socket_type = int;
+	constexpr socket_type NO_SOCKET = -1;
+	void closeSocket(socket_type socket) { close(socket); }
+#endif
+
+	sockaddr_in loopback(uint16_t port) {
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		return address;
+	}
+
+	// a port nobody listens on right now, the exporter can only be told a fixed one
+	uint16_t freePort() {
+		socket_type probe = socket(AF_INET, SOCK_STREAM, 0);
+		CHECK(probe != NO_SOCKET);
+		sockaddr_in address = loopback(0);
+		CHECK(bind(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+		socklen_t length = sizeof(address);
+		CHECK(getsockname(probe, reinterpret_cast<sockaddr*>(&address), &length) == 0);
+		closeSocket(probe);
+		return ntohs(address.sin_port);
+	}
+
+	// the whole response, empty when nothing is listening
+	std::string scrape(uint16_t port, std::string_view path) {
+		socket_type client = socket(AF_INET, SOCK_STREAM, 0);
+		CHECK(client != NO_SOCKET);
+		sockaddr_in address = loopback(port);
+		if(connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+			closeSocket(client);
+			return {};
+		}
+		std::string request = "GET " + std::string(path) + " HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n";
+		send(client, request.data(), int(request.size()), 0);
+
+		std::string response;
+		char buffer[4096];
+		while(true) {
+			auto received = recv(client, buffer, sizeof(buffer), 0);
+			if(received <= 0)
+				break;
+			response.append(buffer, size_t(received));
+		}
+		closeSocket(client);
+		return response;
+	}
+
+	bool contains(std::string_view text, std::string_view line) {
+		return text.find(line) != std::string_view::npos;
+	}
+
+	// scrapes until the response has (or, with present false, no longer has) the line
+	std::string scrapeUntil(uint16_t port, std::string_view line, bool present = true) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+		std::string response;
+		do {
+			response = scrape(port, "/metrics");
+			if(contains(response, line) == present)
+				return response;
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		} while(std::chrono::steady_clock::now() < deadline);
+		std::fprintf(stderr, "Last scrape:\n%s\n", response.c_str());
+		CHECK(contains(response, line) == present);
+		return response;
+	}
+}
+
+int main() {
+#ifdef _WIN32
+	WSADATA data;
+	CHECK(WSAStartup(MAKEWORD(2, 2), &data) == 0);
+#endif
+	IrMe::counter& events = IrMe::addCounter("iridium_test_events_total", "Events seen by the test.", "kind=\"a\"");
+	IrMe::gauge& temperature = IrMe::addGauge("iridium_test_temperature", "A gauge set by the test.");
+	std::atomic<double> sampled{7.0};
+	IrMe::sampler_id sampler = IrMe::addSampler("iridium_test_sampled", "A value read when the exporter samples.", "source=\"test\"", [&sampled]() -> double {
+		return sampled.load();
+	});
+
+	// registering again hands back the same metric, as another type it throws
+	CHECK(&IrMe::addCounter("iridium_test_events_total", "Events seen by the test.", "kind=\"a\"") == &events);
+	bool threw = false;
+	try {
+		IrMe::addGauge("iridium_test_events_total", "Not a counter.");
+	} catch(const std::runtime_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+
+	events.add(3);
+	temperature.set(2.5);
+
+	// the port may be taken between finding it and listening on it, then try another one
+	uint16_t port = 0;
+	for(uint32_t attempt = 0; attempt < 5 && port == 0; attempt++) {
+		uint16_t candidate = freePort();
+		IrMe::init({.port = candidate, .socketPath = {}, .sampleSeconds = 0.01});
+		if(!scrape(candidate, "/metrics").empty())
+			port = candidate;
+		else
+			IrMe::shutdown();
+	}
+	CHECK(port != 0);
+
+	std::string response = scrapeUntil(port, "iridium_test_events_total{kind=\"a\"} 3\n");
+	CHECK(response.starts_with("HTTP/1.1 200 OK\r\n"));
+	CHECK(contains(response, "Content-Type: text/plain; version=0.0.4"));
+	CHECK(contains(response, "# HELP iridium_test_events_total Events seen by the test.\n# TYPE iridium_test_events_total counter\n"));
+	CHECK(contains(response, "# TYPE iridium_test_temperature gauge\niridium_test_temperature 2.5\n"));
+	CHECK(contains(response, "# TYPE iridium_test_sampled gauge\niridium_test_sampled{source=\"test\"} 7\n"));
+	// the body is exactly what Content-Length says
+	size_t bodyStart = response.find("\r\n\r\n") + 4;
+	CHECK(contains(response, "Content-Length: " + std::to_string(response.size() - bodyStart) + "\r\n"));
+
+	// new values show up with the next snapshot
+	events.add(2);
+	temperature.add(-4.0);
+	sampled.store(8.25);
+	response = scrapeUntil(port, "iridium_test_sampled{source=\"test\"} 8.25\n");
+	response = scrapeUntil(port, "iridium_test_events_total{kind=\"a\"} 5\n");
+	CHECK(contains(response, "iridium_test_temperature -1.5\n"));
+
+	CHECK(scrape(port, "/").starts_with("HTTP/1.1 200 OK\r\n"));
+	CHECK(scrape(port, "/other").starts_with("HTTP/1.1 404 Not Found\r\n"));
+
+	// a removed sampler takes its family with it when it was the only series
+	IrMe::removeSampler(sampler);
+	scrapeUntil(port, "iridium_test_sampled", false);
+
+	IrMe::shutdown();
+	CHECK(scrape(port, "/metrics").empty());
+	std::printf("metrics: scraped 127.0.0.1:%u\n", unsigned(port));
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	return 0;
+}
@@ -0,0 +1,188 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "memory.hpp"
+#include "slabAllocator.hpp"
+
+namespace IrM = Iridium::MemoryExperimental;
+
+// Hammers shared and weak pointers from several threads at once: copies of shared roots, fresh
+// make_shared objects, weak locks racing the last release and pointers handed to another thread
+// to die there. Every object has to be destroyed exactly once and every id has to come back.
+
+namespace {
+	constexpr uint32_t THREADS = 8;
+	constexpr uint32_t ROOTS = 64;
+	constexpr uint32_t ITERATIONS = 200000;
+	constexpr uint32_t HELD = 64; // per thread, so the table never runs out of ids
+	constexpr uint64_t CANARY = 0x1D1D1D1D1D1D1D1Dull;
+
+	std::atomic<int64_t> g_live{0};
+
+	struct tracked {
+		uint64_t canary = CANARY;
+		uint32_t value;
+
+		tracked(uint32_t value)
+			:value(value) {
+			g_live.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~tracked() {
+			CHECK(canary == CANARY);
+			canary = 0;
+			g_live.fetch_sub(1, std::memory_order_relaxed);
+		}
+	};
+
+	template<typename Shared>
+	struct handoff {
+		std::mutex mutex;
+		std::vector<Shared> items;
+	};
+
+	template<typename Shared, typename Weak, typename Make>
+	void stress(const char* name, Make make) {
+		std::vector<Shared> roots;
+		for(uint32_t index = 0; index < ROOTS; index++)
+			roots.push_back(make(index));
+		std::vector<Weak> weakRoots(roots.begin(), roots.end());
+		handoff<Shared> exchange;
+
+		std::vector<std::thread> threads;
+		for(uint32_t thread = 0; thread < THREADS; thread++) {
+			threads.emplace_back([&, thread]() -> void {
+				IridiumTests::test_random random{thread + 1};
+				std::vector<Shared> held;
+				std::vector<Weak> weak;
+
+				for(uint32_t iteration = 0; iteration < ITERATIONS; iteration++) {
+					uint64_t pick = random.next();
+					switch(pick % 6) {
+						case 0:
+							held.push_back(make(uint32_t(pick >> 32)));
+							CHECK(held.back()->value == uint32_t(pick >> 32));
+							break;
+						case 1: {
+							uint32_t root = (pick >> 8) % ROOTS;
+							held.push_back(roots[root]);
+							CHECK(held.back()->value == root);
+							break;
+						}
+						case 2:
+							if(!held.empty())
+								weak.push_back(held[(pick >> 8) % held.size()]);
+							else
+								weak.push_back(weakRoots[(pick >> 8) % ROOTS]);
+							break;
+						case 3: {
+							// the other threads may be dropping the last strong reference right now
+							Shared locked = weak.empty() ? weakRoots[(pick >> 8) % ROOTS].lock() : weak[(pick >> 8) % weak.size()].lock();
+							if(locked)
+								CHECK(locked->canary == CANARY);
+							break;
+						}
+						case 4:
+							if(!held.empty()) {
+								std::swap(held[(pick >> 8) % held.size()], held.back());
+								held.pop_back();
+							}
+							break;
+						case 5: {
+							// whatever is taken out is released on this thread, not the one that made it
+							Shared taken;
+							std::scoped_lock<std::mutex> lock(exchange.mutex);
+							if(!held.empty() && exchange.items.size() < HELD) {
+								exchange.items.push_back(std::move(held.back()));
+								held.pop_back();
+							} else if(!exchange.items.empty()) {
+								taken = std::move(exchange.items.back());
+								exchange.items.pop_back();
+							}
+							break;
+						}
+					}
+					if(held.size() > HELD)
+						held.erase(held.begin(), held.begin() + HELD / 2);
+					if(weak.size() > HELD)
+						weak.erase(weak.begin(), weak.begin() + HELD / 2);
+				}
+			});
+		}
+		for(std::thread& thread : threads)
+			thread.join();
+
+		exchange.items.clear();
+		for(uint32_t index = 0; index < ROOTS; index++) {
+			CHECK(roots[index]->value == index);
+			CHECK(!weakRoots[index].expired());
+		}
+		roots.clear();
+		for(const Weak& root : weakRoots)
+			CHECK(root.expired() && !root.lock());
+		weakRoots.clear();
+		CHECK(g_live.load() == 0);
+		std::printf("%s: %u threads, %u iterations each, no leaks\n", name, THREADS, ITERATIONS);
+	}
+
+	// once the narrow table is out of ids, the object a shared pointer was about to own is destroyed
+	void exhausted() {
+		std::vector<IrM::shared_ptr<tracked>> held;
+		bool threw = false;
+		while(!threw && held.size() <= IrM::reftable_type::MAX_ID) {
+			try {
+				held.push_back(IrM::make_shared<tracked>(uint32_t(held.size())));
+			} catch(const std::runtime_error&) {
+				threw = true;
+			}
+		}
+		CHECK(threw);
+		CHECK(g_live.load() == int64_t(held.size()));
+		try {
+			IrM::shared_ptr<tracked> adopted(::new tracked(0));
+			CHECK(false);
+		} catch(const std::runtime_error&) {
+		}
+		CHECK(g_live.load() == int64_t(held.size()));
+		size_t count = held.size();
+		held.clear();
+		CHECK(g_live.load() == 0);
+		std::printf("reftable_type: out of ids after %zu objects, nothing leaked\n", count);
+	}
+}
+
+int main() {
+	IrM::slab_allocator::init();
+	IrM::reftable_type::init();
+	IrM::segmented_reftable_type::init();
+
+	stress<IrM::shared_ptr<tracked>, IrM::weak_ptr<tracked>>("reftable_type", [](uint32_t value) -> IrM::shared_ptr<tracked> {
+		return IrM::make_shared<tracked>(value);
+	});
+	// every id back on the free list with both counts at zero
+	for(uint32_t id = 0; id < IrM::reftable_type::MAX_ID; id++)
+		CHECK(IrM::reftable_type::check(id) == 0 && IrM::reftable_type::checkWeak(id) == 0);
+	exhausted();
+
+	stress<IrM::wide_shared_ptr<tracked>, IrM::wide_weak_ptr<tracked>>("segmented_reftable_type", [](uint32_t value) -> IrM::wide_shared_ptr<tracked> {
+		// half of them through plain new, destroyObject has to tell them apart
+		if(value & 1)
+			return IrM::wide_shared_ptr<tracked>(::new tracked(value));
+		return IrM::make_wide_shared<tracked>(value);
+	});
+	for(uint32_t index = 0; index < IrM::segmented_reftable_type::committedNodes; index++) {
+		const IrM::segmented_reftable_type::node& node = IrM::segmented_reftable_type::refTable[index];
+		CHECK(node.strong.load() == 0 && node.weak.load() == 0);
+	}
+
+	IrM::segmented_reftable_type::cleanup();
+	IrM::reftable_type::cleanup();
+	IrM::slab_allocator::cleanup();
+	return 0;
+}
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <map>
+#include <vector>
+
+#include "check.hpp"
+#include "renderer/tlsf.hpp"
+
+using Iridium::Renderer::tlsf_allocator;
+
+// Random allocations and frees against a map of what should be live. Every used range has to be
+// aligned, inside the allocator and clear of the others, and the free ranges between them have to
+// be merged: freeBefore and largestFree are checked against the gaps the model sees.
+// Freeing everything has to leave one free range over the whole allocator.
+
+namespace {
+	constexpr uint32_t ITERATIONS = 200000;
+	constexpr uint32_t MAX_LIVE = 512;
+
+	struct live_allocation {
+		uint64_t size;
+		uint32_t node;
+	};
+
+	struct model {
+		tlsf_allocator allocator;
+		std::map<uint64_t, live_allocation> live; // by offset
+		uint64_t usedBytes = 0;
+
+		model(uint64_t size)
+			:allocator(size) {}
+
+		uint64_t largestGap() const {
+			uint64_t largest = 0;
+			uint64_t end = 0;
+			for(const auto& [offset, allocation] : live) {
+				largest = std::max(largest, offset - end);
+				end = offset + allocation.size;
+			}
+			return std::max(largest, allocator.size() - end);
+		}
+
+		void check() const {
+			CHECK(allocator.allocationCount() == live.size());
+			CHECK(allocator.usedBytes() == usedBytes);
+			CHECK(allocator.empty() == live.empty());
+			// neighbours are merged on free, so the gap before every allocation is a single free range
+			uint64_t end = 0;
+			for(const auto& [offset, allocation] : live) {
+				CHECK(allocator.allocationOffset(allocation.node) == offset);
+				CHECK(allocator.allocationSize(allocation.node) == allocation.size);
+				CHECK(allocator.freeBefore(allocation.node) == offset - end);
+				end = offset + allocation.size;
+			}
+			CHECK(allocator.largestFree() == largestGap());
+		}
+
+		bool allocate(uint64_t size, uint64_t alignment) {
+			uint64_t largest = largestGap();
+			tlsf_allocator::allocation placed = allocator.allocate(size, alignment);
+			size = std::max<uint64_t>(size, 1);
+			if(placed.node == tlsf_allocator::NO_NODE) {
+				// good fit may skip a gap that would just about do, never one twice the worst case
+				CHECK(largest < 2 * (size + alignment));
+				return false;
+			}
+
+			CHECK(placed.offset % alignment == 0);
+			CHECK(placed.offset + size <= allocator.size());
+			auto next = live.lower_bound(placed.offset);
+			if(next != live.end())
+				CHECK(placed.offset + size <= next->first);
+			if(next != live.begin()) {
+				auto previous = std::prev(next);
+				CHECK(previous->first + previous->second.size <= placed.offset);
+			}
+			live.emplace(placed.offset, live_allocation{size, placed.node});
+			usedBytes += size;
+			return true;
+		}
+
+		void free(std::map<uint64_t, live_allocation>::iterator allocation) {
+			allocator.free(allocation->second.node);
+			usedBytes -= allocation->second.size;
+			live.erase(allocation);
+		}
+
+		// the defragmenter takes largestFree() as something that fits
+		void checkLargestFits() {
+			uint64_t largest = allocator.largestFree();
+			if(largest == 0)
+				return;
+			tlsf_allocator::allocation placed = allocator.allocate(largest, 1);
+			CHECK(placed.node != tlsf_allocator::NO_NODE);
+			allocator.free(placed.node);
+		}
+
+		// everything freed has to come back as one range covering the whole allocator
+		void drain(IridiumTests::test_random& random) {
+			while(!live.empty())
+				free(std::next(live.begin(), random.next() % live.size()));
+			check();
+			CHECK(allocator.largestFree() == allocator.size());
+			tlsf_allocator::allocation whole = allocator.allocate(allocator.size(), 1);
+			CHECK(whole.node != tlsf_allocator::NO_NODE && whole.offset == 0);
+			allocator.free(whole.node);
+			CHECK(allocator.empty() && allocator.largestFree() == allocator.size());
+		}
+	};
+
+	void randomized(uint64_t size, uint64_t seed) {
+		model tested(size);
+		IridiumTests::test_random random{seed};
+		uint32_t failed = 0;
+
+		for(uint32_t iteration = 0; iteration < ITERATIONS; iteration++) {
+			uint64_t pick = random.next();
+			bool freeing = tested.live.size() >= MAX_LIVE || (!tested.live.empty() && pick % 8 < 3);
+			if(freeing) {
+				tested.free(std::next(tested.live.begin(), (pick >> 8) % tested.live.size()));
+			} else {
+				// mostly small, now and then up to a quarter of the range, sometimes sizes that are
+				// right on a list boundary or zero
+				uint64_t scale = (pick >> 8) % 64 == 0 ? size / 4 : size / 256;
+				uint64_t allocationSize = (pick >> 16) % std::max<uint64_t>(scale, 1);
+				if((pick >> 40) % 16 == 0)
+					allocationSize = uint64_t(tlsf_allocator::SL_COUNT) << ((pick >> 44) % 16);
+				uint64_t alignment = uint64_t(1) << ((pick >> 48) % 13);
+				if(!tested.allocate(allocationSize, alignment))
+					failed++;
+			}
+			if(iteration % 16 == 0)
+				tested.check();
+			if(iteration % 1024 == 0) {
+				tested.checkLargestFits();
+				tested.check();
+			}
+		}
+		tested.check();
+		std::printf("%llu bytes: %u iterations, %zu live at the end, %u allocations didn't fit\n",
+			static_cast<unsigned long long>(size), ITERATIONS, tested.live.size(), failed);
+		tested.drain(random);
+	}
+
+	void alignmentEdges() {
+		constexpr uint64_t SIZE = 1 << 20;
+		model tested(SIZE);
+		IridiumTests::test_random random{42};
+
+		// zero bytes still take one, alignment 0 and 1 mean none
+		CHECK(tested.allocate(0, 1));
+		CHECK(tested.allocate(1, 1));
+		tlsf_allocator::allocation unaligned = tested.allocator.allocate(1, 0);
+		CHECK(unaligned.node != tlsf_allocator::NO_NODE && unaligned.offset == 2);
+		tested.allocator.free(unaligned.node);
+		tested.drain(random);
+
+		// an odd offset first, then every alignment up to the whole range must pad past it
+		for(uint64_t alignment = 1; alignment <= SIZE / 2; alignment *= 2) {
+			CHECK(tested.allocate(3, 1));
+			CHECK(tested.allocate(alignment / 2 + 1, alignment));
+			tested.check();
+			tested.drain(random);
+		}
+
+		// the padding in front goes back on the free lists and is used by the next small allocation
+		CHECK(tested.allocate(1, 1));
+		CHECK(tested.allocate(4096, 4096));
+		CHECK(tested.live.rbegin()->first == 4096);
+		CHECK(tested.allocate(2048, 1));
+		CHECK(tested.live.contains(1));
+		CHECK(tested.allocator.largestFree() == SIZE - 8192);
+		tested.check();
+		tested.drain(random);
+
+		// exactly the end of the range, then nothing at all
+		CHECK(tested.allocate(SIZE / 2, SIZE / 2));
+		CHECK(tested.allocate(SIZE / 2, SIZE / 2));
+		CHECK(!tested.allocate(1, 1));
+		tested.check();
+		tested.drain(random);
+
+		// bigger than everything, and aligned past the end
+		CHECK(!tested.allocate(SIZE + 1, 1));
+		CHECK(tested.allocate(1, 1));
+		CHECK(!tested.allocate(1, SIZE));
+		tested.check();
+		tested.drain(random);
+
+		// sizes around the first list boundaries
+		for(uint64_t size = tlsf_allocator::SL_COUNT - 2; size <= tlsf_allocator::SL_COUNT * 2 + 2; size++)
+			CHECK(tested.allocate(size, 1));
+		tested.check();
+		tested.drain(random);
+		std::printf("alignment edges passed\n");
+	}
+}
+
+int main() {
+	alignmentEdges();
+	randomized(64ull << 20, 1);
+	randomized((64ull << 20) + 4096 + 7, 2); // not a power of two or even aligned
+	randomized(1 << 16, 3);                  // full most of the time
+	return 0;
+}
@@ -13,13 +13,13 @@ layout(binding = 0) uniform UniformBufferObject {
 	float rendererTime;
 } ubo;
 	
-layout(push_constant) uniform pc {
+layout(binding = 1) uniform DrawConstants {
 	mat4 modelTransform;
-} push;
+} draw;
 
 void main() {
-	gl_Position = ubo.projection * ubo.viewTransform * push.modelTransform * vec4(inPosition, 1.0);
-	//gl_Position = push.modelTransform * vec4(inPosition, 1.0);
+	gl_Position = ubo.projection * ubo.viewTransform * draw.modelTransform * vec4(inPosition, 1.0);
+	//gl_Position = draw.modelTransform * vec4(inPosition, 1.0);
 	fragColor = inColor;
 	UVcoord = inUV;
 }
\ No newline at end of file